@@ -66,12 +66,10 @@ jxr_container_t jxr_create_container(void)
     return res;
 }
 
-void jxr_destroy_container(jxr_container_t container)
-{
-    if(container == NULL)
-        return;
 #ifdef JPEGXR_ADOBE_EXT
 #define JPEGXR_ADOBE_MAX_IMAGES 64
+static void free_ifd_tables(jxr_container_t container)
+{
 	if ( container->table ) {
 		for ( int i=0; i<JPEGXR_ADOBE_MAX_IMAGES; i++) {
 			if ( container->table[i] ) {
@@ -84,10 +82,35 @@ void jxr_destroy_container(jxr_container_t container)
 	container->table_cnt = 0;
 	jpegxr_free(container->table);
 	container->table = 0;
+}
+#endif //#ifdef JPEGXR_ADOBE_EXT
+
+void jxr_destroy_container(jxr_container_t container)
+{
+    if(container == NULL)
+        return;
+#ifdef JPEGXR_ADOBE_EXT
+	free_ifd_tables(container);
+	jpegxr_free(container->wb.detach(0));
 #endif //#ifdef JPEGXR_ADOBE_EXT
     jpegxr_free(container);
 }
 
+void jxr_reset_container(jxr_container_t container)
+{
+    if(container == NULL)
+        return;
+#ifdef JPEGXR_ADOBE_EXT
+	free_ifd_tables(container);
+	int32_t size;
+	uint8_t *buf = container->wb.detach(&size);
+	memset((void *)container, 0, sizeof (struct jxr_container));
+	container->wb.attach(buf, size);
+#else //#ifdef JPEGXR_ADOBE_EXT
+    memset(container, 0, sizeof (struct jxr_container));
+#endif //#ifdef JPEGXR_ADOBE_EXT
+}
+
 int jxr_read_image_container(jxr_container_t container
 #ifdef JPEGXR_ADOBE_EXT
 	, const uint8_t *data, int32_t len
@@ -70,6 +70,55 @@
 #endif
 #endif //#ifdef JPEGXR_ADOBE_EXT
 
+/* MEMORY */
+
+/*
+* All allocations of this library go through jpegxr_malloc,
+* jpegxr_calloc and jpegxr_free. Applications may route them to their
+* own allocator with jxr_set_alloc_hooks. The hooks are process wide
+* and must be installed before the first object is created. Passing 0
+* for both restores malloc/free.
+*/
+typedef void*(*jxr_alloc_hook_t)(size_t size);
+typedef void (*jxr_free_hook_t)(void*ptr);
+JXR_EXTERN void jxr_set_alloc_hooks(jxr_alloc_hook_t alloc_hook, jxr_free_hook_t free_hook);
+
+/* PROFILING */
+
+/*
+* The encoder calls the stage hook at the start (begin != 0) and end of
+* the steps it takes on every macroblock strip: reading the strip
+* through the block input function and converting its colors
+* (JXR_STAGE_INPUT), and the overlap filters, PCT and prediction
+* (JXR_STAGE_TRANSFORM). The rest of jxr_write_image_bitstream is
+* mostly entropy coding. The hook is process wide, 0 removes it.
+*/
+typedef enum jxr_stage { JXR_STAGE_INPUT = 0, JXR_STAGE_TRANSFORM = 1 } jxr_stage_t;
+typedef void (*jxr_stage_hook_t)(jxr_stage_t stage, int begin);
+JXR_EXTERN void jxr_set_stage_hook(jxr_stage_hook_t hook);
+
+/*
+* Built with JXR_BIT_STATS, the encoder reports the bits it writes for
+* every macroblock to the bits hook, by band, channel and tile. Symbols
+* coded for all channels at once (the joint DC flags, CBPLP and the HP
+* CBP) come with channel -1. The LP coefficients of the two chroma
+* channels of YUV420 and YUV422 are coded together and come as channel
+* 1. alpha is set for the alpha image plane. Quantizer indices and the
+* headers are not counted. Without JXR_BIT_STATS nothing is counted and
+* jxr_set_bits_hook returns 0.
+*/
+typedef enum jxr_band {
+    JXR_BAND_DC = 0,
+    JXR_BAND_LP,
+    JXR_BAND_CBP,
+    JXR_BAND_HP,
+    JXR_BAND_FLEXBITS,
+    JXR_BAND_COUNT
+} jxr_band_t;
+typedef void (*jxr_bits_hook_t)(jxr_band_t band, int alpha, int channel,
+                                unsigned tx, unsigned ty, size_t bits);
+JXR_EXTERN int jxr_set_bits_hook(jxr_bits_hook_t hook);
+
 /* JPEG XR CONTAINER */
 
 /*
@@ -82,6 +131,8 @@ typedef struct jxr_container *jxr_container_t;
 
 JXR_EXTERN jxr_container_t jxr_create_container(void);
 JXR_EXTERN void jxr_destroy_container(jxr_container_t c);
+/* Empty a container for another jxrc_start_file, keeping its output buffer. */
+JXR_EXTERN void jxr_reset_container(jxr_container_t c);
 
 #ifdef JPEGXR_ADOBE_EXT
 #define NUM_GUIDS 79+1
@@ -326,10 +377,16 @@ typedef struct jxr_image *jxr_image_t;
 *
 * jxr_destroy -
 * Destroy an jxr_image_t object.
+*
+* jxr_reset_image -
+* Return an image to the state jxr_create_image leaves it in, for a
+* new size, so that it can be written again. The strip store and
+* bitstream buffers are kept and reused; they only ever grow.
 */
 JXR_EXTERN jxr_image_t jxr_create_image(int width, int height, unsigned char * windowing);
 JXR_EXTERN jxr_image_t jxr_create_input(void);
 JXR_EXTERN void jxr_destroy(jxr_image_t image);
+JXR_EXTERN int jxr_reset_image(jxr_image_t image, int width, int height, unsigned char * windowing);
 
 /*
 * Some user-controlled flags.
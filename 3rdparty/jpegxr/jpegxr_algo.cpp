@@ -69,7 +69,7 @@ const int _jxr_hp_scan_map[16] = { 0, 1, 4, 5,
 10,11,14,15 };
 
 static const unsigned ScanTotals[15] ={32, 30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4};
-static int long_word_flag = 0;
+static thread_local int long_word_flag = 0;
 
 /*
 * These two functions implemented floor(x/2) and ceil(x/2). Note that
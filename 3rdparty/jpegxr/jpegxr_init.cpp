@@ -48,10 +48,42 @@
 
 # include "jxr_priv.h"
 # include <stdlib.h>
+# include <string.h>
 # include <assert.h>
 
 const int _jxr_abslevel_index_delta[7] = { 1, 0, -1, -1, -1, -1, -1 };
 
+jxr_alloc_hook_t _jxr_alloc_hook = 0;
+jxr_free_hook_t _jxr_free_hook = 0;
+
+void jxr_set_alloc_hooks(jxr_alloc_hook_t alloc_hook, jxr_free_hook_t free_hook)
+{
+    _jxr_alloc_hook = alloc_hook;
+    _jxr_free_hook = free_hook;
+}
+
+jxr_stage_hook_t _jxr_stage_hook = 0;
+
+void jxr_set_stage_hook(jxr_stage_hook_t hook)
+{
+    _jxr_stage_hook = hook;
+}
+
+#ifdef JXR_BIT_STATS
+jxr_bits_hook_t _jxr_bits_hook = 0;
+#endif
+
+int jxr_set_bits_hook(jxr_bits_hook_t hook)
+{
+#ifdef JXR_BIT_STATS
+    _jxr_bits_hook = hook;
+    return 1;
+#else
+    (void)hook;
+    return 0;
+#endif
+}
+
 static void clear_vlc_tables(jxr_image_t image)
 {
     int idx;
@@ -64,9 +96,8 @@ static void clear_vlc_tables(jxr_image_t image)
     }
 }
 
-static struct jxr_image* __make_jxr(void)
+static void __init_jxr(struct jxr_image*image)
 {
-    struct jxr_image*image = (struct jxr_image*) jpegxr_calloc(1, sizeof(struct jxr_image));
     image->user_flags = 0;
     image->width1 = 0;
     image->height1 = 0;
@@ -95,19 +126,117 @@ static struct jxr_image* __make_jxr(void)
     image->scaled_flag = 1;
 
     image->out_fun = 0;
+}
 
+static struct jxr_image* __make_jxr(void)
+{
+    struct jxr_image*image = (struct jxr_image*) jpegxr_calloc(1, sizeof(struct jxr_image));
+    __init_jxr(image);
     return image;
 }
 
+static struct jxr_buffer_pool* __get_pool(jxr_image_t image)
+{
+    if (image->pool == 0)
+        image->pool = (struct jxr_buffer_pool*) jpegxr_calloc(1, sizeof(struct jxr_buffer_pool));
+    return image->pool;
+}
+
+static void __release_pool(struct jxr_buffer_pool*pool)
+{
+    unsigned idx;
+    for (idx = 0 ; idx < pool->count ; idx += 1)
+        pool->blocks[idx].in_use = 0;
+}
+
+static void __free_pool(struct jxr_buffer_pool*pool)
+{
+    unsigned idx;
+    for (idx = 0 ; idx < pool->count ; idx += 1)
+        jpegxr_free(pool->blocks[idx].ptr);
+    jpegxr_free(pool->blocks);
+    jpegxr_free(pool->stream_buf[0]);
+    jpegxr_free(pool->stream_buf[1]);
+    jpegxr_free(pool);
+}
+
+/*
+* calloc() replacement for the macroblock strip store. Prefers the
+* smallest free block of the image's pool that fits.
+*/
+void*_jxr_pool_calloc(jxr_image_t image, size_t count, size_t size)
+{
+    struct jxr_buffer_pool*pool = __get_pool(image);
+    size_t need = count*size;
+    struct jxr_pool_block*best = 0;
+    unsigned idx;
+
+    for (idx = 0 ; idx < pool->count ; idx += 1) {
+        struct jxr_pool_block*cur = pool->blocks + idx;
+        if (cur->in_use || cur->size < need)
+            continue;
+        if (best == 0 || cur->size < best->size)
+            best = cur;
+    }
+
+    if (best) {
+        best->in_use = 1;
+        memset(best->ptr, 0, need);
+        return best->ptr;
+    }
+
+    if (pool->count == pool->capacity) {
+        unsigned capacity = pool->capacity ? 2*pool->capacity : 64;
+        struct jxr_pool_block*blocks = (struct jxr_pool_block*)
+            jpegxr_malloc(capacity * sizeof(struct jxr_pool_block));
+        assert(blocks);
+        if (pool->count)
+            memcpy(blocks, pool->blocks, pool->count * sizeof(struct jxr_pool_block));
+        jpegxr_free(pool->blocks);
+        pool->blocks = blocks;
+        pool->capacity = capacity;
+    }
+
+    void*ptr = jpegxr_calloc(count, size);
+    assert(ptr);
+    pool->blocks[pool->count].ptr = ptr;
+    pool->blocks[pool->count].size = need;
+    pool->blocks[pool->count].in_use = 1;
+    pool->count += 1;
+    return ptr;
+}
+
+/*
+* Lend a previously used buffer to a temporary bitstream, and take it
+* back once the stream is done with.
+*/
+void _jxr_pool_attach_stream(jxr_image_t image, int idx, struct wbitstream*str)
+{
+#ifdef JPEGXR_ADOBE_EXT
+    struct jxr_buffer_pool*pool = __get_pool(image);
+    str->attach(pool->stream_buf[idx], pool->stream_size[idx]);
+    pool->stream_buf[idx] = 0;
+#endif //#ifdef JPEGXR_ADOBE_EXT
+}
+
+void _jxr_pool_detach_stream(jxr_image_t image, int idx, struct wbitstream*str)
+{
+#ifdef JPEGXR_ADOBE_EXT
+    struct jxr_buffer_pool*pool = __get_pool(image);
+    jpegxr_free(pool->stream_buf[idx]);
+    pool->stream_buf[idx] = str->detach(&pool->stream_size[idx]);
+#endif //#ifdef JPEGXR_ADOBE_EXT
+}
+
 static void make_mb_row_buffer(jxr_image_t image, unsigned use_height)
 {
     size_t block_count = EXTENDED_WIDTH_BLOCKS(image) * use_height;
     int*data, *pred_dclp;
     size_t idx;
 
-    image->mb_row_buffer[0] = (struct macroblock_s*) jpegxr_calloc(block_count, sizeof(struct macroblock_s));
-    data = (int*) jpegxr_calloc(block_count*256, sizeof(int));
-    pred_dclp = (int*) jpegxr_calloc(block_count*7, sizeof(int));
+    image->mb_row_buffer[0] = (struct macroblock_s*) _jxr_pool_calloc(image, block_count, sizeof(struct macroblock_s));
+    data = (int*) _jxr_pool_calloc(image, block_count*256, sizeof(int));
+    pred_dclp = (int*) _jxr_pool_calloc(image, block_count*7, sizeof(int));
     assert(image->mb_row_buffer[0]);
     assert(data);
     assert(pred_dclp);
@@ -127,9 +256,9 @@ static void make_mb_row_buffer(jxr_image_t image, unsigned use_height)
 
     int ch;
     for (ch = 1 ; ch < image->num_channels ; ch += 1) {
-        image->mb_row_buffer[ch] = (struct macroblock_s*) jpegxr_calloc(block_count, sizeof(struct macroblock_s));
-        data = (int*) jpegxr_calloc(block_count*format_scale, sizeof(int));
-        pred_dclp = (int*) jpegxr_calloc(block_count*7, sizeof(int));
+        image->mb_row_buffer[ch] = (struct macroblock_s*) _jxr_pool_calloc(image, block_count, sizeof(struct macroblock_s));
+        data = (int*) _jxr_pool_calloc(image, block_count*format_scale, sizeof(int));
+        pred_dclp = (int*) _jxr_pool_calloc(image, block_count*7, sizeof(int));
         assert(image->mb_row_buffer[ch]);
         assert(data);
         assert(pred_dclp);
@@ -167,66 +296,66 @@ void _jxr_make_mbstore(jxr_image_t image, int up4_flag)
         unsigned idx;
         if (up4_flag)
             image->strip[ch].up4 = (struct macroblock_s*)
-            jpegxr_calloc(EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
+            _jxr_pool_calloc(image, EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
         image->strip[ch].up3 = (struct macroblock_s*)
-            jpegxr_calloc(EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
+            _jxr_pool_calloc(image, EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
         image->strip[ch].up2 = (struct macroblock_s*)
-            jpegxr_calloc(EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
+            _jxr_pool_calloc(image, EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
         image->strip[ch].up1 = (struct macroblock_s*)
-            jpegxr_calloc(EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
+            _jxr_pool_calloc(image, EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
         image->strip[ch].cur = (struct macroblock_s*)
-            jpegxr_calloc(EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
+            _jxr_pool_calloc(image, EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
 
         if (up4_flag) {
-            image->strip[ch].up4[0].data = (int*)jpegxr_calloc(256 * EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
+            image->strip[ch].up4[0].data = (int*)_jxr_pool_calloc(image, 256 * EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
             for (idx = 1 ; idx < EXTENDED_WIDTH_BLOCKS(image) ; idx += 1)
                 image->strip[ch].up4[idx].data = image->strip[ch].up4[idx-1].data + 256;
         }
-        image->strip[ch].up3[0].data = (int*)jpegxr_calloc(256 * EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
+        image->strip[ch].up3[0].data = (int*)_jxr_pool_calloc(image, 256 * EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
         for (idx = 1 ; idx < EXTENDED_WIDTH_BLOCKS(image) ; idx += 1)
             image->strip[ch].up3[idx].data = image->strip[ch].up3[idx-1].data + 256;
 
-        image->strip[ch].up2[0].data = (int*)jpegxr_calloc(256 * EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
+        image->strip[ch].up2[0].data = (int*)_jxr_pool_calloc(image, 256 * EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
         for (idx = 1 ; idx < EXTENDED_WIDTH_BLOCKS(image) ; idx += 1)
             image->strip[ch].up2[idx].data = image->strip[ch].up2[idx-1].data + 256;
 
-        image->strip[ch].up1[0].data = (int*)jpegxr_calloc(256 * EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
+        image->strip[ch].up1[0].data = (int*)_jxr_pool_calloc(image, 256 * EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
         for (idx = 1 ; idx < EXTENDED_WIDTH_BLOCKS(image) ; idx += 1)
             image->strip[ch].up1[idx].data = image->strip[ch].up1[idx-1].data + 256;
 
-        image->strip[ch].cur[0].data = (int*)jpegxr_calloc(256 * EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
+        image->strip[ch].cur[0].data = (int*)_jxr_pool_calloc(image, 256 * EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
         for (idx = 1 ; idx < EXTENDED_WIDTH_BLOCKS(image) ; idx += 1)
             image->strip[ch].cur[idx].data = image->strip[ch].cur[idx-1].data + 256;
 
         if (up4_flag) {
-            image->strip[ch].up4[0].pred_dclp = (int*)jpegxr_calloc(7*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
+            image->strip[ch].up4[0].pred_dclp = (int*)_jxr_pool_calloc(image, 7*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
             for (idx = 1 ; idx < EXTENDED_WIDTH_BLOCKS(image) ; idx += 1)
                 image->strip[ch].up4[idx].pred_dclp = image->strip[ch].up4[idx-1].pred_dclp + 7;
         }
 
-        image->strip[ch].up3[0].pred_dclp = (int*)jpegxr_calloc(7*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
+        image->strip[ch].up3[0].pred_dclp = (int*)_jxr_pool_calloc(image, 7*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
         for (idx = 1 ; idx < EXTENDED_WIDTH_BLOCKS(image) ; idx += 1)
             image->strip[ch].up3[idx].pred_dclp = image->strip[ch].up3[idx-1].pred_dclp + 7;
 
-        image->strip[ch].up2[0].pred_dclp = (int*)jpegxr_calloc(7*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
+        image->strip[ch].up2[0].pred_dclp = (int*)_jxr_pool_calloc(image, 7*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
         for (idx = 1 ; idx < EXTENDED_WIDTH_BLOCKS(image) ; idx += 1)
             image->strip[ch].up2[idx].pred_dclp = image->strip[ch].up2[idx-1].pred_dclp + 7;
 
-        image->strip[ch].up1[0].pred_dclp = (int*)jpegxr_calloc(7*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
+        image->strip[ch].up1[0].pred_dclp = (int*)_jxr_pool_calloc(image, 7*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
         for (idx = 1 ; idx < EXTENDED_WIDTH_BLOCKS(image) ; idx += 1)
             image->strip[ch].up1[idx].pred_dclp = image->strip[ch].up1[idx-1].pred_dclp + 7;
 
-        image->strip[ch].cur[0].pred_dclp = (int*)jpegxr_calloc(7*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
+        image->strip[ch].cur[0].pred_dclp = (int*)_jxr_pool_calloc(image, 7*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
         for (idx = 1 ; idx < EXTENDED_WIDTH_BLOCKS(image) ; idx += 1)
             image->strip[ch].cur[idx].pred_dclp = image->strip[ch].cur[idx-1].pred_dclp + 7;
 
         if(ch!= 0)
         {
             if(image->use_clr_fmt == 2 || image->use_clr_fmt == 1) /* 422 or 420 */
-                image->strip[ch].upsample_memory_x = (int*)jpegxr_calloc(16, sizeof(int));
+                image->strip[ch].upsample_memory_x = (int*)_jxr_pool_calloc(image, 16, sizeof(int));
 
             if(image->use_clr_fmt == 1)/* 420 */
-                image->strip[ch].upsample_memory_y = (int*)jpegxr_calloc(8*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
+                image->strip[ch].upsample_memory_y = (int*)_jxr_pool_calloc(image, 8*EXTENDED_WIDTH_BLOCKS(image), sizeof(int));
         }
         
     }
@@ -263,9 +392,9 @@ void _jxr_make_mbstore(jxr_image_t image, int up4_flag)
             for (ch = 0 ; ch < image->num_channels ; ch += 1) {
                 int count = (ch==0)? 256 : format_scale;
                 image->mb_row_context[ch] = (struct macroblock_s*)
-                    jpegxr_calloc(4*EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
+                    _jxr_pool_calloc(image, 4*EXTENDED_WIDTH_BLOCKS(image), sizeof(struct macroblock_s));
                 image->mb_row_context[ch][0].data = (int*)
-                    jpegxr_calloc(4*EXTENDED_WIDTH_BLOCKS(image)*count, sizeof(int));
+                    _jxr_pool_calloc(image, 4*EXTENDED_WIDTH_BLOCKS(image)*count, sizeof(int));
                 for (idx = 1 ; idx < 4*EXTENDED_WIDTH_BLOCKS(image) ; idx += 1)
                     image->mb_row_context[ch][idx].data = image->mb_row_context[ch][idx-1].data+count;
             }
@@ -278,9 +407,9 @@ void _jxr_make_mbstore(jxr_image_t image, int up4_flag)
     image->hp_cbp_model_buffer = 0;
     if (image->tile_columns > 1) {
         image->model_hp_buffer = (struct model_s*)
-            jpegxr_calloc(image->tile_columns, sizeof(struct model_s));
+            _jxr_pool_calloc(image, image->tile_columns, sizeof(struct model_s));
         image->hp_cbp_model_buffer = (struct cbp_model_s*)
-            jpegxr_calloc(image->tile_columns, sizeof(struct cbp_model_s));
+            _jxr_pool_calloc(image, image->tile_columns, sizeof(struct cbp_model_s));
     }
 
     image->cur_my = -1;
@@ -293,13 +422,8 @@ jxr_image_t jxr_create_input(void)
     return image;
 }
 
-jxr_image_t jxr_create_image(int width, int height, unsigned char * windowing)
+static void __size_jxr(struct jxr_image*image, int width, int height, unsigned char * windowing)
 {
-    if (width == 0 || height == 0)
-        return 0;
-
-    struct jxr_image*image = __make_jxr();
-
     if (windowing[0] == 1) {
         assert(((width+windowing[2]+windowing[4]) & 0x0f) == 0);
         assert(((height+windowing[1]+windowing[3]) & 0x0f) == 0);
@@ -327,10 +451,51 @@ jxr_image_t jxr_create_image(int width, int height, unsigned char * windowing)
     image->window_extra_left = windowing[2];
     image->window_extra_bottom = windowing[3];
     image->window_extra_right = windowing[4];
+}
+
+jxr_image_t jxr_create_image(int width, int height, unsigned char * windowing)
+{
+    if (width == 0 || height == 0)
+        return 0;
+
+    struct jxr_image*image = __make_jxr();
+    __size_jxr(image, width, height, windowing);
 
     return image;
 }
 
+static void __free_tile_tables(jxr_image_t image)
+{
+    if (image->tile_index_table)
+        jpegxr_free(image->tile_index_table);
+    if (image->tile_column_width)
+        jpegxr_free(image->tile_column_width);
+    if (image->tile_row_height)
+        jpegxr_free(image->tile_row_height);
+}
+
+int jxr_reset_image(jxr_image_t image, int width, int height, unsigned char * windowing)
+{
+    if (width == 0 || height == 0)
+        return JXR_EC_ERROR;
+
+    /* The alpha plane shares the pool, only its own struct goes. */
+    if (ALPHACHANNEL_FLAG(image) && image->alpha)
+        jpegxr_free(image->alpha);
+    __free_tile_tables(image);
+
+    struct jxr_buffer_pool*pool = image->pool;
+    if (pool)
+        __release_pool(pool);
+
+    memset(image, 0, sizeof(struct jxr_image));
+    __init_jxr(image);
+    image->pool = pool;
+    __size_jxr(image, width, height, windowing);
+
+    return JXR_EC_OK;
+}
+
 void jxr_flag_SKIP_HP_DATA(jxr_image_t image, int flag)
 {
     if (flag)
@@ -349,74 +514,19 @@ void jxr_flag_SKIP_FLEX_DATA(jxr_image_t image, int flag)
 
 void jxr_destroy(jxr_image_t image)
 {
-    int idx, plane_idx = 1;
     if(image == NULL)
         return;
 
-    if (ALPHACHANNEL_FLAG(image))
-        plane_idx = 2;
-    
-    for (; plane_idx > 0; plane_idx --) {
-        jxr_image_t plane = (plane_idx == 1 ? image : image->alpha);
-
-        for (idx = 0 ; idx < plane->num_channels ; idx += 1) {
-            if (plane->strip[idx].up4) {
-                jpegxr_free(plane->strip[idx].up4[0].data);
-                jpegxr_free(plane->strip[idx].up4);
-            }
-            if (plane->strip[idx].up3) {
-                jpegxr_free(plane->strip[idx].up3[0].data);
-                jpegxr_free(plane->strip[idx].up3);
-            }
-            if (plane->strip[idx].up2) {
-                jpegxr_free(plane->strip[idx].up2[0].data);
-                jpegxr_free(plane->strip[idx].up2);
-            }
-            if (plane->strip[idx].up1) {
-                jpegxr_free(plane->strip[idx].up1[0].data);
-                jpegxr_free(plane->strip[idx].up1);
-            }
-            if (plane->strip[idx].cur) {
-                jpegxr_free(plane->strip[idx].cur[0].data);
-                jpegxr_free(plane->strip[idx].cur);
-            }
-            if(plane->strip[idx].upsample_memory_x)
-                jpegxr_free(plane->strip[idx].upsample_memory_x);
-            if(plane->strip[idx].upsample_memory_y)
-                jpegxr_free(plane->strip[idx].upsample_memory_y);
-
-        }
-
-        for (idx = 0 ; idx < plane->num_channels ; idx += 1) {
-            if (plane->mb_row_buffer[idx]) {
-                jpegxr_free(plane->mb_row_buffer[idx][0].data);
-                jpegxr_free(plane->mb_row_buffer[idx]);
-            }
+    /* Strip store buffers of both planes live in the pool. */
+    struct jxr_buffer_pool*pool = image->pool;
 
-            if (plane->mb_row_context[idx]) {
-                jpegxr_free(plane->mb_row_context[idx][0].data);
-                jpegxr_free(plane->mb_row_context[idx]);
-            }
-        }
+    if (ALPHACHANNEL_FLAG(image) && image->alpha)
+        jpegxr_free(image->alpha);
+    __free_tile_tables(image);
+    jpegxr_free(image);
 
-        if (plane->model_hp_buffer) {
-            jpegxr_free(plane->model_hp_buffer);
-        }
-
-        if (plane->hp_cbp_model_buffer) {
-            jpegxr_free(plane->hp_cbp_model_buffer);
-        }
-
-        if(plane_idx == 1){
-            if (plane->tile_index_table)
-                jpegxr_free(plane->tile_index_table);
-            if (plane->tile_column_width)
-                jpegxr_free(plane->tile_column_width);
-            if (plane->tile_row_height)
-                jpegxr_free(plane->tile_row_height);
-        }
-        jpegxr_free(plane);
-    }    
+    if (pool)
+        __free_pool(pool);
 }
 
 /*
@@ -85,17 +85,74 @@ minimal typedefs that we need. */
 	
 #else //#ifdef JPEGXR_ADOBE_EXT
 
+/* see jxr_set_alloc_hooks() */
+extern jxr_alloc_hook_t _jxr_alloc_hook;
+extern jxr_free_hook_t _jxr_free_hook;
+
+static inline void *_jxr_malloc(size_t size)
+{
+	return _jxr_alloc_hook ? _jxr_alloc_hook(size) : malloc(size);
+}
+
+static inline void *_jxr_calloc(size_t count, size_t size)
+{
+	if ( !_jxr_alloc_hook ) {
+		return calloc(count,size);
+	}
+	void *ptr = _jxr_alloc_hook(count*size);
+	if ( ptr ) {
+		memset(ptr,0,count*size);
+	}
+	return ptr;
+}
+
+static inline void _jxr_free(void *ptr)
+{
+	if ( _jxr_free_hook ) {
+		_jxr_free_hook(ptr);
+	} else {
+		free(ptr);
+	}
+}
+
 #define jpegxr_calloc(count, size) \
-	((void*)calloc((count),(size)))
+	(_jxr_calloc((count),(size)))
 
 #define jpegxr_malloc(size) \
-	((void*)malloc((size)))
+	(_jxr_malloc((size)))
 
 #define jpegxr_free(ptr) \
-	free((uint8_t*)ptr)
+	_jxr_free((void*)(ptr))
 
 #endif //#ifdef JPEGXR_ADOBE_EXT
 
+/* see jxr_set_stage_hook() */
+extern jxr_stage_hook_t _jxr_stage_hook;
+
+#define JXR_STAGE_BEGIN(stage) \
+	do { if ( _jxr_stage_hook ) _jxr_stage_hook((stage),1); } while (0)
+
+#define JXR_STAGE_END(stage) \
+	do { if ( _jxr_stage_hook ) _jxr_stage_hook((stage),0); } while (0)
+
+/* see jxr_set_bits_hook(). JXR_BITS_MARK starts counting at the current
+   position of str, JXR_BITS_COUNT reports the bits written since and
+   starts over. Both are empty without JXR_BIT_STATS. */
+#ifdef JXR_BIT_STATS
+extern jxr_bits_hook_t _jxr_bits_hook;
+
+#define JXR_BITS_MARK(mark, str) \
+	size_t mark = (str) ? _jxr_wbitstream_bitpos(str) : 0
+
+#define JXR_BITS_COUNT(mark, str, image, band, ch, tx, ty) \
+	do { size_t _jxr_pos = _jxr_wbitstream_bitpos(str); \
+	     if ( _jxr_bits_hook ) _jxr_bits_hook((band),(image)->primary==0,(ch),(tx),(ty),_jxr_pos-(mark)); \
+	     (mark) = _jxr_pos; } while (0)
+#else
+#define JXR_BITS_MARK(mark, str) do { } while (0)
+#define JXR_BITS_COUNT(mark, str, image, band, ch, tx, ty) do { } while (0)
+#endif
+
 #ifdef JPEGXR_ADOBE_EXT
 
 struct mbitstream {
@@ -141,7 +198,10 @@ public:
 		
 		if ( m_pos >= m_len ) {
 			if ( m_dptr ) {
+				int32_t old = m_len;
 				resize(m_len = (m_pos+1));
+				// bytes skipped over are not always written later
+				memset(m_dptr+old,0,m_len-old);
 			} else {
 				m_pos = (m_len-1);
 			}
@@ -178,15 +238,20 @@ public:
 	}
 
 	int32_t write(const uint8_t *data, int32_t len) {
-		int32_t wb = 0;
-		if ( m_cptr ) {
+		if ( m_cptr || len <= 0 ) {
 			return 0;
 		}
-		for ( ; len > 0 ; len-- ) {
-			putc(*data++);
-			wb++;
+		if ( !m_dptr ) {
+			m_dptr = (uint8_t *)jpegxr_malloc(65536);
+			m_size = 65536;
 		}
-		return wb;
+		if ( m_pos + len > m_len ) {
+			m_len = m_pos + len;
+		}
+		resize(m_len);
+		memcpy(m_dptr+m_pos,data,len);
+		m_pos += len;
+		return len;
 	}
 	
 	int32_t read(uint8_t *data, int32_t len) {
@@ -205,6 +270,37 @@ public:
 	inline const uint8_t *buffer() const { 
 		return m_dptr; 
 	}
+
+	// Drops the contents but keeps the buffer.
+	void truncate() {
+		m_len = 0;
+		m_pos = 0;
+	}
+
+	// Takes ownership of a buffer obtained from detach().
+	void attach(uint8_t *buf, int32_t size) {
+		if ( !buf ) {
+			return;
+		}
+		jpegxr_free(m_dptr);
+		m_dptr = buf;
+		m_size = size;
+		m_len = 0;
+		m_pos = 0;
+	}
+
+	// Gives up ownership of the buffer, leaving the stream empty.
+	uint8_t *detach(int32_t *size) {
+		uint8_t *buf = m_dptr;
+		if ( size ) {
+			*size = m_size;
+		}
+		m_dptr = 0;
+		m_size = 0;
+		m_len = 0;
+		m_pos = 0;
+		return buf;
+	}
 	
 	inline int32_t len() const { 
 		return m_len; 
@@ -214,10 +310,14 @@ private:
 
 	void resize(int32_t newSize) {
 		if ( newSize >= m_size ) {
-			uint8_t *nptr = (uint8_t *)jpegxr_malloc(m_size*2);
+			int32_t nsize = m_size;
+			while ( newSize >= nsize ) {
+				nsize *= 2;
+			}
+			uint8_t *nptr = (uint8_t *)jpegxr_malloc(nsize);
 			memcpy(nptr,m_dptr,m_size);
 			jpegxr_free(m_dptr);
-			m_size *= 2;
+			m_size = nsize;
 			m_dptr = nptr;
 		}
 	}
@@ -305,6 +405,27 @@ struct model_s{
     int state[2];
 };
 
+/*
+* Every buffer _jxr_make_mbstore hands out is owned by the image's pool.
+* jxr_reset_image marks them all free again, and the next image takes the
+* smallest free block that is large enough, so an image reused for a mip
+* chain stops allocating once it has seen its largest level.
+*/
+struct jxr_pool_block{
+    void*ptr;
+    size_t size;
+    int in_use;
+};
+
+struct jxr_buffer_pool{
+    struct jxr_pool_block*blocks;
+    unsigned count, capacity;
+
+    /* Buffers of the temporary bitstreams in jxr_write_image_bitstream. */
+    uint8_t*stream_buf[2];
+    int32_t stream_size[2];
+};
+
 struct jxr_image{
     int user_flags;
 
@@ -448,6 +569,10 @@ struct jxr_image{
     uint8_t container_image_band_presence;
     uint8_t container_alpha_band_presence;
     uint8_t container_current_separate_alpha;    
+
+    /* Strip and bitstream buffers, shared with the alpha plane and
+    kept across jxr_reset_image. */
+    struct jxr_buffer_pool*pool;
 };
 
 extern unsigned char _jxr_select_lp_index(jxr_image_t image, unsigned tx, unsigned ty,
@@ -656,6 +781,10 @@ extern void _jxr_wbitstream_flush(struct wbitstream*str);
 extern void _jxr_wbitstream_mark(struct wbitstream*str);
 extern void _jxr_wbitstream_seek(struct wbitstream*str, uint64_t off);
 
+extern void*_jxr_pool_calloc(jxr_image_t image, size_t count, size_t size);
+extern void _jxr_pool_attach_stream(jxr_image_t image, int idx, struct wbitstream*str);
+extern void _jxr_pool_detach_stream(jxr_image_t image, int idx, struct wbitstream*str);
+
 extern void _jxr_w_TILE_SPATIAL(jxr_image_t image, struct wbitstream*str,
                                 unsigned tx, unsigned ty);
 extern void _jxr_w_TILE_DC(jxr_image_t image, struct wbitstream*str,
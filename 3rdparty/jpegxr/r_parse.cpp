@@ -86,6 +86,8 @@ static int r_DECODE_BLOCK_ADAPTIVE(jxr_image_t image, struct rbitstream*str,
                                    int cbp_flag, int chroma_flag,
                                    int channel, int block, int mbhp_pred_mode,
                                    unsigned model_bits);
+static void r_skip_hp_block(jxr_image_t image, unsigned tx, unsigned mx,
+                            int ch, unsigned block);
 static void r_BLOCK_FLEXBITS(jxr_image_t image, struct rbitstream*str,
                              unsigned tx, unsigned ty,
                              unsigned mx, unsigned my,
@@ -1674,6 +1676,9 @@ int _jxr_r_MB_HP(jxr_image_t image, struct rbitstream*str,
             if (flex_flag)
                 r_BLOCK_FLEXBITS(image, str, tx, ty, mx, my,
                 idx, bpos, model_bits);
+            /* A FREQUENCY mode FLEXBITS pass still needs the values. */
+            if (SKIP_HP_DATA(image) && (flex_flag || image->bands_present != 0))
+                r_skip_hp_block(image, tx, mx, idx, bpos);
             lap_mean[chroma_flag] += num_nonzero;
         }
 
@@ -1740,6 +1745,8 @@ int _jxr_r_MB_FLEXBITS(jxr_image_t image, struct rbitstream*str,
 
             r_BLOCK_FLEXBITS(image, str, tx, ty, mx, my,
                 idx, bpos, model_bits);
+            if (SKIP_HP_DATA(image))
+                r_skip_hp_block(image, tx, mx, idx, bpos);
         }
     }
 
@@ -2645,13 +2652,10 @@ static int r_DECODE_BLOCK_ADAPTIVE(jxr_image_t image, struct rbitstream*str,
             DEBUG("\n");
         }
 #endif
-        if (SKIP_HP_DATA(image)) {
-            for (idx = 1; idx < 16; idx += 1)
-                MACROBLK_CUR_HP(image, channel, tx, mx, block, idx-1) = 0;
-        } else {
-            for (idx = 1; idx < 16; idx += 1)
-                MACROBLK_CUR_HP(image, channel, tx, mx, block, idx-1) = hpinput[idx] << model_bits;
-        }
+        /* Keep the values even with SKIP_HP_DATA, the FLEXBITS parse
+        depends on them. The block is cleared once its FLEXBITS are read. */
+        for (idx = 1; idx < 16; idx += 1)
+            MACROBLK_CUR_HP(image, channel, tx, mx, block, idx-1) = hpinput[idx] << model_bits;
     }
 
     return num_nonzero;
@@ -2659,6 +2663,18 @@ static int r_DECODE_BLOCK_ADAPTIVE(jxr_image_t image, struct rbitstream*str,
 
 
 
+/*
+* SKIP_HP_DATA: drop the HP coefficients of a block once nothing left
+* to parse depends on them.
+*/
+static void r_skip_hp_block(jxr_image_t image, unsigned tx, unsigned mx,
+                            int ch, unsigned block)
+{
+    int idx;
+    for (idx = 0; idx < 15; idx += 1)
+        MACROBLK_CUR_HP(image, ch, tx, mx, block, idx) = 0;
+}
+
 static void r_DECODE_FLEX(jxr_image_t image, struct rbitstream*str,
                           unsigned tx, unsigned mx,
                           int ch, unsigned block, unsigned k,
@@ -298,6 +298,8 @@ int jxr_write_image_bitstream(jxr_image_t image
     if (rc < 0)
         return rc;
 
+    _jxr_pool_attach_stream(image, 0, &bits);
+
     /* Prepare index table storage */
     initialize_index_table(image);
 
@@ -347,6 +349,7 @@ int jxr_write_image_bitstream(jxr_image_t image
 			, fdCodedTiles
 #endif //#ifndef JPEGXR_ADOBE_EXT
 		);
+        _jxr_pool_attach_stream(image, 1, &strCodedTiles);
 
         /* CODED_TILES() */
         w_TILE(image, &strCodedTiles);
@@ -397,6 +400,7 @@ int jxr_write_image_bitstream(jxr_image_t image
         /* delete file associated with CodedTiles */
         remove("codedtiles.tmp");
 #endif //#ifndef JPEGXR_ADOBE_EXT
+        _jxr_pool_detach_stream(image, 1, &strCodedTiles);
 
     }
     else {
@@ -427,14 +431,17 @@ int jxr_write_image_bitstream(jxr_image_t image
         DEBUG("Meets conditions for LONG_WORD_FLAG == 0!");
     else {
         DEBUG("Does not meet conditions for LONG_WORD_FLAG == 0!");
-        if (LONG_WORD_FLAG(image) == 0)
+        if (LONG_WORD_FLAG(image) == 0) {
+            _jxr_pool_detach_stream(image, 0, &bits);
             return JXR_EC_BADFORMAT;
+        }
     }
 #endif
 
 #ifdef JPEGXR_ADOBE_EXT
 	container->wb.write(bits.buffer(),bits.len());
 #endif //#ifdef JPEGXR_ADOBE_EXT
+    _jxr_pool_detach_stream(image, 0, &bits);
 
     return res;
 }
@@ -1088,6 +1095,7 @@ void _jxr_w_MB_DC(jxr_image_t image, struct wbitstream*str,
 
     DEBUG(" MB_DC tile=[%u %u] mb=[%u %u] bitpos=%zu\n",
         tx, ty, mx, my, _jxr_wbitstream_bitpos(str));
+    JXR_BITS_MARK(bits_mark, str);
 
     if (_jxr_InitContext(image, tx, ty, mx, my)) {
         DEBUG(" MB_DC: Initialize Context\n");
@@ -1116,6 +1124,7 @@ void _jxr_w_MB_DC(jxr_image_t image, struct wbitstream*str,
             DEBUG(" dc_val at t=[%u %u], m=[%u %u] == %d (0x%08x)\n",
                 tx, ty, mx, my, dc_val, dc_val);
             w_DEC_DC(image, str, model_bits, 0/*chroma*/, is_dc_ch, dc_val);
+            JXR_BITS_COUNT(bits_mark, str, image, JXR_BAND_DC, idx, tx, ty);
         }
     } else {
         int32_t dc_val_Y = MACROBLK_CUR_DC(image,0,tx,mx);
@@ -1138,24 +1147,28 @@ void _jxr_w_MB_DC(jxr_image_t image, struct wbitstream*str,
 
         DEBUG(" VAL_DC_YUV = %x\n", val_dc_yuv);
         encode_val_dc_yuv(image, str, val_dc_yuv);
+        JXR_BITS_COUNT(bits_mark, str, image, JXR_BAND_DC, -1, tx, ty);
 
         DEBUG(" dc_val_Y at t=[%u %u], m=[%u %u] == %d (0x%08x)\n",
             tx, ty, mx, my, dc_val_Y, dc_val_Y);
         int model_bits = image->model_dc.bits[0];
         int is_dc_ch = val_dc_yuv&0x4 ? 1 : 0;
         w_DEC_DC(image, str, model_bits, 0/*chroma*/, is_dc_ch, dc_val_Y);
+        JXR_BITS_COUNT(bits_mark, str, image, JXR_BAND_DC, 0, tx, ty);
 
         DEBUG(" dc_val_U at t=[%u %u], m=[%u %u] == %d (0x%08x)\n",
             tx, ty, mx, my, dc_val_U, dc_val_U);
         model_bits = image->model_dc.bits[1];
         is_dc_ch = val_dc_yuv&0x2 ? 1 : 0;
         w_DEC_DC(image, str, model_bits, 1/*chroma*/, is_dc_ch, dc_val_U);
+        JXR_BITS_COUNT(bits_mark, str, image, JXR_BAND_DC, 1, tx, ty);
 
         DEBUG(" dc_val_V at t=[%u %u], m=[%u %u] == %d (0x%08x)\n",
             tx, ty, mx, my, dc_val_V, dc_val_V);
         model_bits = image->model_dc.bits[1];
         is_dc_ch = val_dc_yuv&0x1 ? 1 : 0;
         w_DEC_DC(image, str, model_bits, 1/*chroma*/, is_dc_ch, dc_val_V);
+        JXR_BITS_COUNT(bits_mark, str, image, JXR_BAND_DC, 2, tx, ty);
     }
 
     /* */
@@ -1376,6 +1389,7 @@ void _jxr_w_MB_LP(jxr_image_t image, struct wbitstream*str,
 
     DEBUG(" MB_LP tile=[%u %u] mb=[%u %u] bitpos=%zu\n",
         tx, ty, mx, my, _jxr_wbitstream_bitpos(str));
+    JXR_BITS_MARK(bits_mark, str);
 
     if (_jxr_InitContext(image, tx, ty, mx, my)) {
         DEBUG(" Init contexts\n");
@@ -1510,6 +1524,7 @@ void _jxr_w_MB_LP(jxr_image_t image, struct wbitstream*str,
         }
     }
     DEBUG(" MB_LP: cbplp = 0x%x (full_planes=%u)\n", cbplp, full_planes);
+    JXR_BITS_COUNT(bits_mark, str, image, JXR_BAND_CBP, -1, tx, ty);
 
     int ndx;
     for (ndx = 0 ; ndx < full_planes ; ndx += 1) {
@@ -1631,6 +1646,7 @@ void _jxr_w_MB_LP(jxr_image_t image, struct wbitstream*str,
                 }
             }
         }
+        JXR_BITS_COUNT(bits_mark, str, image, JXR_BAND_LP, ndx, tx, ty);
     }
 
     DEBUG(" MB_LP: UpdateModelMB lap_mean={%d, %d}\n", lap_mean[0], lap_mean[1]);
@@ -1830,6 +1846,7 @@ void _jxr_w_MB_CBP(jxr_image_t image, struct wbitstream*str,
 {
     DEBUG(" MB_CBP tile=[%u %u] mb=[%u %u] bitpos=%zu\n",
         tx, ty, mx, my, _jxr_wbitstream_bitpos(str));
+    JXR_BITS_MARK(bits_mark, str);
 
     if (_jxr_InitContext(image, tx, ty, mx, my)) {
         DEBUG(" MB_CBP: InitContext\n");
@@ -2093,6 +2110,7 @@ void _jxr_w_MB_CBP(jxr_image_t image, struct wbitstream*str,
         }
     }
 
+    JXR_BITS_COUNT(bits_mark, str, image, JXR_BAND_CBP, -1, tx, ty);
     DEBUG(" MB_CBP done tile=[%u %u] mb=[%u %u]\n", tx, ty, mx, my);
 }
 
@@ -2294,6 +2312,8 @@ int _jxr_w_MB_HP(jxr_image_t image, struct wbitstream*str,
     /* This function can act either as MB_HP() or MB_HP_FLEX() */
     DEBUG(" MB_HP tile=[%u %u] mb=[%u %u] bitpos=%zu\n",
         tx, ty, mx, my, _jxr_wbitstream_bitpos(str));
+    JXR_BITS_MARK(bits_mark, str);
+    JXR_BITS_MARK(flex_mark, strFB);
 
     if (_jxr_InitContext(image, tx, ty, mx, my)) {
         DEBUG(" MB_HP: InitContext\n");
@@ -2344,12 +2364,16 @@ int _jxr_w_MB_HP(jxr_image_t image, struct wbitstream*str,
                 DEBUG("ERROR: r_DECODE_BLOCK_ADAPTIVE returned rc=%d\n", num_nonzero);
                 return JXR_EC_ERROR;
             }
-            if (strFB)
+            JXR_BITS_COUNT(bits_mark, str, image, JXR_BAND_HP, idx, tx, ty);
+            if (strFB) {
                 w_BLOCK_FLEXBITS(image, strFB, tx, ty, mx, my,
                 idx, bpos, model_bits);
-            else if (flex_flag)
+                JXR_BITS_COUNT(flex_mark, strFB, image, JXR_BAND_FLEXBITS, idx, tx, ty);
+            } else if (flex_flag) {
                 w_BLOCK_FLEXBITS(image, str, tx, ty, mx, my,
                 idx, bpos, model_bits);
+                JXR_BITS_COUNT(bits_mark, str, image, JXR_BAND_FLEXBITS, idx, tx, ty);
+            }
         }
 
     }
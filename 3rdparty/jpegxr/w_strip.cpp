@@ -449,9 +449,12 @@ void _jxr_wflush_mb_strip(jxr_image_t image, int tx, int ty, int my, int read_ne
 
             /* Load up4 with new image data. */
             if (cur_row >= -4 && cur_row < (height-4)) {
+                JXR_STAGE_BEGIN(JXR_STAGE_INPUT);
                 collect_and_scale_up4(image, ty);
+                JXR_STAGE_END(JXR_STAGE_INPUT);
             }
                        
+            JXR_STAGE_BEGIN(JXR_STAGE_TRANSFORM);
             wflush_process_strip(image, ty);
             if ((INDEXTABLE_PRESENT_FLAG(image)) && (image->cur_my >= 0)) {
                 /* save processed row */
@@ -464,6 +467,7 @@ void _jxr_wflush_mb_strip(jxr_image_t image, int tx, int ty, int my, int read_ne
                     wflush_to_tile_buffer(image->alpha, image->alpha->cur_my + ty_offset);
                 }
             }
+            JXR_STAGE_END(JXR_STAGE_TRANSFORM);
         }
     }
     else {
@@ -20,10 +20,21 @@ int g_allocCountMid = 0;
 int g_allocCountBig = 0;
 #endif
 
+static void *(*g_AllocHook)(size_t size) = 0;
+static void (*g_FreeHook)(void *address) = 0;
+
+void MyAlloc_SetHooks(void *(*allocHook)(size_t size), void (*freeHook)(void *address))
+{
+  g_AllocHook = allocHook;
+  g_FreeHook = freeHook;
+}
+
 void *MyAlloc(size_t size)
 {
   if (size == 0)
     return 0;
+  if (g_AllocHook != 0)
+    return g_AllocHook(size);
   #ifdef _SZ_ALLOC_DEBUG
   {
     void *p = malloc(size);
@@ -37,6 +48,11 @@ void *MyAlloc(size_t size)
 
 void MyFree(void *address)
 {
+  if (g_FreeHook != 0)
+  {
+    g_FreeHook(address);
+    return;
+  }
   #ifdef _SZ_ALLOC_DEBUG
   if (address != 0)
     fprintf(stderr, "\nFree; count = %10d,  addr = %8X", --g_allocCount, (unsigned)address);
@@ -11,6 +11,10 @@ Public domain */
 void *MyAlloc(size_t size);
 void MyFree(void *address);
 
+/* Routes MyAlloc/MyFree (and so the LzmaLib wrappers) to an application
+   allocator. Install before the first call, pass 0 to restore malloc/free. */
+void MyAlloc_SetHooks(void *(*allocHook)(size_t size), void (*freeHook)(void *address));
+
 #ifdef _WIN32
 
 void SetLargePageSize();
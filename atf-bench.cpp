@@ -0,0 +1,688 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "atf.h"
+#include "atfalloc.h"
+#include "atfblock.h"
+#include "atfbundle.h"
+#include "atfindex.h"
+#include "atfraw.h"
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif //#ifndef _MSC_VER
+
+void print_usage()
+{
+    std::cout << R"(atf-bench V0.1
+
+Usage: atf-bench [-n runs] [-f dxt|pvrtc|etc1|fallback] [-p] [-l levels] [-x] [-t atf-transform]
+                 [-r atf-transform] input.atf
+       atf-bench [-n runs] -a bundle.atfb dir
+       atf-bench [-n runs] -b
+
+Decodes input.atf in memory n times (default 20) with the ATFDecoder library
+and reports the throughput and the time until the smallest mip level is
+ready. With -t the given atf-transform binary is run on the same file n times
+for comparison.
+
+-p also times the preview decode (JPEG-XR DC and low pass bands only) and -l
+the decode of only the smallest levels, both with their speedup over the full
+decode.
+
+-x checks input.atfidx (built from the file if there is none) against the
+file, compares the levels decoded with and without it, times decode() both
+ways and shows what a range request for the smallest level has to fetch.
+
+-r converts input.atf with the given atf-transform binary both to its raw ATF
+output and to the upload ready container (-r), checks the container's levels
+against ATFDecoder and times loading every level into aligned memory from
+either: reading the raw ATF, walking its length prefixes and copying each
+level out, against mapping the container and reading its level table. Both
+are timed again with every byte read once, standing in for the upload.
+
+-a checks every entry of a bundle (atf-bundle) against the file of that name
+under dir, then times loading all of them from the loose files (an open and
+read each) against looking them up in the mapped bundle and reading them, with
+a warm page cache and, where posix_fadvise can drop it, a cold one.
+
+-b checks the software block decoders against their plain C reference on
+random blocks of every format and a range of level sizes, then times the
+reference, the SIMD rows and the threaded driver on a 1024x1024 level.
+)";
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char *name, int32_t runs, double seconds, size_t inLen, size_t outLen)
+{
+    double mb = 1024.0 * 1024.0;
+    std::cout << name << ": " << (seconds * 1000.0 / runs) << " ms/decode, "
+              << (inLen * double(runs) / mb / seconds) << " MB/s in, "
+              << (outLen * double(runs) / mb / seconds) << " MB/s out\n";
+}
+
+// decodes the smallest levels of every side runs times (all of them for 0)
+static double time_decode(const std::vector<uint8_t> &src, int32_t prefer, int32_t runs, bool preview, int32_t levels)
+{
+    auto start = std::chrono::steady_clock::now();
+    for ( int32_t c = 0; c < runs; c++ ) {
+        ATFDecoder decoder(src.data(), src.size());
+        decoder.setPreview(preview);
+        if ( !decoder.decode(prefer) ) {
+            return -1.0;
+        }
+        int32_t first = levels > 0 ? std::max(0, decoder.Count() - levels) : 0;
+        for ( int32_t side = 0; side < (decoder.IsCubeMap() ? 6 : 1); side++ ) {
+            for ( int32_t level = first; level < decoder.Count(); level++ ) {
+                decoder.texData(level, side);
+            }
+        }
+    }
+    return seconds_since(start);
+}
+
+// the sidecar has to match an index built by walking the file, and the
+// indexed decode has to give the same levels
+static int check_index(const char *ifilename, const std::vector<uint8_t> &src, int32_t prefer, int32_t runs)
+{
+    ATFIndex built;
+    if ( !atf_index_build(src.data(), src.size(), built) ) {
+        std::cerr << "Could not index '" << ifilename << "'\n";
+        return -1;
+    }
+    std::vector<uint8_t> expected;
+    atf_index_write(built, expected);
+
+    std::string path = atf_index_path(ifilename);
+    std::ifstream xfile(path, std::ios::in | std::ios::binary);
+    std::vector<uint8_t> index = expected;
+    if ( xfile.is_open() ) {
+        index.assign(std::istreambuf_iterator<char>(xfile), std::istreambuf_iterator<char>());
+        if ( index != expected ) {
+            std::cerr << "'" << path << "' does not match the file\n";
+            return -1;
+        }
+    } else {
+        path = "built index";
+    }
+
+    ATFDecoder plain(src.data(), src.size());
+    ATFDecoder indexed(src.data(), src.size());
+    if ( !indexed.setIndex(index.data(), index.size()) || !plain.decode(prefer) || !indexed.decode(prefer) ||
+         !indexed.Indexed() ) {
+        std::cerr << "Could not decode with the index\n";
+        return -1;
+    }
+    for ( int32_t side = 0; side < (plain.IsCubeMap() ? 6 : 1); side++ ) {
+        for ( int32_t level = 0; level < plain.Count(); level++ ) {
+            uint8_t *a = plain.texData(level, side);
+            uint8_t *b = indexed.texData(level, side);
+            if ( (a == 0) != (b == 0) || (a && memcmp(a, b, plain.texDataLen(level)) != 0) ) {
+                std::cerr << "Level " << level << " side " << side << " differs with the index\n";
+                return -1;
+            }
+        }
+    }
+
+    // decode() alone, the part the index replaces
+    double seconds[2];
+    for ( int32_t i = 0; i < 2; i++ ) {
+        auto start = std::chrono::steady_clock::now();
+        for ( int32_t c = 0; c < runs; c++ ) {
+            ATFDecoder decoder(src.data(), src.size());
+            if ( i == 1 ) {
+                decoder.setIndex(index.data(), index.size());
+            }
+            if ( !decoder.decode(prefer) ) {
+                return -1;
+            }
+        }
+        seconds[i] = seconds_since(start);
+    }
+    std::cout << "Level index (" << path << "): " << built.sections.size() << " sections, decode() "
+              << (seconds[0] * 1000000.0 / runs) << " us walking the file, " << (seconds[1] * 1000000.0 / runs)
+              << " us with the index\n";
+
+    // what a client fetching the smallest level of the first face has to download
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    atf_index_level_range(built, 0, built.count - 1, offset, length);
+    std::cout << "Smallest level by range request: " << (offset + length) << " bytes without the index, "
+              << index.size() << " + " << length << " bytes with it\n";
+    return 0;
+}
+
+// A level ready for upload and what it took to get there
+struct LoadedLevel {
+    const uint8_t *data;
+    size_t length;
+};
+
+static uint64_t touch_levels(const std::vector<LoadedLevel> &loaded)
+{
+    uint64_t sum = 0;
+    for ( const auto &level : loaded ) {
+        for ( size_t i = 0; i < level.length; i += 64 ) {
+            sum += level.data[i];
+        }
+    }
+    return sum;
+}
+
+// What the runtime does with atf-transform's raw ATF: read it, walk the
+// length prefixes and copy every level into memory aligned for upload.
+static bool load_raw_atf(const char *path, std::vector<uint8_t> &aligned, std::vector<LoadedLevel> &loaded)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+    std::vector<uint8_t> src(file.is_open() ? size_t(file.tellg()) : 0);
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(src.data()), src.size());
+    if ( src.size() < 10 || (src[6] != 3 && src[6] != 5) ) {
+        return false;
+    }
+    size_t blockSize = src[6] == 3 ? 8 : 16;
+    int32_t count = src[9];
+
+    // the section lengths are pvrtc sized, the level sizes come from the header
+    std::vector<size_t> offsets;
+    std::vector<size_t> lengths;
+    size_t total = 0;
+    for ( int32_t level = 0; level < count; level++ ) {
+        size_t w = std::max(1, (1 << src[7] >> level) / 4);
+        size_t h = std::max(1, (1 << src[8] >> level) / 4);
+        total = (total + 255) & ~size_t(255);
+        offsets.push_back(total);
+        lengths.push_back(w * h * blockSize);
+        total += lengths.back();
+    }
+    aligned.resize(total + 256);
+    uint8_t *base = aligned.data() + ((256 - (uintptr_t(aligned.data()) & 255)) & 255);
+
+    loaded.clear();
+    size_t pos = 10;
+    for ( int32_t level = 0; level < count; level++ ) {
+        size_t length = lengths[level];
+        if ( pos + 3 + length > src.size() ) {
+            return false;
+        }
+        memcpy(base + offsets[level], src.data() + pos + 3, length);
+        LoadedLevel l = { base + offsets[level], length };
+        loaded.push_back(l);
+        pos += 3 + length;
+        // the empty sections of the other platforms
+        while ( pos + 3 <= src.size() && src[pos] == 0 && src[pos + 1] == 0 && src[pos + 2] == 0 ) {
+            pos += 3;
+        }
+    }
+    return true;
+}
+
+// The container: map it, read the table, the levels are used in place.
+class MappedContainer {
+public:
+    MappedContainer() : m_data(0), m_size(0) {}
+    ~MappedContainer() { close(); }
+
+    bool open(const char *path, std::vector<LoadedLevel> &loaded)
+    {
+#ifdef _MSC_VER
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        m_copy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        m_data = m_copy.data();
+        m_size = m_copy.size();
+#else
+        int fd = ::open(path, O_RDONLY);
+        struct stat st;
+        if ( fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0 ) {
+            if ( fd >= 0 ) {
+                ::close(fd);
+            }
+            return false;
+        }
+        void *data = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if ( data == MAP_FAILED ) {
+            return false;
+        }
+        m_data = static_cast<const uint8_t *>(data);
+        m_size = size_t(st.st_size);
+#endif
+        if ( !atf_raw_read(m_data, m_size, m_header, m_levels) ) {
+            return false;
+        }
+        loaded.clear();
+        for ( const auto &level : m_levels ) {
+            LoadedLevel l = { m_data + level.offset, size_t(level.length) };
+            loaded.push_back(l);
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifndef _MSC_VER
+        if ( m_data ) {
+            munmap(const_cast<uint8_t *>(m_data), m_size);
+        }
+#endif
+        m_copy.clear();
+        m_data = 0;
+        m_size = 0;
+    }
+
+    const ATFRawHeader &header() const { return m_header; }
+
+private:
+    MappedContainer(const MappedContainer &);
+    MappedContainer &operator=(const MappedContainer &);
+
+    const uint8_t *m_data;
+    size_t m_size;
+    std::vector<uint8_t> m_copy;
+    ATFRawHeader m_header;
+    std::vector<ATFRawLevel> m_levels;
+};
+
+static int check_raw(const char *transform, const char *ifilename, const std::vector<uint8_t> &src, int32_t runs)
+{
+    std::string atfPath = std::string(ifilename) + ".bench.atf";
+    std::string rawPath = std::string(ifilename) + ".bench.atfr";
+    std::string command = std::string(transform) + " -i " + ifilename + " -o ";
+    // the raw ATF may legitimately fail (cube maps), the container may not
+    bool atfWritten = system((command + atfPath + " > /dev/null 2>&1").c_str()) == 0;
+    if ( system((command + rawPath + " -r > /dev/null").c_str()) != 0 ) {
+        std::cerr << "'" << transform << "' failed\n";
+        remove(atfPath.c_str());
+        remove(rawPath.c_str());
+        return -1;
+    }
+
+    int result = 0;
+    std::vector<LoadedLevel> loaded;
+    {
+        MappedContainer container;
+        ATFDecoder decoder(src.data(), src.size());
+        if ( !container.open(rawPath.c_str(), loaded) || !decoder.decode(ATFDecoder::PREFER_DXT1) ) {
+            std::cerr << "Could not read '" << rawPath << "'\n";
+            result = -1;
+        } else {
+            const ATFRawHeader &header = container.header();
+            for ( uint32_t i = 0; result == 0 && i < loaded.size(); i++ ) {
+                uint32_t side = i / header.levels;
+                uint32_t level = i % header.levels;
+                const uint8_t *expected = decoder.texData(level, side);
+                if ( (expected == 0) != (loaded[i].length == 0) || uintptr_t(loaded[i].data) % header.alignment != 0 ||
+                     (expected && (loaded[i].length != decoder.texDataLen(level) ||
+                                   memcmp(expected, loaded[i].data, loaded[i].length) != 0)) ) {
+                    std::cerr << "Level " << level << " side " << side << " of the container differs\n";
+                    result = -1;
+                }
+            }
+        }
+    }
+
+    std::vector<uint8_t> aligned;
+    if ( result == 0 && (!atfWritten || !load_raw_atf(atfPath.c_str(), aligned, loaded)) ) {
+        std::cout << "Container matches, no raw ATF output to compare with (not a compressed file or a cube map)\n";
+    } else if ( result == 0 ) {
+        // load only, then load and read every level
+        double seconds[2][2];
+        uint64_t sum = 0;
+        for ( int32_t upload = 0; upload < 2; upload++ ) {
+            auto start = std::chrono::steady_clock::now();
+            for ( int32_t c = 0; c < runs; c++ ) {
+                load_raw_atf(atfPath.c_str(), aligned, loaded);
+                sum += upload ? touch_levels(loaded) : 0;
+            }
+            seconds[0][upload] = seconds_since(start);
+
+            start = std::chrono::steady_clock::now();
+            for ( int32_t c = 0; c < runs; c++ ) {
+                MappedContainer container;
+                container.open(rawPath.c_str(), loaded);
+                sum += upload ? touch_levels(loaded) : 0;
+            }
+            seconds[1][upload] = seconds_since(start);
+        }
+        size_t copied = 0;
+        for ( const auto &level : loaded ) {
+            copied += level.length;
+        }
+        std::cout << "Raw ATF: " << (seconds[0][0] * 1000000.0 / runs) << " us load, "
+                  << (seconds[0][1] * 1000000.0 / runs) << " us with upload reads, " << copied << " bytes copied\n"
+                  << "Container: " << (seconds[1][0] * 1000000.0 / runs) << " us load, "
+                  << (seconds[1][1] * 1000000.0 / runs) << " us with upload reads, 0 bytes copied ("
+                  << (seconds[0][1] / seconds[1][1]) << "x faster, checksum " << (sum & 0xFF) << ")\n";
+    }
+
+    remove(atfPath.c_str());
+    remove(rawPath.c_str());
+    return result;
+}
+
+// Drops a file from the page cache where the system lets us, for cold loads.
+static bool drop_cached(const std::string &path)
+{
+#if !defined(_MSC_VER) && defined(POSIX_FADV_DONTNEED)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if ( fd < 0 ) {
+        return false;
+    }
+    bool dropped = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    ::close(fd);
+    return dropped;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+static bool read_whole(const std::string &path, std::vector<uint8_t> &data)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if ( !file.is_open() ) {
+        return false;
+    }
+    data.resize(size_t(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(data.data()), data.size());
+    return bool(file);
+}
+
+static int check_bundle(const char *bundlePath, const std::string &dir, int32_t runs)
+{
+    ATFBundle bundle;
+    if ( !bundle.open(bundlePath) ) {
+        std::cerr << "Could not open bundle. '" << bundlePath << "'\n";
+        return -1;
+    }
+    std::vector<std::string> names;
+    std::vector<uint8_t> loose;
+    for ( uint32_t i = 0; i < bundle.Count(); i++ ) {
+        std::string name;
+        const uint8_t *data = 0;
+        size_t length = 0;
+        bundle.entry(i, name, data, length);
+        size_t found = 0;
+        if ( !read_whole(dir + "/" + name, loose) || bundle.find(name, found) != data || found != length ||
+             loose.size() != length || memcmp(loose.data(), data, length) != 0 ) {
+            std::cerr << "Entry '" << name << "' differs from " << dir << "/" << name << "\n";
+            return -1;
+        }
+        names.push_back(name);
+    }
+    bundle.close();
+
+    double seconds[2][2];
+    bool cold = true;
+    uint64_t sum = 0;
+    std::vector<LoadedLevel> loaded;
+    for ( int32_t warm = 0; warm < 2; warm++ ) {
+        double looseTime = 0.0;
+        double bundleTime = 0.0;
+        for ( int32_t c = 0; c < runs; c++ ) {
+            if ( !warm ) {
+                for ( const auto &name : names ) {
+                    cold = drop_cached(dir + "/" + name) && cold;
+                }
+            }
+            auto start = std::chrono::steady_clock::now();
+            for ( const auto &name : names ) {
+                read_whole(dir + "/" + name, loose);
+                sum += loose.empty() ? 0 : loose[loose.size() / 2];
+            }
+            looseTime += seconds_since(start);
+
+            if ( !warm ) {
+                cold = drop_cached(bundlePath) && cold;
+            }
+            start = std::chrono::steady_clock::now();
+            ATFBundle timed;
+            timed.open(bundlePath);
+            loaded.clear();
+            for ( const auto &name : names ) {
+                LoadedLevel entry;
+                entry.data = timed.find(name, entry.length);
+                loaded.push_back(entry);
+            }
+            sum += touch_levels(loaded);
+            timed.close();
+            bundleTime += seconds_since(start);
+        }
+        seconds[warm][0] = looseTime;
+        seconds[warm][1] = bundleTime;
+    }
+
+    for ( int32_t warm = cold ? 0 : 1; warm < 2; warm++ ) {
+        std::cout << (warm ? "Warm cache: " : "Cold cache: ") << names.size() << " textures, "
+                  << (seconds[warm][0] * 1000.0 / runs) << " ms from loose files, "
+                  << (seconds[warm][1] * 1000.0 / runs) << " ms from the bundle ("
+                  << (seconds[warm][0] / seconds[warm][1]) << "x faster)\n";
+    }
+    if ( !cold ) {
+        std::cout << "The page cache could not be dropped, no cold cache numbers\n";
+    }
+    std::cout << "checksum " << (sum & 0xFF) << "\n";
+    return 0;
+}
+
+static int check_block_decoders(int32_t runs)
+{
+    static const ATFBlockFormat formats[] = {
+        ATF_BLOCK_BC1, ATF_BLOCK_BC3, ATF_BLOCK_ETC1, ATF_BLOCK_ETC1_ALPHA, ATF_BLOCK_PVRTC4
+    };
+    static const char *names[] = { "bc1", "bc3", "etc1", "etc1+alpha", "pvrtc4" };
+    static const int32_t sizes[][2] = {
+        { 1, 1 }, { 2, 2 }, { 4, 4 }, { 8, 8 }, { 16, 4 }, { 4, 32 }, { 64, 16 }, { 256, 256 }, { 1024, 1024 }
+    };
+
+    std::mt19937 random(1234);
+    int32_t failed = 0;
+    for ( size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++ ) {
+        ATFBlockImage image;
+        image.format = formats[f];
+        std::vector<uint8_t> blocks;
+        for ( const auto &size : sizes ) {
+            image.width = size[0];
+            image.height = size[1];
+            blocks.resize(atf_block_data_size(image));
+            for ( auto &b : blocks ) {
+                b = uint8_t(random());
+            }
+            image.blocks = blocks.data();
+
+            // padded rows, so writes outside the level show up as well
+            size_t pitch = size_t(image.width) * 4 + 12;
+            std::vector<uint8_t> reference(pitch * image.height, 0xCD);
+            std::vector<uint8_t> rows(reference.size(), 0xCD);
+            std::vector<uint8_t> threaded(reference.size(), 0xCD);
+            atf_block_decode_rows_reference(image, 0, atf_block_rows(image), reference.data(), pitch);
+            atf_block_decode_rows(image, 0, atf_block_rows(image), rows.data(), pitch);
+            atf_block_decode(image, threaded.data(), pitch, 4);
+            if ( rows != reference || threaded != reference ) {
+                std::cerr << names[f] << " " << image.width << "x" << image.height << " differs from the reference\n";
+                failed++;
+            }
+        }
+
+        // last size is the timed one
+        double mpix = double(image.width) * image.height * runs / 1000000.0;
+        std::vector<uint8_t> rgba(size_t(image.width) * image.height * 4);
+        auto start = std::chrono::steady_clock::now();
+        for ( int32_t c = 0; c < runs; c++ ) {
+            atf_block_decode_rows_reference(image, 0, atf_block_rows(image), rgba.data(), size_t(image.width) * 4);
+        }
+        double reference = seconds_since(start);
+        start = std::chrono::steady_clock::now();
+        for ( int32_t c = 0; c < runs; c++ ) {
+            atf_block_decode_rows(image, 0, atf_block_rows(image), rgba.data(), size_t(image.width) * 4);
+        }
+        double rows = seconds_since(start);
+        start = std::chrono::steady_clock::now();
+        for ( int32_t c = 0; c < runs; c++ ) {
+            atf_block_decode(image, rgba.data(), size_t(image.width) * 4);
+        }
+        double threaded = seconds_since(start);
+        std::cout << names[f] << ": reference " << (mpix / reference) << " Mpix/s, rows "
+                  << (mpix / rows) << " Mpix/s, threaded " << (mpix / threaded) << " Mpix/s\n";
+    }
+    if ( failed ) {
+        std::cerr << failed << " block decoder checks failed\n";
+        return -1;
+    }
+    std::cout << "block decoders match the reference\n";
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    atf_install_allocator_hooks();
+    ATFAllocatorScope allocScope(ATFPoolAllocator::threadLocal());
+
+    int32_t runs = 20;
+    int32_t prefer = ATFDecoder::PREFER_DXT1;
+    const char *transform = 0;
+    const char *rawTransform = 0;
+    const char *bundlePath = 0;
+    const char *ifilename = 0;
+    bool blocks = false;
+    bool preview = false;
+    bool indexed = false;
+    int32_t levels = 0;
+
+    for ( int32_t c = 1; c < argc; c++ ) {
+        if ( std::string(argv[c]) == "-b" ) {
+            blocks = true;
+        } else if ( std::string(argv[c]) == "-p" ) {
+            preview = true;
+        } else if ( std::string(argv[c]) == "-x" ) {
+            indexed = true;
+        } else if ( argv[c][0] == '-' && c + 1 < argc ) {
+            if ( argv[c][1] == 'n' ) {
+                runs = std::max(1, atoi(argv[++c]));
+            } else if ( argv[c][1] == 'f' ) {
+                std::string f = argv[++c];
+                if ( f == "pvrtc" ) {
+                    prefer = ATFDecoder::PREFER_PVRTC;
+                } else if ( f == "etc1" ) {
+                    prefer = ATFDecoder::PREFER_ETC1;
+                } else if ( f == "fallback" ) {
+                    prefer = ATFDecoder::PREFER_FALLBACK;
+                } else if ( f != "dxt" ) {
+                    std::cerr << "Unknown format '" << f << "'\n\n";
+                    print_usage();
+                    return -1;
+                }
+            } else if ( argv[c][1] == 't' ) {
+                transform = argv[++c];
+            } else if ( argv[c][1] == 'r' ) {
+                rawTransform = argv[++c];
+            } else if ( argv[c][1] == 'a' ) {
+                bundlePath = argv[++c];
+            } else if ( argv[c][1] == 'l' ) {
+                levels = std::max(1, atoi(argv[++c]));
+            }
+        } else {
+            ifilename = argv[c];
+        }
+    }
+
+    if ( blocks ) {
+        return check_block_decoders(runs);
+    }
+
+    if ( !ifilename ) {
+        print_usage();
+        return -1;
+    }
+
+    if ( bundlePath ) {
+        return check_bundle(bundlePath, ifilename, runs);
+    }
+
+    std::ifstream ifile(ifilename, std::ios::in | std::ios::binary);
+    if ( !ifile.is_open() ) {
+        std::cerr << "Could not open input file. '" << ifilename << "'\n\n";
+        return -1;
+    }
+    std::vector<uint8_t> src((std::istreambuf_iterator<char>(ifile)), std::istreambuf_iterator<char>());
+
+    size_t outLen = 0;
+    double full = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for ( int32_t c = 0; c < runs; c++ ) {
+        ATFDecoder decoder(src.data(), src.size());
+        if ( !decoder.decode(prefer) ) {
+            std::cerr << "Could not decode '" << ifilename << "'\n";
+            return -1;
+        }
+        decoder.tex();
+        outLen = decoder.texLen();
+    }
+    full = seconds_since(start);
+    report("ATFDecoder", runs, full, src.size(), outLen);
+
+    if ( preview ) {
+        double seconds = time_decode(src, prefer, runs, true, 0);
+        std::cout << "ATFDecoder preview: " << (seconds * 1000.0 / runs) << " ms/decode, "
+                  << (full / seconds) << "x faster\n";
+    }
+    if ( levels > 0 ) {
+        double seconds = time_decode(src, prefer, runs, preview, levels);
+        std::cout << "ATFDecoder smallest " << levels << " levels" << (preview ? " preview: " : ": ")
+                  << (seconds * 1000.0 / runs) << " ms/decode, " << (full / seconds) << "x faster\n";
+    }
+
+    // what a streaming client waits for before it can show anything
+    size_t smallestLen = 0;
+    start = std::chrono::steady_clock::now();
+    for ( int32_t c = 0; c < runs; c++ ) {
+        ATFDecoder decoder(src.data(), src.size());
+        if ( !decoder.decode(prefer) ) {
+            return -1;
+        }
+        for ( int32_t side = 0; side < (decoder.IsCubeMap() ? 6 : 1); side++ ) {
+            decoder.texData(decoder.Count() - 1, side);
+        }
+        smallestLen = decoder.texDataLen(decoder.Count() - 1);
+    }
+    double smallest = seconds_since(start);
+    std::cout << "ATFDecoder smallest level: " << (smallest * 1000000.0 / runs) << " us/decode ("
+              << smallestLen << " bytes)\n";
+
+    if ( indexed && check_index(ifilename, src, prefer, runs) != 0 ) {
+        return -1;
+    }
+
+    if ( rawTransform && check_raw(rawTransform, ifilename, src, runs) != 0 ) {
+        return -1;
+    }
+
+    if ( transform ) {
+        std::string command = std::string(transform) + " -i " + ifilename + " -o /dev/null > /dev/null";
+        start = std::chrono::steady_clock::now();
+        for ( int32_t c = 0; c < runs; c++ ) {
+            if ( system(command.c_str()) != 0 ) {
+                std::cerr << "'" << command << "' failed\n";
+                return -1;
+            }
+        }
+        report("atf-transform", runs, seconds_since(start), src.size(), outLen);
+    }
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "atfbundle.h"
+
+void print_usage()
+{
+    std::cout << R"(atf-bundle V0.1
+
+Usage: atf-bundle [-a align] [-d] -o bundle.atfb -b dir|list
+       atf-bundle [-a align] [-d] -o bundle.atfb input...
+       atf-bundle -l bundle.atfb
+
+Packs many textures into one archive (atfbundle.h) that is opened once and
+looked up by name through ATFBundle.
+
+-b batch   every .atf and .atfr under a directory, named by their path below
+           it, or the files listed one per line in a text file, named as
+           listed
+-a align   alignment of the entries, a power of two (default 4096, a page)
+-d         store byte-identical inputs once
+-l         list the entries of a bundle
+)";
+}
+
+// ATF files (raw or not, with or without the 0x01 prefix) and atfraw.h
+// containers, the inputs a bundle is meant for
+static bool is_texture(const std::vector<uint8_t> &data)
+{
+    size_t start = (!data.empty() && data[0] == 1) ? 5 : 0;
+    return data.size() >= start + 4 && data[start] == 'A' && data[start + 1] == 'T' && data[start + 2] == 'F';
+}
+
+static bool read_file(const std::string &path, std::vector<uint8_t> &data)
+{
+    // a directory opens, but tellg gives no size for it
+    std::error_code error;
+    if ( !std::filesystem::is_regular_file(path, error) ) {
+        return false;
+    }
+    std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if ( !file.is_open() ) {
+        return false;
+    }
+    std::streamoff size = file.tellg();
+    if ( size < 0 ) {
+        return false;
+    }
+    data.resize(size_t(size));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(data.data()), data.size());
+    return bool(file);
+}
+
+// paths of the inputs and their names in the bundle
+static bool collect(const std::string &batch, std::vector<std::pair<std::string, std::string>> &files)
+{
+    namespace fs = std::filesystem;
+    std::error_code error;
+    if ( fs::is_directory(batch, error) ) {
+        for ( fs::recursive_directory_iterator it(batch, error), end; !error && it != end; it.increment(error) ) {
+            std::string extension = it->path().extension().string();
+            if ( it->is_regular_file(error) && (extension == ".atf" || extension == ".atfr") ) {
+                files.emplace_back(it->path().string(), fs::relative(it->path(), batch, error).generic_string());
+            }
+        }
+        std::sort(files.begin(), files.end());
+        return !error;
+    }
+
+    std::ifstream list(batch);
+    if ( !list.is_open() ) {
+        return false;
+    }
+    std::string line;
+    while ( std::getline(list, line) ) {
+        if ( !line.empty() && line.back() == '\r' ) {
+            line.pop_back();
+        }
+        if ( !line.empty() ) {
+            files.emplace_back(line, line);
+        }
+    }
+    return true;
+}
+
+static int list_bundle(const char *path)
+{
+    ATFBundle bundle;
+    if ( !bundle.open(path) ) {
+        std::cerr << "Could not open bundle. '" << path << "'\n\n";
+        return -1;
+    }
+    for ( uint32_t i = 0; i < bundle.Count(); i++ ) {
+        std::string name;
+        const uint8_t *data = 0;
+        size_t length = 0;
+        bundle.entry(i, name, data, length);
+        std::cout << name << " " << length << "\n";
+    }
+    std::cout << bundle.Count() << " entries\n";
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *ofilename = 0;
+    const char *batch = 0;
+    const char *listed = 0;
+    int32_t alignment = 4096;
+    bool dedup = false;
+    std::vector<std::pair<std::string, std::string>> files;
+
+    for ( int32_t c = 1; c < argc; c++ ) {
+        if ( std::string(argv[c]) == "-d" ) {
+            dedup = true;
+        } else if ( argv[c][0] == '-' && c + 1 < argc ) {
+            if ( argv[c][1] == 'o' ) {
+                ofilename = argv[++c];
+            } else if ( argv[c][1] == 'b' ) {
+                batch = argv[++c];
+            } else if ( argv[c][1] == 'l' ) {
+                listed = argv[++c];
+            } else if ( argv[c][1] == 'a' ) {
+                alignment = atoi(argv[++c]);
+            }
+        } else {
+            files.emplace_back(argv[c], argv[c]);
+        }
+    }
+
+    if ( listed ) {
+        return list_bundle(listed);
+    }
+    if ( !ofilename || (!batch && files.empty()) ) {
+        print_usage();
+        return -1;
+    }
+    if ( alignment <= 0 || (alignment & (alignment - 1)) != 0 ) {
+        std::cerr << "The alignment has to be a power of two.\n\n";
+        return -1;
+    }
+    if ( batch && !collect(batch, files) ) {
+        std::cerr << "Could not read batch '" << batch << "'\n\n";
+        return -1;
+    }
+
+    std::vector<std::vector<uint8_t>> contents(files.size());
+    std::vector<ATFBundleInput> inputs;
+    for ( size_t i = 0; i < files.size(); i++ ) {
+        if ( !read_file(files[i].first, contents[i]) ) {
+            std::cerr << "Could not read '" << files[i].first << "'\n";
+            return -1;
+        }
+        if ( !is_texture(contents[i]) ) {
+            std::cerr << "Skipping '" << files[i].first << "', not an ATF file\n";
+            continue;
+        }
+        ATFBundleInput input = { files[i].second, contents[i].data(), contents[i].size() };
+        inputs.push_back(input);
+    }
+
+    std::ofstream ofile(ofilename, std::ios::out | std::ios::binary);
+    if ( !ofile.is_open() ) {
+        std::cerr << "Could not open output file. '" << ofilename << "'\n\n";
+        return -1;
+    }
+
+    ATFBundleStats stats;
+    if ( !atf_bundle_write(inputs, uint32_t(alignment), dedup, ofile, &stats) ) {
+        std::cerr << "Could not write the bundle (duplicate names?)\n";
+        ofile.close();
+        remove(ofilename);
+        return -1;
+    }
+
+    std::cout << stats.entries << " entries, " << stats.stored << " stored, " << stats.inputBytes << " bytes in, "
+              << stats.fileLength << " bytes out\n";
+    return 0;
+}
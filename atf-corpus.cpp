@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "atfsynth.h"
+
+void print_usage()
+{
+    std::cout << R"(atf-corpus V0.1
+
+Usage: atf-corpus [-f] [-l] -o dir
+
+Writes the synthetic benchmark corpus (atfsynth.h) into dir, every texture as
+name.dds, the file dds2atf reads, and name.pvr, the PVR stream dds2atf hands
+to the converter for it. The files only depend on their names, so two runs or
+two machines write the same bytes.
+
+-f  the full corpus, with 2048x2048 textures and more shapes, instead of the
+    quick one atf-e2e runs by default
+-l  only lists the texture names with their sizes
+)";
+}
+
+static bool write_file(const std::string &path, const std::vector<uint8_t> &data)
+{
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    return bool(file);
+}
+
+int main(int argc, char *argv[])
+{
+    bool full = false;
+    bool list = false;
+    const char *dir = 0;
+    for ( int32_t c = 1; c < argc; c++ ) {
+        if ( argv[c][0] != '-' ) {
+            print_usage();
+            return -1;
+        }
+        if ( argv[c][1] == 'f' ) {
+            full = true;
+        } else if ( argv[c][1] == 'l' ) {
+            list = true;
+        } else if ( argv[c][1] == 'o' && c + 1 < argc ) {
+            dir = argv[++c];
+        } else {
+            print_usage();
+            return -1;
+        }
+    }
+    if ( !dir && !list ) {
+        print_usage();
+        return -1;
+    }
+
+    std::vector<ATFSynthTexture> textures;
+    atf_synth_corpus(full, textures);
+
+    std::error_code error;
+    if ( dir && !list ) {
+        std::filesystem::create_directories(dir, error);
+        if ( error ) {
+            std::cerr << "Could not create '" << dir << "'\n";
+            return -1;
+        }
+    }
+
+    size_t total = 0;
+    std::vector<uint8_t> dds;
+    std::vector<uint8_t> pvr;
+    for ( const ATFSynthTexture &texture : textures ) {
+        std::string name = atf_synth_texture_name(texture);
+        atf_synth_dds(texture, dds);
+        if ( list ) {
+            std::cout << name << ": " << dds.size() << " bytes\n";
+            total += dds.size();
+            continue;
+        }
+        atf_synth_pvr(texture, pvr);
+        std::string path = (std::filesystem::path(dir) / name).string();
+        if ( !write_file(path + ".dds", dds) || !write_file(path + ".pvr", pvr) ) {
+            std::cerr << "Could not write '" << path << "'\n";
+            return -1;
+        }
+        total += dds.size();
+    }
+    std::cout << textures.size() << " textures, " << total << " bytes of DDS\n";
+    return 0;
+}
@@ -0,0 +1,634 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "3rdparty/jpegxr/jpegxr.h"
+#include "atfalloc.h"
+#include "atfsynth.h"
+
+// pvr2atfcore.cpp
+extern bool gSilent;
+extern bool gEncodeRawJXR;
+extern int32_t gCompressedFormats;
+extern bool gStoreRawCompressed;
+extern bool gCheckForAlphaValue;
+extern bool gFilterLzma;
+extern bool gJxrFormatDefault;
+extern jxr_color_fmt_t gJxrFormat;
+extern bool convert(std::istream &ifile_etc1, std::istream &ifile_pvrtc, std::istream &ifile_dxt1, std::istream &ifile_raw, std::ostream &ofile);
+extern bool convert_with_alpha(std::istream &ifile_etc1, std::istream &ifile_pvrtc, std::istream &ifile_dxt5, std::ostream &ofile);
+
+void print_usage()
+{
+    std::cout << R"(atf-e2e V0.1
+
+Usage: atf-e2e [-f] [-n runs] [-j threads] [-k case] [-d dds2atf] [-x atf-transform]
+               [-w results.json] [-b baseline.json] [-t percent] [-s percent] [-m ms] corpus_dir
+
+Converts the synthetic corpus atf-corpus wrote into corpus_dir end to end and
+reports, for every texture, the input MB/s and output bytes of:
+
+dds2atf/        the dds2atf binary on name.dds
+dds2atf-p/      the same with -p, for the DXT formats
+convert/        convert() or convert_with_alpha() in this process on name.pvr,
+                checked byte for byte against the dds2atf output
+convert-p/      the same with the -p settings
+atf-transform/  the atf-transform binary on the dds2atf-p output, not for cube maps
+
+and the thread scaling, in MB/s of all inputs, on 1, 2, 4 ... threads:
+
+scaling/dds2atf-p/jN       that many dds2atf -p processes over the corpus
+scaling/atf-transform-b/jN atf-transform -b -j N over all the -p outputs
+scaling/atf-transform/jN   atf-transform -j N on the largest -p output
+
+total/dds2atf and so on add up every texture of a kind. They are steadier
+than the small textures, which mostly time process start up.
+
+The converter keeps its settings and scratch in globals, so the in process
+cases run on one thread only. Outputs go to corpus_dir/out.
+
+-f  the full corpus (atf-corpus -f), default the quick one
+-n  times every case this many times and keeps the fastest (default 3)
+-j  most threads for the scaling cases (default one per core)
+-k  only runs the cases whose name contains this
+-d  the dds2atf binary (default next to atf-e2e)
+-x  the atf-transform binary (default next to atf-e2e)
+-w  writes the results as JSON
+-b  compares with results written earlier: a case is a regression when its
+    MB/s is more than -t percent (default 20) under the baseline or its output
+    more than -s percent (default 0) over it, and atf-e2e then exits with 1.
+    The MB/s of cases that took less than -m ms (default 50) in the baseline
+    are too noisy to compare, the totals cover them.
+)";
+}
+
+namespace {
+
+struct Options {
+    bool full = false;
+    int32_t runs = 3;
+    int32_t threads = 0;
+    std::string filter;
+    std::string dds2atf;
+    std::string transform;
+    const char *results = 0;
+    const char *baseline = 0;
+    double tolerance = 20;
+    double sizeTolerance = 0;
+    double minimumMs = 50;
+};
+
+struct Result {
+    std::string name;
+    double mbs;
+    double seconds;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+};
+
+Options gOptions;
+std::vector<Result> gResults;
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool selected(const std::string &name)
+{
+    return gOptions.filter.empty() || name.find(gOptions.filter) != std::string::npos;
+}
+
+bool is_block_format(ATFSynthFormat format)
+{
+    return format == ATF_SYNTH_DXT1 || format == ATF_SYNTH_DXT5;
+}
+
+bool read_file(const std::string &path, std::vector<uint8_t> &data)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if ( !file.is_open() ) {
+        return false;
+    }
+    data.resize(size_t(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(data.data()), data.size());
+    return bool(file);
+}
+
+uint64_t file_size(const std::string &path)
+{
+    std::error_code error;
+    uint64_t size = std::filesystem::file_size(path, error);
+    return error ? 0 : size;
+}
+
+void report(const std::string &name, double seconds, uint64_t bytesIn, uint64_t bytesOut)
+{
+    Result result = { name, bytesIn / (1024.0 * 1024.0) / seconds, seconds, bytesIn, bytesOut };
+    std::cout << name << ": " << result.mbs << " MB/s, " << bytesOut << " bytes\n";
+    gResults.push_back(result);
+}
+
+// the fastest of the runs, or a negative value when the command failed
+double time_command(const std::string &command)
+{
+    double best = -1;
+    for ( int32_t r = 0; r < gOptions.runs; r++ ) {
+        auto start = std::chrono::steady_clock::now();
+        if ( system(command.c_str()) != 0 ) {
+            std::cerr << "'" << command << "' failed\n";
+            return -1;
+        }
+        double seconds = seconds_since(start);
+        best = best < 0 ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+// what dds2atf main() sets up for the file before calling the converter
+bool convert_pvr(const ATFSynthTexture &texture, const std::vector<uint8_t> &pvr, bool compressed, std::string &atf, double &seconds)
+{
+    gSilent = true;
+    gCompressedFormats = 1;
+    gCheckForAlphaValue = false;
+    gEncodeRawJXR = !is_block_format(texture.format);
+    gStoreRawCompressed = !compressed;
+    gFilterLzma = compressed;
+    gJxrFormatDefault = false;
+    gJxrFormat = JXR_YUV444;
+
+    std::stringstream input(std::string(pvr.begin(), pvr.end()), std::ios::in | std::ios::out | std::ios::binary);
+    std::stringstream unused(std::ios::in | std::ios::out | std::ios::binary);
+    std::stringstream output(std::ios::in | std::ios::out | std::ios::binary);
+    auto start = std::chrono::steady_clock::now();
+    bool converted = texture.format == ATF_SYNTH_DXT5 ? convert_with_alpha(unused, unused, input, output)
+                                                      : convert(unused, unused, input, input, output);
+    seconds = seconds_since(start);
+    atf = output.str();
+    return converted;
+}
+
+int bench_convert(const ATFSynthTexture &texture, const std::string &name, const std::string &pvrPath,
+                  const std::string &atfPath, bool compressed)
+{
+    std::vector<uint8_t> pvr;
+    std::vector<uint8_t> expected;
+    if ( !read_file(pvrPath, pvr) ) {
+        std::cerr << "Could not read '" << pvrPath << "'\n";
+        return -1;
+    }
+
+    std::string atf;
+    double best = -1;
+    for ( int32_t r = 0; r < gOptions.runs; r++ ) {
+        double seconds = 0;
+        if ( !convert_pvr(texture, pvr, compressed, atf, seconds) ) {
+            std::cerr << name << ": conversion failed\n";
+            return -1;
+        }
+        best = best < 0 ? seconds : std::min(best, seconds);
+    }
+
+    if ( read_file(atfPath, expected) && std::string(expected.begin(), expected.end()) != atf ) {
+        std::cerr << name << ": output differs from '" << atfPath << "'\n";
+        return -1;
+    }
+    report(name, best, pvr.size(), atf.size());
+    return 0;
+}
+
+// Runs dds2atf, the in process converter and atf-transform on every texture
+// and leaves the paths of the -p outputs atf-transform decodes in transformable.
+int bench_textures(const std::vector<ATFSynthTexture> &textures, const std::string &corpus, const std::string &out,
+                   std::vector<std::string> &transformable)
+{
+    for ( const ATFSynthTexture &texture : textures ) {
+        std::string name = atf_synth_texture_name(texture);
+        std::string dds = corpus + "/" + name + ".dds";
+        std::string pvr = corpus + "/" + name + ".pvr";
+        std::string atf = out + "/" + name + ".atf";
+        std::string packed = out + "/" + name + ".p.atf";
+        uint64_t ddsSize = file_size(dds);
+        if ( ddsSize == 0 ) {
+            std::cerr << "Could not read '" << dds << "', run atf-corpus" << (gOptions.full ? " -f" : "") << " first\n";
+            return -1;
+        }
+
+        bool blocks = is_block_format(texture.format);
+        std::string command = gOptions.dds2atf + " -s -i " + dds + " -o ";
+        if ( selected("dds2atf/" + name) || selected("convert/" + name) ) {
+            double seconds = time_command(command + atf + " > /dev/null");
+            if ( seconds < 0 ) {
+                return -1;
+            }
+            report("dds2atf/" + name, seconds, ddsSize, file_size(atf));
+        }
+        if ( blocks && (selected("dds2atf-p/" + name) || selected("convert-p/" + name) || selected("atf-transform/" + name)) ) {
+            double seconds = time_command(command + packed + " -p > /dev/null");
+            if ( seconds < 0 ) {
+                return -1;
+            }
+            report("dds2atf-p/" + name, seconds, ddsSize, file_size(packed));
+        }
+
+        if ( selected("convert/" + name) && bench_convert(texture, "convert/" + name, pvr, atf, false) != 0 ) {
+            return -1;
+        }
+        if ( blocks && selected("convert-p/" + name) && bench_convert(texture, "convert-p/" + name, pvr, packed, true) != 0 ) {
+            return -1;
+        }
+
+        // atf-transform copies RGB files as they are and does not write raw
+        // cube maps
+        if ( blocks && !texture.cube && file_size(packed) > 0 ) {
+            transformable.push_back(packed);
+            if ( selected("atf-transform/" + name) ) {
+                std::string raw = out + "/" + name + ".raw";
+                double seconds = time_command(gOptions.transform + " -j 1 -i " + packed + " -o " + raw + " > /dev/null");
+                if ( seconds < 0 ) {
+                    return -1;
+                }
+                report("atf-transform/" + name, seconds, file_size(packed), file_size(raw));
+            }
+        }
+    }
+    return 0;
+}
+
+// dds2atf -p over all of textures on that many processes at a time
+double time_dds2atf_pool(const std::vector<std::string> &names, const std::string &corpus, const std::string &out, int32_t threads)
+{
+    double best = -1;
+    for ( int32_t r = 0; r < gOptions.runs; r++ ) {
+        std::atomic<size_t> next(0);
+        std::atomic<bool> failed(false);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for ( int32_t t = 0; t < threads; t++ ) {
+            workers.emplace_back([&]() {
+                for ( size_t i = next++; i < names.size() && !failed; i = next++ ) {
+                    std::string command = gOptions.dds2atf + " -s -p -i " + corpus + "/" + names[i] + ".dds -o " +
+                                          out + "/" + names[i] + ".atf > /dev/null";
+                    if ( system(command.c_str()) != 0 ) {
+                        std::cerr << "'" << command << "' failed\n";
+                        failed = true;
+                    }
+                }
+            });
+        }
+        for ( auto &worker : workers ) {
+            worker.join();
+        }
+        if ( failed ) {
+            return -1;
+        }
+        double seconds = seconds_since(start);
+        best = best < 0 ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+int bench_scaling(const std::vector<ATFSynthTexture> &textures, const std::vector<std::string> &transformable,
+                  const std::string &corpus, const std::string &out)
+{
+    int32_t most = gOptions.threads > 0 ? gOptions.threads : std::max(1, int32_t(std::thread::hardware_concurrency()));
+    std::vector<int32_t> counts;
+    for ( int32_t n = 1; n < most; n *= 2 ) {
+        counts.push_back(n);
+    }
+    counts.push_back(most);
+
+    std::vector<std::string> names;
+    uint64_t ddsBytes = 0;
+    for ( const ATFSynthTexture &texture : textures ) {
+        names.push_back(atf_synth_texture_name(texture));
+        ddsBytes += file_size(corpus + "/" + names.back() + ".dds");
+    }
+
+    std::string listPath = out + "/transform.list";
+    std::string largest;
+    uint64_t atfBytes = 0;
+    {
+        std::ofstream list(listPath);
+        for ( const std::string &path : transformable ) {
+            list << path << "\n";
+            atfBytes += file_size(path);
+            if ( largest.empty() || file_size(path) > file_size(largest) ) {
+                largest = path;
+            }
+        }
+    }
+
+    std::string pool = out + "/pool";
+    std::string batch = out + "/batch";
+    std::filesystem::create_directories(pool);
+    for ( int32_t threads : counts ) {
+        std::string suffix = "/j" + std::to_string(threads);
+        if ( selected("scaling/dds2atf-p" + suffix) && !names.empty() ) {
+            double seconds = time_dds2atf_pool(names, corpus, pool, threads);
+            if ( seconds < 0 ) {
+                return -1;
+            }
+            uint64_t bytesOut = 0;
+            for ( const std::string &name : names ) {
+                bytesOut += file_size(pool + "/" + name + ".atf");
+            }
+            report("scaling/dds2atf-p" + suffix, seconds, ddsBytes, bytesOut);
+        }
+        if ( selected("scaling/atf-transform-b" + suffix) && !transformable.empty() ) {
+            double seconds = time_command(gOptions.transform + " -j " + std::to_string(threads) + " -b " + listPath +
+                                          " -o " + batch + " > /dev/null");
+            if ( seconds < 0 ) {
+                return -1;
+            }
+            uint64_t bytesOut = 0;
+            for ( const std::string &path : transformable ) {
+                bytesOut += file_size((std::filesystem::path(batch) / std::filesystem::path(path).relative_path()).string());
+            }
+            report("scaling/atf-transform-b" + suffix, seconds, atfBytes, bytesOut);
+        }
+        if ( selected("scaling/atf-transform" + suffix) && !largest.empty() ) {
+            std::string raw = out + "/largest.raw";
+            double seconds = time_command(gOptions.transform + " -j " + std::to_string(threads) + " -i " + largest +
+                                          " -o " + raw + " > /dev/null");
+            if ( seconds < 0 ) {
+                return -1;
+            }
+            report("scaling/atf-transform" + suffix, seconds, file_size(largest), file_size(raw));
+        }
+    }
+    return 0;
+}
+
+// all bytes over all the time of every kind of per texture case
+void report_totals()
+{
+    static const char *kinds[] = { "dds2atf", "dds2atf-p", "convert", "convert-p", "atf-transform" };
+    size_t count = gResults.size();
+    for ( const char *kind : kinds ) {
+        std::string prefix = std::string(kind) + "/";
+        double seconds = 0;
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        for ( size_t i = 0; i < count; i++ ) {
+            if ( gResults[i].name.compare(0, prefix.size(), prefix) == 0 ) {
+                seconds += gResults[i].seconds;
+                bytesIn += gResults[i].bytesIn;
+                bytesOut += gResults[i].bytesOut;
+            }
+        }
+        if ( seconds > 0 ) {
+            report("total/" + std::string(kind), seconds, bytesIn, bytesOut);
+        }
+    }
+}
+
+bool write_results(const char *path)
+{
+    std::ofstream out(path);
+    out << "{\n  \"corpus\": \"" << (gOptions.full ? "full" : "quick") << "\",\n  \"runs\": " << gOptions.runs
+        << ",\n  \"cases\": {";
+    for ( size_t i = 0; i < gResults.size(); i++ ) {
+        const Result &result = gResults[i];
+        out << (i ? ",\n" : "\n") << "    \"" << result.name << "\": {\"mb_s\": " << std::setprecision(6) << result.mbs
+            << ", \"bytes_in\": " << result.bytesIn << ", \"bytes_out\": " << result.bytesOut << "}";
+    }
+    out << "\n  }\n}\n";
+    return bool(out);
+}
+
+// Just enough JSON for the files write_results() writes: every number ends up
+// in numbers under its path of object keys joined by dots.
+class JsonReader {
+public:
+    JsonReader(const std::string &text) : m_text(text), m_pos(0) {}
+
+    bool read(std::map<std::string, double> &numbers)
+    {
+        return value("", numbers) && (skip(), m_pos == m_text.size());
+    }
+
+private:
+    void skip()
+    {
+        while ( m_pos < m_text.size() && isspace(uint8_t(m_text[m_pos])) ) {
+            m_pos++;
+        }
+    }
+
+    bool string(std::string &str)
+    {
+        skip();
+        if ( m_pos >= m_text.size() || m_text[m_pos] != '"' ) {
+            return false;
+        }
+        for ( m_pos++; m_pos < m_text.size() && m_text[m_pos] != '"'; m_pos++ ) {
+            if ( m_text[m_pos] == '\\' && m_pos + 1 < m_text.size() ) {
+                m_pos++;
+            }
+            str += m_text[m_pos];
+        }
+        return m_pos++ < m_text.size();
+    }
+
+    bool value(const std::string &path, std::map<std::string, double> &numbers)
+    {
+        skip();
+        if ( m_pos >= m_text.size() ) {
+            return false;
+        }
+        char c = m_text[m_pos];
+        if ( c == '{' || c == '[' ) {
+            char close = c == '{' ? '}' : ']';
+            m_pos++;
+            skip();
+            if ( m_pos < m_text.size() && m_text[m_pos] == close ) {
+                m_pos++;
+                return true;
+            }
+            for ( int32_t index = 0;; index++ ) {
+                std::string key = std::to_string(index);
+                if ( c == '{' ) {
+                    key.clear();
+                    if ( !string(key) || (skip(), m_pos >= m_text.size() || m_text[m_pos++] != ':') ) {
+                        return false;
+                    }
+                }
+                if ( !value(path.empty() ? key : path + "." + key, numbers) ) {
+                    return false;
+                }
+                skip();
+                if ( m_pos >= m_text.size() ) {
+                    return false;
+                }
+                if ( m_text[m_pos++] == close ) {
+                    return true;
+                }
+                if ( m_text[m_pos - 1] != ',' ) {
+                    return false;
+                }
+            }
+        }
+        if ( c == '"' ) {
+            std::string ignored;
+            return string(ignored);
+        }
+        const char *start = m_text.c_str() + m_pos;
+        char *end = 0;
+        double number = strtod(start, &end);
+        if ( end == start ) {
+            // true, false and null
+            while ( m_pos < m_text.size() && isalpha(uint8_t(m_text[m_pos])) ) {
+                m_pos++;
+            }
+            return m_text.c_str() + m_pos != start;
+        }
+        m_pos += end - start;
+        numbers[path] = number;
+        return true;
+    }
+
+    const std::string &m_text;
+    size_t m_pos;
+};
+
+// the count of regressions against the baseline, or -1
+int32_t compare_baseline(const char *path)
+{
+    std::vector<uint8_t> data;
+    std::map<std::string, double> numbers;
+    if ( !read_file(path, data) ) {
+        std::cerr << "Could not read '" << path << "'\n";
+        return -1;
+    }
+    std::string text(data.begin(), data.end());
+    if ( !JsonReader(text).read(numbers) ) {
+        std::cerr << "'" << path << "' is not JSON\n";
+        return -1;
+    }
+
+    int32_t compared = 0;
+    int32_t regressions = 0;
+    for ( const Result &result : gResults ) {
+        std::string key = "cases." + result.name;
+        auto mbs = numbers.find(key + ".mb_s");
+        auto bytesIn = numbers.find(key + ".bytes_in");
+        auto bytesOut = numbers.find(key + ".bytes_out");
+        if ( mbs == numbers.end() || bytesIn == numbers.end() || bytesOut == numbers.end() ) {
+            continue;
+        }
+        compared++;
+        double ms = mbs->second > 0 ? bytesIn->second / (1024.0 * 1024.0) / mbs->second * 1000 : 0;
+        double speed = (result.mbs / mbs->second - 1) * 100;
+        double size = bytesOut->second > 0 ? (result.bytesOut / bytesOut->second - 1) * 100 : 0;
+        if ( ms >= gOptions.minimumMs && speed < -gOptions.tolerance ) {
+            std::cout << "regression: " << result.name << ": " << result.mbs << " MB/s, " << std::setprecision(3) << speed
+                      << std::setprecision(6) << "% against " << mbs->second << " MB/s\n";
+            regressions++;
+        }
+        if ( size > gOptions.sizeTolerance ) {
+            std::cout << "regression: " << result.name << ": " << result.bytesOut << " bytes, +" << std::setprecision(3)
+                      << size << std::setprecision(6) << "% against " << uint64_t(bytesOut->second) << " bytes\n";
+            regressions++;
+        }
+    }
+    std::cout << compared << " of " << gResults.size() << " cases compared with '" << path << "', " << regressions
+              << " regressions\n";
+    return regressions;
+}
+
+// the directory of the running binary, where the other tools are built to
+std::string tool_path(const char *argv0, const char *tool)
+{
+    std::string self(argv0);
+    size_t slash = self.find_last_of('/');
+    return (slash == std::string::npos ? std::string(".") : self.substr(0, slash)) + "/" + tool;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    atf_install_allocator_hooks();
+    ATFAllocatorScope allocScope(ATFPoolAllocator::threadLocal());
+
+    const char *corpus = 0;
+    for ( int32_t c = 1; c < argc; c++ ) {
+        if ( argv[c][0] != '-' ) {
+            corpus = argv[c];
+        } else if ( argv[c][1] == 'f' ) {
+            gOptions.full = true;
+        } else if ( c + 1 < argc ) {
+            switch ( argv[c][1] ) {
+            case 'n': gOptions.runs = std::max(1, atoi(argv[++c])); break;
+            case 'j': gOptions.threads = std::max(1, atoi(argv[++c])); break;
+            case 'k': gOptions.filter = argv[++c]; break;
+            case 'd': gOptions.dds2atf = argv[++c]; break;
+            case 'x': gOptions.transform = argv[++c]; break;
+            case 'w': gOptions.results = argv[++c]; break;
+            case 'b': gOptions.baseline = argv[++c]; break;
+            case 't': gOptions.tolerance = std::max(0.0, atof(argv[++c])); break;
+            case 's': gOptions.sizeTolerance = std::max(0.0, atof(argv[++c])); break;
+            case 'm': gOptions.minimumMs = std::max(0.0, atof(argv[++c])); break;
+            default: print_usage(); return -1;
+            }
+        } else {
+            print_usage();
+            return -1;
+        }
+    }
+    if ( !corpus ) {
+        print_usage();
+        return -1;
+    }
+    if ( gOptions.dds2atf.empty() ) {
+        gOptions.dds2atf = tool_path(argv[0], "dds2atf");
+    }
+    if ( gOptions.transform.empty() ) {
+        gOptions.transform = tool_path(argv[0], "atf-transform");
+    }
+
+    std::vector<ATFSynthTexture> textures;
+    atf_synth_corpus(gOptions.full, textures);
+
+    std::string out = std::string(corpus) + "/out";
+    std::error_code error;
+    std::filesystem::create_directories(out, error);
+    if ( error ) {
+        std::cerr << "Could not create '" << out << "'\n";
+        return -1;
+    }
+
+    std::vector<std::string> transformable;
+    if ( bench_textures(textures, corpus, out, transformable) != 0 ||
+         bench_scaling(textures, transformable, corpus, out) != 0 ) {
+        return -1;
+    }
+    report_totals();
+
+    if ( gOptions.results && !write_results(gOptions.results) ) {
+        std::cerr << "Could not write '" << gOptions.results << "'\n";
+        return -1;
+    }
+    if ( gOptions.baseline ) {
+        int32_t regressions = compare_baseline(gOptions.baseline);
+        if ( regressions != 0 ) {
+            return regressions < 0 ? -1 : 1;
+        }
+    }
+    return 0;
+}
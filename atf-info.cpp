@@ -0,0 +1,366 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "atfindex.h"
+#include "atfmap.h"
+
+void print_usage()
+{
+    std::cout << R"(atf-info V0.1
+
+Usage: atf-info [-s] [--json] input...
+
+Lists what is inside ATF files without decoding them: format, version, cube
+map flag, size, level count and, for every level and face, the bytes of each
+LZMA, JPEG-XR or raw section per platform. Empty sections (levels left out
+with dds2atf -n) show as "-". Only the headers and length prefixes are read.
+
+input      .atf files, or directories searched for them recursively
+-s         only the summary over all inputs: bytes per format, per section
+           kind, per level and the header and length prefix overhead
+--json     one JSON document with the files and the summary instead
+)";
+}
+
+namespace {
+
+struct SectionTotal {
+    uint64_t bytes = 0;
+    uint64_t count = 0;
+    uint64_t empty = 0;
+};
+
+struct FormatTotal {
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+};
+
+struct Summary {
+    uint64_t files = 0;
+    uint64_t invalid = 0;
+    uint64_t bytes = 0;
+    uint64_t headerBytes = 0;
+    uint64_t prefixBytes = 0;
+    std::map<std::string, FormatTotal> formats;
+    std::map<std::string, SectionTotal> sections;   // by "platform.payload"
+    std::vector<uint64_t> levels;                   // bytes of every level number, all faces
+};
+
+struct FileInfo {
+    std::string path;
+    const char *error = 0;
+    ATFIndex index;
+    size_t size = 0;
+    size_t wrapper = 0;                             // the 5 byte prefix atf-transform also skips
+    int32_t width = 0;
+    int32_t height = 0;
+};
+
+const char *format_name(int32_t format)
+{
+    static const char *names[] = { "rgb888", "rgba8888", "compressed", "compressed raw", "compressed alpha", "compressed raw alpha" };
+    format &= 0x7F;
+    return format >= 0 && format <= 5 ? names[format] : "unknown";
+}
+
+std::string section_name(const ATFIndex &index, int32_t s)
+{
+    const char *platform = 0;
+    const char *payload = 0;
+    if ( !atf_index_section_kind(index.format, index.version, s, platform, payload) ) {
+        return "section" + std::to_string(s);
+    }
+    return std::string(platform) + "." + payload;
+}
+
+void write_json_string(std::ostream &out, const std::string &str)
+{
+    out << '"';
+    for ( char c : str ) {
+        if ( c == '"' || c == '\\' ) {
+            out << '\\' << c;
+        } else if ( uint8_t(c) < 0x20 ) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+bool inspect(const std::string &path, FileInfo &info)
+{
+    info.path = path;
+    ATFMappedFile file;
+    if ( !file.open(path.c_str(), false) ) {
+        info.error = "could not open";
+        return false;
+    }
+    const uint8_t *data = file.data();
+    info.size = file.size();
+    info.wrapper = ( info.size > 0 && data[0] == 1 ) ? 5 : 0;
+    if ( !atf_index_build(data + info.wrapper, info.size - info.wrapper, info.index) ) {
+        info.error = "not a valid ATF file";
+        return false;
+    }
+    const uint8_t *header = data + info.wrapper + ( info.index.version ? 12 : 6 );
+    info.width = 1 << std::min(int32_t(header[1]), 30);
+    info.height = 1 << std::min(int32_t(header[2]), 30);
+    return true;
+}
+
+uint64_t header_bytes(const FileInfo &info)
+{
+    const ATFIndex &index = info.index;
+    return info.wrapper + ( index.sections.empty() ? index.fileLength : index.sections[0].offset - index.prefixSize );
+}
+
+void add_to_summary(const FileInfo &info, Summary &summary)
+{
+    summary.files++;
+    if ( info.error ) {
+        summary.invalid++;
+        return;
+    }
+    const ATFIndex &index = info.index;
+    summary.bytes += info.size;
+    summary.headerBytes += header_bytes(info);
+    summary.prefixBytes += uint64_t(index.sections.size()) * index.prefixSize;
+    FormatTotal &format = summary.formats[format_name(index.format)];
+    format.files++;
+    format.bytes += info.size;
+
+    if ( summary.levels.size() < index.count ) {
+        summary.levels.resize(index.count);
+    }
+    for ( size_t i = 0; i < index.sections.size(); i++ ) {
+        int32_t s = int32_t(i % index.sectionsPerLevel);
+        int32_t level = int32_t(i / index.sectionsPerLevel % index.count);
+        SectionTotal &section = summary.sections[section_name(index, s)];
+        section.bytes += index.sections[i].length;
+        section.count++;
+        section.empty += index.sections[i].length == 0 ? 1 : 0;
+        summary.levels[level] += index.sections[i].length;
+    }
+}
+
+void print_file(const FileInfo &info)
+{
+    if ( info.error ) {
+        std::cout << info.path << ": " << info.error << "\n\n";
+        return;
+    }
+    const ATFIndex &index = info.index;
+    std::cout << info.path << ": " << format_name(index.format) << ", version " << int32_t(index.version)
+              << ( index.faces == 6 ? ", cube map" : "" ) << ", " << info.width << "x" << info.height << ", "
+              << int32_t(index.count) << " levels, " << info.size << " bytes (header " << header_bytes(info)
+              << ", length prefixes " << index.sections.size() * index.prefixSize << ")\n";
+
+    std::vector<std::string> names;
+    std::vector<size_t> widths;
+    std::cout << "  " << std::setw(5) << "level" << std::setw(5) << "face" << std::setw(10) << "size";
+    for ( int32_t s = 0; s < index.sectionsPerLevel; s++ ) {
+        names.push_back(section_name(index, s));
+        widths.push_back(std::max<size_t>(names.back().size(), 8));
+        std::cout << "  " << std::setw(int(widths.back())) << names.back();
+    }
+    std::cout << "\n";
+
+    for ( int32_t face = 0; face < index.faces; face++ ) {
+        for ( int32_t level = 0; level < index.count; level++ ) {
+            std::string size = std::to_string(std::max(1, info.width >> level)) + "x" + std::to_string(std::max(1, info.height >> level));
+            std::cout << "  " << std::setw(5) << level << std::setw(5) << face << std::setw(10) << size;
+            for ( int32_t s = 0; s < index.sectionsPerLevel; s++ ) {
+                const ATFIndexSection *section = atf_index_section(index, face, level, s);
+                std::cout << "  " << std::setw(int(widths[s]));
+                if ( section && section->length > 0 ) {
+                    std::cout << section->length;
+                } else {
+                    std::cout << "-";
+                }
+            }
+            std::cout << "\n";
+        }
+    }
+    std::cout << "\n";
+}
+
+void print_summary(const Summary &summary)
+{
+    std::cout << summary.files << " files";
+    if ( summary.invalid ) {
+        std::cout << " (" << summary.invalid << " not valid)";
+    }
+    std::cout << ", " << summary.bytes << " bytes, headers " << summary.headerBytes << ", length prefixes "
+              << summary.prefixBytes << "\n";
+    if ( summary.bytes == 0 ) {
+        return;
+    }
+    double total = double(summary.bytes);
+
+    for ( const auto &format : summary.formats ) {
+        std::cout << "  " << format.first << ": " << format.second.files << " files, " << format.second.bytes << " bytes\n";
+    }
+
+    std::vector<std::pair<std::string, SectionTotal>> sections(summary.sections.begin(), summary.sections.end());
+    std::stable_sort(sections.begin(), sections.end(), [](const std::pair<std::string, SectionTotal> &a,
+                                                          const std::pair<std::string, SectionTotal> &b) {
+        return a.second.bytes > b.second.bytes;
+    });
+    std::cout << "\n  " << std::left << std::setw(22) << "section" << std::right << std::setw(14) << "bytes"
+              << std::setw(8) << "share" << "  empty\n";
+    std::cout << std::fixed << std::setprecision(1);
+    for ( const auto &section : sections ) {
+        std::cout << "  " << std::left << std::setw(22) << section.first << std::right << std::setw(14) << section.second.bytes
+                  << std::setw(7) << section.second.bytes * 100.0 / total << "%  " << section.second.empty << " of "
+                  << section.second.count << "\n";
+    }
+
+    std::cout << "\n";
+    for ( size_t level = 0; level < summary.levels.size(); level++ ) {
+        std::cout << "  level " << std::setw(2) << level << std::setw(14) << summary.levels[level] << std::setw(7)
+                  << summary.levels[level] * 100.0 / total << "%\n";
+    }
+    std::cout << std::defaultfloat;
+}
+
+void write_json_file(std::ostream &out, const FileInfo &info)
+{
+    out << "{\"path\":";
+    write_json_string(out, info.path);
+    if ( info.error ) {
+        out << ",\"error\":";
+        write_json_string(out, info.error);
+        out << "}";
+        return;
+    }
+    const ATFIndex &index = info.index;
+    out << ",\"format\":\"" << format_name(index.format) << "\",\"format_id\":" << int32_t(index.format & 0x7F)
+        << ",\"version\":" << int32_t(index.version) << ",\"cube\":" << ( index.faces == 6 ? "true" : "false" )
+        << ",\"width\":" << info.width << ",\"height\":" << info.height << ",\"level_count\":" << int32_t(index.count)
+        << ",\"bytes\":" << info.size << ",\"header_bytes\":" << header_bytes(info)
+        << ",\"prefix_bytes\":" << index.sections.size() * index.prefixSize << ",\"levels\":[";
+    bool first = true;
+    for ( int32_t face = 0; face < index.faces; face++ ) {
+        for ( int32_t level = 0; level < index.count; level++ ) {
+            bool empty = true;
+            out << ( first ? "" : "," ) << "{\"level\":" << level << ",\"face\":" << face
+                << ",\"width\":" << std::max(1, info.width >> level) << ",\"height\":" << std::max(1, info.height >> level)
+                << ",\"sections\":{";
+            for ( int32_t s = 0; s < index.sectionsPerLevel; s++ ) {
+                const ATFIndexSection *section = atf_index_section(index, face, level, s);
+                uint32_t length = section ? section->length : 0;
+                empty = empty && length == 0;
+                out << ( s ? "," : "" ) << "\"" << section_name(index, s) << "\":" << length;
+            }
+            out << "},\"empty\":" << ( empty ? "true" : "false" ) << "}";
+            first = false;
+        }
+    }
+    out << "]}";
+}
+
+void write_json_summary(std::ostream &out, const Summary &summary)
+{
+    out << "{\"files\":" << summary.files << ",\"invalid\":" << summary.invalid << ",\"bytes\":" << summary.bytes
+        << ",\"header_bytes\":" << summary.headerBytes << ",\"prefix_bytes\":" << summary.prefixBytes << ",\"formats\":{";
+    bool first = true;
+    for ( const auto &format : summary.formats ) {
+        out << ( first ? "" : "," ) << "\"" << format.first << "\":{\"files\":" << format.second.files
+            << ",\"bytes\":" << format.second.bytes << "}";
+        first = false;
+    }
+    out << "},\"sections\":{";
+    first = true;
+    for ( const auto &section : summary.sections ) {
+        out << ( first ? "" : "," ) << "\"" << section.first << "\":{\"bytes\":" << section.second.bytes
+            << ",\"count\":" << section.second.count << ",\"empty\":" << section.second.empty << "}";
+        first = false;
+    }
+    out << "},\"levels\":[";
+    for ( size_t level = 0; level < summary.levels.size(); level++ ) {
+        out << ( level ? "," : "" ) << summary.levels[level];
+    }
+    out << "]}";
+}
+
+// the files of an input, directories searched for .atf files in name order
+bool collect(const char *input, std::vector<std::string> &paths)
+{
+    namespace fs = std::filesystem;
+    std::error_code error;
+    if ( !fs::is_directory(input, error) ) {
+        paths.push_back(input);
+        return true;
+    }
+    std::vector<std::string> found;
+    for ( fs::recursive_directory_iterator it(input, error), end; !error && it != end; it.increment(error) ) {
+        if ( it->is_regular_file(error) && it->path().extension() == ".atf" ) {
+            found.push_back(it->path().string());
+        }
+    }
+    std::sort(found.begin(), found.end());
+    paths.insert(paths.end(), found.begin(), found.end());
+    return !error;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    bool summaryOnly = false;
+    std::vector<std::string> paths;
+    for ( int32_t c = 1; c < argc; c++ ) {
+        if ( strcmp(argv[c], "--json") == 0 ) {
+            json = true;
+        } else if ( strcmp(argv[c], "-s") == 0 ) {
+            summaryOnly = true;
+        } else if ( argv[c][0] == '-' ) {
+            print_usage();
+            return -1;
+        } else if ( !collect(argv[c], paths) ) {
+            std::cerr << "Could not read '" << argv[c] << "'\n";
+            return -1;
+        }
+    }
+    if ( paths.empty() ) {
+        print_usage();
+        return -1;
+    }
+
+    Summary summary;
+    if ( json ) {
+        std::cout << "{\"files\":[";
+    }
+    for ( size_t i = 0; i < paths.size(); i++ ) {
+        FileInfo info;
+        inspect(paths[i], info);
+        add_to_summary(info, summary);
+        if ( summaryOnly ) {
+            continue;
+        }
+        if ( json ) {
+            std::cout << ( i ? ",\n" : "\n" );
+            write_json_file(std::cout, info);
+        } else {
+            print_file(info);
+        }
+    }
+    if ( json ) {
+        std::cout << "\n],\"summary\":";
+        write_json_summary(std::cout, summary);
+        std::cout << "}\n";
+    } else if ( summaryOnly || paths.size() > 1 ) {
+        print_summary(summary);
+    }
+    return summary.invalid ? 1 : 0;
+}
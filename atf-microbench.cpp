@@ -0,0 +1,379 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <initializer_list>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "3rdparty/jpegxr/jpegxr.h"
+#include "3rdparty/jpegxr/jxr_priv.h"
+extern "C" {
+#include "3rdparty/lzma/LzmaDec.h"
+}
+
+#include "atfalloc.h"
+#include "atfsynth.h"
+
+// pvr2atfcore.cpp
+extern bool gSilent;
+size_t LzmaSlowCompress(uint8_t *src, uint8_t *dst, size_t len);
+double time_block_input(int32_t platform, int32_t w, int32_t h, const void *colors, const uint8_t *modes, int32_t runs);
+size_t encode_color_plane(int32_t w, int32_t h, const uint16_t *colors, jxr_color_fmt_t format, int32_t quality);
+
+void print_usage()
+{
+    std::cout << R"(atf-microbench V0.1
+
+Usage: atf-microbench [-n runs] [-k kernel]
+
+Times the kernels the conversion spends its time in, one at a time, on
+synthetic data made from fixed seeds, so the numbers can be compared across
+commits and machines. Every kernel reports MB/s over the bytes it reads and
+ns per 16x16 macroblock of the texture plane it works on.
+
+-n  repeats every kernel this many times (default 3)
+-k  only runs the kernels whose name contains this
+
+Kernels: 4x4 PCT and IPCT, the 4x4, 4 and 2x2 prefilters, the encoder's strip
+input (collect_and_scale_up4 with its color conversions, less the block input
+it calls) and transform steps per color format, the DXT1, PVRTC and ETC1 block
+inputs, the JPEG-XR bit writer and reader, LzmaSlowCompress on DXT1 index
+planes and LzmaDecode of its output. Build with optimization for numbers that
+mean something: make clean && make bench CCPARAMS=-O2
+)";
+}
+
+namespace {
+
+const uint32_t kSeed = 1234;
+const int32_t kPlane = 512;             // side of the block input and encoder planes
+const int32_t kBlocks = 16 * 1024;      // 4x4 blocks of the transform kernels
+
+std::string gFilter;
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool selected(const char *name)
+{
+    return gFilter.empty() || std::string(name).find(gFilter) != std::string::npos;
+}
+
+bool selected(std::initializer_list<const char *> names)
+{
+    for ( const char *name : names ) {
+        if ( selected(name) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void report(const char *name, double seconds, double bytes, double macroblocks)
+{
+    std::cout << name << ": " << (bytes / (1024.0 * 1024.0) / seconds) << " MB/s, "
+              << (seconds * 1e9 / macroblocks) << " ns/macroblock\n";
+}
+
+// 9 bit signed samples, the range of the transform's input
+std::vector<int> random_coefficients(size_t count)
+{
+    std::mt19937 random(kSeed);
+    std::vector<int> coeffs(count);
+    for ( auto &c : coeffs ) {
+        c = int(random() % 512) - 256;
+    }
+    return coeffs;
+}
+
+int bench_transforms(int32_t runs)
+{
+    // 16 blocks of 16 coefficients are one channel of a macroblock
+    std::vector<int> source = random_coefficients(size_t(kBlocks) * 16);
+    double bytes = double(source.size()) * sizeof(int) * runs;
+    double macroblocks = double(kBlocks) / 16 * runs;
+
+    if ( selected({ "4x4 pct", "4x4 ipct" }) ) {
+        std::vector<int> coeffs = source;
+        double forward = 0;
+        double inverse = 0;
+        for ( int32_t r = 0; r < runs; r++ ) {
+            auto start = std::chrono::steady_clock::now();
+            for ( int32_t b = 0; b < kBlocks; b++ ) {
+                _jxr_4x4PCT(&coeffs[size_t(b) * 16]);
+            }
+            forward += seconds_since(start);
+            start = std::chrono::steady_clock::now();
+            for ( int32_t b = 0; b < kBlocks; b++ ) {
+                _jxr_4x4IPCT(&coeffs[size_t(b) * 16]);
+            }
+            inverse += seconds_since(start);
+        }
+        if ( coeffs != source ) {
+            std::cerr << "4x4 IPCT does not invert 4x4 PCT\n";
+            return -1;
+        }
+        report("4x4 pct", forward, bytes, macroblocks);
+        report("4x4 ipct", inverse, bytes, macroblocks);
+    }
+
+    if ( selected({ "4x4 prefilter", "4 prefilter", "2x2 prefilter" }) ) {
+        double seconds[3] = { 0, 0, 0 };
+        for ( int32_t r = 0; r < runs; r++ ) {
+            std::vector<int> coeffs = source;
+            auto start = std::chrono::steady_clock::now();
+            for ( int32_t b = 0; b < kBlocks; b++ ) {
+                int *c = &coeffs[size_t(b) * 16];
+                _jxr_4x4PreFilter(c + 0, c + 1, c + 2, c + 3, c + 4, c + 5, c + 6, c + 7,
+                                  c + 8, c + 9, c + 10, c + 11, c + 12, c + 13, c + 14, c + 15);
+            }
+            seconds[0] += seconds_since(start);
+
+            coeffs = source;
+            start = std::chrono::steady_clock::now();
+            for ( int32_t b = 0; b < kBlocks; b++ ) {
+                int *c = &coeffs[size_t(b) * 16];
+                for ( int32_t e = 0; e < 16; e += 4 ) {
+                    _jxr_4PreFilter(c + e, c + e + 1, c + e + 2, c + e + 3);
+                }
+            }
+            seconds[1] += seconds_since(start);
+
+            coeffs = source;
+            start = std::chrono::steady_clock::now();
+            for ( int32_t b = 0; b < kBlocks; b++ ) {
+                int *c = &coeffs[size_t(b) * 16];
+                for ( int32_t e = 0; e < 16; e += 4 ) {
+                    _jxr_2x2PreFilter(c + e, c + e + 1, c + e + 2, c + e + 3);
+                }
+            }
+            seconds[2] += seconds_since(start);
+        }
+        report("4x4 prefilter", seconds[0], bytes, macroblocks);
+        report("4 prefilter", seconds[1], bytes, macroblocks);
+        report("2x2 prefilter", seconds[2], bytes, macroblocks);
+    }
+    return 0;
+}
+
+// time per encoder step, from jxr_set_stage_hook
+double gStageSeconds[2];
+std::chrono::steady_clock::time_point gStageStart[2];
+
+void stage_hook(jxr_stage_t stage, int begin)
+{
+    if ( begin ) {
+        gStageStart[stage] = std::chrono::steady_clock::now();
+    } else {
+        gStageSeconds[stage] += seconds_since(gStageStart[stage]);
+    }
+}
+
+int bench_block_inputs(int32_t runs)
+{
+    std::vector<uint8_t> rgba(size_t(kPlane) * kPlane * 4);
+    atf_synth_rgba(kPlane, kPlane, ATF_SYNTH_SMOOTH, kSeed, rgba.data());
+
+    size_t pixels = size_t(kPlane) * kPlane;
+    std::vector<uint16_t> colors16(pixels);
+    std::vector<uint32_t> colors32(pixels);
+    std::vector<uint8_t> modes(pixels);
+    std::mt19937 random(kSeed);
+    for ( size_t p = 0; p < pixels; p++ ) {
+        const uint8_t *c = &rgba[p * 4];
+        colors16[p] = atf_synth_565(c);
+        colors32[p] = (uint32_t(c[0]) << 16) | (uint32_t(c[1]) << 8) | c[2];
+        modes[p] = uint8_t(random() & 2);
+    }
+    double macroblocks = double(pixels) / 256 * runs;
+
+    static const char *names[] = { "Read565Data_DXT1", "Read555Data_PVRTC", "Read555Data_ETC1" };
+    static const jxr_color_fmt_t formats[] = { JXR_YUV444, JXR_YUV422, JXR_YUV420 };
+    static const char *formatNames[] = { "yuv444", "yuv422", "yuv420" };
+    std::string stripNames[3][2];
+    bool strips = false;
+    for ( int32_t f = 0; f < 3; f++ ) {
+        stripNames[f][0] = std::string("strip input ") + formatNames[f];
+        stripNames[f][1] = std::string("strip transform ") + formatNames[f];
+        strips |= selected(stripNames[f][0].c_str()) || selected(stripNames[f][1].c_str());
+    }
+
+    double dxt1Seconds = -1;
+    for ( int32_t platform = 0; platform < 3; platform++ ) {
+        if ( !selected(names[platform]) && !(platform == 0 && strips) ) {
+            continue;
+        }
+        const void *colors = platform == 2 ? (const void *)colors32.data() : (const void *)colors16.data();
+        double seconds = time_block_input(platform, kPlane, kPlane, colors, modes.data(), runs);
+        if ( seconds < 0 ) {
+            std::cerr << "Could not set up the " << names[platform] << " image\n";
+            return -1;
+        }
+        if ( platform == 0 ) {
+            dxt1Seconds = seconds;
+        }
+        if ( selected(names[platform]) ) {
+            double bytes = double(pixels) * (platform == 2 ? 5 : 2) * runs;
+            report(names[platform], seconds, bytes, macroblocks);
+        }
+    }
+
+    // the encoder reads every strip through Read565Data_DXT1, which is timed
+    // above on the same plane and taken out of the input step
+    for ( int32_t f = 0; f < 3 && strips; f++ ) {
+        gStageSeconds[0] = gStageSeconds[1] = 0;
+        jxr_set_stage_hook(stage_hook);
+        for ( int32_t r = 0; r < runs; r++ ) {
+            if ( !encode_color_plane(kPlane, kPlane, colors16.data(), formats[f], 0) ) {
+                jxr_set_stage_hook(0);
+                std::cerr << "Could not encode the " << formatNames[f] << " plane\n";
+                return -1;
+            }
+        }
+        jxr_set_stage_hook(0);
+        double bytes = double(pixels) * 3 * sizeof(int) * runs;
+        if ( selected(stripNames[f][0].c_str()) ) {
+            report(stripNames[f][0].c_str(), std::max(1e-9, gStageSeconds[JXR_STAGE_INPUT] - dxt1Seconds), bytes, macroblocks);
+        }
+        if ( selected(stripNames[f][1].c_str()) ) {
+            report(stripNames[f][1].c_str(), gStageSeconds[JXR_STAGE_TRANSFORM], bytes, macroblocks);
+        }
+    }
+    return 0;
+}
+
+int bench_bitstream(int32_t runs)
+{
+    // 256 symbols of 1 to 16 bits stand for a macroblock
+    const int32_t macroblocks = 4096;
+    std::mt19937 random(kSeed);
+    std::vector<uint32_t> values(size_t(macroblocks) * 256);
+    std::vector<int> widths(values.size());
+    for ( size_t s = 0; s < values.size(); s++ ) {
+        widths[s] = int(random() % 16) + 1;
+        values[s] = uint32_t(random()) & ((1u << widths[s]) - 1);
+    }
+
+    double write = 0;
+    double read = 0;
+    size_t length = 0;
+    for ( int32_t r = 0; r < runs; r++ ) {
+        wbitstream out;
+        _jxr_wbitstream_initialize(&out);
+        auto start = std::chrono::steady_clock::now();
+        for ( size_t s = 0; s < values.size(); s++ ) {
+            _jxr_wbitstream_uintN(&out, values[s], widths[s]);
+        }
+        _jxr_wbitstream_flush(&out);
+        write += seconds_since(start);
+        length = out.len();
+
+        rbitstream in(out.buffer(), out.len());
+        _jxr_rbitstream_initialize(&in);
+        bool same = true;
+        start = std::chrono::steady_clock::now();
+        for ( size_t s = 0; s < values.size(); s++ ) {
+            same &= _jxr_rbitstream_uintN(&in, widths[s]) == values[s];
+        }
+        read += seconds_since(start);
+        if ( !same ) {
+            std::cerr << "The bit reader does not read back what the writer wrote\n";
+            return -1;
+        }
+    }
+    report("bit writer", write, double(length) * runs, double(macroblocks) * runs);
+    report("bit reader", read, double(length) * runs, double(macroblocks) * runs);
+    return 0;
+}
+
+int bench_lzma(int32_t runs)
+{
+    // the index plane of a DXT1 level as write_dxt1 compresses it, 4 bytes per
+    // block, so 64 bytes per macroblock
+    const int32_t side = 1024;
+    static const ATFSynthContent contents[] = { ATF_SYNTH_SMOOTH, ATF_SYNTH_NOISY };
+    std::vector<uint8_t> rgba(size_t(side) * side * 4);
+    std::vector<uint8_t> blocks(size_t(side / 4) * (side / 4) * 8);
+    std::vector<uint8_t> plane(blocks.size() / 2);
+    std::vector<uint8_t> compressed(plane.size() * 2 + 1024);
+    std::vector<uint8_t> decoded(plane.size());
+    double macroblocks = double(side) * side / 256 * runs;
+
+    for ( ATFSynthContent content : contents ) {
+        atf_synth_rgba(side, side, content, kSeed, rgba.data());
+        atf_synth_dxt1(rgba.data(), side, side, blocks.data());
+        for ( size_t b = 0; b < plane.size() / 4; b++ ) {
+            memcpy(&plane[b * 4], &blocks[b * 8 + 4], 4);
+        }
+
+        size_t length = 0;
+        double compress = 0;
+        double decompress = 0;
+        for ( int32_t r = 0; r < runs; r++ ) {
+            auto start = std::chrono::steady_clock::now();
+            length = LzmaSlowCompress(plane.data(), compressed.data(), plane.size());
+            compress += seconds_since(start);
+            if ( !length ) {
+                return -1;
+            }
+
+            static ISzAlloc alloc = { atf_sz_alloc, atf_sz_free };
+            SizeT outLen = decoded.size();
+            SizeT inLen = length - LZMA_PROPS_SIZE;
+            ELzmaStatus status;
+            start = std::chrono::steady_clock::now();
+            SRes res = LzmaDecode(decoded.data(), &outLen, compressed.data() + LZMA_PROPS_SIZE, &inLen,
+                                  compressed.data(), LZMA_PROPS_SIZE, LZMA_FINISH_END, &status, &alloc, 0);
+            decompress += seconds_since(start);
+            if ( res != SZ_OK || decoded != plane ) {
+                std::cerr << "LzmaDecode does not give back the index plane\n";
+                return -1;
+            }
+        }
+        std::string name = std::string("LzmaSlowCompress ") + atf_synth_content_name(content);
+        report(name.c_str(), compress, double(plane.size()) * runs, macroblocks);
+        name = std::string("LzmaDecode ") + atf_synth_content_name(content);
+        report(name.c_str(), decompress, double(length) * runs, macroblocks);
+        std::cout << "  " << plane.size() << " bytes to " << length << "\n";
+    }
+    return 0;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    atf_install_allocator_hooks();
+    ATFAllocatorScope allocScope(ATFPoolAllocator::threadLocal());
+    gSilent = true;
+
+    int32_t runs = 3;
+    for ( int32_t c = 1; c < argc; c++ ) {
+        if ( argv[c][0] == '-' && c + 1 < argc ) {
+            if ( argv[c][1] == 'n' ) {
+                runs = std::max(1, atoi(argv[++c]));
+            } else if ( argv[c][1] == 'k' ) {
+                gFilter = argv[++c];
+            }
+        } else {
+            print_usage();
+            return -1;
+        }
+    }
+
+    if ( bench_transforms(runs) != 0 || bench_block_inputs(runs) != 0 ) {
+        return -1;
+    }
+    if ( selected({ "bit writer", "bit reader" }) && bench_bitstream(runs) != 0 ) {
+        return -1;
+    }
+    if ( selected({ "LzmaSlowCompress", "LzmaDecode" }) && bench_lzma(runs) != 0 ) {
+        return -1;
+    }
+    return 0;
+}
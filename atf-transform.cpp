@@ -1,11 +1,29 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <iterator>
+#include <mutex>
 #include <sstream>
+#include <string>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
 
 #include "3rdparty/jpegxr/jpegxr.h"
 #include "3rdparty/jpegxr/jxr_priv.h"
+#include "atf.h"
+#include "atfalloc.h"
+#include "atffilter.h"
+#include "atfindex.h"
+#include "atfmap.h"
+#include "atfraw.h"
+#include "atftrace.h"
 
 extern "C"
 {
@@ -17,9 +35,29 @@ void print_usage()
 {
     std::cout << R"(atf-transform V0.1
 
-Usage: atf-transform -i input.atf -o output.atf
+Usage: atf-transform [-p] [-l levels] [-j threads] [-r [-a align]] [--trace file] -i input.atf -o output
+       atf-transform [-p] [-l levels] [-j threads] [-r [-a align]] [-m MB] [--trace file] -b dir|list -o output_dir
+       atf-transform [-p] -t size -i input.atf -o thumbnail.pam
 
 Convert atf lzma encoded to raw representation. Also remove the jpg-xr version
+
+-p         preview, decode the jpg-xr images from their DC and low pass bands only
+-l levels  keep only the smallest levels
+-j threads decode the sections on this many threads, default one per core
+-b batch   convert every .atf under a directory, or the files listed one per
+           line in a text file, to the same paths under output_dir. Files
+           are converted on -j threads, each file on one
+-m MB      decoded blocks the files of a batch may hold at once (default 512)
+-r         write an upload ready container (atfraw.h, .atfr in batches) instead:
+           a fixed header and level table, every level on its own alignment
+           so it can be uploaded straight from a mapped file. Compressed files
+           give DXT1/DXT5, RGB files and cube maps are decoded as they are
+-a align   alignment of the levels for -r, a power of two (default 256, 4096
+           for pages)
+-t size    write an RGBA thumbnail (PAM) of the largest level that fits in
+           size x size instead, the smallest level scaled down if none does
+--trace    write the time spent mapping, decoding and writing, per thread,
+           as Chrome trace events (open in Perfetto or about:tracing)
 )";
 }
 
@@ -35,7 +73,27 @@ enum {
 };
 
 
-bool decodeData( const unsigned char * src, int & index, int version, char * destination, int & output_size)
+static bool previewMode = false;
+
+// false if the section runs past the end of the file
+bool skipSection( const unsigned char * src, size_t size, int & index, int version )
+{
+    if( size_t( index ) + ( version != 0 ? 4 : 3 ) > size )
+    {
+        return false;
+    }
+    if( version != 0 )
+    {
+        index += 4 + ( ( src[ index ] << 24 ) + ( src[ index + 1 ] << 16 ) + ( src[ index + 2 ] << 8 ) + src[ index + 3 ] );
+    }
+    else
+    {
+        index += 3 + ( ( src[ index ] << 16 ) + ( src[ index + 1 ] << 8 ) + src[ index + 2 ] );
+    }
+    return index >= 0 && size_t( index ) <= size;
+}
+
+bool decodeData( const unsigned char * src, int & index, int version, const ATFFilterLayout & layout, char * destination, int & output_size)
 {
     int source_size;
 
@@ -55,23 +113,34 @@ bool decodeData( const unsigned char * src, int & index, int version, char * des
         return false;
     }
 
-    auto _malloc = [](void *, size_t s)
+    ATFTraceSpan span( "lzma decode" );
+
+    // version 4 sections start with the id of the pre-filter applied before LZMA
+    int filter = ATF_FILTER_NONE;
+
+    if( version >= ATF_VERSION_FILTERED )
     {
-        return malloc(s);
-    };
+        filter = src[ index ];
+        index += 1;
+        source_size -= 1;
+    }
+
+    thread_local std::vector<char> filtered;
+    char * lzma_destination = destination;
 
-    auto _free = [](void*, void *p)
+    if( filter != ATF_FILTER_NONE )
     {
-        free(p);
-    };
+        filtered.resize( output_size );
+        lzma_destination = filtered.data();
+    }
 
-    ISzAlloc alloc{ _malloc, _free };
+    static ISzAlloc alloc{ atf_sz_alloc, atf_sz_free };
     source_size -=5;
     ELzmaStatus status;
 
     SizeT src_size = source_size;
     SizeT dest_size = output_size;
-    auto res = LzmaDecode(reinterpret_cast<Byte*>(destination), &dest_size, reinterpret_cast<const Byte*>( src + index + 5 ), &src_size,
+    auto res = LzmaDecode(reinterpret_cast<Byte*>(lzma_destination), &dest_size, reinterpret_cast<const Byte*>( src + index + 5 ), &src_size,
         reinterpret_cast<const Byte*>(src + index), 5, LZMA_FINISH_END, &status, &alloc, nullptr);
 
     if( res != SZ_OK || ( status != LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK && status != LZMA_STATUS_FINISHED_WITH_MARK ) )
@@ -79,16 +148,46 @@ bool decodeData( const unsigned char * src, int & index, int version, char * des
         return false;
     }
 
+    if( filter != ATF_FILTER_NONE &&
+        !atf_filter_decode( filter, layout, reinterpret_cast<const uint8_t*>(lzma_destination), reinterpret_cast<uint8_t*>(destination), dest_size ) )
+    {
+        std::cerr << "Invalid filter(" << filter << ")" << std::endl;
+        return false;
+    }
+
     output_size = dest_size;
     index += 5 + source_size;
 
     return true;
 }
 
-static char * globalDestination = nullptr;
+// Copies the field_size bytes of every block from a decoded plane to offset in
+// the output blocks.
+void scatterField( const char * plane, uint8_t * blocks, int block_count, int field_size, int block_size, int offset )
+{
+    for( int i = 0; i < block_count; ++i )
+    {
+        memcpy( blocks + i * block_size + offset, plane + i * field_size, field_size );
+    }
+}
+
+// Where decodeJpegXR puts the endpoints: the image holds the first endpoint of
+// every block in its top half and the second one in the bottom half, they go
+// straight to their place in the output blocks.
+struct BlockTarget
+{
+    uint8_t * blocks;
+    int block_size;
+    int top_offset;
+    int bottom_offset;
+};
 
-bool decodeJpegXR(const unsigned char * src, int & index, int version, char * destination)
+// false for an empty section and for one that does not decode, which also
+// sets corrupt
+bool decodeJpegXR(const unsigned char * src, int & index, int version, BlockTarget & target, bool & corrupt)
 {
+    corrupt = false;
+
     int source_size;
 
     if( version != 0 )
@@ -110,156 +209,487 @@ bool decodeJpegXR(const unsigned char * src, int & index, int version, char * de
     auto container = jxr_create_container();
     auto image = jxr_create_input();
 
-    jxr_set_user_data(image, destination);
+    jxr_set_user_data(image, &target);
+
+    if( previewMode )
+    {
+        jxr_flag_SKIP_HP_DATA(image, 1);
+        jxr_flag_SKIP_FLEX_DATA(image, 1);
+    }
 
     jxr_set_block_output(image,[](jxr_image_t image, int mx, int my, int*data){
         int32_t w = jxr_get_IMAGE_WIDTH(image);
         int32_t h = jxr_get_IMAGE_HEIGHT(image);
         int32_t n = jxr_get_IMAGE_CHANNELS(image);
 
-        if( n == 1 )
-        {
-
-            auto image_data = reinterpret_cast<uint8_t*>( jxr_get_user_data(image) );
-            for ( int32_t y=0; y<16; y++) {
-                int32_t dy = (my*16) + y;
-                for ( int32_t x=0; x<16; x++) {
-                    int32_t dx = (mx*16) + x;
-                    if ( dy < h && dx < w ) {
+        auto target = reinterpret_cast<BlockTarget*>( jxr_get_user_data(image) );
 
-                        int pixel_index = y*16 + x;
-                        image_data[ dy * w + dx ] = data[ pixel_index ];
-                    }
-                }
-            }
-        }
-        else
-        {
-            auto image_data = reinterpret_cast<uint16_t*>( jxr_get_user_data(image) );
-            for ( int32_t y=0; y<16; y++) {
-                int32_t dy = (my*16) + y;
-                for ( int32_t x=0; x<16; x++) {
-                    int32_t dx = (mx*16) + x;
-                    if ( dy < h && dx < w ) {
+        for ( int32_t y=0; y<16; y++) {
+            int32_t dy = (my*16) + y;
+            for ( int32_t x=0; x<16; x++) {
+                int32_t dx = (mx*16) + x;
+                if ( dy < h && dx < w ) {
 
-                        int pixel_index = y*16 + x;
+                    int pixel_index = y*16 + x;
+                    int block_index = ( dy < h / 2 ? dy : dy - h / 2 ) * w + dx;
+                    uint8_t * block = target->blocks + block_index * target->block_size
+                        + ( dy < h / 2 ? target->top_offset : target->bottom_offset );
 
+                    if( n == 1 )
+                    {
+                        block[ 0 ] = data[ pixel_index ];
+                    }
+                    else
+                    {
                         int r = data[ pixel_index * n + 2 ] & 0x1F;
                         int g = data[ pixel_index * n + 1 ] & 0x3F;
                         int b = data[ pixel_index * n + 0 ] & 0x1F;
 
-                        image_data[ dy * w + dx ] =
-                            (r << 11)
-                            | (g <<  5)
-                            |  b;
+                        int color = (r << 11) | (g << 5) | b;
+                        block[ 0 ] = uint8_t( color );
+                        block[ 1 ] = uint8_t( color >> 8 );
                     }
                 }
             }
         }
     });
     auto result = jxr_read_image_container(container, reinterpret_cast<const unsigned char *>(src + index), source_size);
-    auto image_offset = jxrc_image_offset(container, 0);
-    auto image_size = jxrc_image_bytecount(container, 0);
+    if( result == 0 )
+    {
+        auto image_offset = jxrc_image_offset(container, 0);
+        auto image_size = jxrc_image_bytecount(container, 0);
 
-    result = jxr_read_image_bitstream(image, reinterpret_cast<const unsigned char *>(src + index + image_offset), image_size);
+        ATFTraceSpan span( "jxr_read_image_bitstream" );
+        result = jxr_read_image_bitstream(image, reinterpret_cast<const unsigned char *>(src + index + image_offset), image_size);
+    }
 
     jxr_destroy( image );
     jxr_destroy_container( container );
 
     index += source_size;
 
-    return true;
+    corrupt = result != 0;
+    return !corrupt;
 }
 
-static std::ifstream ifile;
-static std::ofstream ofile;
+// One LZMA or JPEG-XR section of a level and where its data goes in the
+// output blocks.
+struct SectionTask
+{
+    bool jpegxr;
+    int field_size;         // LZMA: bytes per block in the decoded plane
+    int field_bits;
+    int offset;             // LZMA: of the field in the block
+    int top_offset;         // JPEG-XR: see BlockTarget
+    int bottom_offset;
+};
 
-static const char * ifilename;
-static const char * ofilename;
+static const SectionTask dxt1Tasks[] = {
+    { false, 4, 2, 4, 0, 0 },   // color bits
+    { true, 0, 0, 0, 0, 2 },    // colors
+};
 
-int main(int argc, char *argv[]) {
+static const SectionTask dxt5Tasks[] = {
+    { false, 6, 3, 2, 0, 0 },   // alpha bits
+    { true, 0, 0, 0, 0, 1 },    // alphas
+    { false, 4, 2, 12, 0, 0 },  // color bits
+    { true, 0, 0, 0, 8, 10 },   // colors
+};
 
-    if ( argc > 1) {
-        for (int32_t c = 1; c < argc; c++) {
-            if (argv[c][0] == '-') {
-                if (argv[c][1] == 'i') {
-                    ifile.open(argv[c+1],std::ios::in|std::ios::binary);
-                    if ( !ifile.is_open() ) {
-                        std::cerr << "Could not open input file. '";
-                        std::cerr << argv[c+1];
-                        std::cerr << "'\n\n";
-                        return -1;
-                    }
-                    ifilename = argv[c+1];
-                } else if (argv[c][1] == 'o') {
-                    if ( argc < c+1 ) {
-                        std::cerr << "Missing output file name.\n\n";
-                        return -1;
-                    }
-                    ofile.open(argv[c+1],std::ios::out|std::ios::binary);
-                    if ( !ofile.is_open() ) {
-                        std::cerr << "Could not open output file. '";
-                        std::cerr << argv[c+1];
-                        std::cerr << "'\n\n";
-                        return -1;
-                    }
-                    ofilename = argv[c+1];
-                }
-            }
-        }
+struct LevelData
+{
+    int blocks_wide;
+    int blocks_high;
+    int output_size;        // what the section length says, pvrtc sized
+    std::vector<char> blocks;
+    int sections[ 4 ];
+    bool results[ 4 ];
+    bool corrupt[ 4 ];      // JPEG-XR sections that do not decode
+};
 
-        if ( !ifile.is_open() ) {
-            std::cerr << "No input file provided.\n";
-            goto printusage;
-        }
+bool decodeSection( const unsigned char * src, int version, const SectionTask & task, int block_size, LevelData & level, int i )
+{
+    int index = level.sections[ i ];
+    uint8_t * blocks = reinterpret_cast<uint8_t*>( level.blocks.data() );
 
-        if ( !ofile.is_open() ) {
-            std::cerr << "No output file provided.\n";
-            goto printusage;
-        }
+    if( task.jpegxr )
+    {
+        BlockTarget target = { blocks, block_size, task.top_offset, task.bottom_offset };
+        return decodeJpegXR(src, index, version, target, level.corrupt[ i ]);
+    }
 
-        std::cout << "Converting " << ifilename << " to " << ofilename << std::endl;
+    int block_count = level.blocks_wide * level.blocks_high;
+    int plane_size = block_count * task.field_size;
+    std::vector<char> plane( plane_size );
+
+    ATFFilterLayout layout = { level.blocks_wide, level.blocks_high, task.field_size, task.field_bits };
 
-        ifile.seekg(0,std::ios_base::end);
-        size_t filesize = ifile.tellg();
-        ifile.seekg(0,std::ios_base::beg);
+    int output_size = plane_size;
+    bool result = decodeData(src, index, version, layout, plane.data(), output_size);
 
-        uint8_t *src = new uint8_t [filesize];
-        ifile.read((char *)src,filesize);
+    if( output_size != plane_size )
+    {
+        std::cerr << "Issue with bits" << std::endl;
+        result = false;
+    }
+
+    scatterField(plane.data(), blocks, block_count, task.field_size, block_size, task.offset);
+    return result;
+}
+
+struct TransformOptions
+{
+    int keep_levels = 0;
+    int threads = 0;            // for the sections of one file
+    bool quiet = false;
+    int raw_alignment = 0;      // write the atfraw.h container, levels on this alignment
+};
 
-        int index{0};
+// What a worker keeps from one file to the next, grown to the largest
+// texture it has seen.
+struct TransformScratch
+{
+    std::vector<LevelData> levels;
 
-        if( src[ 0 ] == 1 )
+    size_t capacity() const
+    {
+        size_t bytes = 0;
+        for( const auto & level : levels )
         {
-            index += 5;
+            bytes += level.blocks.capacity();
         }
+        return bytes;
+    }
+};
+
+// Bytes of decoded blocks the files in flight may hold together. A file
+// that does not fit waits for others to finish, one file always runs.
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget( size_t limit ) : m_limit( limit ), m_used( 0 ) {}
+
+    void acquire( size_t bytes )
+    {
+        std::unique_lock<std::mutex> lock( m_lock );
+        m_changed.wait( lock, [&]() { return m_used == 0 || m_used + bytes <= m_limit; } );
+        m_used += bytes;
+    }
 
-        if( src[ index ] != 'A' || src[ index + 1 ] != 'T' || src[ index + 2 ] != 'F' )
+    void release( size_t bytes )
+    {
         {
-            std::cerr << "Invalid atf file";
-            goto printusage;
+            std::lock_guard<std::mutex> lock( m_lock );
+            m_used -= bytes;
         }
+        m_changed.notify_all();
+    }
+
+    size_t limit() const { return m_limit; }
+
+private:
+    size_t m_limit;
+    size_t m_used;
+    std::mutex m_lock;
+    std::condition_variable m_changed;
+};
+
+// Decoded block bytes of a file going by its header, what MemoryBudget
+// counts. 0 for anything that is not a compressed ATF.
+static size_t decodedSize( const uint8_t * src, size_t size, int keep_levels )
+{
+    size_t index = ( size > 0 && src[ 0 ] == 1 ) ? 5 : 0;
+    if( size < index + 16 || src[ index ] != 'A' || src[ index + 1 ] != 'T' || src[ index + 2 ] != 'F' )
+    {
+        return 0;
+    }
+    if( src[ index + 6 ] == 255 )
+    {
+        index += 6;
+    }
+    int format = src[ index + 6 ] & 0x8F;
+    if( format != ATF_FORMAT_COMPRESSED && format != ATF_FORMAT_COMPRESSEDALPHA )
+    {
+        return 0;
+    }
+    int count = src[ index + 9 ];
+    int first = keep_levels > 0 ? std::max(0, count - keep_levels) : 0;
+    size_t bytes = 0;
+    for( int level = first; level < count; ++level )
+    {
+        int w = ( 1 << src[ index + 7 ] ) >> level;
+        int h = ( 1 << src[ index + 8 ] ) >> level;
+        bytes += size_t( std::max(1,w/4) ) * std::max(1,h/4) * ( format == ATF_FORMAT_COMPRESSED ? 8 : 16 );
+    }
+    return bytes;
+}
+
+// Offset of the first section of level in atf, taken from the .atfidx next
+// to the input if there is one describing it; -1 otherwise. Like
+// ATFDecoder::scan_index, the header fields and the file length the header
+// gives (file_length) have to match the index exactly.
+static int indexedLevelOffset( const char * ifilename, const uint8_t * atf, size_t size, size_t file_length, int version, int format, int level_sections, int texture_count, int level )
+{
+    std::ifstream xfile( atf_index_path( ifilename ), std::ios::in | std::ios::binary );
+    if( !xfile.is_open() )
+    {
+        return -1;
+    }
+    std::vector<uint8_t> data( ( std::istreambuf_iterator<char>( xfile ) ), std::istreambuf_iterator<char>() );
+
+    ATFIndex atf_index;
+    if( !atf_index_read( data.data(), data.size(), atf_index ) || file_length > size ||
+        atf_index.fileLength != file_length || atf_index.version != version || atf_index.format != format ||
+        atf_index.sectionsPerLevel != level_sections || atf_index.count != texture_count )
+    {
+        return -1;
+    }
+
+    const ATFIndexSection * section = atf_index_section( atf_index, 0, level, 0 );
+    if( !section )
+    {
+        return -1;
+    }
+
+    // the length prefix in front of it has to agree, or the index is stale
+    int offset = section->offset - atf_index.prefixSize;
+    uint32_t length = 0;
+    for( int i = 0; i < atf_index.prefixSize; ++i )
+    {
+        length = ( length << 8 ) | atf[ offset + i ];
+    }
+    return length == section->length ? offset : -1;
+}
+
+// RGBA thumbnail of the input as a PAM image, decoded through ATFDecoder
+static int writeThumbnail( const uint8_t * src, size_t size, uint32_t max_side, std::ofstream & ofile, const char * ofilename )
+{
+    ATFDecoder decoder( src, size );
+    decoder.setPreview( previewMode );
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    const uint8_t * pixels = nullptr;
+
+    if( decoder.decode( ATFDecoder::PREFER_FALLBACK ) )
+    {
+        pixels = decoder.thumbnail( max_side, width, height );
+    }
+
+    if( !pixels )
+    {
+        std::cerr << "Could not decode a thumbnail" << std::endl;
+        ofile.close();
+        remove(ofilename);
+        return -1;
+    }
+
+    ofile << "P7\nWIDTH " << width << "\nHEIGHT " << height << "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+    ofile.write( reinterpret_cast<const char*>( pixels ), size_t( width ) * height * 4 );
+
+    std::cout << "Thumbnail " << width << "x" << height << " written" << std::endl;
+    return 0;
+}
 
-        int version = 0;
+// Writes the container of atfraw.h: header and level table, then the bytes
+// level_bytes( i ) gives for every entry i of the table, each on its
+// alignment. The table needs lengths and sizes, the offsets are set here.
+template <typename LevelBytes>
+static bool writeRawContainer( std::ofstream & ofile, ATFRawHeader & header, std::vector<ATFRawLevel> & table, LevelBytes level_bytes )
+{
+    if( !atf_raw_layout( header, table ) )
+    {
+        return false;
+    }
+
+    ATFTraceSpan span( "write container" );
+    std::vector<uint8_t> head;
+    atf_raw_write_header( header, table, head );
+    ofile.write( reinterpret_cast<const char*>( head.data() ), head.size() );
 
-        if( src[ index + 6 ] == 255 )
+    static const char zeros[ 4096 ] = {};
+    uint64_t position = head.size();
+    for( size_t i = 0; i < table.size(); ++i )
+    {
+        if( table[ i ].length == 0 )
         {
-            version = src[index + 7];
+            continue;
+        }
+        while( position < table[ i ].offset )
+        {
+            size_t padding = size_t( std::min<uint64_t>( sizeof( zeros ), table[ i ].offset - position ) );
+            ofile.write( zeros, padding );
+            position += padding;
+        }
+        const char * data = level_bytes( i );
+        if( !data )
+        {
+            return false;
+        }
+        ofile.write( data, table[ i ].length );
+        position += table[ i ].length;
+    }
+    return bool( ofile );
+}
+
+// The container for what the section pipeline does not handle, RGB files,
+// raw block files and cube maps: every level goes through ATFDecoder as DXT,
+// straight into the buffer it is written from.
+static int writeRawDecoded( const uint8_t * src, size_t size, std::ofstream & ofile, const char * ofilename,
+                            const TransformOptions & options )
+{
+    ATFTraceSpan span( "writeRawDecoded" );
+    ATFDecoder decoder( src, size );
+    decoder.setPreview( previewMode );
+
+    if( !decoder.decode( ATFDecoder::PREFER_DXT1 ) || decoder.IsEmpty() || size < 16 )
+    {
+        std::cerr << "Could not decode the file for the container" << std::endl;
+        ofile.close();
+        remove(ofilename);
+        return -1;
+    }
 
-            index += 6;
+    int format = decoder.Format() & 0x7F;
+    bool alpha = format == ATF_FORMAT_8888 || format == ATF_FORMAT_COMPRESSEDALPHA || format == ATF_FORMAT_COMPRESSEDRAWALPHA;
+    int count = decoder.Count();
+    int first = options.keep_levels > 0 ? std::max(0, count - options.keep_levels) : 0;
+
+    // log2 of the size follows the format byte
+    int header_end = src[ 6 ] == 255 ? 12 : 6;
+    uint32_t width = 1u << src[ header_end + 1 ];
+    uint32_t height = 1u << src[ header_end + 2 ];
+
+    ATFRawHeader header = {};
+    header.format = format == ATF_FORMAT_888 ? ATF_RAW_RGB888 : format == ATF_FORMAT_8888 ? ATF_RAW_RGBA8888 :
+                    alpha ? ATF_RAW_DXT5 : ATF_RAW_DXT1;
+    header.width = std::max(1u, width >> first);
+    header.height = std::max(1u, height >> first);
+    header.levels = count - first;
+    header.faces = decoder.IsCubeMap() ? 6 : 1;
+    header.alignment = options.raw_alignment;
+
+    std::vector<ATFRawLevel> table;
+    for( uint32_t face = 0; face < header.faces; ++face )
+    {
+        for( int level = first; level < count; ++level )
+        {
+            ATFRawLevel entry = {};
+            entry.width = std::max(1u, width >> level);
+            entry.height = std::max(1u, height >> level);
+            if( decoder.LevelAvailable( level ) )
+            {
+                entry.length = decoder.texDataLen( level );
+                entry.rows = decoder.texDataRows( level );
+                entry.rowPitch = entry.rows ? uint32_t( entry.length / entry.rows ) : 0;
+            }
+            table.push_back( entry );
         }
+    }
 
-        int size;
+    std::vector<uint8_t> buffer;
+    bool result = writeRawContainer( ofile, header, table, [&]( size_t i ) -> const char *
+    {
+        buffer.resize( table[ i ].length );
+        uint32_t face = uint32_t( i / header.levels );
+        uint32_t level = uint32_t( first + i % header.levels );
+        ATFTraceSpan level_span( "decodeLevel", "level", int( level ) );
+        return decoder.decodeLevel( level, face, buffer.data() ) ? reinterpret_cast<const char*>( buffer.data() ) : nullptr;
+    } );
+
+    if( !result )
+    {
+        std::cerr << "Could not write the container" << std::endl;
+        ofile.close();
+        remove(ofilename);
+        return -1;
+    }
+    if( !options.quiet )
+    {
+        std::cout << "Conversion succeeded" << std::endl;
+    }
+    return 0;
+}
+
+// Converts one ATF file in memory to ofile. -2 if it is not an ATF file at
+// all, -1 on other errors (ofile is removed then).
+static int transformFile( const uint8_t * src, size_t filesize, const char * ifilename, std::ofstream & ofile, const char * ofilename,
+                          const TransformOptions & options, TransformScratch & scratch )
+{
+    ATFTraceSpan span( "transformFile" );
+    int index{0};
+
+    if( filesize > 0 && src[ 0 ] == 1 )
+    {
+        index += 5;
+    }
+
+    int atf_start = index;
 
-        if( version == 0 )
+    if( filesize < size_t( index ) + 10 || src[ index ] != 'A' || src[ index + 1 ] != 'T' || src[ index + 2 ] != 'F' )
+    {
+        std::cerr << "Invalid atf file";
+        return -2;
+    }
+
+    int version = 0;
+
+    if( src[ index + 6 ] == 255 )
+    {
+        if( filesize < size_t( index ) + 16 )
         {
-            size = ( src[ index + 3 ] << 16 ) + ( src[ index + 4 ] << 8 ) + src[ index + 5 ];
+            std::cerr << "Invalid atf file";
+            return -2;
         }
-        else
+
+        version = src[index + 7];
+
+        index += 6;
+    }
+
+    int size;
+
+    if( version == 0 )
+    {
+        size = ( src[ index + 3 ] << 16 ) + ( src[ index + 4 ] << 8 ) + src[ index + 5 ];
+    }
+    else
+    {
+        size = ( src[ index + 2 ] << 24 ) + ( src[ index + 3 ] << 16 ) + ( src[ index + 4 ] << 8 ) + src[ index + 5 ];
+    }
+
+    int format = src[ index + 6 ];
+    int cube = format >> 7;
+    format &= 0x8F;
+
+    bool raw = options.raw_alignment > 0;
+
+    if( raw && ( cube || ( format != ATF_FORMAT_COMPRESSED && format != ATF_FORMAT_COMPRESSEDALPHA ) ) )
+    {
+        return writeRawDecoded( src + atf_start, filesize - atf_start, ofile, ofilename, options );
+    }
+
+    if(cube)
+    {
+        std::cerr << "Cube is not supported yet" << std::endl;
+        ofile.close();
+        remove(ofilename);
+        return -1;
+    }
+
+    if( format != ATF_FORMAT_COMPRESSED && format != ATF_FORMAT_COMPRESSEDALPHA )
+    {
+        if( !options.quiet )
         {
-            size = ( src[ index + 2 ] << 24 ) + ( src[ index + 3 ] << 16 ) + ( src[ index + 4 ] << 8 ) + src[ index + 5 ];
+            std::cerr << "Not a compressed format, just copying" << std::endl;
         }
+        ofile.seekp(0, std::ios_base::beg);
+        ofile.write(reinterpret_cast<const char*>(src), filesize);
+        return 0;
+    }
 
+    if( !raw )
+    {
         ofile.put('A');
         ofile.put('T');
         ofile.put('F');
@@ -268,26 +698,6 @@ int main(int argc, char *argv[]) {
         ofile.put(uint8_t(0));
         ofile.put(uint8_t(0));
 
-        int format = src[ index + 6 ];
-        int cube = format >> 7;
-        format &= 0x8F;
-
-        if(cube)
-        {
-            std::cerr << "Cube is not supported yet" << std::endl;
-            ofile.close();
-            remove(ofilename);
-            return -1;
-        }
-
-        if( format != ATF_FORMAT_COMPRESSED && format != ATF_FORMAT_COMPRESSEDALPHA )
-        {
-            std::cerr << "Not a compressed format, just copying" << std::endl;
-            ofile.seekp(0, std::ios_base::beg);
-            ofile.write(reinterpret_cast<char*>(src), filesize);
-            return 0;
-        }
-
         switch( format )
         {
             case ATF_FORMAT_COMPRESSED: ofile.put(uint8_t(ATF_FORMAT_COMPRESSEDRAW));break;
@@ -300,216 +710,471 @@ int main(int argc, char *argv[]) {
                 return -1;
             }
         }
+    }
 
-        int width = 1 << src[ index + 7 ];
-        int height = 1 << src[ index + 8 ];
-        int texture_count = src[ index + 9 ];
+    int width = 1 << src[ index + 7 ];
+    int height = 1 << src[ index + 8 ];
+    int texture_count = src[ index + 9 ];
 
-        ofile.put(src[index + 7]);
-        ofile.put(src[index + 8]);
-        ofile.put(src[index + 9]);
+    // the largest levels are skipped without being decoded
+    int skip_levels = options.keep_levels > 0 ? std::max(0, texture_count - options.keep_levels) : 0;
 
-        index += 10;
+    if( !raw )
+    {
+        ofile.put(uint8_t(std::max(0, src[index + 7] - skip_levels)));
+        ofile.put(uint8_t(std::max(0, src[index + 8] - skip_levels)));
+        ofile.put(uint8_t(texture_count - skip_levels));
+    }
+
+    index += 10;
 
-        int texture_index = 0;
+    int texture_index = 0;
 
-        int current_width = width;
-        int current_height = height;
+    int current_width = width;
+    int current_height = height;
 
-        auto * dest = new char[ current_width * current_height * 8 ];
+    int level_sections = ( format == ATF_FORMAT_COMPRESSED ? 2 : 4 ) + ( version == 3 && format == ATF_FORMAT_COMPRESSEDALPHA ? 12 : 6 );
 
-        char * dest_alpha = nullptr;
+    int level_offset = skip_levels > 0 ? indexedLevelOffset( ifilename, src + atf_start, filesize - atf_start,
+                                                              size_t( size ) + ( version == 0 ? 6 : 12 ), version, format, level_sections, texture_count, skip_levels ) : -1;
+
+    if( level_offset >= 0 )
+    {
+        index = atf_start + level_offset;
+        texture_index = skip_levels;
+        current_width >>= skip_levels;
+        current_height >>= skip_levels;
+    }
 
-        if( format == 4 )
+    for( ; texture_index < skip_levels; ++texture_index )
+    {
+        for( int i = 0; i < level_sections; ++i )
         {
-            dest_alpha = new char[ current_width * current_height * 4 ];
+            if( !skipSection(src, filesize, index, version) )
+            {
+                std::cerr << "Truncated atf file" << std::endl;
+                ofile.close();
+                remove(ofilename);
+                return -1;
+            }
         }
+        current_width >>= 1;
+        current_height >>= 1;
+    }
+
+    // first pass: where the LZMA and JPEG-XR sections of every level are
+    const SectionTask * tasks = format == ATF_FORMAT_COMPRESSED ? dxt1Tasks : dxt5Tasks;
+    int task_count = format == ATF_FORMAT_COMPRESSED ? 2 : 4;
+    int block_size = format == ATF_FORMAT_COMPRESSED ? 8 : 16;
+    int skip_image_count = level_sections - task_count;
 
-        while(texture_index < texture_count)
+    // kept from file to file, so the blocks only grow
+    std::vector<LevelData> & levels = scratch.levels;
+    size_t level_count = texture_count - texture_index;
+    if( levels.size() < level_count )
+    {
+        levels.resize( level_count );
+    }
+    for( size_t l = 0; l < level_count; ++l )
+    {
+        LevelData & level = levels[ l ];
+        level.blocks_wide = std::max(1,current_width/4);
+        level.blocks_high = std::max(1,current_height/4);
+        level.output_size = std::max(2,current_width/4)*std::max(2,current_height/4) * block_size;
+        level.blocks.assign( size_t( level.blocks_wide ) * level.blocks_high * block_size, 0 );
+        for( int i = 0; i < level_sections; ++i )
         {
-            /*
-            if( (index + source_size) > (size + 6 ) )
+            if( i < task_count )
+            {
+                level.sections[ i ] = index;
+                level.corrupt[ i ] = false;
+            }
+            if( !skipSection(src, filesize, index, version) )
             {
-                std::cerr << "Error reading, wrong size" << std::endl;
+                std::cerr << "Truncated atf file" << std::endl;
                 ofile.close();
                 remove(ofilename);
-
                 return -1;
             }
-            */
+        }
+        current_width >>= 1;
+        current_height >>= 1;
+    }
 
-            int skip_image_count;
+    // every section decodes on its own into its fields of the level's blocks
+    std::atomic<size_t> next_task{0};
+    auto worker = [&]()
+    {
+        ATFAllocatorScope scope(ATFPoolAllocator::threadLocal());
+        for( size_t t = next_task++; t < level_count * task_count; t = next_task++ )
+        {
+            LevelData & level = levels[ t / task_count ];
+            ATFTraceSpan span( tasks[ t % task_count ].jpegxr ? "jpegxr section" : "lzma section", "level", int( t / task_count ) );
+            level.results[ t % task_count ] = decodeSection( src, version, tasks[ t % task_count ], block_size, level, t % task_count );
+        }
+    };
+
+    int thread_count = options.threads > 0 ? options.threads : std::max(1, int(std::thread::hardware_concurrency()));
+    thread_count = std::min(thread_count, int(level_count) * task_count);
+    std::vector<std::thread> workers;
+    for( int i = 1; i < thread_count; ++i )
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for( auto & thread : workers )
+    {
+        thread.join();
+    }
 
-            if( format == 2 )
+    for( size_t l = 0; l < level_count; ++l )
+    {
+        const LevelData & level = levels[ l ];
+        if( std::find( level.corrupt, level.corrupt + task_count, true ) != level.corrupt + task_count )
+        {
+            std::cerr << "JPEG-XR decoding error in level " << l << std::endl;
+            ofile.close();
+            remove(ofilename);
+            return -1;
+        }
+    }
+
+    if( raw )
+    {
+        ATFRawHeader header = {};
+        header.format = format == ATF_FORMAT_COMPRESSED ? ATF_RAW_DXT1 : ATF_RAW_DXT5;
+        header.width = std::max(1, width >> skip_levels);
+        header.height = std::max(1, height >> skip_levels);
+        header.levels = uint32_t( level_count );
+        header.faces = 1;
+        header.alignment = options.raw_alignment;
+
+        // a level that failed to decode is left out, as ATFDecoder reports it
+        std::vector<ATFRawLevel> table( level_count );
+        for( size_t l = 0; l < level_count; ++l )
+        {
+            const LevelData & level = levels[ l ];
+            ATFRawLevel & entry = table[ l ];
+            entry = ATFRawLevel();
+            entry.width = std::max(1, width >> ( skip_levels + l ));
+            entry.height = std::max(1, height >> ( skip_levels + l ));
+            if( level.results[ task_count - 2 ] || level.results[ task_count - 1 ] )
             {
-                int block_count = std::max(1,current_width/4)*std::max(1,current_height/4);
+                entry.length = level.blocks.size();
+                entry.rows = level.blocks_high;
+                entry.rowPitch = level.blocks_wide * block_size;
+            }
+        }
 
-                int color_base_size = block_count * 2 * 2; //16 bit, 2 color per block
-                int color_bit_size = block_count * 4; // 4 bytes of interpolation
+        if( !writeRawContainer( ofile, header, table, [&]( size_t l ) { return levels[ l ].blocks.data(); } ) )
+        {
+            std::cerr << "Could not write the container" << std::endl;
+            ofile.close();
+            remove(ofilename);
+            return -1;
+        }
+        if( !options.quiet )
+        {
+            std::cout << "Conversion succeeded" << std::endl;
+        }
+        return 0;
+    }
 
-                uint32_t * bits = reinterpret_cast<uint32_t*>( dest );
+    // and the levels go out in order
+    ATFTraceSpan write_span( "write output" );
+    for( size_t l = 0; l < level_count; ++l )
+    {
+        const LevelData & level = levels[ l ];
+        // the color sections decide, a broken alpha image is written anyway
+        bool result = level.results[ task_count - 2 ] || level.results[ task_count - 1 ];
 
-                uint16_t *cl0 = reinterpret_cast<uint16_t*>( bits + color_bit_size );
-                uint16_t *cl1 = cl0 + (color_base_size / 4);
+        if( result )
+        {
+            ofile.put( uint8_t( level.output_size >> 16 ) );
+            ofile.put( uint8_t( level.output_size >> 8 ) );
+            ofile.put( uint8_t( level.output_size ) );
 
-                int output_size = color_bit_size;
-                bool result = decodeData(reinterpret_cast<unsigned char*>(src), index, version, reinterpret_cast<char*>(bits), output_size);
+            ofile.write(level.blocks.data(), level.blocks.size());
+        }
+        else
+        {
+            ofile.put(uint8_t(0));
+            ofile.put(uint8_t(0));
+            ofile.put(uint8_t(0));
+            ofile.put(uint8_t(0));
+            ofile.put(uint8_t(0));
+            ofile.put(uint8_t(0));
+        }
 
-                if( output_size != color_bit_size )
-                {
-                    std::cerr << "Issue with bits" << std::endl;
-                    result = false;
-                }
+        for( int i = 0; i< skip_image_count; ++i) //Skip other format (only dxt1)
+        {
+            ofile.put(uint8_t(0));
+            ofile.put(uint8_t(0));
+            ofile.put(uint8_t(0));
+        }
+    }
 
-                result |= decodeJpegXR(reinterpret_cast<unsigned char*>(src), index, version, reinterpret_cast<char*>(cl0) );
+    auto total_size = ofile.tellp();
 
-                if( result )
-                {
-                    output_size = std::max(2,current_width/4)*std::max(2,current_height/4) * 8;
-                    ofile.put( uint8_t( output_size >> 16 ) );
-                    ofile.put( uint8_t( output_size >> 8 ) );
-                    ofile.put( uint8_t( output_size ) );
+    ofile.seekp( 3, std::ios_base::beg );
+    ofile.put( uint8_t( total_size >> 16 ) );
+    ofile.put( uint8_t( total_size >> 8 ) );
+    ofile.put( uint8_t( total_size ) );
 
-                    for( int i = 0; i < block_count; ++i )
-                    {
-                        ofile.write(reinterpret_cast<char*>(cl0 + i), 2);
-                        ofile.write(reinterpret_cast<char*>(cl1 + i), 2);
-                        ofile.write(reinterpret_cast<char*>(bits + i), 4);
-                    }
-                }
-                else
-                {
-                    ofile.put(uint8_t(0));
-                    ofile.put(uint8_t(0));
-                    ofile.put(uint8_t(0));
-                    ofile.put(uint8_t(0));
-                    ofile.put(uint8_t(0));
-                    ofile.put(uint8_t(0));
-                }
+    if( !options.quiet )
+    {
+        std::cout << "Conversion succeeded" << std::endl;
+    }
+    return 0;
+}
 
-                skip_image_count = 6;
-            }
-            else if( format == 4 )
+// Inputs of a batch and where their outputs go. A directory is searched for
+// .atf files, the tree is recreated under output_dir. Anything else is a
+// list of paths, one per line, that end up at the same path under
+// output_dir.
+static bool collectBatch( const std::string & batch, const std::string & output_dir,
+                          std::vector<std::pair<std::string, std::string>> & files )
+{
+    namespace fs = std::filesystem;
+    std::error_code error;
+    if( fs::is_directory( batch, error ) )
+    {
+        for( fs::recursive_directory_iterator it( batch, error ), end; !error && it != end; it.increment( error ) )
+        {
+            if( it->is_regular_file( error ) && it->path().extension() == ".atf" )
             {
-                int block_count = std::max(1,current_width/4)*std::max(1,current_height/4);
+                fs::path relative = fs::relative( it->path(), batch, error );
+                files.emplace_back( it->path().string(), ( fs::path( output_dir ) / relative ).string() );
+            }
+        }
+        std::sort( files.begin(), files.end() );
+        return !error;
+    }
 
-                int alpha_base_size = block_count * 2; // 2 alpha byte (a0, a1)
-                int alpha_bit_size = block_count * 6; // 3bit of interpolation per pixel
-                int color_base_size = block_count * 2 * 2; //16 bit, 2 color per block
-                int color_bit_size = block_count * 4; // 4 bytes of interpolation
+    std::ifstream list( batch );
+    if( !list.is_open() )
+    {
+        return false;
+    }
+    std::string line;
+    while( std::getline( list, line ) )
+    {
+        if( !line.empty() && line.back() == '\r' )
+        {
+            line.pop_back();
+        }
+        if( !line.empty() )
+        {
+            files.emplace_back( line, ( fs::path( output_dir ) / fs::path( line ).relative_path() ).string() );
+        }
+    }
+    return true;
+}
 
-                auto bits = reinterpret_cast<uint32_t*>( dest );
-                uint16_t *cl0 = reinterpret_cast<uint16_t*>( dest + color_bit_size );
-                uint16_t *cl1 = cl0 + block_count;
+// Converts every file of the batch on a pool of workers, each with its own
+// scratch, holding at most budget bytes of decoded blocks between them.
+static int transformBatch( const std::vector<std::pair<std::string, std::string>> & files, const TransformOptions & file_options,
+                           int threads, size_t budget )
+{
+    TransformOptions options = file_options;
+    options.threads = 1;                // the pool works on files, not sections
+    options.quiet = true;
 
-                auto alpha_bits = reinterpret_cast<uint8_t*>( dest_alpha );
-                uint8_t *a0 = reinterpret_cast<uint8_t*>( alpha_bits + alpha_bit_size );
-                uint8_t *a1 = a0 + block_count;
+    MemoryBudget memory( budget );
+    std::atomic<size_t> next_file{0};
+    std::atomic<size_t> failed{0};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    std::mutex log_lock;
 
-                //Alpha
-                int output_size = alpha_bit_size;
-                bool result = decodeData(reinterpret_cast<unsigned char*>(src), index, version, reinterpret_cast<char*>(alpha_bits), output_size);
+    auto start = std::chrono::steady_clock::now();
 
-                if( output_size != alpha_bit_size )
+    auto worker = [&]()
+    {
+        ATFAllocatorScope scope(ATFPoolAllocator::threadLocal());
+        TransformScratch scratch;
+        ATFMappedFile input;
+        for( size_t f = next_file++; f < files.size(); f = next_file++ )
+        {
+            const char * ifilename = files[ f ].first.c_str();
+            const char * ofilename = files[ f ].second.c_str();
+
+            int result = -1;
+            std::error_code error;
+            std::filesystem::create_directories( std::filesystem::path( ofilename ).parent_path(), error );
+            if( input.open( ifilename ) )
+            {
+                size_t bytes = decodedSize( input.data(), input.size(), options.keep_levels );
+                memory.acquire( bytes );
+                std::ofstream ofile( ofilename, std::ios::out | std::ios::binary );
+                if( ofile.is_open() )
                 {
-                    std::cerr << "Issue with bits" << std::endl;
-                    result = false;
+                    result = transformFile( input.data(), input.size(), ifilename, ofile, ofilename, options, scratch );
+                    bytes_in += input.size();
+                    bytes_out += uint64_t( ofile.tellp() );
                 }
+                memory.release( bytes );
 
-                result |= decodeJpegXR(reinterpret_cast<unsigned char*>(src), index, version, reinterpret_cast<char*>(a0) );
-
-                //Color
-                output_size = color_bit_size;
-                result = decodeData(reinterpret_cast<unsigned char*>(src), index, version, reinterpret_cast<char*>(bits), output_size);
-
-                if( output_size != color_bit_size )
+                // keep no more than a fair share of the budget between files
+                if( scratch.capacity() > memory.limit() / threads )
                 {
-                    std::cerr << "Issue with bits" << std::endl;
-                    result = false;
+                    scratch.levels.clear();
+                    scratch.levels.shrink_to_fit();
                 }
+            }
+            input.close();
 
-                output_size = color_base_size;
-                result |= decodeJpegXR(reinterpret_cast<unsigned char*>(src), index, version, reinterpret_cast<char*>(cl0) );
+            if( result != 0 )
+            {
+                failed++;
+                remove( ofilename );
+                std::lock_guard<std::mutex> lock( log_lock );
+                std::cerr << "\nFailed to convert '" << ifilename << "'" << std::endl;
+            }
+        }
+    };
 
-                if( output_size != color_base_size )
-                {
-                    std::cerr << "Issue with color" << std::endl;
-                    result = false;
-                }
+    threads = std::max(1, std::min(threads, int(files.size())));
+    std::vector<std::thread> workers;
+    for( int i = 1; i < threads; ++i )
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for( auto & thread : workers )
+    {
+        thread.join();
+    }
 
-                if( result )
-                {
-                    output_size = std::max(2,current_width/4)*std::max(2,current_height/4) * 16;
-                    ofile.put( uint8_t( output_size >> 16 ) );
-                    ofile.put( uint8_t( output_size >> 8 ) );
-                    ofile.put( uint8_t( output_size ) );
+    double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    double mb = 1024.0 * 1024.0;
+    std::cout << ( files.size() - failed ) << " of " << files.size() << " files converted, "
+              << ( bytes_in / mb ) << " MB in, " << ( bytes_out / mb ) << " MB out in " << seconds << " s ("
+              << ( bytes_in / mb / std::max(seconds, 1e-9) ) << " MB/s) on " << threads << " threads" << std::endl;
+    return failed ? -1 : 0;
+}
 
-                    for( int i = 0; i < block_count; ++i )
-                    {
-                        ofile.put(a0[i]);
-                        ofile.put(a1[i]);
-                        ofile.write(reinterpret_cast<char*>( &alpha_bits[ i * 6 ] ), 6 );
-                        ofile.write(reinterpret_cast<char*>(cl0 + i), 2);
-                        ofile.write(reinterpret_cast<char*>(cl1 + i), 2);
-                        ofile.write(reinterpret_cast<char*>(bits + i), 4);
+int main(int argc, char *argv[]) {
+
+    atf_install_allocator_hooks();
+    ATFAllocatorScope allocScope(ATFPoolAllocator::threadLocal());
+
+    TransformOptions options;
+    int thumbnail_size = 0;
+    int memory_mb = 512;
+    const char * ifilename = nullptr;
+    const char * ofilename = nullptr;
+    const char * batch = nullptr;
+    bool raw = false;
+    int alignment = 256;
+    const char * trace = nullptr;
+
+    if ( argc > 1) {
+        for (int32_t c = 1; c < argc; c++) {
+            if (argv[c][0] == '-') {
+                if (strcmp(argv[c], "--trace") == 0 && c + 1 < argc) {
+                    trace = argv[++c];
+                } else if (argv[c][1] == 'i' && c + 1 < argc) {
+                    ifilename = argv[c+1];
+                } else if (argv[c][1] == 'o') {
+                    if ( argc < c+1 ) {
+                        std::cerr << "Missing output file name.\n\n";
+                        return -1;
                     }
+                    ofilename = argv[c+1];
+                } else if (argv[c][1] == 'b' && c + 1 < argc) {
+                    batch = argv[c+1];
+                } else if (argv[c][1] == 'p') {
+                    previewMode = true;
+                } else if (argv[c][1] == 'l' && c + 1 < argc) {
+                    options.keep_levels = std::max(1, atoi(argv[c+1]));
+                } else if (argv[c][1] == 't' && c + 1 < argc) {
+                    thumbnail_size = std::max(1, atoi(argv[c+1]));
+                } else if (argv[c][1] == 'j' && c + 1 < argc) {
+                    options.threads = std::max(1, atoi(argv[c+1]));
+                } else if (argv[c][1] == 'm' && c + 1 < argc) {
+                    memory_mb = std::max(1, atoi(argv[c+1]));
+                } else if (argv[c][1] == 'r') {
+                    raw = true;
+                } else if (argv[c][1] == 'a' && c + 1 < argc) {
+                    alignment = atoi(argv[c+1]);
                 }
-                else
-                {
-                    ofile.put(uint8_t(0));
-                    ofile.put(uint8_t(0));
-                    ofile.put(uint8_t(0));
-                    ofile.put(uint8_t(0));
-                    ofile.put(uint8_t(0));
-                    ofile.put(uint8_t(0));
-                }
+            }
+        }
 
-                if( version == 3 )
-                {
-                    skip_image_count = 12;
-                }
-                else
-                {
-                    skip_image_count = 6;
-                }
+        ATFTraceSession session( trace );
+
+        if ( raw ) {
+            if ( alignment <= 0 || ( alignment & ( alignment - 1 ) ) != 0 ) {
+                std::cerr << "The alignment has to be a power of two.\n\n";
+                return -1;
             }
+            options.raw_alignment = alignment;
+        }
 
-            for( int i = 0; i< skip_image_count; ++i) //Skip other format (only dxt1)
-            {
-                int source_size_2;
-                if( version != 0 )
-                {
-                    source_size_2 = ( src[ index ] << 24 ) + ( src[ index + 1 ] << 16 ) + ( src[ index + 2 ] << 8 ) + src[ index + 3 ];
-                    index += 4 + source_size_2;
-                }
-                else
-                {
-                    source_size_2 = ( src[ index ] << 16 ) + ( src[ index + 1 ] << 8 ) + src[ index + 2 ];
-                    index += 3 + source_size_2;
+        if ( batch ) {
+            if ( !ofilename ) {
+                std::cerr << "No output directory provided.\n";
+                goto printusage;
+            }
+            std::vector<std::pair<std::string, std::string>> files;
+            if ( !collectBatch( batch, ofilename, files ) ) {
+                std::cerr << "Could not read batch '" << batch << "'\n\n";
+                return -1;
+            }
+            if ( raw ) {
+                for ( auto & file : files ) {
+                    file.second = std::filesystem::path( file.second ).replace_extension( ".atfr" ).string();
                 }
+            }
+            int threads = options.threads > 0 ? options.threads : std::max(1, int(std::thread::hardware_concurrency()));
+            return transformBatch( files, options, threads, size_t( memory_mb ) * 1024 * 1024 );
+        }
+
+        ATFMappedFile input;
+        if ( ifilename && !input.open( ifilename ) ) {
+            std::cerr << "Could not open input file. '";
+            std::cerr << ifilename;
+            std::cerr << "'\n\n";
+            return -1;
+        }
 
+        if ( !ifilename ) {
+            std::cerr << "No input file provided.\n";
+            goto printusage;
+        }
 
-                ofile.put(uint8_t(0));
-                ofile.put(uint8_t(0));
-                ofile.put(uint8_t(0));
-            }
+        if ( !ofilename ) {
+            std::cerr << "No output file provided.\n";
+            goto printusage;
+        }
 
-            ++texture_index;
-            current_width >>= 1;
-            current_height >>= 1;
+        std::ofstream ofile(ofilename,std::ios::out|std::ios::binary);
+        if ( !ofile.is_open() ) {
+            std::cerr << "Could not open output file. '";
+            std::cerr << ofilename;
+            std::cerr << "'\n\n";
+            return -1;
         }
 
-        delete[] dest;
+        std::cout << "Converting " << ifilename << " to " << ofilename << std::endl;
 
-        auto total_size = ofile.tellp();
+        const uint8_t * src = input.data();
+        size_t filesize = input.size();
 
-        ofile.seekp( 3, std::ios_base::beg );
-        ofile.put( uint8_t( total_size >> 16 ) );
-        ofile.put( uint8_t( total_size >> 8 ) );
-        ofile.put( uint8_t( total_size ) );
+        if( thumbnail_size > 0 )
+        {
+            size_t atf_start = ( filesize > 0 && src[ 0 ] == 1 ) ? 5 : 0;
+            return writeThumbnail( src + atf_start, filesize - std::min(filesize, atf_start), thumbnail_size, ofile, ofilename );
+        }
 
-        std::cout << "Conversion succeeded" << std::endl;
-        return 0;
+        TransformScratch scratch;
+        int result = transformFile( src, filesize, ifilename, ofile, ofilename, options, scratch );
+        if( result == -2 )
+        {
+            goto printusage;
+        }
+        return result;
     }
 printusage:
     print_usage();
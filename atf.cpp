@@ -0,0 +1,965 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "atf.h"
+#include "atfalloc.h"
+#include "atfblock.h"
+#include "atffilter.h"
+#include "atfindex.h"
+
+extern "C" {
+#include "3rdparty/lzma/LzmaDec.h"
+}
+
+using namespace std;
+
+namespace {
+
+const int32_t kMaxLevels = 16;
+
+uint32_t get_u16(const uint8_t *src) {
+	return src[0] | (src[1]<<8);
+}
+
+void put_u16(uint8_t *dst, uint32_t v) {
+	dst[0] = uint8_t(v);
+	dst[1] = uint8_t(v>>8);
+}
+
+}
+
+ATFDecoder::ATFDecoder(const uint8_t *data, size_t dataLen, bool viewerMode)
+	: m_alpha(false)
+	, m_mode(PREFER_DXT1)
+	, m_platform(PREFER_DXT1)
+	, m_threads(0)
+	, m_preview(false)
+	, m_texLen(0)
+	, m_tex(0)
+	, m_format(0)
+	, m_version(0)
+	, m_count(0)
+	, m_width(0)
+	, m_height(0)
+	, m_cubeMap(false)
+	, m_src(data)
+	, m_dst(0)
+	, m_dstPitch(0)
+	, m_tmp(0)
+	, m_tmpLen(0)
+	, m_blocks(0)
+	, m_blocksLen(0)
+	, m_thumbnail(0)
+	, m_index(0)
+	, m_indexed(false)
+	, m_data(data)
+	, m_dataLen(dataLen)
+	, m_fileLen(0)
+	, m_viewerMode(viewerMode)
+	, m_truncated(false)
+	, m_faceLen(0)
+	, m_imageTarget(IMAGE_PIXELS)
+	, m_imageWidth(0)
+	, m_imageHeight(0)
+	, m_imageBlockSize(0)
+	, m_imageOffset(0)
+{
+	for ( int32_t c=0; c<kMaxLevels; c++ ) {
+		m_levelEmpty[c] = true;
+		m_levelOffset[c] = 0;
+		m_levelLen[c] = 0;
+		m_levelRows[c] = 1;
+	}
+	memset(m_levelSrc,0,sizeof(m_levelSrc));
+	memset(m_levelState,LEVEL_EMPTY,sizeof(m_levelState));
+}
+
+ATFDecoder::~ATFDecoder()
+{
+	delete [] m_tex;
+	delete [] m_tmp;
+	delete [] m_blocks;
+	delete [] m_thumbnail;
+	delete m_index;
+}
+
+const PVR_HEADER *ATFDecoder::tex()
+{
+	for ( int32_t i=0; i<(m_cubeMap?6:1); i++ ) {
+		for ( int32_t c=0; c<m_count; c++ ) {
+			texData(c,i);
+		}
+	}
+	return (const PVR_HEADER *)m_tex;
+}
+
+uint8_t *ATFDecoder::texData(uint32_t level, uint32_t side)
+{
+	if ( !m_tex || level >= uint32_t(m_count) || side >= uint32_t(m_cubeMap ? 6 : 1) ) {
+		return 0;
+	}
+	switch ( m_levelState[side][level] ) {
+		case LEVEL_PENDING:
+			m_levelState[side][level] = decodeLevel(level,side,level_data(level,side)) ? LEVEL_DECODED : LEVEL_FAILED;
+			return m_levelState[side][level] == LEVEL_DECODED ? level_data(level,side) : 0;
+		case LEVEL_DECODED:
+			return level_data(level,side);
+		default:
+			return 0;
+	}
+}
+
+const uint8_t *ATFDecoder::thumbnail(uint32_t maxSide, uint32_t &width, uint32_t &height)
+{
+	bool rgb = m_format == ATF_FORMAT_888;
+	if ( m_count < 1 || ( m_format > ATF_FORMAT_8888 && m_mode != PREFER_FALLBACK ) ) {
+		return 0;
+	}
+
+	int32_t level = -1;
+	for ( int32_t c=0; c<m_count; c++ ) {
+		if ( !LevelAvailable(c) ) {
+			continue;
+		}
+		level = c;
+		if ( uint32_t(max(1,m_width>>c)) <= maxSide && uint32_t(max(1,m_height>>c)) <= maxSide ) {
+			break;
+		}
+	}
+
+	const uint8_t *pixels = level >= 0 ? texData(level) : 0;
+	if ( !pixels ) {
+		return 0;
+	}
+	uint32_t levelWidth = max(1,m_width>>level);
+	uint32_t levelHeight = max(1,m_height>>level);
+	// no level fits: box filter the smallest one down by a whole factor
+	uint32_t factor = ( max(levelWidth,levelHeight) + max(1u,maxSide) - 1 ) / max(1u,maxSide);
+	if ( !rgb && factor <= 1 ) {
+		width = levelWidth;
+		height = levelHeight;
+		return pixels;
+	}
+
+	width = max(1u,levelWidth/factor);
+	height = max(1u,levelHeight/factor);
+	uint32_t channels = rgb ? 3 : 4;
+	delete [] m_thumbnail;
+	m_thumbnail = new uint8_t[width*height*4];
+	for ( uint32_t y=0; y<height; y++ ) {
+		for ( uint32_t x=0; x<width; x++ ) {
+			uint32_t sum[4] = { 0, 0, 0, 0 };
+			uint32_t count = 0;
+			for ( uint32_t sy=y*factor; sy<min(levelHeight,(y+1)*factor); sy++ ) {
+				for ( uint32_t sx=x*factor; sx<min(levelWidth,(x+1)*factor); sx++ ) {
+					const uint8_t *p = pixels + ( size_t(sy)*levelWidth + sx ) * channels;
+					for ( uint32_t c=0; c<channels; c++ ) {
+						sum[c] += p[c];
+					}
+					count++;
+				}
+			}
+			uint8_t *out = m_thumbnail + ( size_t(y)*width + x ) * 4;
+			for ( uint32_t c=0; c<4; c++ ) {
+				out[c] = c < channels ? uint8_t(( sum[c] + count/2 ) / count) : 0xFF;
+			}
+		}
+	}
+	return m_thumbnail;
+}
+
+uint8_t *ATFDecoder::level_data(uint32_t level, uint32_t side)
+{
+	return m_tex + sizeof(PVR_HEADER) + m_faceLen*side + m_levelOffset[level];
+}
+
+bool ATFDecoder::read_header()
+{
+	m_src = m_data;
+	if ( !check_buffer_read(10) || m_data[0] != 'A' || m_data[1] != 'T' || m_data[2] != 'F' ) {
+		return false;
+	}
+
+	if ( m_data[6] == 0xFF ) {
+		if ( !check_buffer_read(16) ) {
+			return false;
+		}
+		m_version = m_data[7];
+		m_src = m_data + 8;
+		m_fileLen = get_u32() + 12;
+	} else {
+		m_version = 0;
+		m_src = m_data + 3;
+		m_fileLen = get_u24() + 6;
+	}
+
+	if ( m_fileLen > m_dataLen && !m_viewerMode ) {
+		return false;
+	}
+
+	uint8_t format = get_u8();
+	m_cubeMap = ( format & ATF_FORMAT_CUBEMAP ) ? true : false;
+	m_format = format & ~ATF_FORMAT_CUBEMAP;
+	m_width = 1 << get_u8();
+	m_height = 1 << get_u8();
+	m_count = get_u8();
+
+	if ( m_format > ATF_FORMAT_LAST || m_count < 1 || m_count > kMaxLevels ||
+		 m_width > 4096 || m_height > 4096 ) {
+		return false;
+	}
+
+	m_alpha = m_format == ATF_FORMAT_8888 ||
+			  m_format == ATF_FORMAT_COMPRESSEDALPHA ||
+			  m_format == ATF_FORMAT_COMPRESSEDRAWALPHA;
+	return true;
+}
+
+bool ATFDecoder::init_pvr_header()
+{
+	uint32_t type = 0;
+	uint32_t bits = 0;
+	switch ( m_format ) {
+		case ATF_FORMAT_888:
+			type = PVR_OGL_RGB_888;
+			bits = 24;
+			break;
+		case ATF_FORMAT_8888:
+			type = PVR_OGL_RGBA_8888;
+			bits = 32;
+			break;
+		default:
+			switch ( m_mode ) {
+				case PREFER_DXT1:
+					type = m_alpha ? PVR_D3D_DXT5 : PVR_D3D_DXT1;
+					bits = m_alpha ? 8 : 4;
+					break;
+				case PREFER_PVRTC:
+					type = PVR_OGL_PVRTC4;
+					bits = 4;
+					break;
+				case PREFER_ETC1:
+					type = PVR_ETC_RGB_4BPP;
+					bits = 4;
+					break;
+				case PREFER_FALLBACK:
+					type = PVR_OGL_RGBA_8888;
+					bits = 32;
+					break;
+				default:
+					return false;
+			}
+			break;
+	}
+
+	size_t tmpLen = 0;
+	m_faceLen = 0;
+	int32_t w = m_width;
+	int32_t h = m_height;
+	for ( int32_t c=0; c<m_count; c++ ) {
+		size_t n = max(1,w/4)*max(1,h/4);
+		size_t p = max(1,max(int32_t(PVRTC4_MIN_TEXWIDTH),w)/4)*max(1,max(int32_t(PVRTC4_MIN_TEXWIDTH),h)/4);
+		size_t len = 0;
+		switch ( type ) {
+			case PVR_OGL_RGB_888:	len = max(1,w)*max(1,h)*3; break;
+			case PVR_OGL_RGBA_8888:	len = max(1,w)*max(1,h)*4; break;
+			case PVR_D3D_DXT1:		len = n*8; break;
+			case PVR_D3D_DXT5:		len = n*16; break;
+			case PVR_OGL_PVRTC4:	len = p*8; break;
+			case PVR_ETC_RGB_4BPP:	len = n*8*(m_alpha?2:1); break;
+		}
+		int32_t rows = 0;
+		switch ( type ) {
+			case PVR_OGL_RGB_888:
+			case PVR_OGL_RGBA_8888:	rows = max(1,h); break;
+			case PVR_OGL_PVRTC4:	rows = max(1,max(int32_t(PVRTC4_MIN_TEXWIDTH),h)/4); break;
+			case PVR_ETC_RGB_4BPP:	rows = max(1,h/4)*(m_alpha?2:1); break;
+			default:				rows = max(1,h/4); break;
+		}
+		m_levelOffset[c] = m_faceLen;
+		m_levelLen[c] = len;
+		m_levelRows[c] = rows;
+		m_faceLen += len;
+
+		// the largest lzma plane (6 bytes per block) and its filtered copy
+		size_t blocks = max(n*(m_alpha?2:1),p);
+		tmpLen = max(tmpLen,blocks*6*2);
+
+		w /= 2;
+		h /= 2;
+	}
+
+	m_texLen = sizeof(PVR_HEADER) + m_faceLen*(m_cubeMap?6:1);
+	delete [] m_tex;
+	m_tex = new uint8_t[m_texLen];
+	memset(m_tex,0,m_texLen);
+
+	if ( m_format >= ATF_FORMAT_COMPRESSED && tmpLen > m_tmpLen ) {
+		delete [] m_tmp;
+		m_tmp = new uint8_t[tmpLen];
+		m_tmpLen = tmpLen;
+	}
+
+	// the top level of whichever platform the fallback ends up decoding
+	if ( m_format >= ATF_FORMAT_COMPRESSED && m_mode == PREFER_FALLBACK ) {
+		size_t n = max(1,m_width/4)*max(1,m_height/4);
+		size_t p = max(1,max(int32_t(PVRTC4_MIN_TEXWIDTH),m_width)/4)*max(1,max(int32_t(PVRTC4_MIN_TEXWIDTH),m_height)/4);
+		size_t blocksLen = max(n*16,p*8);
+		if ( blocksLen > m_blocksLen ) {
+			delete [] m_blocks;
+			m_blocks = new uint8_t[blocksLen];
+			m_blocksLen = blocksLen;
+		}
+	}
+
+	PVR_HEADER *header = (PVR_HEADER *)m_tex;
+	header->dwHeaderSize = sizeof(PVR_HEADER);
+	header->dwWidth = m_width;
+	header->dwHeight = m_height;
+	header->dwMipMapCount = m_count-1;
+	header->dwpfFlags = type | (m_count > 1 ? PVRTEX_MIPMAP : 0) | (m_cubeMap ? PVRTEX_CUBEMAP : 0);
+	header->dwTextureDataSize = m_faceLen;
+	header->dwBitCount = bits;
+	header->dwAlphaBitMask = m_alpha ? 1 : 0;
+	header->dwPVR[0] = 'P';
+	header->dwPVR[1] = 'V';
+	header->dwPVR[2] = 'R';
+	header->dwPVR[3] = '!';
+	header->dwNumSurfs = m_cubeMap ? 6 : 1;
+	return true;
+}
+
+int32_t ATFDecoder::section_count(int32_t platform) const
+{
+	switch ( m_format ) {
+		case ATF_FORMAT_COMPRESSED: {
+			static const int32_t counts[] = { 2, 3, 3 };
+			return counts[platform];
+		}
+		case ATF_FORMAT_COMPRESSEDALPHA: {
+			static const int32_t counts[] = { 4, 3, 3 };
+			return counts[platform];
+		}
+		default:
+			return 1;
+	}
+}
+
+bool ATFDecoder::scan_sections()
+{
+	int32_t platforms = m_format >= ATF_FORMAT_COMPRESSED ? 3 : 1;
+	int32_t preferred = m_format >= ATF_FORMAT_COMPRESSED ? m_platform : 0;
+
+	for ( int32_t i=0; i<(m_cubeMap?6:1); i++ ) {
+		for ( int32_t c=0; c<m_count; c++ ) {
+			size_t levelSrc = 0;
+			bool empty = false;
+			for ( int32_t p=0; p<platforms; p++ ) {
+				for ( int32_t s=0; s<section_count(p); s++ ) {
+					if ( p == preferred && s == 0 ) {
+						levelSrc = size_t(m_src-m_data);
+					}
+					size_t len = get_len();
+					if ( m_truncated || !check_buffer_read(len) ) {
+						m_truncated = true;
+						if ( !m_viewerMode ) {
+							return false;
+						}
+						// still streaming, the remaining levels are not there yet.
+						// a cube map level needs all six faces.
+						int32_t first = ( i < (m_cubeMap?5:0) ) ? 0 : c;
+						for ( int32_t d=first; d<m_count; d++ ) {
+							m_levelEmpty[d] = true;
+						}
+						return true;
+					}
+					if ( p == preferred && s == 0 && len == 0 ) {
+						empty = true;
+					}
+					m_src += len;
+				}
+			}
+			// version 3 adds six sections we do not decode
+			if ( m_format == ATF_FORMAT_COMPRESSEDALPHA && m_version == 3 ) {
+				for ( int32_t s=0; s<6; s++ ) {
+					size_t len = get_len();
+					if ( m_truncated || !check_buffer_read(len) ) {
+						m_truncated = true;
+						return m_viewerMode;
+					}
+					m_src += len;
+				}
+			}
+			m_levelSrc[i][c] = levelSrc;
+			m_levelState[i][c] = empty ? LEVEL_EMPTY : LEVEL_PENDING;
+			if ( empty ) {
+				m_levelEmpty[c] = true;
+			}
+		}
+	}
+	return true;
+}
+
+bool ATFDecoder::setIndex(const uint8_t *data, size_t len)
+{
+	if ( !m_index ) {
+		m_index = new ATFIndex;
+	}
+	if ( !atf_index_read(data,len,*m_index) ) {
+		delete m_index;
+		m_index = 0;
+		return false;
+	}
+	return true;
+}
+
+// scan_sections() from the index. Only the length prefix of the first
+// section of each level is read, to catch an index made for another file.
+bool ATFDecoder::scan_index()
+{
+	const ATFIndex &index = *m_index;
+	if ( index.version != m_version || index.count != m_count || index.fileLength != m_fileLen ||
+		 index.format != ( m_format | ( m_cubeMap ? ATF_FORMAT_CUBEMAP : 0 ) ) ||
+		 index.sectionsPerLevel != atf_index_sections_per_level(m_format,m_version) ) {
+		return false;
+	}
+
+	int32_t first = 0;
+	if ( m_format >= ATF_FORMAT_COMPRESSED ) {
+		for ( int32_t p=0; p<m_platform; p++ ) {
+			first += section_count(p);
+		}
+	}
+
+	for ( int32_t i=0; i<(m_cubeMap?6:1); i++ ) {
+		for ( int32_t c=0; c<m_count; c++ ) {
+			const ATFIndexSection *section = atf_index_section(index,i,c,first);
+			uint32_t offset = 0;
+			uint32_t length = 0;
+			if ( !section || !atf_index_level_range(index,i,c,offset,length) ) {
+				return false;
+			}
+			if ( size_t(offset) + length > m_dataLen ) {
+				// still streaming, as in scan_sections()
+				int32_t firstMissing = ( i < (m_cubeMap?5:0) ) ? 0 : c;
+				for ( int32_t d=firstMissing; d<m_count; d++ ) {
+					m_levelEmpty[d] = true;
+				}
+				return true;
+			}
+			m_src = m_data + section->offset - index.prefixSize;
+			if ( get_len() != section->length ) {
+				return false;
+			}
+			m_levelSrc[i][c] = section->offset - index.prefixSize;
+			m_levelState[i][c] = section->length == 0 ? LEVEL_EMPTY : LEVEL_PENDING;
+			if ( section->length == 0 ) {
+				m_levelEmpty[c] = true;
+			}
+		}
+	}
+	return true;
+}
+
+bool ATFDecoder::decode(int32_t preferredFormat)
+{
+	m_mode = preferredFormat;
+	m_truncated = false;
+
+	if ( !read_header() ) {
+		return false;
+	}
+
+	if ( !init_pvr_header() ) {
+		return false;
+	}
+
+	// the fallback decodes the first platform that has any levels
+	static const int32_t platforms[] = { PREFER_DXT1, PREFER_ETC1, PREFER_PVRTC };
+	bool fallback = m_mode == PREFER_FALLBACK && m_format >= ATF_FORMAT_COMPRESSED;
+	const uint8_t *sections = m_src;
+	for ( int32_t p=0; p<(fallback?3:1); p++ ) {
+		m_platform = fallback ? platforms[p] : m_mode;
+		m_src = sections;
+		m_truncated = false;
+		for ( int32_t c=0; c<kMaxLevels; c++ ) {
+			m_levelEmpty[c] = c >= m_count;
+		}
+		memset(m_levelSrc,0,sizeof(m_levelSrc));
+		memset(m_levelState,LEVEL_EMPTY,sizeof(m_levelState));
+
+		m_indexed = m_index && scan_index();
+		if ( !m_indexed ) {
+			for ( int32_t c=0; c<kMaxLevels; c++ ) {
+				m_levelEmpty[c] = c >= m_count;
+			}
+			memset(m_levelSrc,0,sizeof(m_levelSrc));
+			memset(m_levelState,LEVEL_EMPTY,sizeof(m_levelState));
+			m_src = sections;
+			if ( !scan_sections() ) {
+				return false;
+			}
+		}
+		if ( !IsEmpty() ) {
+			break;
+		}
+	}
+	return true;
+}
+
+bool ATFDecoder::decodeLevel(uint32_t level, uint32_t side, uint8_t *dst, size_t rowPitch)
+{
+	if ( !dst || level >= uint32_t(m_count) || side >= uint32_t(m_cubeMap ? 6 : 1) ||
+		 m_levelState[side][level] == LEVEL_EMPTY ) {
+		return false;
+	}
+	size_t tightPitch = m_levelLen[level]/m_levelRows[level];
+	if ( rowPitch == 0 ) {
+		rowPitch = tightPitch;
+	} else if ( rowPitch < tightPitch ) {
+		return false;
+	}
+
+	int32_t w = m_width >> level;
+	int32_t h = m_height >> level;
+
+	if ( m_mode == PREFER_FALLBACK && m_format >= ATF_FORMAT_COMPRESSED ) {
+		return decode_fallback(level,side,w,h,dst,rowPitch);
+	}
+
+	return decode_blocks(level,side,w,h,dst,rowPitch);
+}
+
+bool ATFDecoder::decode_fallback(uint32_t level, uint32_t side, int32_t w, int32_t h, uint8_t *dst, size_t rowPitch)
+{
+	ATFBlockImage image;
+	image.blocks = m_blocks;
+	image.width = max(1,w);
+	image.height = max(1,h);
+	size_t pitch = 0;
+	switch ( m_platform ) {
+		case PREFER_DXT1:
+			image.format = m_alpha ? ATF_BLOCK_BC3 : ATF_BLOCK_BC1;
+			pitch = max(1,w/4)*(m_alpha?16:8);
+			break;
+		case PREFER_PVRTC:
+			image.format = ATF_BLOCK_PVRTC4;
+			pitch = max(1,max(int32_t(PVRTC4_MIN_TEXWIDTH),w)/4)*8;
+			break;
+		case PREFER_ETC1:
+			image.format = m_alpha ? ATF_BLOCK_ETC1_ALPHA : ATF_BLOCK_ETC1;
+			pitch = max(1,w/4)*8;
+			break;
+		default:
+			return false;
+	}
+	if ( !decode_blocks(level,side,w,h,m_blocks,pitch) ) {
+		return false;
+	}
+	atf_block_decode(image,dst,rowPitch,m_threads);
+	return true;
+}
+
+bool ATFDecoder::decode_blocks(uint32_t level, uint32_t side, int32_t w, int32_t h, uint8_t *dst, size_t rowPitch)
+{
+	m_src = m_data + m_levelSrc[side][level];
+	m_dst = dst;
+	m_dstPitch = rowPitch;
+	m_truncated = false;
+
+	bool empty = false;
+	switch ( m_format ) {
+		case ATF_FORMAT_888:
+			return convert_888_texture(w,h,empty);
+		case ATF_FORMAT_8888:
+			return convert_8888_texture(w,h,empty);
+		case ATF_FORMAT_COMPRESSED:
+			switch ( m_platform ) {
+				case PREFER_DXT1:	return convert_dxt1_texture(w,h,empty);
+				case PREFER_PVRTC:	return convert_pvrtc_texture(w,h,empty);
+				case PREFER_ETC1:	return convert_etc1_texture(w,h,empty);
+			}
+			break;
+		case ATF_FORMAT_COMPRESSEDRAW:
+			switch ( m_platform ) {
+				case PREFER_DXT1:	return convert_dxt1_raw_texture(w,h,empty);
+				case PREFER_PVRTC:	return convert_pvrtc_raw_texture(w,h,empty);
+				case PREFER_ETC1:	return convert_etc1_raw_texture(w,h,empty);
+			}
+			break;
+		case ATF_FORMAT_COMPRESSEDALPHA:
+			switch ( m_platform ) {
+				case PREFER_DXT1:	return convert_dxt5_texture(w,h,empty);
+				case PREFER_PVRTC:	return convert_pvrtc_alpha_texture(w,h,empty);
+				case PREFER_ETC1:	return convert_etc1_texture(w,h,empty);
+			}
+			break;
+		case ATF_FORMAT_COMPRESSEDRAWALPHA:
+			switch ( m_platform ) {
+				case PREFER_DXT1:	return convert_dxt5_raw_texture(w,h,empty);
+				case PREFER_PVRTC:	return convert_pvrtc_raw_texture(w,h,empty);
+				case PREFER_ETC1:	return convert_etc1_raw_texture(w,h,empty);
+			}
+			break;
+	}
+	return false;
+}
+
+void ATFDecoder::pack_image(jxr_image_t image, int mx, int my, int *src)
+{
+	ATFDecoder *decoder = (ATFDecoder *)jxr_get_user_data(image);
+	int32_t w = decoder->m_imageWidth;
+	int32_t h = decoder->m_imageHeight;
+	int32_t n = jxr_get_IMAGE_CHANNELS(image) + ( jxr_get_ALPHACHANNEL_FLAG(image) ? 1 : 0 );
+
+	// endpoint images hold the first endpoint of every block in the top half
+	// and the second one in the bottom half
+	int32_t bh = h/2;
+
+	for ( int32_t y=0; y<16; y++ ) {
+		int32_t dy = (my*16)+y;
+		if ( dy >= h ) {
+			break;
+		}
+		bool bottom = dy >= bh;
+		int32_t by = bottom ? dy-bh : dy;
+		for ( int32_t x=0; x<16; x++ ) {
+			int32_t dx = (mx*16)+x;
+			if ( dx >= w ) {
+				break;
+			}
+			const int *p = src+(y*16+x)*n;
+			switch ( decoder->m_imageTarget ) {
+				case IMAGE_PIXELS: {
+					uint8_t *dst = decoder->m_dst + size_t(dy)*decoder->m_dstPitch + size_t(dx)*n;
+					for ( int32_t c=0; c<n; c++ ) {
+						dst[c] = uint8_t(p[c]);
+					}
+				} break;
+				case IMAGE_DXT_ALPHA: {
+					uint8_t *dst = decoder->block(size_t(by)*w+dx,w,16);
+					dst[bottom?1:0] = uint8_t(p[0]);
+				} break;
+				case IMAGE_DXT_COLOR: {
+					uint8_t *dst = decoder->block(size_t(by)*w+dx,w,decoder->m_imageBlockSize);
+					put_u16(dst+decoder->m_imageOffset+(bottom?2:0),((p[2]&0x1F)<<11)|((p[1]&0x3F)<<5)|(p[0]&0x1F));
+				} break;
+				case IMAGE_PVRTC_COLOR: {
+					// the mode bits were put in place from d0 already
+					uint8_t *dst = decoder->block(pvrtc_twiddle(dx,by,w,bh),w,8);
+					uint32_t v = ((p[2]&0x1F)<<10)|((p[1]&0x1F)<<5)|(p[0]&0x1F);
+					if ( bottom ) {
+						put_u16(dst+6,(get_u16(dst+6)&0x8000)|v);
+					} else {
+						put_u16(dst+4,(get_u16(dst+4)&0x8001)|(v&0x7FFE));
+					}
+				} break;
+				case IMAGE_ETC1_COLOR: {
+					// macroblocks arrive top to bottom, so the first color of a
+					// block is in place when its second color shows up
+					uint8_t *dst = decoder->block(size_t(by)*w+dx,w,8);
+					bool diff = ( dst[3] & 2 ) ? true : false;
+					for ( int32_t c=0; c<3; c++ ) {
+						int32_t v = p[2-c]&0x1F;
+						if ( !bottom ) {
+							// differential: 5 bit base color, individual: 4 bit color
+							dst[c] = uint8_t(diff ? (v<<3) : ((v>>1)<<4));
+						} else if ( diff ) {
+							// 3 bit signed delta to the base color
+							dst[c] |= uint8_t((v-(dst[c]>>3))&7);
+						} else {
+							dst[c] |= uint8_t(v>>1);
+						}
+					}
+				} break;
+			}
+		}
+	}
+}
+
+bool ATFDecoder::read_image(size_t len, ImageTarget target, int32_t w, int32_t h)
+{
+	if ( !check_buffer_read(len) ) {
+		m_truncated = true;
+		return false;
+	}
+
+	m_imageTarget = target;
+	m_imageWidth = w;
+	m_imageHeight = h;
+
+	jxr_container_t container = jxr_create_container();
+	jxr_image_t image = jxr_create_input();
+	jxr_set_user_data(image,this);
+	jxr_set_block_output(image,pack_image);
+	if ( m_preview ) {
+		jxr_flag_SKIP_HP_DATA(image,1);
+		jxr_flag_SKIP_FLEX_DATA(image,1);
+	}
+
+	bool ok = jxr_read_image_container(container,m_src,int32_t(len)) == JXR_EC_OK;
+	if ( ok ) {
+		unsigned long offset = jxrc_image_offset(container,0);
+		unsigned long bytes = jxrc_image_bytecount(container,0);
+		ok = offset + bytes <= len &&
+			 jxr_read_image_bitstream(image,m_src+offset,int32_t(bytes)) == JXR_EC_OK &&
+			 int32_t(jxr_get_IMAGE_WIDTH(image)) == w &&
+			 int32_t(jxr_get_IMAGE_HEIGHT(image)) == h;
+	}
+
+	jxr_destroy(image);
+	jxr_destroy_container(container);
+
+	m_src += len;
+	return ok;
+}
+
+const uint8_t *ATFDecoder::lzma_decode(size_t len, int32_t w, int32_t h, int32_t blockSize, int32_t fieldBits)
+{
+	if ( !check_buffer_read(len) ) {
+		m_truncated = true;
+		return 0;
+	}
+
+	const uint8_t *src = m_src;
+	m_src += len;
+
+	ATFFilterLayout layout = { w, h, blockSize, fieldBits };
+	size_t size = atf_filter_size(layout);
+
+	uint32_t filter = ATF_FILTER_NONE;
+	if ( m_version >= ATF_VERSION_FILTERED ) {
+		if ( len < 1 ) {
+			return 0;
+		}
+		filter = *src++;
+		len--;
+	}
+
+	if ( len < LZMA_PROPS_SIZE || size*2 > m_tmpLen ) {
+		return 0;
+	}
+
+	// lzma needs the whole plane as its window. filtered planes are unpacked
+	// in the upper half and unfiltered into the lower one.
+	uint8_t *out = filter != ATF_FILTER_NONE ? m_tmp + m_tmpLen/2 : m_tmp;
+
+	static ISzAlloc alloc = { atf_sz_alloc, atf_sz_free };
+	SizeT outLen = size;
+	SizeT inLen = len - LZMA_PROPS_SIZE;
+	ELzmaStatus status;
+	SRes res = LzmaDecode(out,&outLen,src+LZMA_PROPS_SIZE,&inLen,src,LZMA_PROPS_SIZE,LZMA_FINISH_END,&status,&alloc,0);
+	if ( res != SZ_OK || outLen != size ) {
+		return 0;
+	}
+
+	if ( filter != ATF_FILTER_NONE && !atf_filter_decode(filter,layout,out,m_tmp,size) ) {
+		return 0;
+	}
+	return m_tmp;
+}
+
+bool ATFDecoder::lzma_scatter(size_t len, int32_t w, int32_t h, int32_t fieldSize, int32_t fieldBits, int32_t blockSize, int32_t offset)
+{
+	const uint8_t *plane = lzma_decode(len,w,h,fieldSize,fieldBits);
+	if ( !plane ) {
+		return false;
+	}
+	size_t n = size_t(w)*h;
+	for ( size_t d=0; d<n; d++ ) {
+		memcpy(block(d,w,blockSize)+offset,plane+d*fieldSize,fieldSize);
+	}
+	return true;
+}
+
+bool ATFDecoder::read_raw(size_t rowLen, int32_t rows, bool &empty)
+{
+	size_t len = get_len();
+	if ( m_truncated || !check_buffer_read(len) ) {
+		m_truncated = true;
+		return false;
+	}
+	if ( len == 0 ) {
+		empty = true;
+	} else if ( len != rowLen*rows ) {
+		return false;
+	} else {
+		for ( int32_t r=0; r<rows; r++ ) {
+			memcpy(m_dst+r*m_dstPitch,m_src+r*rowLen,rowLen);
+		}
+	}
+	m_src += len;
+	return true;
+}
+
+bool ATFDecoder::convert_888_texture(int32_t w, int32_t h, bool &empty)
+{
+	size_t len = get_len();
+	if ( m_truncated ) {
+		return false;
+	}
+	if ( len == 0 ) {
+		empty = true;
+		return true;
+	}
+	return read_image(len,IMAGE_PIXELS,max(1,w),max(1,h));
+}
+
+bool ATFDecoder::convert_8888_texture(int32_t w, int32_t h, bool &empty)
+{
+	return convert_888_texture(w,h,empty);
+}
+
+bool ATFDecoder::convert_dxt1_texture(int32_t w, int32_t h, bool &empty)
+{
+	int32_t bw = max(1,w/4);
+	int32_t bh = max(1,h/4);
+
+	size_t len = get_len();
+	if ( m_truncated ) {
+		return false;
+	}
+	if ( len == 0 ) {
+		empty = true;
+		return true;
+	}
+	if ( !lzma_scatter(len,bw,bh,4,2,8,4) ) {
+		return false;
+	}
+
+	m_imageBlockSize = 8;
+	m_imageOffset = 0;
+	len = get_len();
+	return !m_truncated && read_image(len,IMAGE_DXT_COLOR,bw,bh*2);
+}
+
+bool ATFDecoder::convert_dxt5_texture(int32_t w, int32_t h, bool &empty)
+{
+	int32_t bw = max(1,w/4);
+	int32_t bh = max(1,h/4);
+
+	size_t len = get_len();
+	if ( m_truncated ) {
+		return false;
+	}
+	if ( len == 0 ) {
+		empty = true;
+		return true;
+	}
+	if ( !lzma_scatter(len,bw,bh,6,3,16,2) ) {
+		return false;
+	}
+
+	len = get_len();
+	if ( m_truncated || !read_image(len,IMAGE_DXT_ALPHA,bw,bh*2) ) {
+		return false;
+	}
+
+	len = get_len();
+	if ( m_truncated || !lzma_scatter(len,bw,bh,4,2,16,12) ) {
+		return false;
+	}
+
+	m_imageBlockSize = 16;
+	m_imageOffset = 8;
+	len = get_len();
+	return !m_truncated && read_image(len,IMAGE_DXT_COLOR,bw,bh*2);
+}
+
+bool ATFDecoder::convert_pvrtc_texture(int32_t w, int32_t h, bool &empty)
+{
+	int32_t pw = max(int32_t(PVRTC4_MIN_TEXWIDTH),w);
+	int32_t ph = max(int32_t(PVRTC4_MIN_TEXWIDTH),h);
+	int32_t bw = max(1,pw/4);
+	int32_t bh = max(1,ph/4);
+	size_t n = size_t(bw)*bh;
+
+	size_t len = get_len();
+	if ( m_truncated ) {
+		return false;
+	}
+	if ( len == 0 ) {
+		empty = true;
+		return true;
+	}
+	const uint8_t *d0 = lzma_decode(len,bw,bh,1,0);
+	if ( !d0 ) {
+		return false;
+	}
+
+	// d0 holds the mode bit and the two opacity flags, which sit next to the
+	// colors that come from the JPEG-XR image
+	for ( size_t d=0; d<n; d++ ) {
+		uint8_t mode = d0[d];
+		if ( !m_alpha ) {
+			// only the mode bit is stored, both colors are opaque
+			mode = (mode&1) | 6;
+		}
+		uint8_t *dst = block(d,bw,8);
+		put_u16(dst+4,(mode&1) | ((mode&2) ? 0x8000 : 0));
+		put_u16(dst+6,(mode&4) ? 0x8000 : 0);
+	}
+
+	len = get_len();
+	if ( m_truncated || !lzma_scatter(len,bw,bh,4,2,8,0) ) {
+		return false;
+	}
+
+	len = get_len();
+	return !m_truncated && read_image(len,IMAGE_PVRTC_COLOR,bw,bh*2);
+}
+
+bool ATFDecoder::convert_pvrtc_alpha_texture(int32_t w, int32_t h, bool &empty)
+{
+	// same sections as without alpha, d0 also carries the two opacity flags
+	return convert_pvrtc_texture(w,h,empty);
+}
+
+bool ATFDecoder::convert_etc1_texture(int32_t w, int32_t h, bool &empty)
+{
+	int32_t bw = max(1,w/4);
+	int32_t bh = max(1,h/4)*(m_alpha?2:1);
+
+	size_t len = get_len();
+	if ( m_truncated ) {
+		return false;
+	}
+	if ( len == 0 ) {
+		empty = true;
+		return true;
+	}
+	if ( !lzma_scatter(len,bw,bh,1,0,8,3) ) {
+		return false;
+	}
+
+	len = get_len();
+	if ( m_truncated || !lzma_scatter(len,bw,bh,4,0,8,4) ) {
+		return false;
+	}
+
+	len = get_len();
+	return !m_truncated && read_image(len,IMAGE_ETC1_COLOR,bw,bh*2);
+}
+
+bool ATFDecoder::convert_dxt1_raw_texture(int32_t w, int32_t h, bool &empty)
+{
+	return read_raw(max(1,w/4)*8,max(1,h/4),empty);
+}
+
+bool ATFDecoder::convert_dxt5_raw_texture(int32_t w, int32_t h, bool &empty)
+{
+	return read_raw(max(1,w/4)*16,max(1,h/4),empty);
+}
+
+bool ATFDecoder::convert_pvrtc_raw_texture(int32_t w, int32_t h, bool &empty)
+{
+	int32_t pw = max(int32_t(PVRTC4_MIN_TEXWIDTH),w);
+	int32_t ph = max(int32_t(PVRTC4_MIN_TEXWIDTH),h);
+	return read_raw(max(1,pw/4)*8,max(1,ph/4),empty);
+}
+
+bool ATFDecoder::convert_etc1_raw_texture(int32_t w, int32_t h, bool &empty)
+{
+	return read_raw(max(1,w/4)*8,max(1,h/4)*(m_alpha?2:1),empty);
+}
@@ -22,6 +22,13 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef _ATF_H_
 #define _ATF_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "3rdparty/jpegxr/jpegxr.h"
+
+struct ATFIndex;
+
 //
 // ATF format:
 //
@@ -98,6 +105,37 @@ struct PVR_HEADER {
 	uint32_t		dwNumSurfs;
 };
 
+//
+// Decodes an ATF file held in memory into a PVR texture (PVR_HEADER followed
+// by the texture data) for one GPU format. Sections of the other platforms are
+// skipped using their length prefixes only. Formats 0 and 1 decode to
+// RGB888/RGBA8888, formats 2-5 to DXT1/DXT5, PVRTC 4bpp or ETC1 blocks as
+// requested. ETC1 with alpha yields the color blocks followed by the alpha
+// blocks for every level. Cube maps hold six faces in ATF (OpenGL) order,
+// each face with its full mip chain.
+//
+// PREFER_FALLBACK is for clients without any of the block formats: formats
+// 2-5 decode to RGBA8888 in software (atfblock.h) from the first platform the
+// file carries, in the order DXT, ETC1, PVRTC. Levels large enough are split
+// over setThreads() threads.
+//
+// Preview mode decodes the JPEG-XR images from their DC and low pass bands
+// only (the high pass coefficients and flexbits are parsed but dropped), for
+// asset browsers and LOD previews that can live with a blurred image. Together
+// with decoding only the small levels this makes thumbnail() cheap.
+//
+// decode() only walks the section lengths and records where the sections of
+// every level start; a level is decoded the first time texData() asks for it
+// and kept from then on, so the small mip levels of a streamed texture are
+// ready long before the top level is needed. tex() decodes whatever is still
+// pending. The input is not copied and must stay valid as long as levels are
+// requested. In viewer mode a file that ends early (still streaming) makes the
+// levels that are complete available and reports the rest as not available.
+//
+// With a level index (atfindex.h) set, decode() takes the section offsets from
+// it instead of walking the file, touching only the length prefix of the
+// sections it decodes. An index that does not describe the file is ignored.
+//
 class ATFDecoder {
 
 	public:
@@ -110,15 +148,47 @@ class ATFDecoder {
 		};
 
 		ATFDecoder(const uint8_t *data, size_t dataLen, bool viewerMode = false);
+		~ATFDecoder();
 
 		bool decode(int32_t preferredFormat);
+
+		// .atfidx of the file, parsed and kept; before decode(). false and no
+		// index if it is malformed.
+		bool setIndex(const uint8_t *data, size_t len);
+		// whether the last decode() could use it
+		bool Indexed() const { return m_indexed; }
+
+		// threads for the software decode of PREFER_FALLBACK, 0 for one per core
+		void setThreads(int32_t threads) { m_threads = threads; }
+
+		// low fidelity JPEG-XR decode, affects the levels decoded afterwards
+		void setPreview(bool preview) { m_preview = preview; }
+		bool Preview() const { return m_preview; }
+
+		// RGBA pixels of the largest available level that fits in maxSide x
+		// maxSide, or of the smallest available one scaled down to fit if none
+		// does. Needs RGB/RGBA output: formats 0 and 1, or any format decoded
+		// with PREFER_FALLBACK.
+		// Valid until the next call or the decoder goes away; 0 on failure.
+		const uint8_t *thumbnail(uint32_t maxSide, uint32_t &width, uint32_t &height);
 		
-		const PVR_HEADER *tex() { return (PVR_HEADER *)m_tex; }
+		const PVR_HEADER *tex();
 		size_t texLen() { return m_texLen; }
 
+		// level data inside tex(), decoded on first use. 0 if the level or side
+		// does not exist, is not available or fails to decode.
 		uint8_t *texData(uint32_t level, uint32_t side = 0);
+		size_t texDataLen(uint32_t level) const { return level < uint32_t(m_count) ? m_levelLen[level] : 0; }
+
+		// Decodes a level straight into dst, a row of blocks (a row of pixels
+		// for formats 0 and 1) every rowPitch bytes, 0 for tightly packed rows.
+		// PVRTC rows are runs of consecutive blocks in twiddled order. Does not
+		// touch tex(); fails for levels that are not available.
+		bool decodeLevel(uint32_t level, uint32_t side, uint8_t *dst, size_t rowPitch = 0);
+		uint32_t texDataRows(uint32_t level) const { return level < uint32_t(m_count) ? m_levelRows[level] : 0; }
 		
-		bool LevelAvailable(int32_t level) const { return !m_levelEmpty[level]; }
+		// answered from the section table, without decoding
+		bool LevelAvailable(int32_t level) const { return level >= 0 && level < m_count && !m_levelEmpty[level]; }
 		bool IsEmpty() const { for ( int32_t c=0; c<m_count; c++) { if (!m_levelEmpty[c]) return false; } return true; }
 
 		enum {
@@ -133,31 +203,70 @@ class ATFDecoder {
 		};
 
         int32_t Format() const { return m_format; }
+		int32_t Version() const { return m_version; }
+		int32_t Count() const { return m_count; }
+		bool IsCubeMap() const { return m_cubeMap; }
 
 	private:
+		ATFDecoder(const ATFDecoder &);
+		ATFDecoder &operator=(const ATFDecoder &);
 	
 		static void pack_image(jxr_image_t image, int mx, int my, int *src);
 
 	private:
-		bool read_image(size_t len, jxrc_t_pixelFormat format, int32_t w, int32_t h);
+		enum {
+			LEVEL_EMPTY,
+			LEVEL_PENDING,
+			LEVEL_DECODED,
+			LEVEL_FAILED
+		};
+
+		// what pack_image writes the JPEG-XR pixels to
+		enum ImageTarget {
+			IMAGE_PIXELS,		// RGB/RGBA rows
+			IMAGE_DXT_ALPHA,	// a0/a1 of dxt5 blocks
+			IMAGE_DXT_COLOR,	// c0/c1 of dxt1/dxt5 blocks
+			IMAGE_PVRTC_COLOR,	// color a/b of twiddled pvrtc blocks
+			IMAGE_ETC1_COLOR	// base colors of etc1 blocks, merged by mode
+		};
+
+		bool scan_sections();
+		bool scan_index();
+		int32_t section_count(int32_t platform) const;
+		uint8_t *level_data(uint32_t level, uint32_t side);
+
+		// block i of the level being decoded, bw blocks per row
+		uint8_t *block(size_t i, int32_t bw, int32_t blockSize) {
+			return m_dst + (i/bw)*m_dstPitch + (i%bw)*blockSize;
+		}
+
+		bool read_image(size_t len, ImageTarget target, int32_t w, int32_t h);
 		
+		bool read_header();
 		bool init_pvr_header();
 		
-		bool lzma_decode_top(size_t len, int32_t w, int32_t h, bool left);
-		bool lzma_decode_bottom(size_t len, int32_t w, int32_t h, bool left);
-		bool lzma_decode_wide(size_t len, int32_t w, int32_t h, bool left);
+		// LZMA section with fieldSize bytes for each block of a w x h grid,
+		// returned in m_tmp or copied to offset of every destination block
+		const uint8_t *lzma_decode(size_t len, int32_t w, int32_t h, int32_t fieldSize, int32_t fieldBits);
+		bool lzma_scatter(size_t len, int32_t w, int32_t h, int32_t fieldSize, int32_t fieldBits, int32_t blockSize, int32_t offset);
+
+		bool read_raw(size_t rowLen, int32_t rows, bool &empty);
+
+		// decodeLevel() for m_platform's blocks and for the RGBA fallback
+		bool decode_blocks(uint32_t level, uint32_t side, int32_t w, int32_t h, uint8_t *dst, size_t rowPitch);
+		bool decode_fallback(uint32_t level, uint32_t side, int32_t w, int32_t h, uint8_t *dst, size_t rowPitch);
 		
 		bool convert_888_texture(int32_t w, int32_t h, bool &empty);
 		bool convert_8888_texture(int32_t w, int32_t h, bool &empty);
-		bool convert_dxt1_texture(bool skip, int32_t w, int32_t h, bool &empty);
-		bool convert_dxt5_texture(bool skip, int32_t w, int32_t h, bool &empty);
-		bool convert_pvrtc_alpha_texture(bool skip, int32_t w, int32_t h, bool &empty);
-		bool convert_pvrtc_texture(bool skip, int32_t w, int32_t h, bool &empty);
-		bool convert_etc1_texture(bool skip, int32_t w, int32_t h, bool &empty);
-		bool convert_dxt1_raw_texture(bool skip, int32_t w, int32_t h, bool &empty);
-		bool convert_pvrtc_raw_texture(bool skip, int32_t w, int32_t h, bool &empty);
-		bool convert_etc1_raw_texture(bool skip, int32_t w, int32_t h, bool &empty);
-		bool convert_dxt5_raw_texture(bool skip, int32_t w, int32_t h, bool &empty);
+		bool convert_dxt1_texture(int32_t w, int32_t h, bool &empty);
+		bool convert_dxt5_texture(int32_t w, int32_t h, bool &empty);
+		bool convert_pvrtc_alpha_texture(int32_t w, int32_t h, bool &empty);
+		bool convert_pvrtc_texture(int32_t w, int32_t h, bool &empty);
+		bool convert_etc1_texture(int32_t w, int32_t h, bool &empty);
+		bool convert_dxt1_raw_texture(int32_t w, int32_t h, bool &empty);
+		bool convert_pvrtc_raw_texture(int32_t w, int32_t h, bool &empty);
+		bool convert_etc1_raw_texture(int32_t w, int32_t h, bool &empty);
+		bool convert_dxt5_raw_texture(int32_t w, int32_t h, bool &empty);
 
 		bool check_buffer_read(size_t toRead) {
 			if ((m_src-m_data+toRead)<=m_dataLen) {
@@ -174,16 +283,35 @@ class ATFDecoder {
 		}
 
 		uint32_t get_u24() {	
-			if ((m_src+3-m_data)<m_dataLen) {
+			if ((m_src+3-m_data)<=m_dataLen) {
 				uint32_t v = ((m_src[0])<<16)|
 							 ((m_src[1])<< 8)|
 							 ((m_src[2])<< 0);
 				m_src += 3;
 				return v;
 			}
+			m_truncated = true;
 			return 0;
 		}
 
+		uint32_t get_u32() {	
+			if ((m_src+4-m_data)<=m_dataLen) {
+				uint32_t v = ((m_src[0])<<24)|
+							 ((m_src[1])<<16)|
+							 ((m_src[2])<< 8)|
+							 ((m_src[3])<< 0);
+				m_src += 4;
+				return v;
+			}
+			m_truncated = true;
+			return 0;
+		}
+
+		// section length prefix, U24 in version 0 files
+		uint32_t get_len() {
+			return m_version ? get_u32() : get_u24();
+		}
+
 		static inline int32_t pvrtc_twiddle(int32_t u, int32_t v, int32_t w, int32_t h)
 		{
 			int32_t r = 0;
@@ -215,20 +343,46 @@ class ATFDecoder {
 
 		bool			m_alpha;
 		int32_t			m_mode;
+		int32_t			m_platform;		// whose sections are decoded, m_mode unless falling back
+		int32_t			m_threads;
+		bool			m_preview;
 		size_t			m_texLen;
 		uint8_t	*		m_tex;	
 		int32_t			m_format;
+		int32_t			m_version;
 		int32_t			m_count;
 		int32_t			m_width;
 		int32_t			m_height;
+		bool			m_cubeMap;
 		const uint8_t *	m_src;
 		uint8_t *		m_dst;
+		size_t			m_dstPitch;
 		uint8_t *		m_tmp;
+		size_t			m_tmpLen;
+		uint8_t *		m_blocks;		// compressed level for the software decode
+		size_t			m_blocksLen;
+		uint8_t *		m_thumbnail;	// RGBA copy of an RGB thumbnail level
+		ATFIndex *		m_index;
+		bool			m_indexed;
 		const uint8_t *	m_data;
 		size_t			m_dataLen;
 		size_t			m_fileLen;
         bool            m_viewerMode;
+		bool			m_truncated;
         bool			m_levelEmpty[16];
+		size_t			m_levelOffset[16];	// from the start of a face
+		size_t			m_levelLen[16];
+		int32_t			m_levelRows[16];
+		size_t			m_faceLen;
+		size_t			m_levelSrc[6][16];	// first section of the preferred format
+		uint8_t			m_levelState[6][16];
+
+		// target of pack_image while read_image runs
+		ImageTarget		m_imageTarget;
+		int32_t			m_imageWidth;
+		int32_t			m_imageHeight;
+		int32_t			m_imageBlockSize;
+		int32_t			m_imageOffset;		// of c0 in a dxt block
 };
 
 #endif //#ifndef _ATF_H_
@@ -0,0 +1,306 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atfalloc.h"
+
+#include "3rdparty/jpegxr/jpegxr.h"
+
+extern "C"
+{
+#include "3rdparty/lzma/Alloc.h"
+}
+
+namespace {
+
+// Prepended to every block handed out by atf_alloc. 16 bytes keep the user
+// pointer aligned like malloc's.
+struct BlockHeader {
+    ATFAllocator *  owner;
+    size_t          size;
+};
+
+static_assert(sizeof(BlockHeader) <= 16, "block header must fit alignment padding");
+
+const size_t kHeaderSize = 16;
+
+thread_local ATFAllocator *tCurrent = 0;
+
+}
+
+ATFAllocator::~ATFAllocator()
+{
+    assert(m_refs.load(std::memory_order_acquire) <= 1 && "allocator destroyed with blocks still out");
+}
+
+void ATFAllocator::retain()
+{
+    m_refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ATFAllocator::release()
+{
+    if ( m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1 ) {
+        delete this;
+    }
+}
+
+ATFAllocator *ATFAllocator::current()
+{
+    return tCurrent ? tCurrent : ATFHeapAllocator::instance();
+}
+
+void ATFAllocator::setCurrent(ATFAllocator *allocator)
+{
+    tCurrent = allocator;
+}
+
+void *ATFHeapAllocator::allocate(size_t size)
+{
+    return malloc(size);
+}
+
+void ATFHeapAllocator::deallocate(void *ptr, size_t)
+{
+    free(ptr);
+}
+
+ATFHeapAllocator *ATFHeapAllocator::instance()
+{
+    // never destroyed, blocks may be freed by static destructors
+    static ATFHeapAllocator *heap = new ATFHeapAllocator();
+    return heap;
+}
+
+// Owns the calling thread's pool and retires it when the thread exits.
+struct ATFPoolAllocatorThreadSlot {
+    ATFPoolAllocator *pool;
+
+    ATFPoolAllocatorThreadSlot() : pool(0) {}
+    ~ATFPoolAllocatorThreadSlot() {
+        if ( pool ) {
+            pool->retire();
+        }
+    }
+};
+
+static thread_local ATFPoolAllocatorThreadSlot tPoolSlot;
+
+ATFPoolAllocator::ATFPoolAllocator()
+    : m_owner(std::this_thread::get_id())
+    , m_remote(0)
+    , m_retired(false)
+{
+    memset(m_free, 0, sizeof(m_free));
+}
+
+ATFPoolAllocator::~ATFPoolAllocator()
+{
+    // every reference is gone, so no thread touches the lists any more
+    for ( int c = 0; c < kClassCount; c++ ) {
+        freeList(m_free[c]);
+        m_free[c] = 0;
+    }
+    freeList(m_remote.exchange(0, std::memory_order_acquire));
+}
+
+int ATFPoolAllocator::sizeClass(size_t size)
+{
+    int c = 0;
+    size_t s = size_t(1) << kMinClassShift;
+    while ( s < size ) {
+        s <<= 1;
+        c++;
+    }
+    return c;
+}
+
+// a retired pool has no owner; its thread id may already belong to another
+bool ATFPoolAllocator::owned() const
+{
+    return !m_retired.load(std::memory_order_acquire) && m_owner == std::this_thread::get_id();
+}
+
+void ATFPoolAllocator::drainRemote()
+{
+    FreeBlock *block = m_remote.exchange(0, std::memory_order_acquire);
+    while ( block ) {
+        FreeBlock *next = block->next;
+        block->next = m_free[block->sizeClass];
+        m_free[block->sizeClass] = block;
+        block = next;
+    }
+}
+
+void ATFPoolAllocator::freeList(FreeBlock *block)
+{
+    while ( block ) {
+        FreeBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+void *ATFPoolAllocator::allocate(size_t size)
+{
+    if ( size > kMaxPooledSize ) {
+        return malloc(size);
+    }
+
+    int c = sizeClass(size);
+    if ( !m_free[c] && m_remote.load(std::memory_order_relaxed) ) {
+        drainRemote();
+    }
+    FreeBlock *block = m_free[c];
+    if ( block ) {
+        m_free[c] = block->next;
+        return block;
+    }
+    return malloc(size_t(1) << (c + kMinClassShift));
+}
+
+void ATFPoolAllocator::deallocate(void *ptr, size_t size)
+{
+    if ( !ptr ) {
+        return;
+    }
+    if ( size > kMaxPooledSize ) {
+        free(ptr);
+        return;
+    }
+
+    FreeBlock *block = (FreeBlock *)ptr;
+    block->sizeClass = sizeClass(size);
+    if ( owned() ) {
+        block->next = m_free[block->sizeClass];
+        m_free[block->sizeClass] = block;
+        return;
+    }
+    if ( m_retired.load(std::memory_order_acquire) ) {
+        free(ptr);
+        return;
+    }
+
+    FreeBlock *head = m_remote.load(std::memory_order_relaxed);
+    do {
+        block->next = head;
+    } while ( !m_remote.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed) );
+}
+
+void ATFPoolAllocator::trim()
+{
+    drainRemote();
+    for ( int c = 0; c < kClassCount; c++ ) {
+        freeList(m_free[c]);
+        m_free[c] = 0;
+    }
+}
+
+void ATFPoolAllocator::retire()
+{
+    trim();
+    m_retired.store(true, std::memory_order_release);
+    release();
+}
+
+ATFPoolAllocator *ATFPoolAllocator::threadLocal()
+{
+    if ( !tPoolSlot.pool ) {
+        tPoolSlot.pool = new ATFPoolAllocator();
+    }
+    return tPoolSlot.pool;
+}
+
+ATFCountingAllocator::ATFCountingAllocator(ATFAllocator *parent)
+    : m_parent(parent ? parent : ATFHeapAllocator::instance())
+{
+    m_parent->retain();
+    reset();
+}
+
+ATFCountingAllocator::~ATFCountingAllocator()
+{
+    m_parent->release();
+}
+
+void ATFCountingAllocator::reset()
+{
+    m_allocCount = 0;
+    m_freeCount = 0;
+    m_totalBytes = 0;
+    m_liveBytes = 0;
+    m_peakBytes = 0;
+    m_largest = 0;
+}
+
+void *ATFCountingAllocator::allocate(size_t size)
+{
+    void *ptr = m_parent->allocate(size);
+    if ( !ptr ) {
+        return 0;
+    }
+
+    m_allocCount++;
+    m_totalBytes += size;
+    uint64_t live = (m_liveBytes += size);
+
+    uint64_t peak = m_peakBytes;
+    while ( live > peak && !m_peakBytes.compare_exchange_weak(peak, live) ) {
+    }
+    uint64_t largest = m_largest;
+    while ( size > largest && !m_largest.compare_exchange_weak(largest, size) ) {
+    }
+    return ptr;
+}
+
+void ATFCountingAllocator::deallocate(void *ptr, size_t size)
+{
+    if ( !ptr ) {
+        return;
+    }
+    m_freeCount++;
+    m_liveBytes -= size;
+    m_parent->deallocate(ptr, size);
+}
+
+void *atf_alloc(size_t size)
+{
+    ATFAllocator *allocator = ATFAllocator::current();
+    uint8_t *base = (uint8_t *)allocator->allocate(size + kHeaderSize);
+    if ( !base ) {
+        return 0;
+    }
+    BlockHeader *header = (BlockHeader *)base;
+    header->owner = allocator;
+    header->size = size;
+    allocator->retain();
+    return base + kHeaderSize;
+}
+
+void atf_free(void *ptr)
+{
+    if ( !ptr ) {
+        return;
+    }
+    uint8_t *base = (uint8_t *)ptr - kHeaderSize;
+    BlockHeader *header = (BlockHeader *)base;
+    ATFAllocator *owner = header->owner;
+    owner->deallocate(base, header->size + kHeaderSize);
+    owner->release();
+}
+
+void *atf_sz_alloc(void *, size_t size)
+{
+    return atf_alloc(size);
+}
+
+void atf_sz_free(void *, void *address)
+{
+    atf_free(address);
+}
+
+void atf_install_allocator_hooks()
+{
+    jxr_set_alloc_hooks(atf_alloc, atf_free);
+    MyAlloc_SetHooks(atf_alloc, atf_free);
+}
@@ -0,0 +1,174 @@
+#ifndef _ATFALLOC_H_
+#define _ATFALLOC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+
+//
+// Allocator interface shared by the vendored JPEG-XR and LZMA libraries.
+//
+// atf_install_allocator_hooks() routes jpegxr_malloc/jpegxr_free and the
+// LZMA MyAlloc/MyFree (LzmaCompress, LzmaUncompress) through atf_alloc and
+// atf_free. Those allocate from the allocator that is current on the calling
+// thread, which is the plain heap unless an ATFAllocatorScope says otherwise.
+//
+// Every block remembers the allocator it came from, so a block may be freed
+// on any thread and after the scope that allocated it has ended. Blocks also
+// keep that allocator alive: atf_alloc retains it and atf_free releases it.
+// An allocator created with new is given up with release() rather than
+// deleted, and goes away with the last of its blocks; this is what lets the
+// thread_local LZMA encoder cache outlive the scope its encoders were made
+// in. An allocator on the stack or in a static must outlive its blocks,
+// which its destructor asserts. Allocators that forward to another one
+// retain it for as long as they live.
+//
+
+class ATFAllocator {
+public:
+    ATFAllocator() : m_refs(1) {}
+    virtual ~ATFAllocator();
+
+    // raw, sized interface; callers always pass back the allocation size
+    virtual void *allocate(size_t size) = 0;
+    virtual void deallocate(void *ptr, size_t size) = 0;
+
+    // one reference is the creator's, the others are blocks and forwarding
+    // allocators; release() deletes the allocator with the last one
+    void retain();
+    void release();
+
+    // allocator used by atf_alloc on the calling thread
+    static ATFAllocator *current();
+    static void setCurrent(ATFAllocator *allocator);
+
+private:
+    ATFAllocator(const ATFAllocator &);
+    ATFAllocator &operator=(const ATFAllocator &);
+
+    std::atomic<size_t> m_refs;
+};
+
+// Makes an allocator current on this thread for the lifetime of the scope.
+class ATFAllocatorScope {
+public:
+    explicit ATFAllocatorScope(ATFAllocator *allocator) : m_prev(ATFAllocator::current()) {
+        ATFAllocator::setCurrent(allocator);
+    }
+    ~ATFAllocatorScope() {
+        ATFAllocator::setCurrent(m_prev);
+    }
+
+private:
+    ATFAllocatorScope(const ATFAllocatorScope &);
+    ATFAllocatorScope &operator=(const ATFAllocatorScope &);
+
+    ATFAllocator *m_prev;
+};
+
+// malloc/free
+class ATFHeapAllocator : public ATFAllocator {
+public:
+    void *allocate(size_t size) override;
+    void deallocate(void *ptr, size_t size) override;
+
+    static ATFHeapAllocator *instance();
+};
+
+// Caches freed blocks in power of two size classes up to kMaxPooledSize,
+// larger blocks go straight to the heap. Meant to be used one per thread
+// (see threadLocal()) so that parallel encodes do not contend on malloc:
+// allocate() and trim() belong to the thread that created the pool and take
+// no lock. deallocate() may come from any thread; the owner puts the block
+// back on its free list, other threads push it onto an atomic remote list
+// that the owner takes over whenever a size class runs dry.
+class ATFPoolAllocator : public ATFAllocator {
+public:
+    enum {
+        kMinClassShift = 4,
+        kMaxClassShift = 20,
+        kMaxPooledSize = 1 << kMaxClassShift,
+        kClassCount = kMaxClassShift - kMinClassShift + 1
+    };
+
+    ATFPoolAllocator();
+    ~ATFPoolAllocator();
+
+    void *allocate(size_t size) override;
+    void deallocate(void *ptr, size_t size) override;
+
+    // returns cached blocks to the heap, owner thread only
+    void trim();
+
+    // the calling thread's pool, created on first use and released when the
+    // thread exits
+    static ATFPoolAllocator *threadLocal();
+
+private:
+    friend struct ATFPoolAllocatorThreadSlot;
+
+    ATFPoolAllocator(const ATFPoolAllocator &);
+    ATFPoolAllocator &operator=(const ATFPoolAllocator &);
+
+    struct FreeBlock {
+        FreeBlock * next;
+        int         sizeClass;
+    };
+
+    static int sizeClass(size_t size);
+
+    bool owned() const;
+    // moves the blocks other threads freed onto the free lists
+    void drainRemote();
+    void freeList(FreeBlock *block);
+
+    // called when the owning thread exits
+    void retire();
+
+    std::thread::id             m_owner;
+    FreeBlock *                 m_free[kClassCount];
+    std::atomic<FreeBlock *>    m_remote;
+    std::atomic<bool>           m_retired;
+};
+
+// Forwards to another allocator and keeps statistics.
+class ATFCountingAllocator : public ATFAllocator {
+public:
+    explicit ATFCountingAllocator(ATFAllocator *parent = 0);
+    ~ATFCountingAllocator();
+
+    void *allocate(size_t size) override;
+    void deallocate(void *ptr, size_t size) override;
+
+    void reset();
+
+    uint64_t allocCount() const { return m_allocCount; }
+    uint64_t freeCount() const { return m_freeCount; }
+    uint64_t totalBytes() const { return m_totalBytes; }
+    uint64_t liveBytes() const { return m_liveBytes; }
+    uint64_t peakBytes() const { return m_peakBytes; }
+    uint64_t largestAlloc() const { return m_largest; }
+
+private:
+    ATFAllocator *          m_parent;
+    std::atomic<uint64_t>   m_allocCount;
+    std::atomic<uint64_t>   m_freeCount;
+    std::atomic<uint64_t>   m_totalBytes;
+    std::atomic<uint64_t>   m_liveBytes;
+    std::atomic<uint64_t>   m_peakBytes;
+    std::atomic<uint64_t>   m_largest;
+};
+
+void *atf_alloc(size_t size);
+void atf_free(void *ptr);
+
+// ISzAlloc compatible callbacks, e.g. ISzAlloc alloc = { atf_sz_alloc, atf_sz_free };
+void *atf_sz_alloc(void *p, size_t size);
+void atf_sz_free(void *p, void *address);
+
+// Call once at startup, before any JPEG-XR or LZMA object is created.
+void atf_install_allocator_hooks();
+
+#endif //#ifndef _ATFALLOC_H_
@@ -0,0 +1,614 @@
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ATF_BLOCK_SSE2 1
+#endif
+
+#include "atfblock.h"
+
+namespace {
+
+// levels with fewer blocks per thread are not worth splitting
+const int32_t kMinBlocksPerThread = 4096;
+
+const int32_t kEtc1Modifiers[8][2] = {
+    { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 }
+};
+
+// pvrtc modulation weight of color b in eighths, standard and punch-through mode
+const int32_t kPvrtcModulation[2][4] = {
+    { 0, 3, 5, 8 },
+    { 0, 4, 4, 8 }
+};
+
+typedef void (*RowDecoder)(const ATFBlockImage &image, int32_t row, uint8_t *dst, size_t pitch);
+
+uint32_t get_u32le(const uint8_t *p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+int32_t blocks_wide(const ATFBlockImage &image)
+{
+    return std::max(image.format == ATF_BLOCK_PVRTC4 ? 2 : 1, image.width / 4);
+}
+
+int32_t blocks_high(const ATFBlockImage &image)
+{
+    return std::max(image.format == ATF_BLOCK_PVRTC4 ? 2 : 1, image.height / 4);
+}
+
+// same order as ATFDecoder::pvrtc_twiddle
+int32_t twiddle(int32_t u, int32_t v, int32_t w, int32_t h)
+{
+    int32_t mins = h < w ? h : w;
+    int32_t maxv = h < w ? u : v;
+    int32_t r = 0;
+    int32_t b = 1;
+    int32_t c = 0;
+    for ( int32_t a = 1; a < mins; a <<= 1 ) {
+        if ( u & a ) {
+            r |= b << 1;
+        }
+        if ( v & a ) {
+            r |= b;
+        }
+        b <<= 2;
+        c++;
+    }
+    return r | ((maxv >> c) << (2 * c));
+}
+
+void expand565(uint32_t c, uint8_t *rgba)
+{
+    int32_t r = (c >> 11) & 0x1F;
+    int32_t g = (c >> 5) & 0x3F;
+    int32_t b = c & 0x1F;
+    rgba[0] = uint8_t((r << 3) | (r >> 2));
+    rgba[1] = uint8_t((g << 2) | (g >> 4));
+    rgba[2] = uint8_t((b << 3) | (b >> 2));
+    rgba[3] = 255;
+}
+
+// the four colors of a dxt color block. dxt5 always uses four colors, dxt1
+// three and transparent black when c0 <= c1.
+bool bc1_four_colors(const uint8_t *block, bool bc3)
+{
+    return bc3 || (block[0] | (block[1] << 8)) > (block[2] | (block[3] << 8));
+}
+
+void bc1_palette(const uint8_t *block, bool bc3, uint8_t pal[4][4])
+{
+    expand565(block[0] | (block[1] << 8), pal[0]);
+    expand565(block[2] | (block[3] << 8), pal[1]);
+    bool four = bc1_four_colors(block, bc3);
+    for ( int32_t ch = 0; ch < 4; ch++ ) {
+        if ( four ) {
+            pal[2][ch] = uint8_t((2 * pal[0][ch] + pal[1][ch]) / 3);
+            pal[3][ch] = uint8_t((pal[0][ch] + 2 * pal[1][ch]) / 3);
+        } else {
+            pal[2][ch] = uint8_t((pal[0][ch] + pal[1][ch]) / 2);
+            pal[3][ch] = 0;
+        }
+    }
+}
+
+void bc3_alphas(const uint8_t *block, uint8_t alphas[8])
+{
+    int32_t a0 = block[0];
+    int32_t a1 = block[1];
+    alphas[0] = uint8_t(a0);
+    alphas[1] = uint8_t(a1);
+    if ( a0 > a1 ) {
+        for ( int32_t i = 2; i < 8; i++ ) {
+            alphas[i] = uint8_t(((8 - i) * a0 + (i - 1) * a1) / 7);
+        }
+    } else {
+        for ( int32_t i = 2; i < 6; i++ ) {
+            alphas[i] = uint8_t(((6 - i) * a0 + (i - 1) * a1) / 5);
+        }
+        alphas[6] = 0;
+        alphas[7] = 255;
+    }
+}
+
+uint64_t bc3_alpha_bits(const uint8_t *block)
+{
+    uint64_t bits = 0;
+    for ( int32_t i = 0; i < 6; i++ ) {
+        bits |= uint64_t(block[2 + i]) << (8 * i);
+    }
+    return bits;
+}
+
+struct Etc1Block {
+    int32_t base[2][3];
+    const int32_t *modifiers[2];
+    bool flip;
+    uint32_t bits;
+};
+
+void etc1_unpack(const uint8_t *block, Etc1Block &etc)
+{
+    for ( int32_t ch = 0; ch < 3; ch++ ) {
+        if ( block[3] & 2 ) {
+            int32_t c0 = block[ch] >> 3;
+            int32_t c1 = (c0 + (int32_t(block[ch] & 7) ^ 4) - 4) & 0x1F;
+            etc.base[0][ch] = (c0 << 3) | (c0 >> 2);
+            etc.base[1][ch] = (c1 << 3) | (c1 >> 2);
+        } else {
+            etc.base[0][ch] = (block[ch] >> 4) * 17;
+            etc.base[1][ch] = (block[ch] & 0xF) * 17;
+        }
+    }
+    etc.modifiers[0] = kEtc1Modifiers[block[3] >> 5];
+    etc.modifiers[1] = kEtc1Modifiers[(block[3] >> 2) & 7];
+    etc.flip = (block[3] & 1) != 0;
+    etc.bits = (uint32_t(block[4]) << 24) | (uint32_t(block[5]) << 16) | (uint32_t(block[6]) << 8) | block[7];
+}
+
+int32_t etc1_subblock(const Etc1Block &etc, int32_t x, int32_t y)
+{
+    return etc.flip ? (y >= 2) : (x >= 2);
+}
+
+// pixels are indexed column by column, the low bit picks the modifier and
+// the high bit negates it
+int32_t etc1_modifier(const Etc1Block &etc, int32_t x, int32_t y)
+{
+    int32_t i = x * 4 + y;
+    int32_t m = etc.modifiers[etc1_subblock(etc, x, y)][(etc.bits >> i) & 1];
+    return ((etc.bits >> (i + 16)) & 1) ? -m : m;
+}
+
+uint8_t clamp255(int32_t v)
+{
+    return uint8_t(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// color a and b of a pvrtc block as RGBA8. opaque colors are RGB555 (a has
+// one blue bit less), translucent ones ARGB3444 (a: ARGB3443).
+void pvrtc_colors(const uint8_t *block, uint8_t a[4], uint8_t b[4])
+{
+    uint32_t ca = block[4] | (block[5] << 8);
+    uint32_t cb = block[6] | (block[7] << 8);
+    int32_t c[2][4];
+    if ( ca & 0x8000 ) {
+        c[0][0] = (ca >> 10) & 0x1F;
+        c[0][1] = (ca >> 5) & 0x1F;
+        c[0][2] = (ca & 0x1E) | ((ca & 0x1E) >> 4);
+        c[0][3] = 0xF;
+    } else {
+        c[0][0] = ((ca >> 7) & 0x1E) | ((ca >> 11) & 1);
+        c[0][1] = ((ca >> 3) & 0x1E) | ((ca >> 7) & 1);
+        c[0][2] = ((ca << 1) & 0x1C) | ((ca >> 2) & 3);
+        c[0][3] = (ca >> 11) & 0xE;
+    }
+    if ( cb & 0x8000 ) {
+        c[1][0] = (cb >> 10) & 0x1F;
+        c[1][1] = (cb >> 5) & 0x1F;
+        c[1][2] = cb & 0x1F;
+        c[1][3] = 0xF;
+    } else {
+        c[1][0] = ((cb >> 7) & 0x1E) | ((cb >> 11) & 1);
+        c[1][1] = ((cb >> 3) & 0x1E) | ((cb >> 7) & 1);
+        c[1][2] = ((cb << 1) & 0x1E) | ((cb >> 3) & 1);
+        c[1][3] = (cb >> 11) & 0xE;
+    }
+    uint8_t *out[2] = { a, b };
+    for ( int32_t i = 0; i < 2; i++ ) {
+        for ( int32_t ch = 0; ch < 3; ch++ ) {
+            out[i][ch] = uint8_t((c[i][ch] << 3) | (c[i][ch] >> 2));
+        }
+        out[i][3] = uint8_t((c[i][3] << 4) | c[i][3]);
+    }
+}
+
+//
+// plain C reference, one block row of 4 pixel rows at a time
+//
+
+void bc1_block_reference(const uint8_t *block, bool bc3, uint8_t *dst, size_t pitch)
+{
+    uint8_t pal[4][4];
+    bc1_palette(block, bc3, pal);
+    for ( int32_t y = 0; y < 4; y++ ) {
+        for ( int32_t x = 0; x < 4; x++ ) {
+            memcpy(dst + y * pitch + x * 4, pal[(block[4 + y] >> (2 * x)) & 3], 4);
+        }
+    }
+}
+
+void etc1_block_reference(const uint8_t *block, uint8_t *dst, size_t pitch, int32_t channels)
+{
+    Etc1Block etc;
+    etc1_unpack(block, etc);
+    for ( int32_t y = 0; y < 4; y++ ) {
+        for ( int32_t x = 0; x < 4; x++ ) {
+            const int32_t *base = etc.base[etc1_subblock(etc, x, y)];
+            int32_t m = etc1_modifier(etc, x, y);
+            uint8_t *p = dst + y * pitch + x * 4;
+            if ( channels == 1 ) {
+                p[3] = clamp255(base[0] + m);
+            } else {
+                p[0] = clamp255(base[0] + m);
+                p[1] = clamp255(base[1] + m);
+                p[2] = clamp255(base[2] + m);
+                p[3] = 255;
+            }
+        }
+    }
+}
+
+void pvrtc_row_reference(const ATFBlockImage &image, int32_t row, uint8_t *dst, size_t pitch)
+{
+    int32_t bw = blocks_wide(image);
+    int32_t bh = blocks_high(image);
+    for ( int32_t py = 0; py < 4; py++ ) {
+        // pixels sit between the centers of the blocks above/left and below/right
+        int32_t rt = py < 2 ? (row + bh - 1) % bh : row;
+        int32_t rb = py < 2 ? row : (row + 1) % bh;
+        int32_t fy = py < 2 ? py + 2 : py - 2;
+        for ( int32_t x = 0; x < bw * 4; x++ ) {
+            int32_t c = x / 4;
+            int32_t px = x % 4;
+            int32_t cl = px < 2 ? (c + bw - 1) % bw : c;
+            int32_t cr = px < 2 ? c : (c + 1) % bw;
+            int32_t fx = px < 2 ? px + 2 : px - 2;
+
+            uint8_t a[4][4];
+            uint8_t b[4][4];
+            pvrtc_colors(image.blocks + twiddle(cl, rt, bw, bh) * 8, a[0], b[0]);
+            pvrtc_colors(image.blocks + twiddle(cr, rt, bw, bh) * 8, a[1], b[1]);
+            pvrtc_colors(image.blocks + twiddle(cl, rb, bw, bh) * 8, a[2], b[2]);
+            pvrtc_colors(image.blocks + twiddle(cr, rb, bw, bh) * 8, a[3], b[3]);
+
+            const uint8_t *block = image.blocks + twiddle(c, row, bw, bh) * 8;
+            int32_t mode = block[4] & 1;
+            int32_t index = (get_u32le(block) >> (2 * (py * 4 + px))) & 3;
+            int32_t m = kPvrtcModulation[mode][index];
+
+            uint8_t *p = dst + py * pitch + x * 4;
+            for ( int32_t ch = 0; ch < 4; ch++ ) {
+                int32_t ua = (a[0][ch] * (4 - fy) + a[2][ch] * fy) * (4 - fx) + (a[1][ch] * (4 - fy) + a[3][ch] * fy) * fx;
+                int32_t ub = (b[0][ch] * (4 - fy) + b[2][ch] * fy) * (4 - fx) + (b[1][ch] * (4 - fy) + b[3][ch] * fy) * fx;
+                p[ch] = uint8_t((ua * (8 - m) + ub * m + 64) >> 7);
+            }
+            if ( mode && index == 2 ) {
+                p[3] = 0;
+            }
+        }
+    }
+}
+
+void decode_row_reference(const ATFBlockImage &image, int32_t row, uint8_t *dst, size_t pitch)
+{
+    if ( image.format == ATF_BLOCK_PVRTC4 ) {
+        pvrtc_row_reference(image, row, dst, pitch);
+        return;
+    }
+
+    int32_t bw = blocks_wide(image);
+    int32_t bh = blocks_high(image);
+    for ( int32_t c = 0; c < bw; c++ ) {
+        size_t i = size_t(row) * bw + c;
+        uint8_t *p = dst + c * 16;
+        switch ( image.format ) {
+            case ATF_BLOCK_BC1:
+                bc1_block_reference(image.blocks + i * 8, false, p, pitch);
+                break;
+            case ATF_BLOCK_BC3: {
+                const uint8_t *block = image.blocks + i * 16;
+                bc1_block_reference(block + 8, true, p, pitch);
+                uint8_t alphas[8];
+                bc3_alphas(block, alphas);
+                uint64_t bits = bc3_alpha_bits(block);
+                for ( int32_t k = 0; k < 16; k++ ) {
+                    p[(k / 4) * pitch + (k % 4) * 4 + 3] = alphas[(bits >> (3 * k)) & 7];
+                }
+                break;
+            }
+            case ATF_BLOCK_ETC1:
+                etc1_block_reference(image.blocks + i * 8, p, pitch, 3);
+                break;
+            case ATF_BLOCK_ETC1_ALPHA:
+                etc1_block_reference(image.blocks + i * 8, p, pitch, 3);
+                etc1_block_reference(image.blocks + (size_t(bw) * bh + i) * 8, p, pitch, 1);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+#ifdef ATF_BLOCK_SSE2
+
+//
+// SSE2, four pixels (one row of a block) per register
+//
+
+__m128i bc1_palette_sse2(const uint8_t *block, bool bc3)
+{
+    uint8_t e[2][4];
+    expand565(block[0] | (block[1] << 8), e[0]);
+    expand565(block[2] | (block[3] << 8), e[1]);
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i e0 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(int32_t(get_u32le(e[0]))), zero);
+    __m128i e1 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(int32_t(get_u32le(e[1]))), zero);
+    __m128i p2;
+    __m128i p3;
+    if ( bc1_four_colors(block, bc3) ) {
+        // x / 3 == (x * 0xAAAB) >> 17 for x < 98304
+        __m128i third = _mm_set1_epi16(int16_t(0xAAAB));
+        p2 = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(e0, e0), e1), third), 1);
+        p3 = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(e1, e1), e0), third), 1);
+    } else {
+        p2 = _mm_srli_epi16(_mm_add_epi16(e0, e1), 1);
+        p3 = zero;
+    }
+    return _mm_packus_epi16(_mm_unpacklo_epi64(e0, e1), _mm_unpacklo_epi64(p2, p3));
+}
+
+// one pixel row from a four entry palette, bits holds the 2 bit indices
+__m128i bc1_select_sse2(__m128i pal, uint32_t bits)
+{
+    __m128i three = _mm_set_epi32(0xC0, 0x30, 0x0C, 0x03);
+    __m128i one = _mm_set_epi32(0x40, 0x10, 0x04, 0x01);
+    __m128i two = _mm_set_epi32(0x80, 0x20, 0x08, 0x02);
+    __m128i index = _mm_and_si128(_mm_set1_epi32(int32_t(bits)), three);
+
+    __m128i out = _mm_and_si128(_mm_cmpeq_epi32(index, _mm_setzero_si128()), _mm_shuffle_epi32(pal, 0x00));
+    out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi32(index, one), _mm_shuffle_epi32(pal, 0x55)));
+    out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi32(index, two), _mm_shuffle_epi32(pal, 0xAA)));
+    out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi32(index, three), _mm_shuffle_epi32(pal, 0xFF)));
+    return out;
+}
+
+// one pixel row of an etc1 block, base colors and modifiers added in 16 bit
+// lanes and clamped by the pack
+__m128i etc1_row_sse2(const Etc1Block &etc, int32_t y)
+{
+    __m128i base[2];
+    for ( int32_t s = 0; s < 2; s++ ) {
+        const int32_t *b = etc.base[s];
+        base[s] = _mm_set_epi16(255, int16_t(b[2]), int16_t(b[1]), int16_t(b[0]), 255, int16_t(b[2]), int16_t(b[1]), int16_t(b[0]));
+    }
+    int16_t m[4];
+    for ( int32_t x = 0; x < 4; x++ ) {
+        m[x] = int16_t(etc1_modifier(etc, x, y));
+    }
+    __m128i lo = etc.flip ? base[y >= 2] : base[0];
+    __m128i hi = etc.flip ? base[y >= 2] : base[1];
+    lo = _mm_add_epi16(lo, _mm_set_epi16(0, m[1], m[1], m[1], 0, m[0], m[0], m[0]));
+    hi = _mm_add_epi16(hi, _mm_set_epi16(0, m[3], m[3], m[3], 0, m[2], m[2], m[2]));
+    return _mm_packus_epi16(lo, hi);
+}
+
+// color a in the low, color b in the high four 16 bit lanes
+__m128i pvrtc_colors_sse2(const uint8_t *block)
+{
+    uint8_t a[4];
+    uint8_t b[4];
+    pvrtc_colors(block, a, b);
+    return _mm_set_epi16(b[3], b[2], b[1], b[0], a[3], a[2], a[1], a[0]);
+}
+
+// keeps the vector type out of template arguments
+struct Lanes {
+    __m128i v;
+};
+
+void pvrtc_row_sse2(const ATFBlockImage &image, int32_t row, uint8_t *dst, size_t pitch)
+{
+    // low lanes weight color a, high lanes color b
+    alignas(16) static const int16_t kWeights[2][4][8] = {
+        { { 8, 8, 8, 8, 0, 0, 0, 0 }, { 5, 5, 5, 5, 3, 3, 3, 3 }, { 3, 3, 3, 3, 5, 5, 5, 5 }, { 0, 0, 0, 0, 8, 8, 8, 8 } },
+        { { 8, 8, 8, 8, 0, 0, 0, 0 }, { 4, 4, 4, 4, 4, 4, 4, 4 }, { 4, 4, 4, 4, 4, 4, 4, 4 }, { 0, 0, 0, 0, 8, 8, 8, 8 } }
+    };
+
+    int32_t bw = blocks_wide(image);
+    int32_t bh = blocks_high(image);
+
+    // colors of the block rows above, at and below row, then blended vertically
+    std::vector<Lanes> colors(size_t(bw) * 3);
+    std::vector<Lanes> blend(bw);
+    for ( int32_t k = 0; k < 3; k++ ) {
+        int32_t r = (row + bh - 1 + k) % bh;
+        for ( int32_t c = 0; c < bw; c++ ) {
+            colors[k * bw + c].v = pvrtc_colors_sse2(image.blocks + twiddle(c, r, bw, bh) * 8);
+        }
+    }
+
+    __m128i round = _mm_set1_epi16(64);
+    for ( int32_t py = 0; py < 4; py++ ) {
+        const Lanes *top = colors.data() + (py < 2 ? 0 : bw);
+        const Lanes *bottom = top + bw;
+        int32_t fy = py < 2 ? py + 2 : py - 2;
+        __m128i wt = _mm_set1_epi16(int16_t(4 - fy));
+        __m128i wb = _mm_set1_epi16(int16_t(fy));
+        for ( int32_t c = 0; c < bw; c++ ) {
+            blend[c].v = _mm_add_epi16(_mm_mullo_epi16(top[c].v, wt), _mm_mullo_epi16(bottom[c].v, wb));
+        }
+
+        for ( int32_t c = 0; c < bw; c++ ) {
+            __m128i left = blend[(c + bw - 1) % bw].v;
+            __m128i mid = blend[c].v;
+            __m128i right = blend[(c + 1) % bw].v;
+            __m128i mid3 = _mm_add_epi16(_mm_slli_epi16(mid, 1), mid);
+            __m128i ab[4];
+            ab[0] = _mm_slli_epi16(_mm_add_epi16(left, mid), 1);
+            ab[1] = _mm_add_epi16(left, mid3);
+            ab[2] = _mm_slli_epi16(mid, 2);
+            ab[3] = _mm_add_epi16(mid3, right);
+
+            const uint8_t *block = image.blocks + twiddle(c, row, bw, bh) * 8;
+            int32_t mode = block[4] & 1;
+            uint32_t bits = get_u32le(block) >> (8 * py);
+
+            __m128i px[4];
+            int32_t punch[4];
+            for ( int32_t x = 0; x < 4; x++ ) {
+                int32_t index = (bits >> (2 * x)) & 3;
+                __m128i p = _mm_mullo_epi16(ab[x], _mm_load_si128(reinterpret_cast<const __m128i *>(kWeights[mode][index])));
+                p = _mm_add_epi16(p, _mm_srli_si128(p, 8));
+                px[x] = _mm_srli_epi16(_mm_add_epi16(p, round), 7);
+                punch[x] = ( mode && index == 2 ) ? 0x00FFFFFF : -1;
+            }
+            __m128i out = _mm_packus_epi16(_mm_unpacklo_epi64(px[0], px[1]), _mm_unpacklo_epi64(px[2], px[3]));
+            if ( mode ) {
+                out = _mm_and_si128(out, _mm_set_epi32(punch[3], punch[2], punch[1], punch[0]));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + py * pitch + c * 16), out);
+        }
+    }
+}
+
+void decode_row_sse2(const ATFBlockImage &image, int32_t row, uint8_t *dst, size_t pitch)
+{
+    int32_t bw = blocks_wide(image);
+    int32_t bh = blocks_high(image);
+    __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+
+    switch ( image.format ) {
+        case ATF_BLOCK_BC1:
+            for ( int32_t c = 0; c < bw; c++ ) {
+                const uint8_t *block = image.blocks + (size_t(row) * bw + c) * 8;
+                __m128i pal = bc1_palette_sse2(block, false);
+                for ( int32_t y = 0; y < 4; y++ ) {
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + y * pitch + c * 16), bc1_select_sse2(pal, block[4 + y]));
+                }
+            }
+            break;
+        case ATF_BLOCK_BC3:
+            for ( int32_t c = 0; c < bw; c++ ) {
+                const uint8_t *block = image.blocks + (size_t(row) * bw + c) * 16;
+                __m128i pal = bc1_palette_sse2(block + 8, true);
+                uint8_t alphas[8];
+                bc3_alphas(block, alphas);
+                uint64_t bits = bc3_alpha_bits(block);
+                for ( int32_t y = 0; y < 4; y++ ) {
+                    uint32_t b = uint32_t(bits >> (12 * y));
+                    __m128i alpha = _mm_set_epi32(int32_t(uint32_t(alphas[(b >> 9) & 7]) << 24),
+                                                  int32_t(uint32_t(alphas[(b >> 6) & 7]) << 24),
+                                                  int32_t(uint32_t(alphas[(b >> 3) & 7]) << 24),
+                                                  int32_t(uint32_t(alphas[b & 7]) << 24));
+                    __m128i color = _mm_and_si128(bc1_select_sse2(pal, block[12 + y]), rgb);
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + y * pitch + c * 16), _mm_or_si128(color, alpha));
+                }
+            }
+            break;
+        case ATF_BLOCK_ETC1:
+        case ATF_BLOCK_ETC1_ALPHA:
+            for ( int32_t c = 0; c < bw; c++ ) {
+                size_t i = size_t(row) * bw + c;
+                Etc1Block color;
+                Etc1Block alpha;
+                etc1_unpack(image.blocks + i * 8, color);
+                if ( image.format == ATF_BLOCK_ETC1_ALPHA ) {
+                    etc1_unpack(image.blocks + (size_t(bw) * bh + i) * 8, alpha);
+                }
+                for ( int32_t y = 0; y < 4; y++ ) {
+                    __m128i out = etc1_row_sse2(color, y);
+                    if ( image.format == ATF_BLOCK_ETC1_ALPHA ) {
+                        // red of the alpha block moves to the alpha byte
+                        out = _mm_or_si128(_mm_and_si128(out, rgb), _mm_slli_epi32(etc1_row_sse2(alpha, y), 24));
+                    }
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + y * pitch + c * 16), out);
+                }
+            }
+            break;
+        case ATF_BLOCK_PVRTC4:
+            pvrtc_row_sse2(image, row, dst, pitch);
+            break;
+    }
+}
+
+#endif // ATF_BLOCK_SSE2
+
+void decode_rows(const ATFBlockImage &image, int32_t first, int32_t last, uint8_t *dst, size_t pitch, RowDecoder decodeRow)
+{
+    int32_t bw = blocks_wide(image);
+    last = std::min(last, blocks_high(image));
+
+    std::vector<uint8_t> strip;
+    for ( int32_t r = first; r < last; r++ ) {
+        int32_t y = r * 4;
+        if ( image.width == bw * 4 && y + 4 <= image.height ) {
+            decodeRow(image, r, dst + y * pitch, pitch);
+            continue;
+        }
+        // level smaller than its blocks, decode aside and copy what is inside
+        size_t stripPitch = size_t(bw) * 16;
+        strip.resize(stripPitch * 4);
+        decodeRow(image, r, strip.data(), stripPitch);
+        for ( int32_t py = 0; py < 4 && y + py < image.height; py++ ) {
+            memcpy(dst + (y + py) * pitch, strip.data() + py * stripPitch, size_t(std::min(image.width, bw * 4)) * 4);
+        }
+    }
+}
+
+}
+
+int32_t atf_block_rows(const ATFBlockImage &image)
+{
+    return blocks_high(image);
+}
+
+size_t atf_block_data_size(const ATFBlockImage &image)
+{
+    size_t blocks = size_t(blocks_wide(image)) * blocks_high(image);
+    switch ( image.format ) {
+        case ATF_BLOCK_BC3:
+            return blocks * 16;
+        case ATF_BLOCK_ETC1_ALPHA:
+            return blocks * 16;
+        default:
+            return blocks * 8;
+    }
+}
+
+void atf_block_decode_rows(const ATFBlockImage &image, int32_t first, int32_t last, uint8_t *dst, size_t pitch)
+{
+#ifdef ATF_BLOCK_SSE2
+    decode_rows(image, first, last, dst, pitch, decode_row_sse2);
+#else
+    decode_rows(image, first, last, dst, pitch, decode_row_reference);
+#endif
+}
+
+void atf_block_decode_rows_reference(const ATFBlockImage &image, int32_t first, int32_t last, uint8_t *dst, size_t pitch)
+{
+    decode_rows(image, first, last, dst, pitch, decode_row_reference);
+}
+
+void atf_block_decode(const ATFBlockImage &image, uint8_t *dst, size_t pitch, int32_t threads)
+{
+    int32_t rows = blocks_high(image);
+    if ( threads <= 0 ) {
+        threads = std::max(1, int32_t(std::thread::hardware_concurrency()));
+    }
+    int32_t rowsPerThread = std::max(1, kMinBlocksPerThread / blocks_wide(image));
+    threads = std::min(threads, (rows + rowsPerThread - 1) / rowsPerThread);
+
+    if ( threads <= 1 ) {
+        atf_block_decode_rows(image, 0, rows, dst, pitch);
+        return;
+    }
+
+    // contiguous bands of block rows, the first one on the calling thread
+    std::vector<std::thread> workers;
+    for ( int32_t t = 1; t < threads; t++ ) {
+        workers.emplace_back(atf_block_decode_rows, std::cref(image), rows * t / threads, rows * (t + 1) / threads, dst, pitch);
+    }
+    atf_block_decode_rows(image, 0, rows / threads, dst, pitch);
+    for ( auto &worker : workers ) {
+        worker.join();
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef _ATFBLOCK_H_
+#define _ATFBLOCK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Software decompression of the GPU block formats ATFDecoder produces, for
+// clients without hardware support for them (PREFER_FALLBACK), thumbnailers
+// and CPU side inspection of mip levels. Output is RGBA8888, R first in
+// memory.
+//
+// The block data is one level as ATFDecoder lays it out:
+//
+//   ATF_BLOCK_BC1          dxt1 blocks in rows, max(1,w/4) x max(1,h/4)
+//   ATF_BLOCK_BC3          dxt5 blocks in rows
+//   ATF_BLOCK_ETC1         etc1 blocks in rows
+//   ATF_BLOCK_ETC1_ALPHA   etc1 color blocks followed by as many etc1 blocks
+//                          whose red channel is the alpha
+//   ATF_BLOCK_PVRTC4       pvrtc 4bpp blocks in twiddled order,
+//                          max(2,w/4) x max(2,h/4)
+//
+// Rows of blocks are decoded with SSE2 where the compiler targets it and with
+// the plain C reference otherwise; both give the same bytes. Pixels outside
+// width x height (levels smaller than a block) are not written.
+//
+
+enum ATFBlockFormat {
+    ATF_BLOCK_BC1,
+    ATF_BLOCK_BC3,
+    ATF_BLOCK_ETC1,
+    ATF_BLOCK_ETC1_ALPHA,
+    ATF_BLOCK_PVRTC4
+};
+
+struct ATFBlockImage {
+    ATFBlockFormat format;
+    const uint8_t *blocks;
+    int32_t width;          // pixels of the level, at least 1
+    int32_t height;
+};
+
+// Rows of blocks in the level and the byte count of its block data.
+int32_t atf_block_rows(const ATFBlockImage &image);
+size_t atf_block_data_size(const ATFBlockImage &image);
+
+// Decodes block rows [first, last) to RGBA rows. dst is pixel row 0 of the
+// level, pitch bytes from one pixel row to the next.
+void atf_block_decode_rows(const ATFBlockImage &image, int32_t first, int32_t last, uint8_t *dst, size_t pitch);
+void atf_block_decode_rows_reference(const ATFBlockImage &image, int32_t first, int32_t last, uint8_t *dst, size_t pitch);
+
+// Decodes the whole level, splitting the block rows over up to threads
+// threads (0 for one per core). Small levels stay on the calling thread.
+void atf_block_decode(const ATFBlockImage &image, uint8_t *dst, size_t pitch, int32_t threads = 0);
+
+#endif //#ifndef _ATFBLOCK_H_
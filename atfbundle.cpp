@@ -0,0 +1,341 @@
+#include "atfbundle.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif //#ifndef _MSC_VER
+
+namespace {
+
+uint32_t readU32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+uint64_t readU64(const uint8_t *p)
+{
+    return uint64_t(readU32(p)) | (uint64_t(readU32(p + 4)) << 32);
+}
+
+void writeU32(uint32_t v, std::vector<uint8_t> &out)
+{
+    out.push_back(uint8_t(v));
+    out.push_back(uint8_t(v >> 8));
+    out.push_back(uint8_t(v >> 16));
+    out.push_back(uint8_t(v >> 24));
+}
+
+void writeU64(uint64_t v, std::vector<uint8_t> &out)
+{
+    writeU32(uint32_t(v), out);
+    writeU32(uint32_t(v >> 32), out);
+}
+
+uint64_t fnv1a(const uint8_t *data, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for ( size_t i = 0; i < length; i++ ) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+struct Entry {
+    uint64_t hash;
+    uint64_t offset;
+    uint64_t length;
+    const std::string *name;
+};
+
+}
+
+uint64_t atf_bundle_hash(const char *name, size_t length)
+{
+    return fnv1a(reinterpret_cast<const uint8_t *>(name), length);
+}
+
+bool atf_bundle_write(const std::vector<ATFBundleInput> &inputs, uint32_t alignment, bool dedup, std::ostream &out,
+                      ATFBundleStats *stats)
+{
+    if ( alignment == 0 || (alignment & (alignment - 1)) != 0 || inputs.size() > 0xFFFFFFFFu ) {
+        return false;
+    }
+
+    uint64_t namesLength = 0;
+    for ( const auto &input : inputs ) {
+        namesLength += input.name.size();
+    }
+    if ( namesLength > 0xFFFFFFFFu ) {
+        return false;
+    }
+    uint64_t mask = alignment - 1;
+    uint64_t pos = ATF_BUNDLE_HEADER_SIZE + uint64_t(inputs.size()) * ATF_BUNDLE_ENTRY_SIZE + namesLength;
+
+    // data in input order, identical contents found by their hash first
+    std::vector<Entry> entries(inputs.size());
+    std::vector<const ATFBundleInput *> stored;
+    std::unordered_multimap<uint64_t, size_t> contents;
+    for ( size_t i = 0; i < inputs.size(); i++ ) {
+        const ATFBundleInput &input = inputs[i];
+        Entry &entry = entries[i];
+        entry.hash = atf_bundle_hash(input.name.data(), input.name.size());
+        entry.name = &input.name;
+        entry.length = input.length;
+        entry.offset = 0;
+        if ( input.length == 0 ) {
+            continue;
+        }
+
+        uint64_t content = dedup ? fnv1a(input.data, input.length) : 0;
+        bool shared = false;
+        auto range = contents.equal_range(content);
+        for ( auto it = range.first; dedup && it != range.second; ++it ) {
+            const Entry &other = entries[it->second];
+            if ( other.length == input.length && memcmp(inputs[it->second].data, input.data, input.length) == 0 ) {
+                entry.offset = other.offset;
+                shared = true;
+                break;
+            }
+        }
+        if ( shared ) {
+            continue;
+        }
+        pos = (pos + mask) & ~mask;
+        entry.offset = pos;
+        pos += input.length;
+        stored.push_back(&input);
+        if ( dedup ) {
+            contents.emplace(content, i);
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.hash != b.hash ? a.hash < b.hash : *a.name < *b.name;
+    });
+    for ( size_t i = 1; i < entries.size(); i++ ) {
+        if ( entries[i].hash == entries[i - 1].hash && *entries[i].name == *entries[i - 1].name ) {
+            return false;
+        }
+    }
+
+    std::vector<uint8_t> head;
+    head.reserve(size_t(ATF_BUNDLE_HEADER_SIZE + entries.size() * ATF_BUNDLE_ENTRY_SIZE + namesLength));
+    head.push_back('A');
+    head.push_back('T');
+    head.push_back('F');
+    head.push_back('B');
+    writeU32(ATF_BUNDLE_VERSION, head);
+    writeU32(uint32_t(entries.size()), head);
+    writeU32(alignment, head);
+    writeU64(ATF_BUNDLE_HEADER_SIZE + uint64_t(entries.size()) * ATF_BUNDLE_ENTRY_SIZE, head);
+    writeU64(namesLength, head);
+    writeU64(pos, head);
+    uint32_t nameOffset = 0;
+    for ( const auto &entry : entries ) {
+        writeU64(entry.hash, head);
+        writeU64(entry.offset, head);
+        writeU64(entry.length, head);
+        writeU32(nameOffset, head);
+        writeU32(uint32_t(entry.name->size()), head);
+        nameOffset += uint32_t(entry.name->size());
+    }
+    for ( const auto &entry : entries ) {
+        head.insert(head.end(), entry.name->begin(), entry.name->end());
+    }
+    out.write(reinterpret_cast<const char *>(head.data()), head.size());
+
+    static const char zeros[4096] = {};
+    uint64_t written = head.size();
+    for ( const ATFBundleInput *input : stored ) {
+        uint64_t start = (written + mask) & ~mask;
+        while ( written < start ) {
+            size_t padding = size_t(std::min<uint64_t>(sizeof(zeros), start - written));
+            out.write(zeros, padding);
+            written += padding;
+        }
+        out.write(reinterpret_cast<const char *>(input->data), input->length);
+        written += input->length;
+    }
+
+    if ( stats ) {
+        stats->entries = inputs.size();
+        stats->stored = stored.size();
+        stats->inputBytes = 0;
+        for ( const auto &input : inputs ) {
+            stats->inputBytes += input.length;
+        }
+        stats->fileLength = pos;
+    }
+    return bool(out);
+}
+
+ATFBundle::ATFBundle()
+    : m_data(0)
+    , m_length(0)
+    , m_mapped(false)
+    , m_count(0)
+    , m_entries(0)
+    , m_names(0)
+    , m_namesLength(0)
+{
+}
+
+ATFBundle::~ATFBundle()
+{
+    close();
+}
+
+bool ATFBundle::open(const char *path)
+{
+    close();
+#ifdef _MSC_VER
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if ( !file.is_open() ) {
+        return false;
+    }
+    m_copy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    m_data = m_copy.data();
+    m_length = m_copy.size();
+#else
+    int fd = ::open(path, O_RDONLY);
+    if ( fd < 0 ) {
+        return false;
+    }
+    struct stat st;
+    if ( fstat(fd, &st) != 0 || st.st_size < ATF_BUNDLE_HEADER_SIZE ) {
+        ::close(fd);
+        return false;
+    }
+    void *data = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if ( data == MAP_FAILED ) {
+        return false;
+    }
+    m_data = static_cast<const uint8_t *>(data);
+    m_length = size_t(st.st_size);
+    m_mapped = true;
+#endif
+    if ( !parse() ) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ATFBundle::attach(const uint8_t *data, size_t length)
+{
+    close();
+    m_data = data;
+    m_length = length;
+    if ( !parse() ) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ATFBundle::close()
+{
+#ifndef _MSC_VER
+    if ( m_mapped ) {
+        munmap(const_cast<uint8_t *>(m_data), m_length);
+    }
+#endif
+    m_copy.clear();
+    m_data = 0;
+    m_length = 0;
+    m_mapped = false;
+    m_count = 0;
+    m_entries = 0;
+    m_names = 0;
+    m_namesLength = 0;
+}
+
+bool ATFBundle::parse()
+{
+    const uint8_t *d = m_data;
+    if ( m_length < ATF_BUNDLE_HEADER_SIZE || d[0] != 'A' || d[1] != 'T' || d[2] != 'F' || d[3] != 'B' ||
+         readU32(d + 4) != ATF_BUNDLE_VERSION ) {
+        return false;
+    }
+    uint32_t count = readU32(d + 8);
+    uint32_t alignment = readU32(d + 12);
+    uint64_t namesOffset = readU64(d + 16);
+    uint64_t namesLength = readU64(d + 24);
+    uint64_t fileLength = readU64(d + 32);
+    if ( alignment == 0 || (alignment & (alignment - 1)) != 0 || fileLength > m_length ||
+         namesOffset != ATF_BUNDLE_HEADER_SIZE + uint64_t(count) * ATF_BUNDLE_ENTRY_SIZE ||
+         namesOffset > fileLength || namesLength > fileLength - namesOffset ) {
+        return false;
+    }
+
+    // every entry has to lie inside the file, so lookups need no checks
+    const uint8_t *p = d + ATF_BUNDLE_HEADER_SIZE;
+    for ( uint32_t i = 0; i < count; i++, p += ATF_BUNDLE_ENTRY_SIZE ) {
+        uint64_t offset = readU64(p + 8);
+        uint64_t length = readU64(p + 16);
+        uint64_t nameOffset = readU32(p + 24);
+        uint64_t nameLength = readU32(p + 28);
+        if ( offset > fileLength || length > fileLength - offset || nameOffset > namesLength ||
+             nameLength > namesLength - nameOffset ) {
+            return false;
+        }
+    }
+
+    m_count = count;
+    m_entries = d + ATF_BUNDLE_HEADER_SIZE;
+    m_names = d + namesOffset;
+    m_namesLength = namesLength;
+    return true;
+}
+
+const uint8_t *ATFBundle::find(const char *name, size_t &length) const
+{
+    size_t nameLength = strlen(name);
+    uint64_t hash = atf_bundle_hash(name, nameLength);
+
+    // first entry with this hash
+    uint32_t lo = 0;
+    uint32_t hi = m_count;
+    while ( lo < hi ) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if ( readU64(m_entries + size_t(mid) * ATF_BUNDLE_ENTRY_SIZE) < hash ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for ( ; lo < m_count; lo++ ) {
+        const uint8_t *p = m_entries + size_t(lo) * ATF_BUNDLE_ENTRY_SIZE;
+        if ( readU64(p) != hash ) {
+            break;
+        }
+        if ( readU32(p + 28) == nameLength && memcmp(m_names + readU32(p + 24), name, nameLength) == 0 ) {
+            length = size_t(readU64(p + 16));
+            return m_data + readU64(p + 8);
+        }
+    }
+    length = 0;
+    return 0;
+}
+
+bool ATFBundle::entry(uint32_t i, std::string &name, const uint8_t *&data, size_t &length) const
+{
+    if ( i >= m_count ) {
+        return false;
+    }
+    const uint8_t *p = m_entries + size_t(i) * ATF_BUNDLE_ENTRY_SIZE;
+    name.assign(reinterpret_cast<const char *>(m_names + readU32(p + 24)), readU32(p + 28));
+    data = m_data + readU64(p + 8);
+    length = size_t(readU64(p + 16));
+    return true;
+}
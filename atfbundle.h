@@ -0,0 +1,103 @@
+#ifndef _ATFBUNDLE_H_
+#define _ATFBUNDLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+//
+// Archive of many textures (ATF files, atf-transform outputs) in one file,
+// written by atf-bundle, so a scene load opens one file instead of one per
+// texture.
+//
+// The entries are sorted by a 64 bit FNV-1a hash of their name, a lookup is a
+// binary search on the mapped table plus one name compare. Entry data starts
+// on an alignment boundary (a page by default) so each texture can be mapped
+// or read on its own, and sits in the order the inputs were given, keeping
+// textures packed together next to each other on disk. Byte-identical inputs
+// can be stored once, their entries then share the data.
+//
+// Layout, little endian:
+//
+//    0  'A' 'T' 'F' 'B'
+//    4  U32  ATF_BUNDLE_VERSION
+//    8  U32  entries
+//   12  U32  alignment of the entry data, a power of two
+//   16  U64  offset of the name table
+//   24  U64  length of the name table
+//   32  U64  file length
+//   40  entries sorted by hash, then name:
+//         U64 name hash, U64 offset, U64 length, U32 name offset, U32 name length
+//       the name table, names without terminator
+//       the entry data
+//
+// An empty entry has offset and length 0.
+//
+
+enum { ATF_BUNDLE_VERSION = 1 };
+
+enum {
+    ATF_BUNDLE_HEADER_SIZE = 40,
+    ATF_BUNDLE_ENTRY_SIZE = 32
+};
+
+uint64_t atf_bundle_hash(const char *name, size_t length);
+
+struct ATFBundleInput {
+    std::string name;
+    const uint8_t *data;
+    size_t length;
+};
+
+struct ATFBundleStats {
+    size_t entries;
+    size_t stored;          // entries with data of their own
+    uint64_t inputBytes;
+    uint64_t fileLength;
+};
+
+// Writes the bundle of inputs to out. false on duplicate names, a bad
+// alignment or a write error.
+bool atf_bundle_write(const std::vector<ATFBundleInput> &inputs, uint32_t alignment, bool dedup, std::ostream &out,
+                      ATFBundleStats *stats = 0);
+
+// Read side: maps a bundle (or uses one in memory) and finds entries by name
+// without copying anything. The data stays valid until close().
+class ATFBundle {
+    public:
+        ATFBundle();
+        ~ATFBundle();
+
+        bool open(const char *path);
+        // bundle in memory, not copied, must outlive the lookups
+        bool attach(const uint8_t *data, size_t length);
+        void close();
+
+        // data of an entry, 0 if there is none of that name
+        const uint8_t *find(const char *name, size_t &length) const;
+        const uint8_t *find(const std::string &name, size_t &length) const { return find(name.c_str(), length); }
+
+        uint32_t Count() const { return m_count; }
+        // entry i in hash order
+        bool entry(uint32_t i, std::string &name, const uint8_t *&data, size_t &length) const;
+
+    private:
+        ATFBundle(const ATFBundle &);
+        ATFBundle &operator=(const ATFBundle &);
+
+        bool parse();
+
+        const uint8_t *m_data;
+        size_t m_length;
+        bool m_mapped;
+        std::vector<uint8_t> m_copy;
+        uint32_t m_count;
+        const uint8_t *m_entries;
+        const uint8_t *m_names;
+        uint64_t m_namesLength;
+};
+
+#endif //#ifndef _ATFBUNDLE_H_
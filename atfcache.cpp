@@ -0,0 +1,220 @@
+#include "atfcache.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif //#ifndef _MSC_VER
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif //#ifdef __linux__
+
+#define XXH_INLINE_ALL
+#include "3rdparty/xxhash/xxhash.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// dst as a reflink of src where the file system can, a copy otherwise
+bool clone_file(const std::string &src, const std::string &dst)
+{
+#ifdef FICLONE
+    int in = ::open(src.c_str(), O_RDONLY);
+    if ( in >= 0 ) {
+        int out = ::open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+        if ( out >= 0 ) {
+            ::close(out);
+        }
+        ::close(in);
+        if ( cloned ) {
+            return true;
+        }
+    }
+#endif //#ifdef FICLONE
+    std::error_code error;
+    fs::copy_file(src, dst, fs::copy_options::overwrite_existing, error);
+    return !error;
+}
+
+// exclusive lock on a file for the lifetime of the scope; parallel runs on
+// MSVC builds are not locked against each other
+class FileLock {
+public:
+    explicit FileLock(const std::string &path) : m_fd(-1)
+    {
+#ifndef _MSC_VER
+        m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if ( m_fd >= 0 ) {
+            flock(m_fd, LOCK_EX);
+        }
+#else
+        (void)path;
+#endif //#ifndef _MSC_VER
+    }
+    ~FileLock()
+    {
+#ifndef _MSC_VER
+        if ( m_fd >= 0 ) {
+            flock(m_fd, LOCK_UN);
+            ::close(m_fd);
+        }
+#endif //#ifndef _MSC_VER
+    }
+
+private:
+    int m_fd;
+};
+
+uint64_t read_total(const std::string &path)
+{
+    std::ifstream file(path);
+    uint64_t total = 0;
+    file >> total;
+    return total;
+}
+
+void write_total(const std::string &path, uint64_t total)
+{
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    file << total << "\n";
+}
+
+} // namespace
+
+std::string atf_cache_key(const uint8_t *data, size_t len, const std::string &settings)
+{
+    // the settings with their terminator, then the data, as one XXH3 stream
+    XXH3_state_t state;
+    XXH3_INITSTATE(&state);
+    XXH3_128bits_reset(&state);
+    XXH3_128bits_update(&state, settings.c_str(), settings.size() + 1);
+    XXH3_128bits_update(&state, data, len);
+    XXH128_hash_t hash = XXH3_128bits_digest(&state);
+
+    static const char digits[] = "0123456789abcdef";
+    uint64_t halves[2] = { hash.high64, hash.low64 };
+    std::string key;
+    for ( int32_t h = 0; h < 2; h++ ) {
+        for ( int32_t shift = 60; shift >= 0; shift -= 4 ) {
+            key += digits[( halves[h] >> shift ) & 15];
+        }
+    }
+    return key;
+}
+
+ATFCache::ATFCache(const std::string &dir, uint64_t limit)
+    : m_dir(dir)
+    , m_limit(limit)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+std::string ATFCache::entry_path(const std::string &key) const
+{
+    return ( fs::path(m_dir) / key.substr(0, 2) / ( key + ".atf" ) ).string();
+}
+
+bool ATFCache::fetch(const std::string &key, const std::string &path)
+{
+    std::string entry = entry_path(key);
+    std::error_code error;
+    if ( !fs::is_regular_file(entry, error) || !clone_file(entry, path) ) {
+        m_stats.misses++;
+        return false;
+    }
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), error);
+    m_stats.hits++;
+    m_stats.bytes = read_total(( fs::path(m_dir) / "size" ).string());
+    return true;
+}
+
+bool ATFCache::store(const std::string &key, const std::string &path)
+{
+    std::string entry = entry_path(key);
+    std::error_code error;
+    std::error_code ignored;
+    fs::create_directories(fs::path(entry).parent_path(), error);
+    if ( error ) {
+        return false;
+    }
+    std::random_device random;
+    std::string temp = entry + ".tmp" + std::to_string(random());
+    if ( !clone_file(path, temp) ) {
+        fs::remove(temp, ignored);
+        return false;
+    }
+    uint64_t size = fs::file_size(temp, error);
+    if ( error ) {
+        fs::remove(temp, ignored);
+        return false;
+    }
+
+    // the entry this replaces, if any, is no longer counted; both under the
+    // lock so that two runs storing the same key do not subtract it twice
+    FileLock lock(( fs::path(m_dir) / "lock" ).string());
+    std::error_code missing;
+    uint64_t replaced = fs::file_size(entry, missing);
+    if ( missing ) {
+        replaced = 0;
+    }
+    fs::rename(temp, entry, error);
+    if ( error ) {
+        fs::remove(temp, ignored);
+        return false;
+    }
+
+    std::string totalPath = ( fs::path(m_dir) / "size" ).string();
+    uint64_t total = read_total(totalPath);
+    total = ( total > replaced ? total - replaced : 0 ) + size;
+    if ( m_limit && total > m_limit ) {
+        evict(total);
+    }
+    write_total(totalPath, total);
+    m_stats.bytes = total;
+    return true;
+}
+
+// with the lock held: recounts the entries and removes the least recently
+// used ones until they take up at most 90% of the limit
+void ATFCache::evict(uint64_t &total)
+{
+    struct Entry {
+        fs::file_time_type used;
+        uint64_t size;
+        fs::path path;
+    };
+    std::vector<Entry> entries;
+    total = 0;
+    std::error_code error;
+    std::error_code ignored;
+    for ( fs::recursive_directory_iterator it(m_dir, error), end; !error && it != end; it.increment(error) ) {
+        if ( !it->is_regular_file(ignored) || it->path().extension() != ".atf" ) {
+            continue;
+        }
+        Entry entry = { it->last_write_time(ignored), it->file_size(ignored), it->path() };
+        total += entry.size;
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.used < b.used;
+    });
+    uint64_t target = m_limit / 10 * 9;
+    for ( size_t c = 0; c < entries.size() && total > target; c++ ) {
+        if ( fs::remove(entries[c].path, ignored) ) {
+            total -= entries[c].size;
+            m_stats.evicted++;
+        }
+    }
+}
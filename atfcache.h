@@ -0,0 +1,60 @@
+#ifndef _ATFCACHE_H_
+#define _ATFCACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+//
+// Content addressed cache of conversion outputs, for dds2atf --cache.
+//
+// An entry is keyed by a hash of the input file together with a string
+// naming every setting that changes the output and the version of the tool
+// (atf_cache_key), and holds the ATF file the conversion wrote. A hit copies
+// the entry to the output, as a reflink where the file system shares blocks
+// (FICLONE, Linux), so an unchanged texture costs reading and hashing it and
+// nothing else.
+//
+// Entries are dir/xx/<key>.atf, xx being the first two digits of the key.
+// Their modification time is their last use: a hit touches the entry and
+// eviction removes the least recently used ones first. The total size is
+// kept in dir/size, updated under a lock on dir/lock so that parallel
+// conversions share one cache. Once it passes the limit the directory is
+// scanned, entries are removed down to 90% of the limit and the total is
+// counted again. Entries are written under a temporary name and renamed, so
+// no reader sees half of one.
+//
+
+// 32 hex digits: the XXH3 128 bit hash (3rdparty/xxhash) of settings and data
+std::string atf_cache_key(const uint8_t *data, size_t len, const std::string &settings);
+
+struct ATFCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evicted;       // entries removed to stay under the limit
+    uint64_t bytes;         // size of the cache after the last fetch or store
+};
+
+class ATFCache {
+public:
+    // limit in bytes, 0 for none
+    ATFCache(const std::string &dir, uint64_t limit);
+
+    // Copies the entry for key to path and marks it used, false on a miss.
+    bool fetch(const std::string &key, const std::string &path);
+    // Adds the file at path as the entry for key.
+    bool store(const std::string &key, const std::string &path);
+
+    const ATFCacheStats &stats() const { return m_stats; }
+
+private:
+    std::string entry_path(const std::string &key) const;
+    void evict(uint64_t &total);
+
+    std::string m_dir;
+    uint64_t m_limit;
+    ATFCacheStats m_stats;
+};
+
+#endif //#ifndef _ATFCACHE_H_
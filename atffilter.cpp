@@ -0,0 +1,225 @@
+#include <string.h>
+
+#include <vector>
+
+#include "atffilter.h"
+
+namespace {
+
+uint32_t compactBits(uint32_t v)
+{
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0F0F0F0F;
+    v = (v | (v >> 4)) & 0x00FF00FF;
+    v = (v | (v >> 8)) & 0x0000FFFF;
+    return v;
+}
+
+bool hasBitPlanes(const ATFFilterLayout &layout)
+{
+    return layout.fieldBits > 1 && layout.fieldBits < layout.blockSize * 8 &&
+           (layout.blockSize * 8) % layout.fieldBits == 0;
+}
+
+bool applies(uint32_t filter, const ATFFilterLayout &layout, size_t len)
+{
+    if ( filter & ~uint32_t(ATF_FILTER_MASK) ) {
+        return false;
+    }
+    if ( layout.blocksWide < 1 || layout.blocksHigh < 1 || layout.blockSize < 1 || layout.blockSize > 8 ) {
+        return false;
+    }
+    if ( len != atf_filter_size(layout) ) {
+        return false;
+    }
+    if ( (filter & ATF_FILTER_BITPLANE) && !hasBitPlanes(layout) ) {
+        return false;
+    }
+    return true;
+}
+
+// Row order <-> Morton order. Grids that are not a power of two square are
+// walked on the enclosing square, skipping the cells outside.
+void morton(const ATFFilterLayout &layout, const uint8_t *src, uint8_t *dst, bool inverse)
+{
+    uint32_t side = 1;
+    while ( side < uint32_t(layout.blocksWide) || side < uint32_t(layout.blocksHigh) ) {
+        side <<= 1;
+    }
+
+    size_t bs = layout.blockSize;
+    size_t k = 0;
+    for ( uint32_t i = 0; i < side * side; i++ ) {
+        uint32_t x = compactBits(i);
+        uint32_t y = compactBits(i >> 1);
+        if ( x >= uint32_t(layout.blocksWide) || y >= uint32_t(layout.blocksHigh) ) {
+            continue;
+        }
+        size_t row = size_t(y) * layout.blocksWide + x;
+        if ( inverse ) {
+            memcpy(dst + row * bs, src + k * bs, bs);
+        } else {
+            memcpy(dst + k * bs, src + row * bs, bs);
+        }
+        k++;
+    }
+}
+
+// Field f, bit b (little endian within the block) <-> bit b*fields+f.
+void bitPlanes(const ATFFilterLayout &layout, const uint8_t *src, uint8_t *dst, size_t count, bool inverse)
+{
+    size_t bs = layout.blockSize;
+    int32_t bits = layout.fieldBits;
+    int32_t fields = int32_t(bs * 8) / bits;
+
+    for ( size_t c = 0; c < count; c++ ) {
+        uint64_t in = 0;
+        for ( size_t b = 0; b < bs; b++ ) {
+            in |= uint64_t(src[c * bs + b]) << (b * 8);
+        }
+
+        uint64_t out = 0;
+        for ( int32_t f = 0; f < fields; f++ ) {
+            for ( int32_t b = 0; b < bits; b++ ) {
+                int32_t packed = f * bits + b;
+                int32_t planar = b * fields + f;
+                if ( inverse ) {
+                    out |= ((in >> planar) & 1) << packed;
+                } else {
+                    out |= ((in >> packed) & 1) << planar;
+                }
+            }
+        }
+
+        for ( size_t b = 0; b < bs; b++ ) {
+            dst[c * bs + b] = uint8_t(out >> (b * 8));
+        }
+    }
+}
+
+void bytePlanes(const ATFFilterLayout &layout, const uint8_t *src, uint8_t *dst, size_t count, bool inverse)
+{
+    size_t bs = layout.blockSize;
+    for ( size_t c = 0; c < count; c++ ) {
+        for ( size_t b = 0; b < bs; b++ ) {
+            if ( inverse ) {
+                dst[c * bs + b] = src[b * count + c];
+            } else {
+                dst[b * count + c] = src[c * bs + b];
+            }
+        }
+    }
+}
+
+void delta(uint8_t *data, size_t len, size_t distance, bool inverse)
+{
+    if ( inverse ) {
+        for ( size_t c = distance; c < len; c++ ) {
+            data[c] = uint8_t(data[c] + data[c - distance]);
+        }
+    } else {
+        for ( size_t c = len; c-- > distance; ) {
+            data[c] = uint8_t(data[c] - data[c - distance]);
+        }
+    }
+}
+
+}
+
+size_t atf_filter_size(const ATFFilterLayout &layout)
+{
+    return size_t(layout.blocksWide) * layout.blocksHigh * layout.blockSize;
+}
+
+bool atf_filter_encode(uint32_t filter, const ATFFilterLayout &layout, const uint8_t *src, uint8_t *dst, size_t len)
+{
+    if ( !applies(filter, layout, len) ) {
+        return false;
+    }
+
+    size_t count = len / layout.blockSize;
+    std::vector<uint8_t> work(src, src + len);
+    std::vector<uint8_t> tmp(len);
+
+    if ( filter & ATF_FILTER_MORTON ) {
+        morton(layout, work.data(), tmp.data(), false);
+        work.swap(tmp);
+    }
+    if ( filter & ATF_FILTER_BITPLANE ) {
+        bitPlanes(layout, work.data(), tmp.data(), count, false);
+        work.swap(tmp);
+    }
+    if ( filter & ATF_FILTER_BYTEPLANE ) {
+        bytePlanes(layout, work.data(), tmp.data(), count, false);
+        work.swap(tmp);
+    }
+    if ( filter & ATF_FILTER_DELTA ) {
+        delta(work.data(), len, (filter & ATF_FILTER_BYTEPLANE) ? 1 : layout.blockSize, false);
+    }
+
+    memcpy(dst, work.data(), len);
+    return true;
+}
+
+bool atf_filter_decode(uint32_t filter, const ATFFilterLayout &layout, const uint8_t *src, uint8_t *dst, size_t len)
+{
+    if ( !applies(filter, layout, len) ) {
+        return false;
+    }
+
+    size_t count = len / layout.blockSize;
+    std::vector<uint8_t> work(src, src + len);
+    std::vector<uint8_t> tmp(len);
+
+    if ( filter & ATF_FILTER_DELTA ) {
+        delta(work.data(), len, (filter & ATF_FILTER_BYTEPLANE) ? 1 : layout.blockSize, true);
+    }
+    if ( filter & ATF_FILTER_BYTEPLANE ) {
+        bytePlanes(layout, work.data(), tmp.data(), count, true);
+        work.swap(tmp);
+    }
+    if ( filter & ATF_FILTER_BITPLANE ) {
+        bitPlanes(layout, work.data(), tmp.data(), count, true);
+        work.swap(tmp);
+    }
+    if ( filter & ATF_FILTER_MORTON ) {
+        morton(layout, work.data(), tmp.data(), true);
+        work.swap(tmp);
+    }
+
+    memcpy(dst, work.data(), len);
+    return true;
+}
+
+// Delta only pays off on the single byte planes (etc1 table and flip bits,
+// pvrtc mode bits), index words are not smooth enough for it.
+int32_t atf_filter_candidates(const ATFFilterLayout &layout, uint8_t *filters, int32_t max)
+{
+    static const uint8_t kSingleByte[] = {
+        ATF_FILTER_NONE,
+        ATF_FILTER_MORTON,
+        ATF_FILTER_DELTA,
+        ATF_FILTER_MORTON | ATF_FILTER_DELTA,
+    };
+    static const uint8_t kMultiByte[] = {
+        ATF_FILTER_NONE,
+        ATF_FILTER_MORTON,
+        ATF_FILTER_BYTEPLANE,
+        ATF_FILTER_MORTON | ATF_FILTER_BYTEPLANE,
+        ATF_FILTER_BITPLANE | ATF_FILTER_BYTEPLANE,
+        ATF_FILTER_MORTON | ATF_FILTER_BITPLANE | ATF_FILTER_BYTEPLANE,
+    };
+
+    const uint8_t *list = layout.blockSize > 1 ? kMultiByte : kSingleByte;
+    int32_t size = layout.blockSize > 1 ? int32_t(sizeof(kMultiByte)) : int32_t(sizeof(kSingleByte));
+
+    int32_t count = 0;
+    for ( int32_t c = 0; c < size && count < max; c++ ) {
+        if ( (list[c] & ATF_FILTER_BITPLANE) && !hasBitPlanes(layout) ) {
+            continue;
+        }
+        filters[count++] = list[c];
+    }
+    return count;
+}
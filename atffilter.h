@@ -0,0 +1,65 @@
+#ifndef _ATFFILTER_H_
+#define _ATFFILTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Reversible pre-filters for the block index planes that are stored as LZMA
+// sections (dxt1/dxt5 index bits, dxt5 alpha index bits, pvrtc modulation
+// data, etc1 flag and pixel index planes).
+//
+// A section is a grid of fixed size blocks. The filters rearrange it so that
+// LZMA's byte oriented literal and match models see the 2 and 3 bit index
+// structure:
+//
+//   ATF_FILTER_MORTON     blocks in Morton (Z) order instead of row order, so
+//                         neighbouring blocks stay close in the stream
+//   ATF_FILTER_BITPLANE   inside each block, bit n of every index field is
+//                         gathered into plane n
+//   ATF_FILTER_BYTEPLANE  byte n of every block is stored together, one plane
+//                         after the other
+//   ATF_FILTER_DELTA      each byte minus the byte one block earlier (one
+//                         byte earlier with ATF_FILTER_BYTEPLANE)
+//
+// Filters combine in the order listed above; decoding undoes them in reverse.
+//
+// Starting with ATF_VERSION_FILTERED every LZMA section begins with a single
+// byte holding the filter bits, followed by the usual LZMA props and stream.
+// The block layout is not stored, it follows from the section's position.
+//
+
+enum {
+    ATF_FILTER_NONE      = 0x00,
+    ATF_FILTER_MORTON    = 0x01,
+    ATF_FILTER_BITPLANE  = 0x02,
+    ATF_FILTER_BYTEPLANE = 0x04,
+    ATF_FILTER_DELTA     = 0x08,
+    ATF_FILTER_MASK      = 0x0F,
+
+    ATF_FILTER_MAX_CANDIDATES = 8
+};
+
+// first ATF version with a filter id in front of each LZMA section
+enum { ATF_VERSION_FILTERED = 4 };
+
+struct ATFFilterLayout {
+    int32_t blocksWide;     // block grid
+    int32_t blocksHigh;
+    int32_t blockSize;      // bytes per block, 1 to 8
+    int32_t fieldBits;      // width of the index fields in a block, 0 if it has none
+};
+
+// Byte count of a section with this layout.
+size_t atf_filter_size(const ATFFilterLayout &layout);
+
+// Apply / undo filter on len bytes. src and dst must not overlap. Fail if
+// len does not match the layout or the filter does not apply to it.
+bool atf_filter_encode(uint32_t filter, const ATFFilterLayout &layout, const uint8_t *src, uint8_t *dst, size_t len);
+bool atf_filter_decode(uint32_t filter, const ATFFilterLayout &layout, const uint8_t *src, uint8_t *dst, size_t len);
+
+// Fills filters with the combinations worth trying for layout,
+// ATF_FILTER_NONE first, and returns how many there are.
+int32_t atf_filter_candidates(const ATFFilterLayout &layout, uint8_t *filters, int32_t max);
+
+#endif //#ifndef _ATFFILTER_H_
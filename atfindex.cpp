@@ -0,0 +1,217 @@
+#include "atfindex.h"
+
+namespace {
+
+const size_t kHeaderSize = 16;
+
+uint32_t readU32(const uint8_t *p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+void writeU32(uint32_t v, std::vector<uint8_t> &out)
+{
+    out.push_back(uint8_t(v >> 24));
+    out.push_back(uint8_t(v >> 16));
+    out.push_back(uint8_t(v >> 8));
+    out.push_back(uint8_t(v));
+}
+
+}
+
+int32_t atf_index_sections_per_level(int32_t format, int32_t version)
+{
+    switch ( format & 0x7F ) {
+        case 0:                             // rgb888
+        case 1:                             // rgba8888
+            return 1;
+        case 2:                             // dxt1, pvrtc and etc1: lzma + jpeg-xr
+            return 2 + 3 + 3;
+        case 4:                             // the same with alpha, version 3 adds six more
+            return 4 + 3 + 3 + ( version == 3 ? 6 : 0 );
+        case 3:                             // raw blocks, one section per platform
+        case 5:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+bool atf_index_section_kind(int32_t format, int32_t version, int32_t s, const char *&platform, const char *&payload)
+{
+    struct Kind {
+        const char *platform;
+        const char *payload;
+    };
+    static const Kind rgb[] = { { "rgb", "jpegxr" } };
+    static const Kind rgba[] = { { "rgba", "jpegxr" } };
+    static const Kind compressed[] = {
+        { "dxt1", "lzma" }, { "dxt1", "jpegxr" },
+        { "pvrtc", "lzma_top" }, { "pvrtc", "lzma_bottom" }, { "pvrtc", "jpegxr" },
+        { "etc1", "lzma_top" }, { "etc1", "lzma_bottom" }, { "etc1", "jpegxr" },
+    };
+    static const Kind compressedAlpha[] = {
+        { "dxt5", "alpha_lzma" }, { "dxt5", "alpha_jpegxr" }, { "dxt5", "lzma" }, { "dxt5", "jpegxr" },
+        { "pvrtc", "lzma_top" }, { "pvrtc", "lzma_bottom" }, { "pvrtc", "jpegxr" },
+        { "etc1", "lzma_top" }, { "etc1", "lzma_bottom" }, { "etc1", "jpegxr" },
+        { "v3", "extra" }, { "v3", "extra" }, { "v3", "extra" },
+        { "v3", "extra" }, { "v3", "extra" }, { "v3", "extra" },
+    };
+    static const Kind raw[] = { { "dxt1", "raw" }, { "pvrtc", "raw" }, { "etc1", "raw" } };
+    static const Kind rawAlpha[] = { { "dxt5", "raw" }, { "pvrtc", "raw" }, { "etc1", "raw" } };
+    static const Kind *kinds[] = { rgb, rgba, compressed, raw, compressedAlpha, rawAlpha };
+
+    int32_t format7 = format & 0x7F;
+    if ( s < 0 || s >= atf_index_sections_per_level(format7, version) ) {
+        return false;
+    }
+    platform = kinds[format7][s].platform;
+    payload = kinds[format7][s].payload;
+    return true;
+}
+
+bool atf_index_build(const uint8_t *data, size_t len, ATFIndex &index)
+{
+    if ( len < 10 || data[0] != 'A' || data[1] != 'T' || data[2] != 'F' ) {
+        return false;
+    }
+
+    size_t pos;
+    if ( data[6] == 0xFF ) {
+        if ( len < 16 ) {
+            return false;
+        }
+        index.version = data[7];
+        index.fileLength = readU32(data + 8) + 12;
+        pos = 12;
+    } else {
+        index.version = 0;
+        index.fileLength = ((uint32_t(data[3]) << 16) | (uint32_t(data[4]) << 8) | uint32_t(data[5])) + 6;
+        pos = 6;
+    }
+    if ( index.fileLength > len ) {
+        return false;
+    }
+
+    index.format = data[pos];
+    index.count = data[pos + 3];
+    index.faces = ( index.format & 0x80 ) ? 6 : 1;
+    index.prefixSize = index.version ? 4 : 3;
+    int32_t perLevel = atf_index_sections_per_level(index.format, index.version);
+    if ( perLevel == 0 || index.count < 1 || index.count > 16 ) {
+        return false;
+    }
+    index.sectionsPerLevel = uint8_t(perLevel);
+    pos += 4;
+
+    index.sections.clear();
+    index.sections.reserve(size_t(index.faces) * index.count * perLevel);
+    for ( int32_t i = 0; i < index.faces * index.count * perLevel; i++ ) {
+        if ( pos + index.prefixSize > index.fileLength ) {
+            return false;
+        }
+        uint32_t length = index.prefixSize == 4 ? readU32(data + pos) :
+                          ((uint32_t(data[pos]) << 16) | (uint32_t(data[pos + 1]) << 8) | uint32_t(data[pos + 2]));
+        pos += index.prefixSize;
+        if ( length > index.fileLength - pos ) {
+            return false;
+        }
+        ATFIndexSection section = { uint32_t(pos), length };
+        index.sections.push_back(section);
+        pos += length;
+    }
+    return true;
+}
+
+void atf_index_write(const ATFIndex &index, std::vector<uint8_t> &out)
+{
+    out.clear();
+    out.reserve(kHeaderSize + index.sections.size() * 8);
+    out.push_back('A');
+    out.push_back('T');
+    out.push_back('F');
+    out.push_back('I');
+    out.push_back(ATF_INDEX_VERSION);
+    out.push_back(index.version);
+    out.push_back(index.format);
+    out.push_back(index.count);
+    out.push_back(index.faces);
+    out.push_back(index.sectionsPerLevel);
+    out.push_back(index.prefixSize);
+    out.push_back(0);
+    writeU32(index.fileLength, out);
+    for ( const auto &section : index.sections ) {
+        writeU32(section.offset, out);
+        writeU32(section.length, out);
+    }
+}
+
+bool atf_index_read(const uint8_t *data, size_t len, ATFIndex &index)
+{
+    if ( len < kHeaderSize || data[0] != 'A' || data[1] != 'T' || data[2] != 'F' || data[3] != 'I' ||
+         data[4] != ATF_INDEX_VERSION ) {
+        return false;
+    }
+    index.version = data[5];
+    index.format = data[6];
+    index.count = data[7];
+    index.faces = data[8];
+    index.sectionsPerLevel = data[9];
+    index.prefixSize = data[10];
+    index.fileLength = readU32(data + 12);
+
+    if ( index.count < 1 || index.count > 16 || ( index.faces != 1 && index.faces != 6 ) ||
+         index.sectionsPerLevel == 0 || ( index.prefixSize != 3 && index.prefixSize != 4 ) ) {
+        return false;
+    }
+    size_t sections = size_t(index.faces) * index.count * index.sectionsPerLevel;
+    if ( len != kHeaderSize + sections * 8 ) {
+        return false;
+    }
+
+    index.sections.resize(sections);
+    const uint8_t *p = data + kHeaderSize;
+    for ( auto &section : index.sections ) {
+        section.offset = readU32(p);
+        section.length = readU32(p + 4);
+        p += 8;
+        if ( section.offset < index.prefixSize || section.offset > index.fileLength ||
+             section.length > index.fileLength - section.offset ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const ATFIndexSection *atf_index_section(const ATFIndex &index, int32_t face, int32_t level, int32_t s)
+{
+    if ( face < 0 || face >= index.faces || level < 0 || level >= index.count ||
+         s < 0 || s >= index.sectionsPerLevel ) {
+        return 0;
+    }
+    size_t i = (size_t(face) * index.count + level) * index.sectionsPerLevel + s;
+    return i < index.sections.size() ? &index.sections[i] : 0;
+}
+
+bool atf_index_level_range(const ATFIndex &index, int32_t face, int32_t level, uint32_t &offset, uint32_t &length)
+{
+    const ATFIndexSection *first = atf_index_section(index, face, level, 0);
+    const ATFIndexSection *last = atf_index_section(index, face, level, index.sectionsPerLevel - 1);
+    if ( !first || !last ) {
+        return false;
+    }
+    offset = first->offset - index.prefixSize;
+    length = last->offset + last->length - offset;
+    return true;
+}
+
+std::string atf_index_path(const std::string &atfPath)
+{
+    size_t slash = atfPath.find_last_of("/\\");
+    size_t dot = atfPath.rfind('.');
+    if ( dot != std::string::npos && ( slash == std::string::npos || dot > slash ) &&
+         atfPath.compare(dot, std::string::npos, ".atf") == 0 ) {
+        return atfPath + "idx";
+    }
+    return atfPath + ".atfidx";
+}
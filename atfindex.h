@@ -0,0 +1,86 @@
+#ifndef _ATFINDEX_H_
+#define _ATFINDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+//
+// Level index for ATF files, kept next to the file as a .atfidx sidecar so
+// the ATF itself stays readable by every existing client.
+//
+// Finding a level in an ATF means walking the length prefix of every section
+// in front of it. The index records where the payload of every section of
+// every level and face starts and how long it is, so a reader can go straight
+// to a level and an HTTP client can fetch exactly one mip with a single range
+// request (atf_index_level_range).
+//
+// Layout, big endian like ATF:
+//
+//   'A' 'T' 'F' 'I'     magic
+//   U8                  ATF_INDEX_VERSION
+//   U8                  ATF version of the indexed file
+//   U8                  ATF format byte, cube map flag included
+//   U8                  levels
+//   U8                  faces, 1 or 6
+//   U8                  sections per level
+//   U8                  length prefix size, 3 or 4
+//   U8                  reserved
+//   U32                 length of the indexed file
+//   U32 U32             payload offset and length of each section, for every
+//                       face, every level of it, in file order
+//
+// An index only describes the file it was made for: readers compare the
+// header fields and the file length and ignore a stale one.
+//
+
+enum { ATF_INDEX_VERSION = 1 };
+
+struct ATFIndexSection {
+    uint32_t offset;        // of the payload from the start of the file, after the length prefix
+    uint32_t length;
+};
+
+struct ATFIndex {
+    uint8_t version;        // of the ATF file
+    uint8_t format;
+    uint8_t count;
+    uint8_t faces;
+    uint8_t sectionsPerLevel;
+    uint8_t prefixSize;
+    uint32_t fileLength;
+    std::vector<ATFIndexSection> sections;
+};
+
+// Sections per level and face of an ATF format (cube map flag ignored) and
+// version, 0 for unknown formats.
+int32_t atf_index_sections_per_level(int32_t format, int32_t version);
+
+// What section s of a level of such a format holds: the platform ("rgb",
+// "rgba", "dxt1", "dxt5", "pvrtc" or "etc1") and the payload ("jpegxr",
+// "lzma", "lzma_top", "lzma_bottom", "alpha_lzma", "alpha_jpegxr" or "raw").
+// The six sections version 3 adds to format 4 are "v3" "extra". false when s
+// is out of range.
+bool atf_index_section_kind(int32_t format, int32_t version, int32_t s, const char *&platform, const char *&payload);
+
+// Builds the index by walking the section lengths of an ATF file in memory.
+bool atf_index_build(const uint8_t *data, size_t len, ATFIndex &index);
+
+// Serializes / parses a .atfidx. atf_index_read fails on anything malformed.
+void atf_index_write(const ATFIndex &index, std::vector<uint8_t> &out);
+bool atf_index_read(const uint8_t *data, size_t len, ATFIndex &index);
+
+// Section s of a level, 0 if out of range.
+const ATFIndexSection *atf_index_section(const ATFIndex &index, int32_t face, int32_t level, int32_t s);
+
+// Bytes of the file holding a whole level of a face, length prefixes
+// included: what a range request for one mip asks for.
+bool atf_index_level_range(const ATFIndex &index, int32_t face, int32_t level, uint32_t &offset, uint32_t &length);
+
+// Sidecar name for an ATF path: "a.atf" -> "a.atfidx", anything else gets
+// ".atfidx" appended.
+std::string atf_index_path(const std::string &atfPath);
+
+#endif //#ifndef _ATFINDEX_H_
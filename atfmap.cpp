@@ -0,0 +1,65 @@
+#include "atfmap.h"
+
+#include <fstream>
+#include <iterator>
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif //#ifndef _MSC_VER
+
+#include "atftrace.h"
+
+bool ATFMappedFile::open(const char *path, bool prefetch)
+{
+    ATFTraceSpan span("map input");
+    close();
+#ifdef _MSC_VER
+    (void)prefetch;
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if ( !file.is_open() ) {
+        return false;
+    }
+    m_copy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    m_data = m_copy.data();
+    m_size = m_copy.size();
+    return true;
+#else
+    int fd = ::open(path, O_RDONLY);
+    if ( fd < 0 ) {
+        return false;
+    }
+    struct stat st;
+    if ( fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ) {
+        ::close(fd);
+        return false;
+    }
+    m_size = size_t(st.st_size);
+    if ( m_size > 0 ) {
+        void *data = mmap(0, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if ( data == MAP_FAILED ) {
+            ::close(fd);
+            m_size = 0;
+            return false;
+        }
+        madvise(data, m_size, prefetch ? MADV_WILLNEED : MADV_RANDOM);
+        m_data = static_cast<const uint8_t *>(data);
+    }
+    ::close(fd);
+    return true;
+#endif
+}
+
+void ATFMappedFile::close()
+{
+#ifndef _MSC_VER
+    if ( m_data ) {
+        munmap(const_cast<uint8_t *>(m_data), m_size);
+    }
+#endif
+    m_copy.clear();
+    m_data = 0;
+    m_size = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef _ATFMAP_H_
+#define _ATFMAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+//
+// Input file mapped read only, for the tools that read many ATF files. Where
+// there is no mmap (MSVC) the file is read into memory instead.
+//
+// prefetch asks the kernel to read the whole file ahead, for callers that go
+// on to decode all of it. Callers that only look at the length prefixes
+// leave it off so only the pages holding those are read.
+//
+
+class ATFMappedFile {
+public:
+    ATFMappedFile() : m_data(0), m_size(0) {}
+    ~ATFMappedFile() { close(); }
+
+    bool open(const char *path, bool prefetch = true);
+    void close();
+
+    const uint8_t *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    ATFMappedFile(const ATFMappedFile &);
+    ATFMappedFile &operator=(const ATFMappedFile &);
+
+    const uint8_t *m_data;
+    size_t m_size;
+    std::vector<uint8_t> m_copy;
+};
+
+#endif //#ifndef _ATFMAP_H_
@@ -0,0 +1,253 @@
+#include "atfmemory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+namespace {
+
+struct StageCounters {
+    std::atomic<uint64_t> allocs;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> largest;
+    std::atomic<uint64_t> peakBytes;
+};
+
+// zero initialized before any constructor runs, operator new may come first
+StageCounters stageCounters[ATF_STAGE_COUNT + 1];
+StageCounters totalCounters;
+// signed: blocks from before atf_memory_enable() may be freed after it
+std::atomic<int64_t> liveBytes;
+std::atomic<bool> accounting;
+
+uint64_t budgetBytes = 0;
+void (*budgetExceeded)() = 0;
+std::atomic<bool> reporting;
+
+void raise(std::atomic<uint64_t> &value, uint64_t to)
+{
+    uint64_t current = value;
+    while ( to > current && !value.compare_exchange_weak(current, to) ) {
+    }
+}
+
+void snapshot(const StageCounters &counters, ATFStageMemory &memory)
+{
+    memory.allocs = counters.allocs;
+    memory.bytes = counters.bytes;
+    memory.largest = counters.largest;
+    memory.peakBytes = counters.peakBytes;
+}
+
+const char *stageName(int32_t stage)
+{
+    return stage == ATF_MEMORY_OTHER ? "other" : atf_stage_name(stage);
+}
+
+// stdio only from here on, the heap is what ran out
+void exceed(size_t size, int32_t stage, uint64_t live)
+{
+    if ( reporting.exchange(true) ) {
+        return;
+    }
+    fprintf(stderr, "\nMemory budget of %llu bytes exceeded: allocating %llu bytes in %s took the live bytes to %llu.\n",
+            (unsigned long long)budgetBytes, (unsigned long long)size, stageName(stage), (unsigned long long)live);
+    fprintf(stderr, "%-14s %10s %14s %14s %14s\n", "stage", "allocs", "bytes", "largest", "peak live");
+    for ( int32_t s = 0; s <= ATF_STAGE_COUNT; s++ ) {
+        ATFStageMemory memory;
+        snapshot(stageCounters[s], memory);
+        if ( memory.allocs ) {
+            fprintf(stderr, "%-14s %10llu %14llu %14llu %14llu\n", stageName(s), (unsigned long long)memory.allocs,
+                    (unsigned long long)memory.bytes, (unsigned long long)memory.largest,
+                    (unsigned long long)memory.peakBytes);
+        }
+    }
+    fflush(stderr);
+    if ( budgetExceeded ) {
+        budgetExceeded();
+    }
+    _Exit(EXIT_FAILURE);
+}
+
+size_t heapSize(void *ptr)
+{
+#if defined(_MSC_VER)
+    return _msize(ptr);
+#elif defined(__APPLE__)
+    return malloc_size(ptr);
+#else
+    return malloc_usable_size(ptr);
+#endif
+}
+
+// what new and delete book is the size the heap gives, the same both ways
+void *heapAlloc(size_t size)
+{
+    void *ptr = malloc(size ? size : 1);
+    if ( ptr && accounting.load(std::memory_order_relaxed) ) {
+        atf_memory_book_alloc(heapSize(ptr));
+    }
+    return ptr;
+}
+
+void heapFree(void *ptr)
+{
+    if ( ptr && accounting.load(std::memory_order_relaxed) ) {
+        atf_memory_book_free(heapSize(ptr));
+    }
+    free(ptr);
+}
+
+}
+
+void atf_memory_enable()
+{
+    accounting.store(true);
+}
+
+void atf_memory_stages(ATFStageMemory *stages)
+{
+    for ( int32_t s = 0; s <= ATF_STAGE_COUNT; s++ ) {
+        snapshot(stageCounters[s], stages[s]);
+    }
+}
+
+void atf_memory_totals(ATFStageMemory &totals)
+{
+    snapshot(totalCounters, totals);
+}
+
+uint64_t atf_memory_live()
+{
+    return uint64_t(std::max<int64_t>(0, liveBytes));
+}
+
+void atf_memory_set_budget(uint64_t budget, void (*exceeded)())
+{
+    budgetBytes = budget;
+    budgetExceeded = exceeded;
+}
+
+void atf_memory_book_alloc(size_t size)
+{
+    if ( !accounting.load(std::memory_order_relaxed) ) {
+        return;
+    }
+    int32_t stage = atf_stage_current();
+    if ( stage < 0 || stage >= ATF_STAGE_COUNT ) {
+        stage = ATF_MEMORY_OTHER;
+    }
+    uint64_t live = uint64_t(std::max<int64_t>(0, liveBytes += int64_t(size)));
+
+    StageCounters *counters[2] = { &stageCounters[stage], &totalCounters };
+    for ( StageCounters *c : counters ) {
+        c->allocs++;
+        c->bytes += size;
+        raise(c->largest, size);
+        raise(c->peakBytes, live);
+    }
+
+    if ( budgetBytes && live > budgetBytes ) {
+        exceed(size, stage, live);
+    }
+}
+
+void atf_memory_book_free(size_t size)
+{
+    if ( accounting.load(std::memory_order_relaxed) ) {
+        liveBytes -= int64_t(size);
+    }
+}
+
+ATFMemoryAllocator::ATFMemoryAllocator(ATFAllocator *parent)
+    : m_parent(parent ? parent : ATFHeapAllocator::instance())
+{
+    m_parent->retain();
+}
+
+ATFMemoryAllocator::~ATFMemoryAllocator()
+{
+    m_parent->release();
+}
+
+void *ATFMemoryAllocator::allocate(size_t size)
+{
+    void *ptr = m_parent->allocate(size);
+    if ( ptr ) {
+        atf_memory_book_alloc(size);
+    }
+    return ptr;
+}
+
+void ATFMemoryAllocator::deallocate(void *ptr, size_t size)
+{
+    if ( ptr ) {
+        atf_memory_book_free(size);
+        m_parent->deallocate(ptr, size);
+    }
+}
+
+void *operator new(size_t size)
+{
+    void *ptr = heapAlloc(size);
+    if ( !ptr ) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return heapAlloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return heapAlloc(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    heapFree(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    heapFree(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    heapFree(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    heapFree(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    heapFree(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    heapFree(ptr);
+}
@@ -0,0 +1,67 @@
+#ifndef _ATFMEMORY_H_
+#define _ATFMEMORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "atfalloc.h"
+#include "atfstats.h"
+
+//
+// Heap accounting per conversion stage, for dds2atf --stats and
+// --memory-budget.
+//
+// Linking atfmemory.cpp replaces the global operator new and delete, and an
+// ATFMemoryAllocator made current catches the JPEG-XR and LZMA blocks of
+// atf_alloc (jpegxr_malloc, ISzAlloc). Every block is booked on the stage
+// running on the calling thread (atfstats.h), or on ATF_MEMORY_OTHER
+// outside of any. Live bytes are process wide; the peak of a stage is the
+// most bytes live at any point while it ran, whoever allocated them.
+//
+// Nothing is booked until atf_memory_enable(): until then operator new and
+// delete cost one relaxed load on top of malloc and free. Blocks allocated
+// before it are not counted, and freeing them never takes the live bytes
+// below zero.
+//
+
+enum { ATF_MEMORY_OTHER = ATF_STAGE_COUNT };
+
+struct ATFStageMemory {
+    uint64_t allocs;
+    uint64_t bytes;         // allocated in total
+    uint64_t largest;       // largest single allocation
+    uint64_t peakBytes;     // most bytes live
+};
+
+// starts booking, for good
+void atf_memory_enable();
+
+// ATF_STAGE_COUNT + 1 entries, the last for ATF_MEMORY_OTHER
+void atf_memory_stages(ATFStageMemory *stages);
+// the whole run, peakBytes being the peak of the process
+void atf_memory_totals(ATFStageMemory &totals);
+uint64_t atf_memory_live();
+
+// Fails an allocation that would take the live bytes over budget (0 for
+// none): prints what every stage used to stderr, calls exceeded (if not 0,
+// it must not allocate) and exits.
+void atf_memory_set_budget(uint64_t budget, void (*exceeded)());
+
+// books size bytes on the calling thread's stage
+void atf_memory_book_alloc(size_t size);
+void atf_memory_book_free(size_t size);
+
+// Forwards to another allocator and books every block.
+class ATFMemoryAllocator : public ATFAllocator {
+public:
+    explicit ATFMemoryAllocator(ATFAllocator *parent = 0);
+    ~ATFMemoryAllocator();
+
+    void *allocate(size_t size) override;
+    void deallocate(void *ptr, size_t size) override;
+
+private:
+    ATFAllocator *m_parent;
+};
+
+#endif //#ifndef _ATFMEMORY_H_
@@ -0,0 +1,128 @@
+#include "atfraw.h"
+
+namespace {
+
+uint32_t readU32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+uint64_t readU64(const uint8_t *p)
+{
+    return uint64_t(readU32(p)) | (uint64_t(readU32(p + 4)) << 32);
+}
+
+void writeU32(uint32_t v, std::vector<uint8_t> &out)
+{
+    out.push_back(uint8_t(v));
+    out.push_back(uint8_t(v >> 8));
+    out.push_back(uint8_t(v >> 16));
+    out.push_back(uint8_t(v >> 24));
+}
+
+void writeU64(uint64_t v, std::vector<uint8_t> &out)
+{
+    writeU32(uint32_t(v), out);
+    writeU32(uint32_t(v >> 32), out);
+}
+
+bool isPowerOfTwo(uint32_t v)
+{
+    return v != 0 && (v & (v - 1)) == 0;
+}
+
+}
+
+bool atf_raw_layout(ATFRawHeader &header, std::vector<ATFRawLevel> &levels)
+{
+    if ( !isPowerOfTwo(header.alignment) ) {
+        return false;
+    }
+    uint64_t mask = header.alignment - 1;
+    uint64_t pos = ATF_RAW_HEADER_SIZE + uint64_t(levels.size()) * ATF_RAW_LEVEL_SIZE;
+    for ( auto &level : levels ) {
+        pos = (pos + mask) & ~mask;
+        level.offset = pos;
+        pos += level.length;
+    }
+    header.fileLength = pos;
+    return true;
+}
+
+void atf_raw_write_header(const ATFRawHeader &header, const std::vector<ATFRawLevel> &levels, std::vector<uint8_t> &out)
+{
+    out.clear();
+    out.reserve(ATF_RAW_HEADER_SIZE + levels.size() * ATF_RAW_LEVEL_SIZE);
+    out.push_back('A');
+    out.push_back('T');
+    out.push_back('F');
+    out.push_back('R');
+    writeU32(ATF_RAW_VERSION, out);
+    writeU32(header.format, out);
+    writeU32(header.width, out);
+    writeU32(header.height, out);
+    writeU32(header.levels, out);
+    writeU32(header.faces, out);
+    writeU32(header.alignment, out);
+    writeU64(header.fileLength, out);
+    for ( const auto &level : levels ) {
+        writeU64(level.offset, out);
+        writeU64(level.length, out);
+        writeU32(level.width, out);
+        writeU32(level.height, out);
+        writeU32(level.rows, out);
+        writeU32(level.rowPitch, out);
+    }
+}
+
+bool atf_raw_read(const uint8_t *data, size_t len, ATFRawHeader &header, std::vector<ATFRawLevel> &levels)
+{
+    if ( len < ATF_RAW_HEADER_SIZE || data[0] != 'A' || data[1] != 'T' || data[2] != 'F' || data[3] != 'R' ||
+         readU32(data + 4) != ATF_RAW_VERSION ) {
+        return false;
+    }
+    header.format = readU32(data + 8);
+    header.width = readU32(data + 12);
+    header.height = readU32(data + 16);
+    header.levels = readU32(data + 20);
+    header.faces = readU32(data + 24);
+    header.alignment = readU32(data + 28);
+    header.fileLength = readU64(data + 32);
+
+    if ( header.format < ATF_RAW_RGB888 || header.format > ATF_RAW_ETC1_ALPHA ||
+         header.levels < 1 || header.levels > 16 || ( header.faces != 1 && header.faces != 6 ) ||
+         !isPowerOfTwo(header.alignment) || header.fileLength > len ) {
+        return false;
+    }
+    size_t count = size_t(header.levels) * header.faces;
+    if ( ATF_RAW_HEADER_SIZE + count * ATF_RAW_LEVEL_SIZE > header.fileLength ) {
+        return false;
+    }
+
+    levels.resize(count);
+    const uint8_t *p = data + ATF_RAW_HEADER_SIZE;
+    for ( auto &level : levels ) {
+        level.offset = readU64(p);
+        level.length = readU64(p + 8);
+        level.width = readU32(p + 16);
+        level.height = readU32(p + 20);
+        level.rows = readU32(p + 24);
+        level.rowPitch = readU32(p + 28);
+        p += ATF_RAW_LEVEL_SIZE;
+        if ( level.offset % header.alignment != 0 || level.offset > header.fileLength ||
+             level.length > header.fileLength - level.offset ||
+             ( level.length != 0 && uint64_t(level.rows) * level.rowPitch > level.length ) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const ATFRawLevel *atf_raw_level(const ATFRawHeader &header, const std::vector<ATFRawLevel> &levels, uint32_t face, uint32_t level)
+{
+    if ( face >= header.faces || level >= header.levels ) {
+        return 0;
+    }
+    size_t i = size_t(face) * header.levels + level;
+    return i < levels.size() ? &levels[i] : 0;
+}
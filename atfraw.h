@@ -0,0 +1,86 @@
+#ifndef _ATFRAW_H_
+#define _ATFRAW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+//
+// Upload ready texture container written by atf-transform -r.
+//
+// Everything the runtime needs is in a fixed header and a level table, and
+// the data of every level starts on an alignment boundary (256 bytes or a
+// page), so a mapped file can be handed to the graphics API level by level
+// without parsing length prefixes or copying into aligned memory first.
+//
+// Layout, little endian:
+//
+//    0  'A' 'T' 'F' 'R'
+//    4  U32  ATF_RAW_VERSION
+//    8  U32  ATFRawFormat
+//   12  U32  width of level 0
+//   16  U32  height of level 0
+//   20  U32  levels
+//   24  U32  faces, 1 or 6 (cube maps in ATF order)
+//   28  U32  alignment of the level data, a power of two
+//   32  U64  file length
+//   40  the level table, levels x faces entries, every level of a face
+//       before the next face:
+//         U64 offset, U64 length, U32 width, U32 height, U32 rows, U32 row pitch
+//
+// rows is in blocks for the block formats, in pixels otherwise. A level the
+// source file did not carry has length 0.
+//
+
+enum { ATF_RAW_VERSION = 1 };
+
+enum ATFRawFormat {
+    ATF_RAW_RGB888 = 1,
+    ATF_RAW_RGBA8888,
+    ATF_RAW_DXT1,
+    ATF_RAW_DXT5,
+    ATF_RAW_PVRTC4,
+    ATF_RAW_ETC1,
+    ATF_RAW_ETC1_ALPHA          // color blocks followed by the alpha blocks
+};
+
+struct ATFRawLevel {
+    uint64_t offset;
+    uint64_t length;
+    uint32_t width;
+    uint32_t height;
+    uint32_t rows;
+    uint32_t rowPitch;
+};
+
+struct ATFRawHeader {
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    uint32_t faces;
+    uint32_t alignment;
+    uint64_t fileLength;
+};
+
+enum {
+    ATF_RAW_HEADER_SIZE = 40,
+    ATF_RAW_LEVEL_SIZE = 32
+};
+
+// Sets the offset of every level (lengths filled in) and header.fileLength.
+// false if the alignment is not a power of two.
+bool atf_raw_layout(ATFRawHeader &header, std::vector<ATFRawLevel> &levels);
+
+// Header and level table as they go at the start of the file.
+void atf_raw_write_header(const ATFRawHeader &header, const std::vector<ATFRawLevel> &levels, std::vector<uint8_t> &out);
+
+// Parses header and table of a container in memory and checks every level
+// lies inside it and on its alignment.
+bool atf_raw_read(const uint8_t *data, size_t len, ATFRawHeader &header, std::vector<ATFRawLevel> &levels);
+
+// Entry of a level of a face, 0 if out of range.
+const ATFRawLevel *atf_raw_level(const ATFRawHeader &header, const std::vector<ATFRawLevel> &levels, uint32_t face, uint32_t level);
+
+#endif //#ifndef _ATFRAW_H_
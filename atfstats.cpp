@@ -0,0 +1,288 @@
+#include "atfstats.h"
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+
+#include "3rdparty/jpegxr/jpegxr.h"
+
+#ifndef _MSC_VER
+#include <time.h>
+#endif //#ifndef _MSC_VER
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define ATF_PERF_COUNTERS
+#endif //#ifdef __linux__
+
+namespace {
+
+thread_local ATFStageTime stageTimes[ATF_STAGE_COUNT];
+thread_local ATFBandBits bandBits[ATF_JXR_BAND_COUNT];
+thread_local ATFStageTimer *innermost = 0;
+thread_local int32_t currentStage = -1;
+
+std::atomic<bool> perfEnabled(false);
+std::atomic<bool> bitsCounted(false);
+
+static_assert(int(ATF_JXR_BAND_COUNT) == int(JXR_BAND_COUNT), "ATFBandBits per jxr_band_t");
+
+double wallMs()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double cpuMs()
+{
+#if !defined(_MSC_VER) && defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#else
+    return std::clock() * 1000.0 / CLOCKS_PER_SEC;
+#endif
+}
+
+// The counters of a thread, one perf event group read with a single call.
+// Counters the CPU or kernel does not have are left out of the group.
+struct PerfGroup {
+    bool opened;
+    int leader;
+    int fds[ATF_COUNTER_COUNT];
+    int32_t slots[ATF_COUNTER_COUNT];   // position in the group's read, -1 if not open
+
+    PerfGroup() : opened(false), leader(-1) {
+        for ( int32_t c = 0; c < ATF_COUNTER_COUNT; c++ ) {
+            fds[c] = -1;
+            slots[c] = -1;
+        }
+    }
+    ~PerfGroup() {
+#ifdef ATF_PERF_COUNTERS
+        for ( int32_t c = 0; c < ATF_COUNTER_COUNT; c++ ) {
+            if ( fds[c] >= 0 ) {
+                close(fds[c]);
+            }
+        }
+#endif //#ifdef ATF_PERF_COUNTERS
+    }
+
+    void open() {
+        opened = true;
+#ifdef ATF_PERF_COUNTERS
+        static const uint64_t configs[ATF_COUNTER_COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+        int32_t count = 0;
+        for ( int32_t c = 0; c < ATF_COUNTER_COUNT; c++ ) {
+            perf_event_attr attr = {};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[c];
+            attr.disabled = leader < 0 ? 1 : 0;
+            attr.exclude_kernel = 1;    // all perf_event_paranoid 2 allows
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+            if ( fd < 0 ) {
+                continue;
+            }
+            if ( leader < 0 ) {
+                leader = fd;
+            }
+            fds[c] = fd;
+            slots[c] = count++;
+        }
+        if ( leader >= 0 ) {
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif //#ifdef ATF_PERF_COUNTERS
+    }
+
+    // counts so far, scaled up if the group had to share the PMU
+    void read(uint64_t *values) {
+        if ( !opened ) {
+            open();
+        }
+#ifdef ATF_PERF_COUNTERS
+        uint64_t buffer[3 + ATF_COUNTER_COUNT];
+        if ( leader >= 0 && ::read(leader, buffer, sizeof(buffer)) > 0 && buffer[2] > 0 ) {
+            double scale = double(buffer[1]) / double(buffer[2]);
+            for ( int32_t c = 0; c < ATF_COUNTER_COUNT; c++ ) {
+                values[c] = slots[c] >= 0 ? uint64_t(double(buffer[3 + slots[c]]) * scale) : 0;
+            }
+            return;
+        }
+#endif //#ifdef ATF_PERF_COUNTERS
+        for ( int32_t c = 0; c < ATF_COUNTER_COUNT; c++ ) {
+            values[c] = 0;
+        }
+    }
+};
+
+thread_local PerfGroup perfGroup;
+
+// one timer per encoder step, their begin and end come in separate calls
+thread_local ATFStageTimer jxrTimers[2];
+
+void jxrStageHook(jxr_stage_t stage, int begin)
+{
+    ATFStageTimer &timer = jxrTimers[stage == JXR_STAGE_INPUT ? 0 : 1];
+    if ( begin ) {
+        timer.start(stage == JXR_STAGE_INPUT ? ATF_STAGE_JXR_INPUT : ATF_STAGE_JXR_TRANSFORM);
+    } else {
+        timer.stop();
+    }
+}
+
+void jxrBitsHook(jxr_band_t band, int alpha, int channel, unsigned tx, unsigned ty, size_t bits)
+{
+    ATFBandBits &total = bandBits[band];
+    total.bits += bits;
+    if ( alpha ) {
+        total.channels[ATF_JXR_CHANNELS - 1] += bits;
+    } else if ( channel < 0 ) {
+        total.joint += bits;
+    } else {
+        total.channels[channel < ATF_JXR_CHANNELS - 1 ? channel : ATF_JXR_CHANNELS - 2] += bits;
+    }
+    total.tiles[ty < ATF_JXR_TILES ? ty : ATF_JXR_TILES - 1][tx < ATF_JXR_TILES ? tx : ATF_JXR_TILES - 1] += bits;
+}
+
+}
+
+const char *atf_stage_name(int32_t stage)
+{
+    static const char *names[ATF_STAGE_COUNT] = {
+        "load", "swizzle", "plane_split", "lzma", "jpegxr", "jxr_input", "jxr_transform", "write", "verify"
+    };
+    return stage >= 0 && stage < ATF_STAGE_COUNT ? names[stage] : "unknown";
+}
+
+const char *atf_counter_name(int32_t counter)
+{
+    static const char *names[ATF_COUNTER_COUNT] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+    return counter >= 0 && counter < ATF_COUNTER_COUNT ? names[counter] : "unknown";
+}
+
+const ATFStageTime *atf_stage_times()
+{
+    return stageTimes;
+}
+
+void atf_stage_reset()
+{
+    for ( int32_t i = 0; i < ATF_STAGE_COUNT; i++ ) {
+        stageTimes[i] = ATFStageTime();
+    }
+    for ( int32_t i = 0; i < ATF_JXR_BAND_COUNT; i++ ) {
+        bandBits[i] = ATFBandBits();
+    }
+}
+
+const char *atf_jxr_band_name(int32_t band)
+{
+    static const char *names[ATF_JXR_BAND_COUNT] = { "dc", "lp", "cbp", "hp", "flexbits" };
+    return band >= 0 && band < ATF_JXR_BAND_COUNT ? names[band] : "unknown";
+}
+
+const ATFBandBits *atf_jxr_bits()
+{
+    return bitsCounted ? bandBits : 0;
+}
+
+int32_t atf_stage_current()
+{
+    return currentStage;
+}
+
+void atf_install_stage_hooks()
+{
+    jxr_set_stage_hook(jxrStageHook);
+    bitsCounted = jxr_set_bits_hook(jxrBitsHook) != 0;
+}
+
+bool atf_perf_counters_start()
+{
+    perfEnabled = true;
+    uint64_t values[ATF_COUNTER_COUNT];
+    perfGroup.read(values);
+    if ( perfGroup.leader < 0 ) {
+        perfEnabled = false;
+        return false;
+    }
+    return true;
+}
+
+bool atf_perf_counter_available(int32_t counter)
+{
+    return perfEnabled && counter >= 0 && counter < ATF_COUNTER_COUNT && perfGroup.slots[counter] >= 0;
+}
+
+ATFStageTimer::ATFStageTimer() : m_stage(-1), m_outer(0), m_wall(0), m_cpu(0)
+{
+}
+
+ATFStageTimer::ATFStageTimer(int32_t stage) : m_stage(-1), m_outer(0), m_wall(0), m_cpu(0)
+{
+    start(stage);
+}
+
+ATFStageTimer::~ATFStageTimer()
+{
+    if ( m_stage >= 0 ) {
+        stop();
+    }
+}
+
+void ATFStageTimer::start(int32_t stage)
+{
+    m_stage = stage;
+    m_outer = innermost;
+    if ( m_outer ) {
+        m_outer->pause();
+    }
+    innermost = this;
+    currentStage = m_stage;
+    stageTimes[m_stage].calls++;
+    resume();
+}
+
+void ATFStageTimer::stop()
+{
+    pause();
+    innermost = m_outer;
+    currentStage = m_outer ? m_outer->m_stage : -1;
+    if ( m_outer ) {
+        m_outer->resume();
+    }
+    m_stage = -1;
+}
+
+void ATFStageTimer::resume()
+{
+    m_wall = wallMs();
+    m_cpu = cpuMs();
+    if ( perfEnabled.load(std::memory_order_relaxed) ) {
+        perfGroup.read(m_counters);
+    }
+}
+
+void ATFStageTimer::pause()
+{
+    ATFStageTime &time = stageTimes[m_stage];
+    if ( perfEnabled.load(std::memory_order_relaxed) ) {
+        uint64_t counters[ATF_COUNTER_COUNT];
+        perfGroup.read(counters);
+        for ( int32_t c = 0; c < ATF_COUNTER_COUNT; c++ ) {
+            // scaled counts can step back a little when the PMU is shared
+            time.counters[c] += counters[c] > m_counters[c] ? counters[c] - m_counters[c] : 0;
+        }
+    }
+    time.wallMs += wallMs() - m_wall;
+    time.cpuMs += cpuMs() - m_cpu;
+}
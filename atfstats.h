@@ -0,0 +1,112 @@
+#ifndef _ATFSTATS_H_
+#define _ATFSTATS_H_
+
+#include <stdint.h>
+
+//
+// Wall and CPU time per conversion stage, for dds2atf --stats.
+//
+// An ATFStageTimer adds the time of its scope to its stage. Timers nest: one
+// started inside another pauses the outer one, so every stage gets the time
+// spent in it alone and the stages add up to the whole conversion. Totals
+// are kept per thread, CPU time is that of the calling thread.
+//
+// With atf_perf_counters_start() the timers also read the thread's hardware
+// counters (perf_event_open, Linux only) and add them to their stage the
+// same way. Where the kernel does not allow them only the times are kept.
+//
+
+enum ATFStage {
+    ATF_STAGE_LOAD,         // reading and parsing the input
+    ATF_STAGE_SWIZZLE,      // reordering channels into the encoder's layout
+    ATF_STAGE_SPLIT,        // reading blocks of a level and splitting them into planes
+    ATF_STAGE_LZMA,
+    ATF_STAGE_JPEGXR,       // what the two below leave of it, mostly entropy coding
+    ATF_STAGE_JXR_INPUT,    // the Read*Data block callbacks and color conversion, per strip
+    ATF_STAGE_JXR_TRANSFORM,// overlap filters, PCT and prediction, per strip
+    ATF_STAGE_WRITE,        // flushing the output and writing the sidecar
+    ATF_STAGE_VERIFY,       // --verify: handing levels over and waiting for the check
+    ATF_STAGE_COUNT
+};
+
+enum ATFCounter {
+    ATF_COUNTER_CYCLES,
+    ATF_COUNTER_INSTRUCTIONS,
+    ATF_COUNTER_CACHE_MISSES,
+    ATF_COUNTER_BRANCH_MISSES,
+    ATF_COUNTER_COUNT
+};
+
+struct ATFStageTime {
+    double wallMs;
+    double cpuMs;
+    uint64_t calls;
+    uint64_t counters[ATF_COUNTER_COUNT];
+};
+
+const char *atf_stage_name(int32_t stage);
+const char *atf_counter_name(int32_t counter);
+
+// totals of the calling thread, ATF_STAGE_COUNT of them
+const ATFStageTime *atf_stage_times();
+void atf_stage_reset();
+// stage of the innermost timer on the calling thread, -1 outside of any
+int32_t atf_stage_current();
+
+// Reports the encoder's per strip steps (jxr_set_stage_hook) as the
+// ATF_STAGE_JXR_* stages and counts its bits (jxr_set_bits_hook).
+void atf_install_stage_hooks();
+
+// Counts from here on, false if the kernel gives no counters at all.
+bool atf_perf_counters_start();
+// whether a counter was opened for the calling thread
+bool atf_perf_counter_available(int32_t counter);
+
+// Bits the JPEG-XR encoder wrote per band (jxr_set_bits_hook), counted only
+// when the encoder was built with JXR_BIT_STATS (make JXR_BIT_STATS=1).
+// Channels 0 to 2 are those of the color image, the last one the alpha
+// plane. Symbols coded for all channels at once count as joint. Tiles are
+// kept by row and column, later ones count on the last row or column.
+enum {
+    ATF_JXR_BAND_COUNT = 5, // dc, lp, cbp, hp, flexbits as in jxr_band_t
+    ATF_JXR_CHANNELS = 4,
+    ATF_JXR_TILES = 16
+};
+
+struct ATFBandBits {
+    uint64_t bits;
+    uint64_t joint;
+    uint64_t channels[ATF_JXR_CHANNELS];
+    uint64_t tiles[ATF_JXR_TILES][ATF_JXR_TILES];   // [row][column]
+};
+
+const char *atf_jxr_band_name(int32_t band);
+// totals of the calling thread, ATF_JXR_BAND_COUNT of them, 0 when the
+// encoder counts no bits
+const ATFBandBits *atf_jxr_bits();
+
+class ATFStageTimer {
+public:
+    explicit ATFStageTimer(int32_t stage);
+    ~ATFStageTimer();
+
+    // idle, for stages that start and stop in different calls
+    ATFStageTimer();
+    void start(int32_t stage);
+    void stop();
+
+private:
+    ATFStageTimer(const ATFStageTimer &);
+    ATFStageTimer &operator=(const ATFStageTimer &);
+
+    void pause();
+    void resume();
+
+    int32_t m_stage;
+    ATFStageTimer *m_outer;
+    double m_wall;
+    double m_cpu;
+    uint64_t m_counters[ATF_COUNTER_COUNT];
+};
+
+#endif //#ifndef _ATFSTATS_H_
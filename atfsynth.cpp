@@ -0,0 +1,502 @@
+#include "atfsynth.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+
+#include "atf.h"
+
+namespace {
+
+const int32_t kGridStep = 32;
+
+// DDS header flags, as in dds2atf.cpp
+const uint32_t kDDSMagic = 0x20534444;
+const uint32_t kDDSDCaps = 0x00000001;
+const uint32_t kDDSDHeight = 0x00000002;
+const uint32_t kDDSDWidth = 0x00000004;
+const uint32_t kDDSDPitch = 0x00000008;
+const uint32_t kDDSDPixelFormat = 0x00001000;
+const uint32_t kDDSDMipMapCount = 0x00020000;
+const uint32_t kDDSDLinearSize = 0x00080000;
+const uint32_t kDDPFAlphaPixels = 0x00000001;
+const uint32_t kDDPFFourCC = 0x00000004;
+const uint32_t kDDPFRGB = 0x00000040;
+const uint32_t kDDPFLuminance = 0x00020000;
+const uint32_t kDDSCapsComplex = 0x00000008;
+const uint32_t kDDSCapsTexture = 0x00001000;
+const uint32_t kDDSCapsMipMap = 0x00400000;
+const uint32_t kDDSCaps2CubeMap = 0x0000FE00;     // the cube map flag and all six faces
+const uint32_t kFourCCDXT1 = 0x31545844;
+const uint32_t kFourCCDXT5 = 0x35545844;
+
+uint8_t clamp_byte(int32_t v)
+{
+    return uint8_t(std::min(255, std::max(0, v)));
+}
+
+// palette index of a point at t / 3 of the way from the second endpoint to
+// the first: 0 is the first endpoint, 1 the second, 2 and 3 in between
+int32_t dxt1_index(int32_t t)
+{
+    static const int32_t indices[4] = { 1, 3, 2, 0 };
+    return indices[t];
+}
+
+// the same for eight level alpha: 0 is the first endpoint, 1 the second and
+// 2 to 7 the points in between, from the first endpoint on
+int32_t dxt5_index(int32_t t)
+{
+    static const int32_t indices[8] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+    return indices[t];
+}
+
+// the 16 texels of a block, edge ones repeated for levels under 4 texels
+void block_texels(const uint8_t *rgba, int32_t w, int32_t h, int32_t bx, int32_t by, const uint8_t *texels[16])
+{
+    for ( int32_t t = 0; t < 16; t++ ) {
+        int32_t x = std::min(w - 1, bx * 4 + (t & 3));
+        int32_t y = std::min(h - 1, by * 4 + (t >> 2));
+        texels[t] = rgba + (size_t(y) * w + x) * 4;
+    }
+}
+
+void color_block(const uint8_t *const texels[16], uint8_t *block)
+{
+    uint8_t lo[3] = { 255, 255, 255 };
+    uint8_t hi[3] = { 0, 0, 0 };
+    for ( int32_t t = 0; t < 16; t++ ) {
+        for ( int32_t c = 0; c < 3; c++ ) {
+            lo[c] = std::min(lo[c], texels[t][c]);
+            hi[c] = std::max(hi[c], texels[t][c]);
+        }
+    }
+
+    uint16_t c0 = atf_synth_565(hi);
+    uint16_t c1 = atf_synth_565(lo);
+    uint32_t bits = 0;
+    int32_t axis[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+    int32_t length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    if ( c0 != c1 && length > 0 ) {
+        for ( int32_t t = 0; t < 16; t++ ) {
+            int32_t dot = 0;
+            for ( int32_t c = 0; c < 3; c++ ) {
+                dot += (texels[t][c] - lo[c]) * axis[c];
+            }
+            int32_t step = (dot * 3 + length / 2) / length;
+            bits |= uint32_t(dxt1_index(std::min(3, step))) << (t * 2);
+        }
+    }
+
+    block[0] = uint8_t(c0);
+    block[1] = uint8_t(c0 >> 8);
+    block[2] = uint8_t(c1);
+    block[3] = uint8_t(c1 >> 8);
+    for ( int32_t b = 0; b < 4; b++ ) {
+        block[4 + b] = uint8_t(bits >> (b * 8));
+    }
+}
+
+void alpha_block(const uint8_t *const texels[16], uint8_t *block)
+{
+    uint8_t lo = 255;
+    uint8_t hi = 0;
+    for ( int32_t t = 0; t < 16; t++ ) {
+        lo = std::min(lo, texels[t][3]);
+        hi = std::max(hi, texels[t][3]);
+    }
+
+    uint64_t bits = 0;
+    if ( hi > lo ) {
+        int32_t range = hi - lo;
+        for ( int32_t t = 0; t < 16; t++ ) {
+            int32_t step = ((texels[t][3] - lo) * 7 + range / 2) / range;
+            bits |= uint64_t(dxt5_index(step)) << (t * 3);
+        }
+    }
+
+    block[0] = hi;
+    block[1] = lo;
+    for ( int32_t b = 0; b < 6; b++ ) {
+        block[2 + b] = uint8_t(bits >> (b * 8));
+    }
+}
+
+int32_t level_count(const ATFSynthTexture &texture)
+{
+    int32_t count = 1;
+    if ( texture.mips ) {
+        while ( (std::max(texture.width, texture.height) >> count) > 0 ) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// the next smaller mip, each texel the average of up to 2x2 texels above it
+void box_filter(const std::vector<uint8_t> &src, int32_t sw, int32_t sh, std::vector<uint8_t> &dst, int32_t dw, int32_t dh)
+{
+    dst.resize(size_t(dw) * dh * 4);
+    for ( int32_t y = 0; y < dh; y++ ) {
+        int32_t y0 = std::min(sh - 1, y * 2);
+        int32_t y1 = std::min(sh - 1, y * 2 + 1);
+        for ( int32_t x = 0; x < dw; x++ ) {
+            int32_t x0 = std::min(sw - 1, x * 2);
+            int32_t x1 = std::min(sw - 1, x * 2 + 1);
+            for ( int32_t c = 0; c < 4; c++ ) {
+                int32_t sum = src[(size_t(y0) * sw + x0) * 4 + c] + src[(size_t(y0) * sw + x1) * 4 + c] +
+                              src[(size_t(y1) * sw + x0) * 4 + c] + src[(size_t(y1) * sw + x1) * 4 + c];
+                dst[(size_t(y) * dw + x) * 4 + c] = uint8_t((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+uint8_t luminance(const uint8_t *rgba)
+{
+    return uint8_t((rgba[0] * 77 + rgba[1] * 150 + rgba[2] * 29 + 128) >> 8);
+}
+
+// One level in the byte order of the file: BGR(A) for DDS, RGB(A) for PVR.
+void append_level(ATFSynthFormat format, bool pvr, const std::vector<uint8_t> &rgba, int32_t w, int32_t h, std::vector<uint8_t> &file)
+{
+    size_t offset = file.size();
+    size_t texels = size_t(w) * h;
+    switch ( format ) {
+    case ATF_SYNTH_DXT1:
+        file.resize(offset + size_t(std::max(1, w / 4)) * std::max(1, h / 4) * 8);
+        atf_synth_dxt1(rgba.data(), w, h, &file[offset]);
+        break;
+    case ATF_SYNTH_DXT5:
+        file.resize(offset + size_t(std::max(1, w / 4)) * std::max(1, h / 4) * 16);
+        atf_synth_dxt5(rgba.data(), w, h, &file[offset]);
+        break;
+    case ATF_SYNTH_BGRA8:
+    case ATF_SYNTH_BGR8: {
+        int32_t channels = format == ATF_SYNTH_BGRA8 ? 4 : 3;
+        file.resize(offset + texels * channels);
+        for ( size_t p = 0; p < texels; p++ ) {
+            uint8_t *dst = &file[offset + p * channels];
+            const uint8_t *src = &rgba[p * 4];
+            dst[0] = pvr ? src[0] : src[2];
+            dst[1] = src[1];
+            dst[2] = pvr ? src[2] : src[0];
+            if ( channels == 4 ) {
+                dst[3] = src[3];
+            }
+        }
+        break;
+    }
+    case ATF_SYNTH_L8: {
+        int32_t channels = pvr ? 3 : 1;
+        file.resize(offset + texels * channels);
+        for ( size_t p = 0; p < texels; p++ ) {
+            memset(&file[offset + p * channels], luminance(&rgba[p * 4]), channels);
+        }
+        break;
+    }
+    }
+}
+
+// every face with all its levels, faces in DDS order
+void append_faces(const ATFSynthTexture &texture, bool pvr, std::vector<uint8_t> &file)
+{
+    int32_t faces = texture.cube ? 6 : 1;
+    int32_t levels = level_count(texture);
+    for ( int32_t f = 0; f < faces; f++ ) {
+        int32_t w = texture.width;
+        int32_t h = texture.height;
+        std::vector<uint8_t> rgba(size_t(w) * h * 4);
+        std::vector<uint8_t> next;
+        atf_synth_rgba(w, h, texture.content, texture.seed + uint32_t(f) * 7919, rgba.data());
+        for ( int32_t l = 0; l < levels; l++ ) {
+            append_level(texture.format, pvr, rgba, w, h, file);
+            if ( l + 1 < levels ) {
+                int32_t nw = std::max(1, w / 2);
+                int32_t nh = std::max(1, h / 2);
+                box_filter(rgba, w, h, next, nw, nh);
+                rgba.swap(next);
+                w = nw;
+                h = nh;
+            }
+        }
+    }
+}
+
+void append_uint32(std::vector<uint8_t> &file, uint32_t value)
+{
+    for ( int32_t b = 0; b < 4; b++ ) {
+        file.push_back(uint8_t(value >> (b * 8)));
+    }
+}
+
+uint32_t name_seed(const std::string &name)
+{
+    uint32_t hash = 2166136261u;
+    for ( char c : name ) {
+        hash = (hash ^ uint8_t(c)) * 16777619u;
+    }
+    return hash;
+}
+
+void add_texture(std::vector<ATFSynthTexture> &textures, ATFSynthFormat format, int32_t w, int32_t h, bool mips, bool cube, ATFSynthContent content)
+{
+    ATFSynthTexture texture = { format, w, h, mips, cube, content, 0 };
+    texture.seed = name_seed(atf_synth_texture_name(texture));
+    textures.push_back(texture);
+}
+
+}
+
+const char *atf_synth_content_name(int32_t content)
+{
+    static const char *names[] = { "flat", "smooth", "noisy" };
+    return content >= 0 && content <= ATF_SYNTH_NOISY ? names[content] : "unknown";
+}
+
+const char *atf_synth_format_name(int32_t format)
+{
+    static const char *names[] = { "dxt1", "dxt5", "bgra8", "bgr8", "l8" };
+    return format >= 0 && format <= ATF_SYNTH_L8 ? names[format] : "unknown";
+}
+
+void atf_synth_rgba(int32_t w, int32_t h, ATFSynthContent content, uint32_t seed, uint8_t *rgba)
+{
+    std::mt19937 random(seed);
+    if ( content == ATF_SYNTH_FLAT ) {
+        uint32_t color = uint32_t(random());
+        for ( size_t p = 0; p < size_t(w) * h; p++ ) {
+            for ( int32_t c = 0; c < 4; c++ ) {
+                rgba[p * 4 + c] = uint8_t(color >> (c * 8));
+            }
+        }
+        return;
+    }
+
+    int32_t gw = w / kGridStep + 2;
+    int32_t gh = h / kGridStep + 2;
+    std::vector<uint32_t> grid(size_t(gw) * gh);
+    for ( auto &g : grid ) {
+        g = uint32_t(random());
+    }
+
+    for ( int32_t y = 0; y < h; y++ ) {
+        int32_t gy = y / kGridStep;
+        int32_t fy = y % kGridStep;
+        for ( int32_t x = 0; x < w; x++ ) {
+            int32_t gx = x / kGridStep;
+            int32_t fx = x % kGridStep;
+            const uint32_t *g = &grid[size_t(gy) * gw + gx];
+            uint8_t *p = rgba + (size_t(y) * w + x) * 4;
+            for ( int32_t c = 0; c < 4; c++ ) {
+                int32_t a = (g[0] >> (c * 8)) & 0xFF;
+                int32_t b = (g[1] >> (c * 8)) & 0xFF;
+                int32_t d = (g[gw] >> (c * 8)) & 0xFF;
+                int32_t e = (g[gw + 1] >> (c * 8)) & 0xFF;
+                int32_t top = a * (kGridStep - fx) + b * fx;
+                int32_t bottom = d * (kGridStep - fx) + e * fx;
+                int32_t v = (top * (kGridStep - fy) + bottom * fy) / (kGridStep * kGridStep);
+                if ( content == ATF_SYNTH_NOISY ) {
+                    v += int32_t(random() % 65) - 32;
+                }
+                p[c] = clamp_byte(v);
+            }
+        }
+    }
+}
+
+uint16_t atf_synth_565(const uint8_t *rgba)
+{
+    return uint16_t(((rgba[0] >> 3) << 11) | ((rgba[1] >> 2) << 5) | (rgba[2] >> 3));
+}
+
+void atf_synth_dxt1(const uint8_t *rgba, int32_t w, int32_t h, uint8_t *blocks)
+{
+    int32_t bw = std::max(1, w / 4);
+    int32_t bh = std::max(1, h / 4);
+    for ( int32_t by = 0; by < bh; by++ ) {
+        for ( int32_t bx = 0; bx < bw; bx++ ) {
+            const uint8_t *texels[16];
+            block_texels(rgba, w, h, bx, by, texels);
+            color_block(texels, blocks + (size_t(by) * bw + bx) * 8);
+        }
+    }
+}
+
+void atf_synth_dxt5(const uint8_t *rgba, int32_t w, int32_t h, uint8_t *blocks)
+{
+    int32_t bw = std::max(1, w / 4);
+    int32_t bh = std::max(1, h / 4);
+    for ( int32_t by = 0; by < bh; by++ ) {
+        for ( int32_t bx = 0; bx < bw; bx++ ) {
+            const uint8_t *texels[16];
+            block_texels(rgba, w, h, bx, by, texels);
+            uint8_t *block = blocks + (size_t(by) * bw + bx) * 16;
+            alpha_block(texels, block);
+            color_block(texels, block + 8);
+        }
+    }
+}
+
+std::string atf_synth_texture_name(const ATFSynthTexture &texture)
+{
+    std::string name = atf_synth_format_name(texture.format);
+    name += "-" + std::to_string(texture.width) + "x" + std::to_string(texture.height);
+    if ( texture.mips ) {
+        name += "-mips";
+    }
+    if ( texture.cube ) {
+        name += "-cube";
+    }
+    return name + "-" + atf_synth_content_name(texture.content);
+}
+
+void atf_synth_corpus(bool full, std::vector<ATFSynthTexture> &textures)
+{
+    static const int32_t sizes[] = { 1, 4, 64, 256, 1024 };
+    for ( int32_t f = ATF_SYNTH_DXT1; f <= ATF_SYNTH_L8; f++ ) {
+        ATFSynthFormat format = ATFSynthFormat(f);
+        for ( int32_t size : sizes ) {
+            add_texture(textures, format, size, size, true, false, ATF_SYNTH_SMOOTH);
+        }
+        add_texture(textures, format, 256, 256, false, false, ATF_SYNTH_FLAT);
+        add_texture(textures, format, 256, 256, false, false, ATF_SYNTH_NOISY);
+        add_texture(textures, format, 64, 64, true, true, ATF_SYNTH_NOISY);
+        if ( full ) {
+            add_texture(textures, format, 2, 2, true, false, ATF_SYNTH_NOISY);
+            add_texture(textures, format, 16, 16, false, false, ATF_SYNTH_SMOOTH);
+            add_texture(textures, format, 1024, 1024, true, false, ATF_SYNTH_NOISY);
+            add_texture(textures, format, 1024, 1024, false, false, ATF_SYNTH_FLAT);
+            add_texture(textures, format, 512, 512, true, true, ATF_SYNTH_SMOOTH);
+            add_texture(textures, format, 2048, 2048, true, false, ATF_SYNTH_SMOOTH);
+            add_texture(textures, format, 2048, 2048, false, false, ATF_SYNTH_NOISY);
+        }
+    }
+}
+
+void atf_synth_dds(const ATFSynthTexture &texture, std::vector<uint8_t> &file)
+{
+    int32_t levels = level_count(texture);
+    bool blocks = texture.format == ATF_SYNTH_DXT1 || texture.format == ATF_SYNTH_DXT5;
+    static const uint32_t bitCounts[] = { 0, 0, 32, 24, 8 };
+
+    uint32_t flags = kDDSDCaps | kDDSDHeight | kDDSDWidth | kDDSDPixelFormat;
+    flags |= blocks ? kDDSDLinearSize : kDDSDPitch;
+    flags |= texture.mips ? kDDSDMipMapCount : 0;
+    uint32_t pitch = 0;
+    if ( blocks ) {
+        pitch = uint32_t(std::max(1, texture.width / 4) * std::max(1, texture.height / 4) * (texture.format == ATF_SYNTH_DXT1 ? 8 : 16));
+    } else {
+        pitch = uint32_t(texture.width) * bitCounts[texture.format] / 8;
+    }
+
+    file.clear();
+    append_uint32(file, kDDSMagic);
+    append_uint32(file, 124);
+    append_uint32(file, flags);
+    append_uint32(file, uint32_t(texture.height));
+    append_uint32(file, uint32_t(texture.width));
+    append_uint32(file, pitch);
+    append_uint32(file, 0);
+    append_uint32(file, texture.mips ? uint32_t(levels) : 0);
+    for ( int32_t r = 0; r < 11; r++ ) {
+        append_uint32(file, 0);
+    }
+
+    // pixel format
+    append_uint32(file, 32);
+    switch ( texture.format ) {
+    case ATF_SYNTH_DXT1:
+    case ATF_SYNTH_DXT5:
+        append_uint32(file, kDDPFFourCC);
+        append_uint32(file, texture.format == ATF_SYNTH_DXT1 ? kFourCCDXT1 : kFourCCDXT5);
+        for ( int32_t m = 0; m < 5; m++ ) {
+            append_uint32(file, 0);
+        }
+        break;
+    case ATF_SYNTH_BGRA8:
+    case ATF_SYNTH_BGR8:
+        append_uint32(file, kDDPFRGB | (texture.format == ATF_SYNTH_BGRA8 ? kDDPFAlphaPixels : 0));
+        append_uint32(file, 0);
+        append_uint32(file, bitCounts[texture.format]);
+        append_uint32(file, 0xFF0000);
+        append_uint32(file, 0xFF00);
+        append_uint32(file, 0xFF);
+        append_uint32(file, texture.format == ATF_SYNTH_BGRA8 ? 0xFF000000U : 0);
+        break;
+    case ATF_SYNTH_L8:
+        append_uint32(file, kDDPFLuminance);
+        append_uint32(file, 0);
+        append_uint32(file, 8);
+        append_uint32(file, 0xFF);
+        for ( int32_t m = 0; m < 3; m++ ) {
+            append_uint32(file, 0);
+        }
+        break;
+    }
+
+    uint32_t caps1 = kDDSCapsTexture;
+    if ( texture.mips || texture.cube ) {
+        caps1 |= kDDSCapsComplex;
+    }
+    if ( texture.mips ) {
+        caps1 |= kDDSCapsMipMap;
+    }
+    append_uint32(file, caps1);
+    append_uint32(file, texture.cube ? kDDSCaps2CubeMap : 0);
+    for ( int32_t r = 0; r < 3; r++ ) {
+        append_uint32(file, 0);
+    }
+
+    append_faces(texture, false, file);
+}
+
+void atf_synth_pvr(const ATFSynthTexture &texture, std::vector<uint8_t> &file)
+{
+    std::vector<uint8_t> data;
+    append_faces(texture, true, data);
+
+    PVR_HEADER header;
+    memset(&header, 0, sizeof(header));
+    header.dwHeaderSize = sizeof(PVR_HEADER);
+    header.dwWidth = uint32_t(texture.width);
+    header.dwHeight = uint32_t(texture.height);
+    header.dwMipMapCount = uint32_t(level_count(texture) - 1);
+    header.dwTextureDataSize = uint32_t(data.size() / (texture.cube ? 6 : 1));
+    header.dwpfFlags = header.dwMipMapCount ? PVRTEX_MIPMAP : 0;
+    memcpy(header.dwPVR, "PVR!", 4);
+    header.dwNumSurfs = 1;
+    switch ( texture.format ) {
+    case ATF_SYNTH_DXT1:
+    case ATF_SYNTH_DXT5:
+        header.dwRBitMask = 0xFFFFFFFF;
+        header.dwGBitMask = 0xFFFFFFFF;
+        header.dwBBitMask = 0xFFFFFFFF;
+        header.dwpfFlags |= texture.format == ATF_SYNTH_DXT1 ? PVR_D3D_DXT1 : PVR_D3D_DXT5;
+        break;
+    case ATF_SYNTH_BGRA8:
+        header.dwRBitMask = 0xFF;
+        header.dwGBitMask = 0xFF;
+        header.dwBBitMask = 0xFF;
+        header.dwAlphaBitMask = 0xFF;
+        header.dwBitCount = 32;
+        header.dwpfFlags |= PVR_OGL_RGBA_8888;
+        break;
+    case ATF_SYNTH_BGR8:
+    case ATF_SYNTH_L8:
+        header.dwRBitMask = 0xFF;
+        header.dwGBitMask = 0xFF;
+        header.dwBBitMask = 0xFF;
+        header.dwBitCount = 24;
+        header.dwpfFlags |= PVR_OGL_RGB_888;
+        break;
+    }
+    if ( texture.cube ) {
+        header.dwpfFlags |= PVRTEX_CUBEMAP | PVRTEX_DDSCUBEMAPORDER;
+    }
+
+    file.resize(sizeof(header));
+    memcpy(file.data(), &header, sizeof(header));
+    file.insert(file.end(), data.begin(), data.end());
+}
@@ -0,0 +1,81 @@
+#ifndef _ATFSYNTH_H_
+#define _ATFSYNTH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+//
+// Synthetic textures for the benchmarks, made from a seed alone so every
+// machine and every commit measures the same pixels.
+//
+// Images are RGBA8 in memory order. Flat images are one color, smooth ones
+// interpolate a coarse grid of random colors and noisy ones add per pixel
+// noise on top of that. All randomness is std::mt19937 bits and integer
+// math, no floating point or library distributions.
+//
+// atf_synth_dxt1 is a plain bounding box block encoder, good enough to give
+// the DXT planes the statistics of real content. It never picks the three
+// color mode. atf_synth_dxt5 puts the same color blocks after eight level
+// alpha blocks made the same way.
+//
+// ATFSynthTexture describes a whole input texture: atf_synth_dds writes it as
+// the DDS file dds2atf reads and atf_synth_pvr as the PVR stream dds2atf
+// hands to convert() or convert_with_alpha() for that file (swizzled to RGB,
+// L8 expanded to RGB888). Mips are 2x2 box filtered from the level above,
+// down to 1x1, and every cube face has a seed of its own. The file names of
+// atf_synth_texture_name and the texture lists of atf_synth_corpus are part
+// of the benchmark baselines, change them only together with those.
+//
+
+enum ATFSynthContent {
+    ATF_SYNTH_FLAT,
+    ATF_SYNTH_SMOOTH,
+    ATF_SYNTH_NOISY
+};
+
+enum ATFSynthFormat {
+    ATF_SYNTH_DXT1,
+    ATF_SYNTH_DXT5,
+    ATF_SYNTH_BGRA8,
+    ATF_SYNTH_BGR8,
+    ATF_SYNTH_L8
+};
+
+struct ATFSynthTexture {
+    ATFSynthFormat format;
+    int32_t width;
+    int32_t height;
+    bool mips;
+    bool cube;
+    ATFSynthContent content;
+    uint32_t seed;
+};
+
+const char *atf_synth_content_name(int32_t content);
+const char *atf_synth_format_name(int32_t format);
+
+// w * h * 4 bytes
+void atf_synth_rgba(int32_t w, int32_t h, ATFSynthContent content, uint32_t seed, uint8_t *rgba);
+
+uint16_t atf_synth_565(const uint8_t *rgba);
+
+// max(1, w / 4) * max(1, h / 4) blocks of 8 bytes, little endian as in a DDS
+void atf_synth_dxt1(const uint8_t *rgba, int32_t w, int32_t h, uint8_t *blocks);
+
+// the same count of 16 byte blocks
+void atf_synth_dxt5(const uint8_t *rgba, int32_t w, int32_t h, uint8_t *blocks);
+
+// "dxt1-256x256-mips-smooth", "bgra8-64x64-mips-cube-noisy", no extension
+std::string atf_synth_texture_name(const ATFSynthTexture &texture);
+
+// The benchmark corpus: every format at 1 to 1024 texels with mips, without
+// mips for every content and as a cube map. full adds 2048 and more shapes.
+void atf_synth_corpus(bool full, std::vector<ATFSynthTexture> &textures);
+
+void atf_synth_dds(const ATFSynthTexture &texture, std::vector<uint8_t> &file);
+void atf_synth_pvr(const ATFSynthTexture &texture, std::vector<uint8_t> &file);
+
+#endif //#ifndef _ATFSYNTH_H_
@@ -0,0 +1,142 @@
+#include "atftrace.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+std::atomic<bool> gTraceEnabled(false);
+
+namespace {
+
+struct TraceEvent {
+    const char *name;
+    const char *argName;
+    int32_t arg;
+    double start;           // microseconds since atf_trace_start
+    double duration;
+};
+
+struct ThreadTrace {
+    uint32_t tid;
+    std::string name;
+    std::vector<TraceEvent> events;
+};
+
+std::mutex traceLock;
+std::string tracePath;
+std::chrono::steady_clock::time_point traceStart;
+// kept after their threads exit, until the trace is written
+std::vector<std::shared_ptr<ThreadTrace>> threadTraces;
+
+thread_local std::shared_ptr<ThreadTrace> threadTrace;
+
+ThreadTrace &currentThread()
+{
+    if ( !threadTrace ) {
+        threadTrace = std::make_shared<ThreadTrace>();
+        std::lock_guard<std::mutex> lock(traceLock);
+        threadTrace->tid = uint32_t(threadTraces.size() + 1);
+        threadTrace->name = threadTrace->tid == 1 ? "main" : "thread " + std::to_string(threadTrace->tid);
+        threadTraces.push_back(threadTrace);
+    }
+    return *threadTrace;
+}
+
+double now()
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - traceStart).count();
+}
+
+void writeJsonString(std::ostream &out, const std::string &str)
+{
+    out << '"';
+    for ( char c : str ) {
+        if ( c == '"' || c == '\\' ) {
+            out << '\\' << c;
+        } else if ( uint8_t(c) >= 0x20 ) {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+}
+
+bool atf_trace_start(const char *path)
+{
+    std::lock_guard<std::mutex> lock(traceLock);
+    tracePath = path;
+    traceStart = std::chrono::steady_clock::now();
+    for ( auto &thread : threadTraces ) {
+        thread->events.clear();
+    }
+    gTraceEnabled.store(true);
+    return true;
+}
+
+bool atf_trace_stop()
+{
+    if ( !gTraceEnabled.exchange(false) ) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(traceLock);
+    std::ofstream out(tracePath.c_str(), std::ios::out | std::ios::binary);
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for ( const auto &thread : threadTraces ) {
+        out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << thread->tid
+            << ",\"args\":{\"name\":";
+        writeJsonString(out, thread->name);
+        out << "}}";
+        first = false;
+        for ( const auto &event : thread->events ) {
+            out << ",\n{\"ph\":\"X\",\"name\":\"" << event.name << "\",\"pid\":1,\"tid\":" << thread->tid
+                << ",\"ts\":" << event.start << ",\"dur\":" << event.duration;
+            if ( event.argName ) {
+                out << ",\"args\":{\"" << event.argName << "\":" << event.arg << "}";
+            }
+            out << "}";
+        }
+        thread->events.clear();
+    }
+    out << "\n]}\n";
+    return out.good();
+}
+
+ATFTraceSession::ATFTraceSession(const char *path) : m_path(path)
+{
+    if ( m_path ) {
+        atf_trace_start(m_path);
+    }
+}
+
+ATFTraceSession::~ATFTraceSession()
+{
+    if ( m_path && !atf_trace_stop() ) {
+        std::cerr << "Could not write trace file. '" << m_path << "'\n\n";
+    }
+}
+
+#ifndef ATF_NO_TRACE
+
+void ATFTraceSpan::begin(const char *name, const char *argName, int32_t arg)
+{
+    m_name = name;
+    m_argName = argName;
+    m_arg = arg;
+    m_start = now();
+}
+
+void ATFTraceSpan::end()
+{
+    TraceEvent event = { m_name, m_argName, m_arg, m_start, now() - m_start };
+    currentThread().events.push_back(event);
+}
+
+#endif //#ifndef ATF_NO_TRACE
@@ -0,0 +1,79 @@
+#ifndef _ATFTRACE_H_
+#define _ATFTRACE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+//
+// Scoped trace spans written as Chrome trace-event JSON (Perfetto,
+// about:tracing), one track per thread ("main", "thread 2", ... in the order
+// they first record), for --trace in dds2atf and atf-transform.
+//
+// Tracing is off unless atf_trace_start() was called: a span then costs one
+// relaxed atomic load. Building with ATF_NO_TRACE removes the spans
+// altogether. Every thread records into its own buffer; atf_trace_stop()
+// merges them, so it has to run after the traced threads are done.
+//
+
+extern std::atomic<bool> gTraceEnabled;
+
+inline bool atf_trace_enabled() { return gTraceEnabled.load(std::memory_order_relaxed); }
+
+bool atf_trace_start(const char *path);
+// writes the trace, false if the file could not be written
+bool atf_trace_stop();
+
+// Traces to path, if not 0, until it goes out of scope, for tools with many
+// ways out of main.
+class ATFTraceSession {
+    public:
+        explicit ATFTraceSession(const char *path);
+        ~ATFTraceSession();
+
+    private:
+        ATFTraceSession(const ATFTraceSession &);
+        ATFTraceSession &operator=(const ATFTraceSession &);
+
+        const char *m_path;
+};
+
+#ifndef ATF_NO_TRACE
+
+class ATFTraceSpan {
+    public:
+        // name and argName must outlive the trace, string literals
+        explicit ATFTraceSpan(const char *name, const char *argName = 0, int32_t arg = 0) : m_name(0) {
+            if ( atf_trace_enabled() ) {
+                begin(name, argName, arg);
+            }
+        }
+        ~ATFTraceSpan() {
+            if ( m_name ) {
+                end();
+            }
+        }
+
+    private:
+        ATFTraceSpan(const ATFTraceSpan &);
+        ATFTraceSpan &operator=(const ATFTraceSpan &);
+
+        void begin(const char *name, const char *argName, int32_t arg);
+        void end();
+
+        const char *m_name;
+        const char *m_argName;
+        int32_t m_arg;
+        double m_start;
+};
+
+#else
+
+class ATFTraceSpan {
+    public:
+        explicit ATFTraceSpan(const char *, const char * = 0, int32_t = 0) {}
+};
+
+#endif //#ifndef ATF_NO_TRACE
+
+#endif //#ifndef _ATFTRACE_H_
@@ -0,0 +1,195 @@
+#include "atfverify.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "atf.h"
+#include "atfalloc.h"
+#include "atfblock.h"
+#include "atfstats.h"
+#include "atftrace.h"
+
+namespace {
+
+int32_t log2_size(int32_t x)
+{
+    int32_t l = 0;
+    while ( ( 1 << ( l + 1 ) ) <= x ) {
+        l++;
+    }
+    return l;
+}
+
+double psnr(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    double sum = 0;
+    for ( size_t c = 0; c < len; c++ ) {
+        double d = double(a[c]) - double(b[c]);
+        sum += d * d;
+    }
+    if ( sum == 0 || len == 0 ) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return 10.0 * log10(255.0 * 255.0 * len / sum);
+}
+
+// RGBA pixels of a level of DXT blocks
+void decode_blocks(ATFBlockFormat format, const uint8_t *blocks, int32_t w, int32_t h, std::vector<uint8_t> &rgba)
+{
+    ATFBlockImage image = { format, blocks, w, h };
+    rgba.assign(size_t(w) * h * 4, 0);
+    atf_block_decode(image, rgba.data(), size_t(w) * 4, 1);
+}
+
+} // namespace
+
+ATFVerifier::ATFVerifier(const uint8_t *header, size_t headerLen, bool lossless, int32_t threads)
+    : m_header(header, header + headerLen)
+    , m_lossless(lossless)
+    , m_done(false)
+{
+    if ( threads <= 0 ) {
+        threads = std::max(1, int32_t(std::thread::hardware_concurrency()) - 1);
+    }
+    for ( int32_t c = 0; c < threads; c++ ) {
+        m_workers.emplace_back(&ATFVerifier::work, this);
+    }
+}
+
+ATFVerifier::~ATFVerifier()
+{
+    finish();
+}
+
+void ATFVerifier::add(int32_t face, int32_t level, int32_t w, int32_t h, std::vector<uint8_t> &input, std::vector<uint8_t> &sections)
+{
+    Job job;
+    job.face = face;
+    job.level = level;
+    job.width = std::max(1, w);
+    job.height = std::max(1, h);
+    job.input.swap(input);
+    job.sections.swap(sections);
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_jobs.push_back(std::move(job));
+    }
+    m_changed.notify_one();
+}
+
+bool ATFVerifier::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_done = true;
+    }
+    m_changed.notify_all();
+    for ( std::thread &worker : m_workers ) {
+        if ( worker.joinable() ) {
+            worker.join();
+        }
+    }
+    std::sort(m_results.begin(), m_results.end(), [](const ATFVerifyResult &a, const ATFVerifyResult &b) {
+        return a.face != b.face ? a.face < b.face : a.level < b.level;
+    });
+    for ( const ATFVerifyResult &result : m_results ) {
+        if ( !result.ok ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ATFVerifier::work()
+{
+    ATFAllocatorScope scope(ATFPoolAllocator::threadLocal());
+    for ( ;; ) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_changed.wait(lock, [this] { return m_done || !m_jobs.empty(); });
+            if ( m_jobs.empty() ) {
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        ATFTraceSpan span("verify level", "level", job.level);
+        ATFStageTimer timer(ATF_STAGE_VERIFY);
+        ATFVerifyResult result = check(job);
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_results.push_back(result);
+    }
+}
+
+ATFVerifyResult ATFVerifier::check(const Job &job) const
+{
+    ATFVerifyResult result = { job.face, job.level, false, false, 0, 0, 0 };
+
+    // the level alone, as a file of one level of the same format and version
+    size_t preamble = ( m_header.size() > 6 && m_header[6] == 0xFF ) ? 12 : 6;
+    if ( m_header.size() < preamble + 4 ) {
+        result.error = "no ATF header";
+        return result;
+    }
+    std::vector<uint8_t> file(m_header.begin(), m_header.begin() + preamble);
+    file.push_back(m_header[preamble] & ~ATFDecoder::ATF_FORMAT_CUBEMAP);
+    file.push_back(uint8_t(log2_size(job.width)));
+    file.push_back(uint8_t(log2_size(job.height)));
+    file.push_back(1);
+    file.insert(file.end(), job.sections.begin(), job.sections.end());
+    size_t length = file.size() - preamble;
+    if ( preamble == 12 ) {
+        file[8] = uint8_t(length >> 24);
+        file[9] = uint8_t(length >> 16);
+        file[10] = uint8_t(length >> 8);
+        file[11] = uint8_t(length);
+    } else {
+        file[3] = uint8_t(length >> 16);
+        file[4] = uint8_t(length >> 8);
+        file[5] = uint8_t(length);
+    }
+
+    ATFDecoder decoder(file.data(), file.size());
+    const uint8_t *data = decoder.decode(ATFDecoder::PREFER_DXT1) ? decoder.texData(0) : 0;
+    if ( !data ) {
+        result.error = "does not decode";
+        return result;
+    }
+    size_t len = decoder.texDataLen(0);
+    if ( len != job.input.size() ) {
+        result.error = "decodes to a different size";
+        return result;
+    }
+
+    const uint8_t *input = job.input.data();
+    const uint8_t *mismatch = std::mismatch(input, input + len, data).first;
+    result.exact = mismatch == input + len;
+    result.offset = mismatch - input;
+    if ( result.exact ) {
+        result.ok = true;
+        result.psnr = std::numeric_limits<double>::infinity();
+        return result;
+    }
+    if ( m_lossless ) {
+        result.error = "differs from the input";
+        return result;
+    }
+
+    int32_t format = decoder.Format();
+    if ( format == ATFDecoder::ATF_FORMAT_888 || format == ATFDecoder::ATF_FORMAT_8888 ) {
+        result.psnr = psnr(input, data, len);
+    } else {
+        ATFBlockFormat blocks = format == ATFDecoder::ATF_FORMAT_COMPRESSEDALPHA ||
+                                format == ATFDecoder::ATF_FORMAT_COMPRESSEDRAWALPHA ? ATF_BLOCK_BC3 : ATF_BLOCK_BC1;
+        std::vector<uint8_t> expected;
+        std::vector<uint8_t> decoded;
+        decode_blocks(blocks, input, job.width, job.height, expected);
+        decode_blocks(blocks, data, job.width, job.height, decoded);
+        result.psnr = psnr(expected.data(), decoded.data(), expected.size());
+    }
+    result.ok = true;
+    return result;
+}
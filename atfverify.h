@@ -0,0 +1,82 @@
+#ifndef _ATFVERIFY_H_
+#define _ATFVERIFY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Round trip check of a conversion, for dds2atf --verify.
+//
+// The encoder hands over every level of every face as soon as it is written:
+// the PVR data it was encoded from and the bytes of its sections. Worker
+// threads wrap the sections into a one level ATF file, decode it with
+// ATFDecoder and compare the result with the input while the encoder goes
+// on with the next level, so finish() mostly waits for the last few levels.
+//
+// Lossless settings must give the input back bit for bit. With lossy
+// JPEG-XR settings every level gets a PSNR instead, over the RGB(A) pixels or
+// over the RGBA of the decoded DXT blocks (atfblock.h), and only a level that
+// does not decode at all fails.
+//
+
+struct ATFVerifyResult {
+    int32_t face;
+    int32_t level;
+    bool ok;
+    bool exact;
+    double psnr;            // dB, infinity when exact
+    const char *error;      // why the level failed, 0 if ok
+    size_t offset;          // first differing byte of a lossless level
+};
+
+class ATFVerifier {
+public:
+    // header is the start of the ATF file: the length preamble, format,
+    // log2 width, log2 height and count. threads 0 for one less than cores.
+    ATFVerifier(const uint8_t *header, size_t headerLen, bool lossless, int32_t threads = 0);
+    ~ATFVerifier();
+
+    // level w x h of face, from its input data and its sections
+    void add(int32_t face, int32_t level, int32_t w, int32_t h, std::vector<uint8_t> &input, std::vector<uint8_t> &sections);
+
+    // waits for the levels still queued, false if any failed
+    bool finish();
+
+    bool lossless() const { return m_lossless; }
+    int32_t threads() const { return int32_t(m_workers.size()); }
+    // sorted by face and level, complete after finish()
+    const std::vector<ATFVerifyResult> &results() const { return m_results; }
+
+private:
+    ATFVerifier(const ATFVerifier &);
+    ATFVerifier &operator=(const ATFVerifier &);
+
+    struct Job {
+        int32_t face;
+        int32_t level;
+        int32_t width;
+        int32_t height;
+        std::vector<uint8_t> input;
+        std::vector<uint8_t> sections;
+    };
+
+    void work();
+    ATFVerifyResult check(const Job &job) const;
+
+    std::vector<uint8_t> m_header;
+    bool m_lossless;
+    std::vector<std::thread> m_workers;
+    std::mutex m_lock;
+    std::condition_variable m_changed;
+    std::deque<Job> m_jobs;
+    bool m_done;
+    std::vector<ATFVerifyResult> m_results;
+};
+
+#endif //#ifndef _ATFVERIFY_H_
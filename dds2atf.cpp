@@ -20,8 +20,12 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <limits>
 #include <sstream>
 #include <math.h>
 
@@ -37,6 +41,14 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "3rdparty/jpegxr/jxr_priv.h"
 #include "3rdparty/lzma/LzmaLib.h"
 #include "atf.h"
+#include "atfalloc.h"
+#include "atfcache.h"
+#include "atffilter.h"
+#include "atfindex.h"
+#include "atfmemory.h"
+#include "atfstats.h"
+#include "atftrace.h"
+#include "atfverify.h"
 
 using namespace std;
 
@@ -226,6 +238,8 @@ using namespace std;
 extern int32_t	gCompressedFormats;
 extern bool		gEncodeRawJXR;
 extern bool		gCheckForAlphaValue;
+extern bool		gStoreRawCompressed;
+extern bool		gFilterLzma;
 extern bool		gSilent;
 extern bool		gTrimFlexBitsDefault ;
 extern int32_t	gTrimFlexBits;
@@ -242,15 +256,75 @@ extern size_t	outlzmasize;
 extern size_t	texturew;
 extern size_t	textureh;
 extern size_t	texturecomp;
+extern atomic<size_t>	lzmastreams;
+extern atomic<size_t>	lzmaencoders;
+extern atomic<double>	lzmasetupms;
+extern atomic<double>	lzmasavedms;
+extern atomic<size_t>	lzmasections;
+extern atomic<size_t>	lzmafiltered;
+extern atomic<size_t>	lzmafiltersaved;
+
+extern ATFIndex	gIndex;
+extern void		(*gLevelWritten)(int32_t face, int32_t level, int32_t w, int32_t h, streamoff inStart, streamoff inEnd, streamoff outStart, streamoff outEnd);
 
 extern bool convert(istream &ifile_etc1, istream &ifile_pvrtc, istream &ifile_dxt1, istream &ifile_raw, ostream &ofile);	
 extern bool convert_with_alpha(istream &ifile_etc1, istream &ifile_pvrtc, istream &ifile_dxt5, ostream &ofile);
 
+void print_stats()
+{
+	if ( gSilent || !lzmastreams ) {
+		return;
+	}
+	cout << fixed << setprecision(2) << "\nLZMA: " << lzmastreams.load() << " streams, " << lzmaencoders.load() << " encoders created in "
+		 << lzmasetupms.load() << " ms, ~" << lzmasavedms.load() << " ms setup saved by reuse\n";
+	if ( lzmasections ) {
+		cout << "Pre-filters: " << lzmafiltered.load() << " of " << lzmasections.load() << " sections filtered, "
+			 << lzmafiltersaved.load() << " bytes saved\n";
+	}
+}
+
+// hardware counters per stage, for --perf-counters
+static void print_perf()
+{
+	if ( gSilent || !atf_perf_counter_available(ATF_COUNTER_CYCLES) ) {
+		return;
+	}
+	const ATFStageTime *times = atf_stage_times();
+	cout << fixed << setprecision(2) << "\n" << left << setw(14) << "stage" << right << setw(10) << "wall ms";
+	for ( int32_t k = 0; k < ATF_COUNTER_COUNT; k++ ) {
+		if ( atf_perf_counter_available(k) ) {
+			cout << setw(15) << atf_counter_name(k);
+		}
+	}
+	cout << setw(7) << "IPC" << "\n";
+	for ( int32_t c = 0; c < ATF_STAGE_COUNT; c++ ) {
+		if ( !times[c].calls ) {
+			continue;
+		}
+		cout << left << setw(14) << atf_stage_name(c) << right << setw(10) << times[c].wallMs;
+		for ( int32_t k = 0; k < ATF_COUNTER_COUNT; k++ ) {
+			if ( atf_perf_counter_available(k) ) {
+				cout << setw(15) << times[c].counters[k];
+			}
+		}
+		uint64_t cycles = times[c].counters[ATF_COUNTER_CYCLES];
+		cout << setw(7) << (cycles ? double(times[c].counters[ATF_COUNTER_INSTRUCTIONS]) / cycles : 0.0) << "\n";
+	}
+}
+
 void print_usage()
 {
 	cout << "\ndds2atf V0.4 Copyright 2010-2012 Adobe Systems Inc. All rights reserved.\n\n";
-	cout << "\nUsage: dds2atf [-4|-2|-0] [-q <0-180>] [-f <0-15>] -i input.dds -o output.atf\n\n";
+	cout << "\nUsage: dds2atf [-4|-2|-0] [-q <0-180>] [-f <0-15>] [-p] [-x] [--stats <file|->] [--trace <file>] [--perf-counters] [--memory-budget <MB>] [--verify] [--cache <dir> [--cache-size <MB>]] -i input.dds -o output.atf\n\n";
 	cout << "   -n  Embed a specific range of texture levels (main texture + mip map) for texture streaming. The range is defined as <start>,<end>. 0 is the main texture, mip map starts with 1.\n\n";
+	cout << "   -p  Compress block data with LZMA and JPEG-XR instead of storing it raw, trying texture pre-filters on the LZMA sections (ATF version 4, use atf-transform to get raw blocks back).\n\n";
+	cout << "   -x  Also write a level index (output.atfidx) with the offset and length of every section, for seeking and HTTP range requests.\n\n";
+	cout << "   --stats  Append a JSON line with wall and CPU time per stage, bytes in and out per level and section and the compression ratio per platform to the file (- for stdout, use with -s). Runs over many files give one line each (NDJSON).\n\n";
+	cout << "   --perf-counters  Also count cycles, instructions, cache and branch misses per stage (perf_event_open, Linux). Printed after the conversion and added to --stats. Falls back to times only where the kernel does not allow counters.\n\n";
+	cout << "   --memory-budget  Stop with a report of the allocations, largest allocation and peak live bytes of every stage as soon as more than this many MB are live. --stats always has these numbers.\n\n";
+	cout << "   --verify  Decode every level again while the next one is encoded, on other threads, and fail (removing the output) unless it gives the input back bit for bit. With lossy JPEG-XR settings (-q, -f, -2, -0) the PSNR of every level is printed instead.\n\n";
+	cout << "   --cache  Keep outputs in dir, keyed by a hash of the input file and the settings, and copy the output from there instead of converting when the input was seen before. --cache-size limits the cache (1024 MB by default), the least recently used entries go first. --stats counts hits and misses.\n\n";
+	cout << "   --trace  Write the time spent in reading, swizzling, the per level encoders, LZMA, JPEG-XR and writing as Chrome trace events (open in Perfetto or about:tracing).\n\n";
     cout << "Options for non-block compressed texture:\n";
 	cout << "   -4  Use 4:4:4 colorspace (default)\n";
 	cout << "   -2  Use 4:2:2 colorspace\n";
@@ -260,12 +334,510 @@ void print_usage()
 }
 
 const char *ofilename = 0;
+static bool writeIndex = false;
 
 static ifstream ifile;
-static ofstream ofile;
+static fstream ofile;
 static stringstream *tfile;
 static stringstream *dfile;
 
+static const char *ifilename = 0;
+static const char *statsPath = 0;
+static const char *tracePath = 0;
+static bool perfCounters = false;
+static uint64_t memoryBudget = 0;
+static bool verify = false;
+static ATFVerifier *verifier = 0;
+static int32_t verifyUnread = 0;
+static const char *cacheDir = 0;
+static uint64_t cacheLimit = uint64_t(1024) * 1024 * 1024;
+static ATFCache *cache = 0;
+static string cacheKey;
+
+// bump whenever the encoder writes different bytes for the same input and
+// settings, so --cache entries of older builds are not used
+static const int32_t kCacheVersion = 1;
+static int32_t inputWidth = 0;
+static int32_t inputHeight = 0;
+
+// writes gIndex, filled in while converting, next to the output file
+static bool write_index()
+{
+	if ( !writeIndex ) {
+		return true;
+	}
+	std::vector<uint8_t> data;
+	atf_index_write(gIndex,data);
+	string path = atf_index_path(ofilename);
+	ofstream xfile(path.c_str(),ios::out|ios::binary);
+	xfile.write((const char *)data.data(),data.size());
+	if ( !xfile.good() ) {
+		cerr << "Could not write index file. '" << path << "'\n\n";
+		return false;
+	}
+	return true;
+}
+
+static void write_json_string(ostream &out, const char *str)
+{
+	out << '"';
+	for ( const char *c = str; *c; c++ ) {
+		if ( *c == '"' || *c == '\\' ) {
+			out << '\\' << *c;
+		} else if ( uint8_t(*c) < 0x20 ) {
+			out << "\\u00" << hex << setw(2) << setfill('0') << int32_t(*c) << dec << setfill(' ');
+		} else {
+			out << *c;
+		}
+	}
+	out << '"';
+}
+
+// platform of section s of a level, going by the section order of the writers
+static int32_t section_platform(int32_t format, int32_t s)
+{
+	enum { DXT, PVRTC, ETC1, RGB };
+	switch ( format & 0x7F ) {
+		case ATFDecoder::ATF_FORMAT_888:
+		case ATFDecoder::ATF_FORMAT_8888:
+			return RGB;
+		case ATFDecoder::ATF_FORMAT_COMPRESSED:
+			return s < 2 ? DXT : s < 5 ? PVRTC : ETC1;
+		case ATFDecoder::ATF_FORMAT_COMPRESSEDALPHA:
+			return s < 4 ? DXT : s < 7 ? PVRTC : ETC1;
+		default:
+			return s == 0 ? DXT : s == 1 ? PVRTC : ETC1;
+	}
+}
+
+// bytes of a level handed to the encoder, only DXT or RGB data comes in
+static size_t level_input_size(int32_t format, int32_t w, int32_t h)
+{
+	switch ( format & 0x7F ) {
+		case ATFDecoder::ATF_FORMAT_888:
+			return size_t(w) * h * 3;
+		case ATFDecoder::ATF_FORMAT_8888:
+			return size_t(w) * h * 4;
+		case ATFDecoder::ATF_FORMAT_COMPRESSED:
+		case ATFDecoder::ATF_FORMAT_COMPRESSEDRAW:
+			return size_t(max(1,w/4)) * max(1,h/4) * 8;
+		default:
+			return size_t(max(1,w/4)) * max(1,h/4) * 16;
+	}
+}
+
+static void write_memory(ostream &out, const ATFStageMemory &memory)
+{
+	out << "\"allocs\":" << memory.allocs << ",\"alloc_bytes\":" << memory.bytes
+		<< ",\"largest_alloc\":" << memory.largest << ",\"peak_bytes\":" << memory.peakBytes;
+}
+
+// bits per band of the JPEG-XR encoder, with the tiles that have any
+static void write_jxr_bits(ostream &out, const ATFBandBits *bits)
+{
+	out << ",\"jxr_bits\":{";
+	for ( int32_t b = 0; b < ATF_JXR_BAND_COUNT; b++ ) {
+		out << (b ? "," : "") << "\"" << atf_jxr_band_name(b) << "\":{\"bits\":" << bits[b].bits
+			<< ",\"joint\":" << bits[b].joint << ",\"channels\":[";
+		for ( int32_t c = 0; c < ATF_JXR_CHANNELS - 1; c++ ) {
+			out << (c ? "," : "") << bits[b].channels[c];
+		}
+		out << "],\"alpha\":" << bits[b].channels[ATF_JXR_CHANNELS - 1] << ",\"tiles\":[";
+		bool first = true;
+		for ( int32_t y = 0; y < ATF_JXR_TILES; y++ ) {
+			for ( int32_t x = 0; x < ATF_JXR_TILES; x++ ) {
+				if ( bits[b].tiles[y][x] ) {
+					out << (first ? "" : ",") << "{\"x\":" << x << ",\"y\":" << y << ",\"bits\":" << bits[b].tiles[y][x] << "}";
+					first = false;
+				}
+			}
+		}
+		out << "]}";
+	}
+	out << "}";
+}
+
+// pre-filter id of section s of a level, the first byte of an LZMA payload;
+// null for the other sections
+static void write_filter(ostream &out, istream &written, int32_t s, const ATFIndexSection *section)
+{
+	const char *platform;
+	const char *payload;
+	char id = 0;
+	if ( !section || !section->length || !atf_index_section_kind(gIndex.format, gIndex.version, s, platform, payload) ||
+		 !strstr(payload, "lzma") ) {
+		out << "null";
+		return;
+	}
+	written.clear();
+	written.seekg(section->offset);
+	if ( written.get(id) ) {
+		out << int32_t(uint8_t(id));
+	} else {
+		out << "null";
+	}
+}
+
+// Appends the stats of this run as one JSON line to statsPath.
+static bool write_stats(bool converted)
+{
+	if ( !statsPath ) {
+		return true;
+	}
+	static const char *platforms[] = { "dxt", "pvrtc", "etc1", "rgb" };
+	ostringstream out;
+	out << fixed << setprecision(3);
+
+	out << "{\"input\":";
+	write_json_string(out, ifilename ? ifilename : "");
+	out << ",\"output\":";
+	write_json_string(out, ofilename ? ofilename : "");
+	out << ",\"ok\":" << (converted ? "true" : "false")
+		<< ",\"format\":" << int32_t(gIndex.format & 0x7F) << ",\"cube\":" << ((gIndex.format & ATFDecoder::ATF_FORMAT_CUBEMAP) ? "true" : "false")
+		<< ",\"version\":" << int32_t(gIndex.version)
+		<< ",\"width\":" << inputWidth << ",\"height\":" << inputHeight
+		<< ",\"levels\":" << int32_t(gIndex.count) << ",\"threads\":" << 1 + (verifier ? verifier->threads() : 0)
+		<< ",\"bytes_in\":" << infilesize << ",\"bytes_out\":" << outfilesize << ",\"lzma_bytes\":" << outlzmasize;
+
+	out << ",\"lzma\":{\"streams\":" << lzmastreams.load() << ",\"encoders\":" << lzmaencoders.load()
+		<< ",\"setup_ms\":" << lzmasetupms.load() << ",\"saved_ms\":" << lzmasavedms.load()
+		<< ",\"filter_sections\":" << lzmasections.load() << ",\"filtered\":" << lzmafiltered.load()
+		<< ",\"filter_saved_bytes\":" << lzmafiltersaved.load() << "}";
+
+	if ( verifier ) {
+		int32_t failed = verifyUnread;
+		double worst = numeric_limits<double>::infinity();
+		for ( const ATFVerifyResult &result : verifier->results() ) {
+			failed += result.ok ? 0 : 1;
+			worst = result.ok ? min(worst,result.psnr) : worst;
+		}
+		out << ",\"verify\":{\"levels\":" << verifier->results().size() << ",\"failed\":" << failed
+			<< ",\"lossless\":" << (verifier->lossless() ? "true" : "false") << ",\"min_psnr\":";
+		if ( isinf(worst) ) {
+			out << "null";
+		} else {
+			out << worst;
+		}
+		out << "}";
+	}
+
+	if ( cache ) {
+		const ATFCacheStats &stats = cache->stats();
+		out << ",\"cache\":{\"hits\":" << stats.hits << ",\"misses\":" << stats.misses
+			<< ",\"evicted\":" << stats.evicted << ",\"bytes\":" << stats.bytes << "}";
+	}
+
+	out << ",\"stages\":{";
+	const ATFStageTime *times = atf_stage_times();
+	ATFStageMemory memory[ATF_STAGE_COUNT + 1];
+	atf_memory_stages(memory);
+	double wall = 0;
+	double cpu = 0;
+	for ( int32_t c = 0; c < ATF_STAGE_COUNT; c++ ) {
+		out << (c ? "," : "") << "\"" << atf_stage_name(c) << "\":{\"wall_ms\":" << times[c].wallMs
+			<< ",\"cpu_ms\":" << times[c].cpuMs << ",\"calls\":" << times[c].calls;
+		for ( int32_t k = 0; k < ATF_COUNTER_COUNT; k++ ) {
+			if ( atf_perf_counter_available(k) ) {
+				out << ",\"" << atf_counter_name(k) << "\":" << times[c].counters[k];
+			}
+		}
+		out << ",";
+		write_memory(out, memory[c]);
+		out << "}";
+		wall += times[c].wallMs;
+		cpu += times[c].cpuMs;
+	}
+	ATFStageMemory total;
+	atf_memory_totals(total);
+	out << "},\"wall_ms\":" << wall << ",\"cpu_ms\":" << cpu << ",\"memory\":{";
+	write_memory(out, total);
+	out << ",\"outside_stages\":{";
+	write_memory(out, memory[ATF_MEMORY_OTHER]);
+	out << "}}";
+	if ( const ATFBandBits *bits = atf_jxr_bits() ) {
+		write_jxr_bits(out, bits);
+	}
+
+	// per level and face: input bytes and the payload of every section
+	uint64_t platformIn[4] = { 0 };
+	uint64_t platformOut[4] = { 0 };
+	int32_t perLevel = gIndex.sectionsPerLevel;
+	bool filtered = converted && gIndex.version == ATF_VERSION_FILTERED;
+	ifstream written;
+	if ( filtered ) {
+		written.open(ofilename, ios::in | ios::binary);
+	}
+	out << ",\"level_stats\":[";
+	for ( int32_t face = 0; converted && face < gIndex.faces; face++ ) {
+		for ( int32_t level = 0; level < gIndex.count; level++ ) {
+			int32_t w = max(1, inputWidth >> level);
+			int32_t h = max(1, inputHeight >> level);
+			uint64_t levelOut = 0;
+			uint64_t sectionOut[4] = { 0 };
+			out << ((face || level) ? "," : "") << "{\"face\":" << face << ",\"level\":" << level
+				<< ",\"width\":" << w << ",\"height\":" << h << ",\"sections\":[";
+			for ( int32_t c = 0; c < perLevel; c++ ) {
+				const ATFIndexSection *section = atf_index_section(gIndex, face, level, c);
+				uint32_t length = section ? section->length : 0;
+				out << (c ? "," : "") << length;
+				levelOut += length;
+				sectionOut[section_platform(gIndex.format, c)] += length;
+			}
+			out << "]";
+			if ( filtered ) {
+				out << ",\"filters\":[";
+				for ( int32_t c = 0; c < perLevel; c++ ) {
+					out << (c ? "," : "");
+					write_filter(out, written, c, atf_index_section(gIndex, face, level, c));
+				}
+				out << "]";
+			}
+			int32_t inPlatform = section_platform(gIndex.format, 0);
+			size_t levelIn = sectionOut[inPlatform] ? level_input_size(gIndex.format, w, h) : 0;
+			out << ",\"bytes_in\":" << levelIn << ",\"bytes_out\":" << levelOut << "}";
+			platformIn[inPlatform] += levelIn;
+			for ( int32_t p = 0; p < 4; p++ ) {
+				platformOut[p] += sectionOut[p];
+			}
+		}
+	}
+	out << "],\"platforms\":{";
+	bool first = true;
+	for ( int32_t p = 0; p < 4; p++ ) {
+		if ( !platformOut[p] ) {
+			continue;
+		}
+		out << (first ? "" : ",") << "\"" << platforms[p] << "\":{\"bytes_in\":" << platformIn[p] << ",\"bytes_out\":" << platformOut[p]
+			<< ",\"ratio\":";
+		if ( platformIn[p] ) {
+			out << double(platformIn[p]) / platformOut[p];
+		} else {
+			out << "null";
+		}
+		out << "}";
+		first = false;
+	}
+	out << "}}\n";
+
+	if ( strcmp(statsPath, "-") == 0 ) {
+		cout << out.str();
+		cout.flush();
+		return true;
+	}
+	ofstream sfile(statsPath, ios::out | ios::app);
+	sfile << out.str();
+	if ( !sfile.good() ) {
+		cerr << "Could not write stats file. '" << statsPath << "'\n\n";
+		return false;
+	}
+	return true;
+}
+
+static void print_memory()
+{
+	if ( gSilent || !memoryBudget ) {
+		return;
+	}
+	ATFStageMemory total;
+	atf_memory_totals(total);
+	cout << fixed << setprecision(2) << "Memory: " << total.peakBytes / 1048576.0 << " MB peak of "
+		 << memoryBudget / 1048576.0 << " MB budget, " << total.allocs << " allocations, largest "
+		 << total.largest / 1048576.0 << " MB\n";
+}
+
+// the budget ran out, the report is printed already
+static void memory_exceeded()
+{
+	if ( ofilename && ofile.is_open() ) {
+		remove(ofilename);
+	}
+}
+
+static bool write_trace()
+{
+	if ( tracePath && !atf_trace_stop() ) {
+		cerr << "Could not write trace file. '" << tracePath << "'\n\n";
+		return false;
+	}
+	return true;
+}
+
+static uint8_t *load_input(size_t &filesize)
+{
+	ATFTraceSpan span("read input");
+	ATFStageTimer timer(ATF_STAGE_LOAD);
+
+	ifile.seekg(0,ios_base::end);
+	filesize = ifile.tellg();
+	ifile.seekg(0,ios_base::beg);
+
+	uint8_t *src = new uint8_t [filesize];
+	ifile.read((char *)src,filesize);
+	return src;
+}
+
+// reads [start, end) of a stream the encoder is still reading or writing
+// and leaves its positions where they were
+static bool read_back(iostream &stream, streamoff start, streamoff end, vector<uint8_t> &data)
+{
+	streamoff get = stream.tellg();
+	streamoff put = stream.tellp();
+	if ( start < 0 || end < start || get < 0 || put < 0 ) {
+		return false;
+	}
+	data.resize(size_t(end-start));
+	stream.seekg(start);
+	stream.read((char *)data.data(),data.size());
+	bool ok = stream.good();
+	stream.clear();
+	stream.seekg(get);
+	stream.seekp(put);
+	return ok;
+}
+
+// gLevelWritten for --verify, on the encoding thread: copies the input and
+// the sections of the level and queues them for the verifier threads
+static void verify_level(int32_t face, int32_t level, int32_t w, int32_t h, streamoff inStart, streamoff inEnd, streamoff outStart, streamoff outEnd)
+{
+	ATFStageTimer timer(ATF_STAGE_VERIFY);
+	if ( level < gEmbedRangeStart || level > gEmbedRangeEnd ) {
+		return; // written empty on purpose
+	}
+	if ( !verifier ) {
+		// the header up to the level count is written before any level, and
+		// the settings are final once the encoder has picked its defaults
+		vector<uint8_t> header;
+		read_back(ofile,0,gFilterLzma ? 16 : 10,header);
+		bool lossless = ( !gEncodeRawJXR && gStoreRawCompressed ) ||
+						( gJxrQuality == 0 && gTrimFlexBits == 0 && gJxrFormat == JXR_YUV444 );
+		verifier = new ATFVerifier(header.data(),header.size(),lossless);
+	}
+	vector<uint8_t> input;
+	vector<uint8_t> sections;
+	if ( !read_back(*tfile,inStart,inEnd,input) || !read_back(ofile,outStart,outEnd,sections) ) {
+		verifyUnread++;
+		return;
+	}
+	verifier->add(face,level,w,h,input,sections);
+}
+
+// waits for the levels still being checked and reports, false if any failed
+static bool finish_verify()
+{
+	if ( !verify ) {
+		return true;
+	}
+	bool verified = true;
+	{
+		ATFTraceSpan span("verify wait");
+		ATFStageTimer timer(ATF_STAGE_VERIFY);
+		if ( verifier ) {
+			verified = verifier->finish();
+		}
+	}
+	if ( verifyUnread ) {
+		cerr << "Verify failed: " << verifyUnread << " levels could not be read back.\n";
+		verified = false;
+	}
+	if ( !verifier ) {
+		return verified;
+	}
+	if ( !gSilent ) {
+		cout << "\n";
+	}
+	const vector<ATFVerifyResult> &results = verifier->results();
+	double worst = numeric_limits<double>::infinity();
+	for ( const ATFVerifyResult &result : results ) {
+		if ( !result.ok ) {
+			cerr << "Verify failed: face " << result.face << " level " << result.level << " " << result.error;
+			if ( strcmp(result.error,"differs from the input") == 0 ) {
+				cerr << " at byte " << result.offset;
+			}
+			cerr << ".\n";
+		} else if ( !verifier->lossless() && !gSilent ) {
+			cout << fixed << setprecision(2) << "Verify: face " << result.face << " level " << result.level << " ";
+			if ( result.exact ) {
+				cout << "exact\n";
+			} else {
+				cout << "PSNR " << result.psnr << " dB\n";
+			}
+		}
+		if ( result.ok ) {
+			worst = min(worst,result.psnr);
+		}
+	}
+	if ( !gSilent && verified ) {
+		cout << "Verified " << results.size() << " levels on " << verifier->threads() << " threads, ";
+		if ( verifier->lossless() ) {
+			cout << "bit exact\n";
+		} else if ( isinf(worst) ) {
+			cout << "all exact\n";
+		} else {
+			cout << fixed << setprecision(2) << "lowest PSNR " << worst << " dB\n";
+		}
+	}
+	return verified;
+}
+
+// every setting that changes the output, for the --cache key
+static string cache_settings()
+{
+	ostringstream s;
+	s << "dds2atf V0.4 cache " << kCacheVersion
+	  << " raw=" << gStoreRawCompressed << " filter=" << gFilterLzma
+	  << " q=" << (gJxrQualityDefault ? -1 : gJxrQuality)
+	  << " f=" << (gTrimFlexBitsDefault ? -1 : gTrimFlexBits)
+	  << " c=" << (gJxrFormatDefault ? -1 : int32_t(gJxrFormat))
+	  << " n=" << gEmbedRangeStart << "," << gEmbedRangeEnd;
+	return s.str();
+}
+
+// --cache hit: the output is in place, the sidecar and the reports are left.
+// The index comes from walking the file, only read back when it is needed.
+static int finish_cached()
+{
+	bool indexed = true;
+	if ( writeIndex || statsPath ) {
+		ATFStageTimer timer(ATF_STAGE_WRITE);
+		ifstream cached(ofilename,ios::in|ios::binary);
+		vector<uint8_t> data((istreambuf_iterator<char>(cached)),istreambuf_iterator<char>());
+		outfilesize += data.size();
+		indexed = atf_index_build(data.data(),data.size(),gIndex) && write_index();
+	}
+	if ( !gSilent ) {
+		cout << "Cache hit " << cacheKey << "\n";
+	}
+	bool traced = write_trace();
+	return ( write_stats(true) && indexed && traced ) ? 0 : -1;
+}
+
+// flushes the output, writes the sidecar and reports, for a converted file
+static int finish_output()
+{
+	bool verified = finish_verify();
+	bool indexed = false;
+	{
+		ATFTraceSpan span("write output");
+		ATFStageTimer timer(ATF_STAGE_WRITE);
+		ofile.flush();
+		outfilesize += ofile.tellp();
+		ofile.close();
+		if ( verified ) {
+			indexed = write_index();
+			if ( cache && !cache->store(cacheKey,ofilename) ) {
+				cerr << "Warning: Could not add the output to the cache. '" << cacheDir << "'\n";
+			}
+		} else {
+			remove(ofilename);
+		}
+	}
+	bool traced = write_trace();
+	print_stats();
+	print_memory();
+	print_perf();
+	return ( write_stats(verified) && verified && indexed && traced ) ? 0 : -1;
+}
+
 static bool set_dxt1_header(uint8_t *dst, int width, int height, int count, bool cubemap, size_t textureLen)
 {
 	PVR_HEADER *header = (PVR_HEADER *)dst;
@@ -401,11 +973,11 @@ static int32_t calcActualMipLevels(DDS_header *dds, int32_t size, int32_t &actua
 			int32_t h4 = max(1,(h/4));
             texLen += w4*h4*sizeof(uint32_t)*4*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
         } else if ( PF_IS_BGRA8((*dds)) || PF_IS_BGRX8((*dds)) ) {
-			texLen += w*h*4*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
+			texLen += max(1,w)*max(1,h)*4*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
         } else if ( PF_IS_BGR8((*dds)) ) {
-            texLen += w*h*3*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
+            texLen += max(1,w)*max(1,h)*3*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
         } else if ( PF_IS_SINGLECHANNEL((*dds)) ) {
-            texLen += w*h*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
+            texLen += max(1,w)*max(1,h)*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
         }
         if ( texLen > size ) {
             actual = c-1;
@@ -435,14 +1007,14 @@ done:
             texLen += w4*h4*sizeof(uint32_t)*4;
             fileLen += w4*h4*sizeof(uint32_t)*4*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
         } else if ( PF_IS_BGRA8((*dds)) || PF_IS_BGRX8((*dds)) ) {
-			texLen += w*h*4;
-			fileLen += w*h*4*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
+			texLen += max(1,w)*max(1,h)*4;
+			fileLen += max(1,w)*max(1,h)*4*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
         } else if ( PF_IS_BGR8((*dds)) ) {
-            texLen += w*h*3;
-            fileLen += w*h*3*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
+            texLen += max(1,w)*max(1,h)*3;
+            fileLen += max(1,w)*max(1,h)*3*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
         } else if ( PF_IS_SINGLECHANNEL((*dds)) ) {
-            texLen += w*h;
-            fileLen += w*h*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
+            texLen += max(1,w)*max(1,h);
+            fileLen += max(1,w)*max(1,h)*((dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?6:1);
         }
         w /= 2;
         h /= 2;
@@ -454,18 +1026,50 @@ done:
 
 int main(int argc, char *argv[]) {
 
+	atf_install_allocator_hooks();
+	atf_install_stage_hooks();
+
     gJxrFormatDefault = false;
 	gJxrFormat = JXR_YUV444;
     
 	if ( argc > 1) {
 		for (int32_t c = 1; c < argc; c++) {
 			if (argv[c][0] == '-') {
-                if (argv[c][1] == 'n') {
+				if (strcmp(argv[c], "--stats") == 0) {
+					if ( c + 1 < argc ) {
+						statsPath = argv[++c];
+					}
+				} else if (strcmp(argv[c], "--memory-budget") == 0) {
+					if ( c + 1 < argc ) {
+						memoryBudget = uint64_t(max(1,atoi(argv[++c]))) * 1024 * 1024;
+					}
+				} else if (strcmp(argv[c], "--cache") == 0) {
+					if ( c + 1 < argc ) {
+						cacheDir = argv[++c];
+					}
+				} else if (strcmp(argv[c], "--cache-size") == 0) {
+					if ( c + 1 < argc ) {
+						cacheLimit = uint64_t(max(1,atoi(argv[++c]))) * 1024 * 1024;
+					}
+				} else if (strcmp(argv[c], "--verify") == 0) {
+					verify = true;
+				} else if (strcmp(argv[c], "--perf-counters") == 0) {
+					perfCounters = true;
+				} else if (strcmp(argv[c], "--trace") == 0) {
+					if ( c + 1 < argc ) {
+						tracePath = argv[++c];
+					}
+				} else if (argv[c][1] == 'n') {
 					std::istringstream s(argv[c+1]);
                     char dummy;
                     s >> gEmbedRangeStart >> dummy >> gEmbedRangeEnd;
 				} else if (argv[c][1] == 's') {
 					gSilent = true;
+				} else if (argv[c][1] == 'p') {
+					gStoreRawCompressed = false;
+					gFilterLzma = true;
+				} else if (argv[c][1] == 'x') {
+					writeIndex = true;
 				} else if (argv[c][1] == '4') {
 					gJxrFormat = JXR_YUV444;
 					gJxrFormatDefault = false;
@@ -487,6 +1091,7 @@ int main(int argc, char *argv[]) {
 					gJxrQuality = max(0,min(100,gJxrQuality));
 					gJxrQualityDefault = false;
 				} else if (argv[c][1] == 'i') {
+					ifilename = argv[c+1];
 					ifile.open(argv[c+1],ios::in|ios::binary);
 	                if ( !ifile.is_open() ) {
 		                cerr << "Could not open input file. '";
@@ -514,12 +1119,27 @@ int main(int argc, char *argv[]) {
             goto printusage;
         }
 
-	    ifile.seekg(0,ios_base::end);
-	    size_t filesize = ifile.tellg();
-	    ifile.seekg(0,ios_base::beg);
+        if ( tracePath ) {
+            atf_trace_start(tracePath);
+        }
+
+        // accounting taxes every allocation, so only when something reads it.
+        // The allocator is never deleted: the thread_local LZMA encoders keep
+        // blocks of it until the process exits.
+        ATFAllocator *allocator = ATFPoolAllocator::threadLocal();
+        if ( statsPath || memoryBudget ) {
+            atf_memory_enable();
+            atf_memory_set_budget(memoryBudget, memory_exceeded);
+            allocator = new ATFMemoryAllocator(allocator);
+        }
+        ATFAllocatorScope allocScope(allocator);
+
+        if ( perfCounters && !atf_perf_counters_start() ) {
+            cerr << "Hardware counters not available (perf_event_paranoid?), reporting times only.\n";
+        }
 
-        uint8_t *src = new uint8_t [filesize];
-        ifile.read((char *)src,filesize);
+	    size_t filesize = 0;
+        uint8_t *src = load_input(filesize);
 
         DDS_header *dds = (DDS_header *)src;
         if ( dds->dwMagic != DDS_MAGIC ) {
@@ -532,6 +1152,9 @@ int main(int argc, char *argv[]) {
         int32_t actualMipLevels = calcActualMipLevels(dds,filesize-sizeof(DDS_header),actualFileSize,actualTextureSize);
         int32_t strayBytes = (filesize-sizeof(DDS_header)) - actualFileSize;
 
+        inputWidth = dds->dwWidth;
+        inputHeight = dds->dwHeight;
+
         PVR_HEADER pvr;
         if ( PF_IS_DXT1((*dds)) ) {
             set_dxt1_header((uint8_t*)&pvr,dds->dwWidth,dds->dwHeight,actualMipLevels,(dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?true:false,actualTextureSize);
@@ -543,6 +1166,12 @@ int main(int argc, char *argv[]) {
             set_bgra_header((uint8_t*)&pvr,dds->dwWidth,dds->dwHeight,actualMipLevels,(dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?true:false,actualTextureSize);
             gEncodeRawJXR = true;
         } else if ( PF_IS_BGR8((*dds)) || PF_IS_SINGLECHANNEL((*dds)) || PF_IS_BGRX8((*dds))) {
+            // the face size of the RGB888 data the swizzle below writes
+            if ( PF_IS_SINGLECHANNEL((*dds)) ) {
+                actualTextureSize *= 3;
+            } else if ( PF_IS_BGRX8((*dds)) ) {
+                actualTextureSize = actualTextureSize / 4 * 3;
+            }
             set_bgr_header((uint8_t*)&pvr,dds->dwWidth,dds->dwHeight,actualMipLevels,(dds->sCaps.dwCaps2&DDSCAPS2_CUBEMAP)?true:false,actualTextureSize);
             gEncodeRawJXR = true;
         } else {
@@ -560,48 +1189,76 @@ int main(int argc, char *argv[]) {
     		cerr << "Warning: Stray data in input file.\n";
         }
 
+        if ( cacheDir ) {
+            {
+                ATFTraceSpan span("cache key");
+                ATFStageTimer timer(ATF_STAGE_LOAD);
+                cache = new ATFCache(cacheDir,cacheLimit);
+                cacheKey = atf_cache_key(src,filesize,cache_settings());
+            }
+            bool hit;
+            {
+                ATFTraceSpan span("cache fetch");
+                ATFStageTimer timer(ATF_STAGE_WRITE);
+                hit = cache->fetch(cacheKey,ofilename);
+            }
+            if ( hit ) {
+                return finish_cached();
+            }
+        }
+
         tfile = new stringstream(ios_base::out|ios_base::in|ios_base::binary);
         dfile = new stringstream(ios_base::out|ios_base::in|ios_base::binary);
         tfile->write((char *)&pvr,sizeof(PVR_HEADER));
 
-        if ( PF_IS_BGRA8((*dds)) ) {
-            uint8_t *s = (src+sizeof(DDS_header));
-            for (int32_t c=0; c<actualFileSize; c+=4 ) {
-                tfile->put((char)s[c+2]);
-                tfile->put((char)s[c+1]);
-                tfile->put((char)s[c+0]);
-                tfile->put((char)s[c+3]);
-            }
-        } else if ( PF_IS_BGRX8((*dds)) ) {
-            uint8_t *s = (src+sizeof(DDS_header));
-            for (int32_t c=0; c<actualFileSize; c+=4 ) {
-                tfile->put((char)s[c+2]);
-                tfile->put((char)s[c+1]);
-                tfile->put((char)s[c+0]);
-            }
-        } else if ( PF_IS_BGR8((*dds)) ) {
-            uint8_t *s = (src+sizeof(DDS_header));
-            for (int32_t c=0; c<actualFileSize; c+=3 ) {
-                tfile->put((char)s[c+2]);
-                tfile->put((char)s[c+1]);
-                tfile->put((char)s[c+0]);
-            }
-        } else if ( PF_IS_SINGLECHANNEL((*dds)) ) {
-            uint8_t *s = (src+sizeof(DDS_header));
-            for (int32_t c=0; c<actualFileSize; c++) {
-                tfile->put((char)s[c+0]);
-                tfile->put((char)s[c+0]);
-                tfile->put((char)s[c+0]);
+        {
+            ATFTraceSpan span("swizzle");
+            ATFStageTimer timer(ATF_STAGE_SWIZZLE);
+
+            if ( PF_IS_BGRA8((*dds)) ) {
+                uint8_t *s = (src+sizeof(DDS_header));
+                for (int32_t c=0; c<actualFileSize; c+=4 ) {
+                    tfile->put((char)s[c+2]);
+                    tfile->put((char)s[c+1]);
+                    tfile->put((char)s[c+0]);
+                    tfile->put((char)s[c+3]);
+                }
+            } else if ( PF_IS_BGRX8((*dds)) ) {
+                uint8_t *s = (src+sizeof(DDS_header));
+                for (int32_t c=0; c<actualFileSize; c+=4 ) {
+                    tfile->put((char)s[c+2]);
+                    tfile->put((char)s[c+1]);
+                    tfile->put((char)s[c+0]);
+                }
+            } else if ( PF_IS_BGR8((*dds)) ) {
+                uint8_t *s = (src+sizeof(DDS_header));
+                for (int32_t c=0; c<actualFileSize; c+=3 ) {
+                    tfile->put((char)s[c+2]);
+                    tfile->put((char)s[c+1]);
+                    tfile->put((char)s[c+0]);
+                }
+            } else if ( PF_IS_SINGLECHANNEL((*dds)) ) {
+                uint8_t *s = (src+sizeof(DDS_header));
+                for (int32_t c=0; c<actualFileSize; c++) {
+                    tfile->put((char)s[c+0]);
+                    tfile->put((char)s[c+0]);
+                    tfile->put((char)s[c+0]);
+                }
+            } else {
+                tfile->write((char *)(src+sizeof(DDS_header)),actualFileSize);
             }
-        } else {
-            tfile->write((char *)(src+sizeof(DDS_header)),actualFileSize);
         }
         tfile->seekg(0,ios_base::beg);
 
+        if ( verify ) {
+            gLevelWritten = verify_level;
+        }
+
         gCompressedFormats = 1;
 		gCheckForAlphaValue = false;
 
-		ofile.open(ofilename,ios::out|ios::binary);
+		// read back by --verify
+		ofile.open(ofilename,ios::in|ios::out|ios::trunc|ios::binary);
 		if ( !ofile.is_open() ) {
 			cerr << "Could not open output file. '";
 			cerr << ofilename;
@@ -613,18 +1270,17 @@ int main(int argc, char *argv[]) {
 		}
 
         if (PF_IS_DXT5((*dds)) && convert_with_alpha(*dfile, *dfile, *tfile, ofile)) {
-			ofile.flush();
-			outfilesize += ofile.tellp();
-			ofile.close();
-			return 0;
+			return finish_output();
         } else if ( convert(*dfile, *dfile, *tfile, *tfile, ofile) ) {
-			ofile.flush();
-			outfilesize += ofile.tellp();
-			ofile.close();
-			return 0;
+			return finish_output();
 		} 
+		if ( verifier ) {
+			verifier->finish();
+		}
 		ofile.close();
 		remove(ofilename);
+		write_trace();
+		write_stats(false);
         return 0;
 	}
 printusage:
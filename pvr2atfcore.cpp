@@ -20,9 +20,11 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
 #include <math.h>
 
 #ifdef _MSC_VER
@@ -36,6 +38,17 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "3rdparty/jpegxr/jpegxr.h"
 #include "3rdparty/jpegxr/jxr_priv.h"
 #include "3rdparty/lzma/LzmaLib.h"
+extern "C" {
+#include "3rdparty/lzma/LzmaEnc.h"
+}
+
+#include "atfalloc.h"
+#include "atffilter.h"
+#include "atfindex.h"
+#include "atfstats.h"
+#include "atftrace.h"
+
+#include <chrono>
 
 using namespace std;
 
@@ -46,6 +59,7 @@ int32_t gCompressedFormats	 = 0;			// 0 == all, 1 == dxt, 2 == pvrtc, 3 == etc1
 bool	gStoreRawCompressed	 = true;		// Store raw compressed data, do not attempt to apply JXR compression
 bool	gEncodeEmptyMipmap	 = false;		// Store empty mip levels
 bool	gCheckForAlphaValue	 = false;		// Check for DXT1/PVRTC alpha channel values
+bool	gFilterLzma			 = false;		// Try texture pre-filters on LZMA sections, writes ATF version 4
 
 bool	gTrimFlexBitsDefault = true;		// JXR setting 
 int32_t gTrimFlexBits		 = 0;			// JXR setting 
@@ -64,6 +78,22 @@ size_t outlzmasize			 = 0;
 size_t texturew				 = 0;
 size_t textureh				 = 0;
 size_t texturecomp			 = 3;
+// LZMA stats, atomic since every thread compresses with its own encoders
+atomic<size_t> lzmastreams(0);		// LzmaSlowCompress calls
+atomic<size_t> lzmaencoders(0);		// LZMA encoders created
+atomic<double> lzmasetupms(0);		// time spent creating them
+atomic<double> lzmasavedms(0);		// estimated setup time avoided by reusing them
+atomic<size_t> lzmasections(0);		// LZMA sections written with a pre-filter id
+atomic<size_t> lzmafiltered(0);		// of those, sections where a filter won
+atomic<size_t> lzmafiltersaved(0);	// bytes saved over the unfiltered stream
+
+// where every section went, for the .atfidx sidecar
+ATFIndex gIndex;
+
+// dds2atf --verify: called once every platform of a level of a face is
+// written, with the input stream range it was read from and the output
+// stream range its sections went to
+void (*gLevelWritten)(int32_t face, int32_t level, int32_t w, int32_t h, streamoff inStart, streamoff inEnd, streamoff outStart, streamoff outEnd) = 0;
 
 enum {
 //
@@ -182,6 +212,19 @@ static void write_uint24(uint32_t v, ostream &ofile) {
 	write_uint8((v>> 0)&0xFF,ofile);
 }
 
+// Section lengths are U24 in version 0 files and U32 from version 1 on.
+// Every section goes through here, so this is also where the index learns
+// about it.
+static void write_section_size(uint32_t v, ostream &ofile) {
+	if ( gFilterLzma ) {
+		write_uint32(v,ofile);
+	} else {
+		write_uint24(v,ofile);
+	}
+	ATFIndexSection section = { uint32_t(ofile.tellp()), v };
+	gIndex.sections.push_back(section);
+}
+
 static void write_uint64(uint64_t v, ostream &ofile) {
 	write_uint32(v>>32,ofile);
 	write_uint32(v&((uint64_t(1)<<32)-1),ofile);
@@ -211,6 +254,75 @@ struct ImageData {
 	uint32_t *etc1_d1;		// etc1 data bottom
 };
 
+// Bump allocator for the per-level scratch planes and LZMA output buffers.
+// It is sized once per texture from the largest mip level and rewound at the
+// start of every level, so a whole conversion does O(1) heap allocations and
+// early error returns no longer leak.
+class ScratchArena {
+public:
+	ScratchArena() : m_base(0), m_size(0), m_used(0) {}
+	~ScratchArena() { release(); }
+
+	// bytes taken by count elements of T, including alignment padding
+	template<class T> static size_t bytes(size_t count) {
+		return (count*sizeof(T)+kAlign-1)&~(kAlign-1);
+	}
+
+	void reserve(size_t size) {
+		if ( size > m_size ) {
+			delete [] m_base;
+			m_base = new uint8_t[size];
+			m_size = size;
+		}
+		m_used = 0;
+	}
+
+	void reset() {
+		for ( size_t c=0; c<m_overflow.size(); c++ ) {
+			delete [] m_overflow[c];
+		}
+		m_overflow.clear();
+		m_used = 0;
+	}
+
+	template<class T> T *alloc(size_t count) {
+		size_t len = bytes<T>(count);
+		if ( m_used + len > m_size ) {
+			// only reached if reserve() underestimated, keep going correctly
+			m_overflow.push_back(new uint8_t[len]);
+			return (T *)m_overflow.back();
+		}
+		T *p = (T *)(m_base + m_used);
+		m_used += len;
+		return p;
+	}
+
+private:
+	enum { kAlign = 16 };
+
+	void release() {
+		reset();
+		delete [] m_base;
+		m_base = 0;
+		m_size = 0;
+	}
+
+	ScratchArena(const ScratchArena &);
+	ScratchArena &operator=(const ScratchArena &);
+
+	uint8_t *		m_base;
+	size_t			m_size;
+	size_t			m_used;
+	vector<uint8_t *> m_overflow;
+};
+
+// Worst case LZMA output for len input bytes, including the props header
+// and the pre-filter id.
+static size_t lzma_bound(size_t len)
+{
+	return len + len/3 + 128 + LZMA_PROPS_SIZE + 1;
+}
+
 static unsigned int tile_width_in_MB[4096 * 2] = {0};
 static unsigned int tile_height_in_MB[4096 * 2] = {0};
 
@@ -326,6 +438,81 @@ static bool SetJPEGX888(jxr_container_t container, jxr_image_t image, int32_t qu
     return true;
 }
 
+// A JPEG-XR container and image that are reset for every section instead of
+// being created and destroyed, so their strip store and bitstream buffers
+// survive from one section and mip level to the next.
+class JxrEncoder {
+public:
+	JxrEncoder() : m_container(jxr_create_container()), m_image(0) {
+	}
+
+	~JxrEncoder() {
+		jxr_destroy(m_image);
+		jxr_destroy_container(m_container);
+	}
+
+	jxr_container_t container() const {
+		return m_container;
+	}
+
+	// Starts a w x h image in the given pixel format.
+	jxr_image_t begin(jxrc_t_pixelFormat fmt, int32_t w, int32_t h) {
+		jxr_reset_container(m_container);
+		jxrc_start_file(m_container);
+
+		if ( jxrc_begin_ifd_entry(m_container) != 0 ) {
+			cerr << "Could not create ATF file!\n\n";
+			return 0;
+		}
+		jxrc_set_pixel_format(m_container, fmt);
+		jxrc_set_image_shape(m_container, w, h);
+		jxrc_set_separate_alpha_image_plane(m_container, 0);
+		jxrc_set_image_band_presence(m_container, JXR_BP_ALL);
+
+		unsigned char window_params[5] = {0,0,0,0,0};
+		if ( !m_image || jxr_reset_image(m_image, w, h, window_params) != JXR_EC_OK ) {
+			jxr_destroy(m_image);
+			m_image = jxr_create_image(w, h, window_params);
+		}
+		if ( !m_image ) {
+			cerr << "Could not create image!\n\n";
+		}
+		return m_image;
+	}
+
+	// Encodes the image set up since begin() and writes it as a section.
+	bool write(block_fun_t input, void *userData, ostream &ofile) {
+		ATFStageTimer timer(ATF_STAGE_JPEGXR);
+
+		jxrc_begin_image_data(m_container);
+		jxr_set_block_input(m_image, input);
+		jxr_set_user_data(m_image, userData);
+
+		{
+			ATFTraceSpan span("jxr_write_image_bitstream");
+			if ( jxr_write_image_bitstream(m_image,m_container) != 0 ) {
+				cerr << "JPEGXR encoding error!\n\n";
+				return false;
+			}
+		}
+
+		jxrc_write_container_post(m_container);
+
+		//write_debug_image(m_container);
+
+		write_section_size(m_container->wb.len(),ofile);
+		ofile.write((const char *)m_container->wb.buffer(),m_container->wb.len());
+		return true;
+	}
+
+private:
+	JxrEncoder(const JxrEncoder &);
+	JxrEncoder &operator=(const JxrEncoder &);
+
+	jxr_container_t	m_container;
+	jxr_image_t		m_image;
+};
+
 static void Read8888Data(jxr_image_t image, int mx, int my, int *data) {
 	ImageData *imageData = (ImageData*)jxr_get_user_data(image);
 	int32_t w = jxr_get_IMAGE_WIDTH(image);
@@ -645,21 +832,210 @@ bool validate_texture(PVR_HEADER &pvr_header)
 	return true;
 }
 
+// std::atomic<double> has no fetch_add before C++20
+static void add_ms(atomic<double> &total, double ms) {
+	double current = total.load(memory_order_relaxed);
+	while ( !total.compare_exchange_weak(current,current + ms,memory_order_relaxed) ) {
+	}
+}
+
+// LZMA encoders kept per thread, one per dictionary size. An encoder keeps
+// its match finder, window and range coder between MemEncode calls as long
+// as the dictionary size stays the same, so only the first stream of each
+// size pays for allocating them. The dictionary is sized to the input, which
+// also keeps the hash table that is cleared for every stream small on the
+// small mip levels.
+class LzmaEncoderCache {
+public:
+	enum {
+		kMinDictLog = 12,
+		kMaxDictLog = 20
+	};
+
+	LzmaEncoderCache() {
+		for ( int32_t i=0; i<=kMaxDictLog; i++ ) {
+			m_enc[i] = 0;
+			m_setupMs[i] = 0;
+		}
+	}
+
+	~LzmaEncoderCache() {
+		for ( int32_t i=0; i<=kMaxDictLog; i++ ) {
+			if ( m_enc[i] ) {
+				LzmaEnc_Destroy(m_enc[i],&sAlloc,&sAlloc);
+			}
+		}
+	}
+
+	// Writes the props header and the compressed stream to dst, returns the
+	// total size or 0 on failure.
+	size_t compress(const uint8_t *src, uint8_t *dst, size_t len) {
+		int32_t dictLog = kMinDictLog;
+		while ( dictLog < kMaxDictLog && (size_t(1)<<dictLog) < len ) {
+			dictLog++;
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		bool fresh = m_enc[dictLog] == 0;
+		if ( fresh ) {
+			CLzmaEncHandle enc = LzmaEnc_Create(&sAlloc);
+			if ( !enc ) {
+				return 0;
+			}
+			CLzmaEncProps props;
+			LzmaEncProps_Init(&props);
+			props.level = 9;
+			props.dictSize = 1<<dictLog;
+			props.lc = 3;
+			props.lp = 0;
+			props.pb = 2;
+			props.fb = 273;
+			props.numThreads = 1;
+			if ( LzmaEnc_SetProps(enc,&props) != SZ_OK ) {
+				LzmaEnc_Destroy(enc,&sAlloc,&sAlloc);
+				return 0;
+			}
+			m_enc[dictLog] = enc;
+		}
+		double createMs = chrono::duration<double,milli>(chrono::steady_clock::now()-start).count();
+
+		SizeT propsLen = LZMA_PROPS_SIZE;
+		SizeT bufferLen = lzma_bound(len)-LZMA_PROPS_SIZE;
+		tAllocMs = 0;
+		int res = LzmaEnc_WriteProperties(m_enc[dictLog],dst,&propsLen);
+		if ( res == SZ_OK ) {
+			res = LzmaEnc_MemEncode(m_enc[dictLog],dst+LZMA_PROPS_SIZE,&bufferLen,src,len,0,0,&sAlloc,&sAlloc);
+		}
+		if ( res != SZ_OK ) {
+			return 0;
+		}
+
+		lzmastreams++;
+		if ( fresh ) {
+			m_setupMs[dictLog] = createMs + tAllocMs;
+			lzmaencoders++;
+			add_ms(lzmasetupms,m_setupMs[dictLog]);
+		} else {
+			add_ms(lzmasavedms,max(0.0,m_setupMs[dictLog] - tAllocMs));
+		}
+		return bufferLen+LZMA_PROPS_SIZE;
+	}
+
+	static LzmaEncoderCache &threadLocal() {
+		static thread_local LzmaEncoderCache cache;
+		return cache;
+	}
+
+private:
+	LzmaEncoderCache(const LzmaEncoderCache &);
+	LzmaEncoderCache &operator=(const LzmaEncoderCache &);
+
+	// encoder allocations, timed to measure setup cost
+	static void *Alloc(void *, size_t size) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		void *ptr = atf_alloc(size);
+		tAllocMs += chrono::duration<double,milli>(chrono::steady_clock::now()-start).count();
+		return ptr;
+	}
+
+	static void Free(void *, void *address) {
+		atf_free(address);
+	}
+
+	static ISzAlloc sAlloc;
+	static thread_local double tAllocMs;
+
+	CLzmaEncHandle	m_enc[kMaxDictLog+1];
+	double			m_setupMs[kMaxDictLog+1];
+};
+
+ISzAlloc LzmaEncoderCache::sAlloc = { LzmaEncoderCache::Alloc, LzmaEncoderCache::Free };
+thread_local double LzmaEncoderCache::tAllocMs = 0;
+
 size_t LzmaSlowCompress(uint8_t *src, uint8_t *dst, size_t len)
 {
-	size_t  sln = 0x7FFFFFFF;
-	int32_t slc = 3;
-	int32_t spb = 2;
+	ATFTraceSpan span("LzmaSlowCompress");
 
 	if ( !gSilent ) {
 		cout << ".";
 		cout.flush();
 	}
 
-	size_t bufferLen = len*2+4096;
-	size_t propsLen = LZMA_PROPS_SIZE;
-	int res = LzmaCompress(dst+LZMA_PROPS_SIZE,&bufferLen,(const unsigned char *)src,len,(unsigned char *)dst,&propsLen,9,1<<20,slc,0,spb,273,1);
-	return bufferLen+LZMA_PROPS_SIZE;
+	size_t bufferLen = LzmaEncoderCache::threadLocal().compress(src,dst,len);
+	if ( !bufferLen ) {
+		cerr << "LZMA encoding error!\n\n";
+		return 0;
+	}
+	return bufferLen;
+}
+
+// Compresses one LZMA section. With gFilterLzma every pre-filter that fits
+// the block layout is tried and the smallest result is kept, prefixed with
+// its filter id.
+static size_t LzmaSectionCompress(uint8_t *src, uint8_t *dst, size_t len, const ATFFilterLayout &layout, ScratchArena &arena)
+{
+	ATFTraceSpan span("lzma section");
+	ATFStageTimer timer(ATF_STAGE_LZMA);
+
+	if ( !gFilterLzma ) {
+		return LzmaSlowCompress(src,dst,len);
+	}
+
+	if ( !gSilent ) {
+		cout << ".";
+		cout.flush();
+	}
+
+	uint8_t filters[ATF_FILTER_MAX_CANDIDATES];
+	int32_t count = atf_filter_candidates(layout,filters,ATF_FILTER_MAX_CANDIDATES);
+
+	uint8_t *filtered = arena.alloc<uint8_t>(len);
+	uint8_t *trial = arena.alloc<uint8_t>(lzma_bound(len));
+
+	uint8_t *best = 0;
+	size_t bestLen = 0;
+	size_t plainLen = 0;
+	for ( int32_t c=0; c<count; c++ ) {
+		const uint8_t *input = src;
+		if ( filters[c] != ATF_FILTER_NONE ) {
+			if ( !atf_filter_encode(filters[c],layout,src,filtered,len) ) {
+				continue;
+			}
+			input = filtered;
+		}
+
+		uint8_t *out = (best == dst) ? trial : dst;
+		size_t outLen = LzmaEncoderCache::threadLocal().compress(input,out+1,len);
+		if ( !outLen ) {
+			cerr << "LZMA encoding error!\n\n";
+			return 0;
+		}
+		out[0] = filters[c];
+		outLen += 1;
+
+		if ( filters[c] == ATF_FILTER_NONE ) {
+			plainLen = outLen;
+		}
+		if ( !best || outLen < bestLen ) {
+			best = out;
+			bestLen = outLen;
+		}
+	}
+
+	if ( !best ) {
+		cerr << "LZMA encoding error!\n\n";
+		return 0;
+	}
+	if ( best != dst ) {
+		memcpy(dst,best,bestLen);
+	}
+
+	lzmasections++;
+	if ( dst[0] != ATF_FILTER_NONE ) {
+		lzmafiltered++;
+		lzmafiltersaved += plainLen - bestLen;
+	}
+	return bestLen;
 }
 
 bool read_pvr(istream &file, PVR_HEADER &pvr_header) {
@@ -746,9 +1122,18 @@ static void write_header(int32_t w, int32_t h, uint8_t format, int32_t textureCo
 	ofile.put('A');
 	ofile.put('T');
 	ofile.put('F');
-	ofile.put(uint8_t(0)); // placeholder for size
-	ofile.put(uint8_t(0)); // placeholder for size
-	ofile.put(uint8_t(0)); // placeholder for size
+	if ( gFilterLzma ) {
+		ofile.put(uint8_t(0)); // reserved
+		ofile.put(uint8_t(0)); // reserved
+		ofile.put(uint8_t(0)); // reserved
+		ofile.put(uint8_t(0xFF)); // versioned header
+		ofile.put(uint8_t(ATF_VERSION_FILTERED));
+		write_uint32(0,ofile); // placeholder for size
+	} else {
+		ofile.put(uint8_t(0)); // placeholder for size
+		ofile.put(uint8_t(0)); // placeholder for size
+		ofile.put(uint8_t(0)); // placeholder for size
+	}
 	ofile.put(uint8_t(format));
 	int32_t wsizelog2 =	(((w & 0xAAAAAAAA)?1:0)     )|
 						(((w & 0xCCCCCCCC)?1:0) << 1)|
@@ -763,28 +1148,39 @@ static void write_header(int32_t w, int32_t h, uint8_t format, int32_t textureCo
 						(((h & 0xFFFF0000)?1:0) << 4);
 	ofile.put(uint8_t(hsizelog2));
 	ofile.put(uint8_t(textureCount));
+
+	gIndex.version = gFilterLzma ? ATF_VERSION_FILTERED : 0;
+	gIndex.format = format;
+	gIndex.count = textureCount;
+	gIndex.faces = ( format & ATF_FORMAT_CUBEMAP ) ? 6 : 1;
+	gIndex.prefixSize = gFilterLzma ? 4 : 3;
+	gIndex.sections.clear();
 }
 
-static bool write_dxt1(int32_t w, int32_t h, int32_t level, bool flipped, istream &ifile, ostream &ofile)
+static bool write_dxt1(int32_t w, int32_t h, int32_t level, bool flipped, istream &ifile, ostream &ofile, ScratchArena &arena, JxrEncoder &jxr)
 {
+	ATFTraceSpan span("write_dxt1","level",level);
+	ATFStageTimer timer(ATF_STAGE_SPLIT);
+
 	if ( ( gCompressedFormats == 0 || gCompressedFormats == 1 ) && !(level < gEmbedRangeStart || level > gEmbedRangeEnd ) ) {
 
 		if ( gStoreRawCompressed ) {
 
 			uint32_t tsize = max(1,w/4)*max(1,h/4)*sizeof(uint32_t)*2;
-			write_uint24(tsize,ofile);
+			write_section_size(tsize,ofile);
 
 			for ( int32_t d=0; d<tsize; d++) {
 				write_uint8(read_uint8(ifile),ofile);
 			}
 
 		} else {
+			arena.reset();
 			ImageData imageData;
 			imageData.flipped = flipped;
-			imageData.dxt1_col = new uint16_t[max(2,(w/4))*max(2,(h/4)*2)];
+			imageData.dxt1_col = arena.alloc<uint16_t>(max(1,w/4)*max(1,h/4)*2);
 			uint16_t *cl0 = imageData.dxt1_col;
 			uint16_t *cl1 = imageData.dxt1_col + max(1,w/4)*max(1,h/4);
-			imageData.dxt1_bit = new uint8_t[max(1,w/4)*max(1,h/4)*4];
+			imageData.dxt1_bit = arena.alloc<uint8_t>(max(1,w/4)*max(1,h/4)*4);
 			uint8_t *bit = imageData.dxt1_bit;
 			for ( int32_t d=0; d<max(1,w/4)*max(1,h/4); d++) {
 				if ( gEncodeEmptyMipmap && level > 0 ) {
@@ -811,67 +1207,38 @@ static bool write_dxt1(int32_t w, int32_t h, int32_t level, bool flipped, istrea
 			}
 
 			{
-				uint8_t *buffer = new uint8_t[max(1,w/4)*max(1,h/4)*sizeof(uint32_t)*2+LZMA_PROPS_SIZE+4096];
+				uint8_t *buffer = arena.alloc<uint8_t>(lzma_bound(max(1,w/4)*max(1,h/4)*sizeof(uint32_t)));
 
-				size_t bufferLen = LzmaSlowCompress((uint8_t*)imageData.dxt1_bit, buffer, max(1,w/4)*max(1,h/4)*sizeof(uint32_t));
-				
-				write_uint24(bufferLen,ofile);
+				ATFFilterLayout layout = { max(1,w/4), max(1,h/4), 4, 2 };
+				size_t bufferLen = LzmaSectionCompress((uint8_t*)imageData.dxt1_bit, buffer, max(1,w/4)*max(1,h/4)*sizeof(uint32_t), layout, arena);
+				if ( !bufferLen ) {
+					return false;
+				}
+
+				write_section_size(bufferLen,ofile);
 
 				ofile.write((const char *)buffer,bufferLen);
 				outlzmasize += bufferLen;
-
-				delete [] buffer;
-			}
-
-			jxr_container_t container = jxr_create_container();
-			jxrc_start_file(container);
-
-			if ( jxrc_begin_ifd_entry(container) != 0 ) {
-				cerr << "Could not create ATF file!\n\n";
-				return false;
 			}
-			jxrc_set_pixel_format(container, JXRC_FMT_16bppBGR565);
-			jxrc_set_image_shape(container, max(1,w/4), max(2,h/2));
-			jxrc_set_separate_alpha_image_plane(container, 0);
-			jxrc_set_image_band_presence(container, JXR_BP_ALL);
-			static unsigned char window_params[5] = {0,0,0,0,0};
-			jxr_image_t image = jxr_create_image(max(1,w/4), max(2,h/2), window_params);
 
+			jxr_image_t image = jxr.begin(JXRC_FMT_16bppBGR565, max(1,w/4), max(2,h/2));
 			if ( !image ) {
 				return false;
 			}
 
-			SetJPEGX565(container,image,gJxrQuality, max(1,w/4), max(2,h/2));
+			SetJPEGX565(jxr.container(),image,gJxrQuality, max(1,w/4), max(2,h/2));
 
-			jxrc_begin_image_data(container);
-			jxr_set_block_input(image, Read565Data_DXT1);  
-			jxr_set_user_data(image, &imageData);
-
-			if ( jxr_write_image_bitstream(image,container) != 0 ) {
-				cerr << "JPEGXR encoding error!\n\n";
+			if ( !jxr.write(Read565Data_DXT1, &imageData, ofile) ) {
 				return false;
 			}
-
-			jxr_destroy(image); 
-
-			jxrc_write_container_post(container);
-
-			//write_debug_image(container);
-
-			write_uint24(container->wb.len(),ofile);
-			ofile.write((const char *)container->wb.buffer(),container->wb.len());
-			
-			jxr_destroy_container(container);
 			
-			delete [] imageData.dxt1_col;
-			delete [] imageData.dxt1_bit;
 		}
 	} else {
 		if ( gStoreRawCompressed ) {
-			write_uint24(0,ofile);
+			write_section_size(0,ofile);
 		} else {
-			write_uint24(0,ofile);
-			write_uint24(0,ofile);
+			write_section_size(0,ofile);
+			write_section_size(0,ofile);
 		}
 		for ( int32_t d=0; d<max(1,w/4)*max(1,h/4); d++) {
             read_uint32(ifile);
@@ -881,30 +1248,34 @@ static bool write_dxt1(int32_t w, int32_t h, int32_t level, bool flipped, istrea
 	return true;
 }
 
-static bool write_dxt5(int32_t w, int32_t h, int32_t level, bool flipped, istream &ifile, ostream &ofile)
+static bool write_dxt5(int32_t w, int32_t h, int32_t level, bool flipped, istream &ifile, ostream &ofile, ScratchArena &arena, JxrEncoder &jxr)
 {
+	ATFTraceSpan span("write_dxt5","level",level);
+	ATFStageTimer timer(ATF_STAGE_SPLIT);
+
 	if ( ( gCompressedFormats == 0 || gCompressedFormats == 1 ) && !(level < gEmbedRangeStart || level > gEmbedRangeEnd ) ) {
 
 		if ( gStoreRawCompressed ) {
 
 			uint32_t tsize = max(1,w/4)*max(1,h/4)*sizeof(uint32_t)*4;
-			write_uint24(tsize,ofile);
+			write_section_size(tsize,ofile);
 			for ( int32_t d=0; d<tsize; d++) {
 				write_uint8(read_uint8(ifile),ofile);
 			}
 
 		} else {
 
+			arena.reset();
 			ImageData imageData;
 			imageData.flipped = flipped;
-			imageData.dxt5_alp = new uint8_t[max(2,(w/4))*max(2,(h/4)*2)];
-			imageData.dxt5_col = new uint16_t[max(2,(w/4))*max(2,(h/4)*2)];
+			imageData.dxt5_alp = arena.alloc<uint8_t>(max(1,w/4)*max(1,h/4)*2);
+			imageData.dxt5_col = arena.alloc<uint16_t>(max(1,w/4)*max(1,h/4)*2);
 			uint8_t *al0 = imageData.dxt5_alp;
 			uint8_t *al1= imageData.dxt5_alp + max(1,w/4)*max(1,h/4);
 			uint16_t *cl0 = imageData.dxt5_col;
 			uint16_t *cl1 = imageData.dxt5_col + max(1,w/4)*max(1,h/4);
-			imageData.dxt5_abt = new uint8_t[max(1,w/4)*max(1,h/4)*6];
-			imageData.dxt5_bit = new uint8_t[max(1,w/4)*max(1,h/4)*4];
+			imageData.dxt5_abt = arena.alloc<uint8_t>(max(1,w/4)*max(1,h/4)*6);
+			imageData.dxt5_bit = arena.alloc<uint8_t>(max(1,w/4)*max(1,h/4)*4);
 			uint8_t *abt = (uint8_t *)imageData.dxt5_abt;
 			uint8_t *bit = (uint8_t *)imageData.dxt5_bit;
 			for ( int32_t d=0; d<max(1,w/4)*max(1,h/4); d++) {
@@ -948,129 +1319,69 @@ static bool write_dxt5(int32_t w, int32_t h, int32_t level, bool flipped, istrea
 				}
 			}
 
+			// shared by both index planes, sized for the larger one
+			uint8_t *buffer = arena.alloc<uint8_t>(lzma_bound(max(1,w/4)*max(1,h/4)*6));
+
 			{
-				uint8_t *buffer = new uint8_t[max(1,w/4)*max(1,h/4)*sizeof(uint32_t)*8+LZMA_PROPS_SIZE+4096];
+				ATFFilterLayout layout = { max(1,w/4), max(1,h/4), 6, 3 };
+				size_t bufferLen = LzmaSectionCompress((uint8_t*)imageData.dxt5_abt, buffer, max(1,w/4)*max(1,h/4)*6, layout, arena);
+				if ( !bufferLen ) {
+					return false;
+				}
 
-				size_t bufferLen = LzmaSlowCompress((uint8_t*)imageData.dxt5_abt, buffer, max(1,w/4)*max(1,h/4)*6);
-				
-				write_uint24(bufferLen,ofile);
+				write_section_size(bufferLen,ofile);
 
 				ofile.write((const char *)buffer,bufferLen);
 				outlzmasize += bufferLen;
-
-				delete [] buffer;
 			}
 
 			{
-				jxr_container_t container = jxr_create_container();
-				jxrc_start_file(container);
-
-				if ( jxrc_begin_ifd_entry(container) != 0 ) {
-					cerr << "Could not create ATF file!\n\n";
-					return false;
-				}
-				jxrc_set_pixel_format(container, JXRC_FMT_8bppGray);
-				jxrc_set_image_shape(container, max(1,w/4), max(2,h/2));
-				jxrc_set_separate_alpha_image_plane(container, 0);
-				jxrc_set_image_band_presence(container, JXR_BP_ALL);
-				static unsigned char window_params[5] = {0,0,0,0,0};
-				jxr_image_t image = jxr_create_image(max(1,w/4), max(2,h/2), window_params);
-
+				jxr_image_t image = jxr.begin(JXRC_FMT_8bppGray, max(1,w/4), max(2,h/2));
 				if ( !image ) {
 					return false;
 				}
 
-				SetJPEG8(container,image,gJxrQuality, max(1,w/4), max(2,h/2));
-
-				jxrc_begin_image_data(container);
-				jxr_set_block_input(image, Read8Data_DXT5);  
-				jxr_set_user_data(image, &imageData);
+				SetJPEG8(jxr.container(),image,gJxrQuality, max(1,w/4), max(2,h/2));
 
-				if ( jxr_write_image_bitstream(image,container) != 0 ) {
-					cerr << "JPEGXR encoding error!\n\n";
+				if ( !jxr.write(Read8Data_DXT5, &imageData, ofile) ) {
 					return false;
 				}
-
-				jxr_destroy(image); 
-
-				jxrc_write_container_post(container);
-
-				//write_debug_image(container);
-
-				write_uint24(container->wb.len(),ofile);
-				ofile.write((const char *)container->wb.buffer(),container->wb.len());
-				
-				jxr_destroy_container(container);
 			}
 
 			{
-				uint8_t *buffer = new uint8_t[max(1,w/4)*max(1,h/4)*sizeof(uint32_t)*8+LZMA_PROPS_SIZE+4096];
+				ATFFilterLayout layout = { max(1,w/4), max(1,h/4), 4, 2 };
+				size_t bufferLen = LzmaSectionCompress((uint8_t*)imageData.dxt5_bit, buffer, max(1,w/4)*max(1,h/4)*4, layout, arena);
+				if ( !bufferLen ) {
+					return false;
+				}
 
-				size_t bufferLen = LzmaSlowCompress((uint8_t*)imageData.dxt5_bit, buffer, max(1,w/4)*max(1,h/4)*4);
-				
-				write_uint24(bufferLen,ofile);
+				write_section_size(bufferLen,ofile);
 
 				ofile.write((const char *)buffer,bufferLen);
 				outlzmasize += bufferLen;
-
-				delete [] buffer;
 			}
 
 			{
-				jxr_container_t container = jxr_create_container();
-				jxrc_start_file(container);
-
-				if ( jxrc_begin_ifd_entry(container) != 0 ) {
-					cerr << "Could not create ATF file!\n\n";
-					return false;
-				}
-				jxrc_set_pixel_format(container, JXRC_FMT_16bppBGR565);
-				jxrc_set_image_shape(container, max(1,w/4), max(2,h/2));
-				jxrc_set_separate_alpha_image_plane(container, 0);
-				jxrc_set_image_band_presence(container, JXR_BP_ALL);
-				static unsigned char window_params[5] = {0,0,0,0,0};
-				jxr_image_t image = jxr_create_image(max(1,w/4), max(2,h/2), window_params);
-
+				jxr_image_t image = jxr.begin(JXRC_FMT_16bppBGR565, max(1,w/4), max(2,h/2));
 				if ( !image ) {
 					return false;
 				}
 
-				SetJPEGX565(container,image,gJxrQuality, max(1,w/4), max(2,h/2));
-
-				jxrc_begin_image_data(container);
-				jxr_set_block_input(image, Read565Data_DXT5);  
-				jxr_set_user_data(image, &imageData);
+				SetJPEGX565(jxr.container(),image,gJxrQuality, max(1,w/4), max(2,h/2));
 
-				if ( jxr_write_image_bitstream(image,container) != 0 ) {
-					cerr << "JPEGXR encoding error!\n\n";
+				if ( !jxr.write(Read565Data_DXT5, &imageData, ofile) ) {
 					return false;
 				}
-
-				jxr_destroy(image); 
-
-				jxrc_write_container_post(container);
-
-				//write_debug_image(container);
-
-				write_uint24(container->wb.len(),ofile);
-				ofile.write((const char *)container->wb.buffer(),container->wb.len());
-				
-				jxr_destroy_container(container);
 			}
-			
-			delete [] imageData.dxt5_alp;
-			delete [] imageData.dxt5_abt;
-			delete [] imageData.dxt5_col;
-			delete [] imageData.dxt5_bit;
 		}
 	} else {
 		if ( gStoreRawCompressed ) {
-			write_uint24(0,ofile);
+			write_section_size(0,ofile);
 		} else {
-			write_uint24(0,ofile);
-			write_uint24(0,ofile);
-			write_uint24(0,ofile);
-			write_uint24(0,ofile);
+			write_section_size(0,ofile);
+			write_section_size(0,ofile);
+			write_section_size(0,ofile);
+			write_section_size(0,ofile);
 		}
 		for ( int32_t d=0; d<max(1,w/4)*max(1,h/4); d++) {
             read_uint32(ifile);
@@ -1082,8 +1393,11 @@ static bool write_dxt5(int32_t w, int32_t h, int32_t level, bool flipped, istrea
 	return true;
 }
 
-static bool write_pvrtc_alpha(int32_t w, int32_t h, int32_t level, bool flipped, istream &ifile, ostream &ofile)
+static bool write_pvrtc_alpha(int32_t w, int32_t h, int32_t level, bool flipped, istream &ifile, ostream &ofile, ScratchArena &arena, JxrEncoder &jxr)
 {
+	ATFTraceSpan span("write_pvrtc_alpha","level",level);
+	ATFStageTimer timer(ATF_STAGE_SPLIT);
+
 	int32_t pw = max(int32_t(PVRTC4_MIN_TEXWIDTH),w);
 	int32_t ph = max(int32_t(PVRTC4_MIN_TEXWIDTH),h);
 
@@ -1092,20 +1406,21 @@ static bool write_pvrtc_alpha(int32_t w, int32_t h, int32_t level, bool flipped,
         if ( gStoreRawCompressed ) {
 
 			uint32_t tsize = max(1,pw/4)*max(1,ph/4)*sizeof(uint32_t)*2;
-			write_uint24(tsize,ofile);
+			write_section_size(tsize,ofile);
 			for ( int32_t d=0; d<tsize; d++) {
 				write_uint8(read_uint8(ifile),ofile);
 			}
 
 		} else {
+			arena.reset();
 			ImageData imageData;
 			imageData.flipped = flipped;
-			imageData.pvrtc_col = new uint16_t[max(2,pw/4)*max(2,ph/4)*2];
+			imageData.pvrtc_col = arena.alloc<uint16_t>(max(1,pw/4)*max(1,ph/4)*2);
 			uint16_t *cl0 = imageData.pvrtc_col;
 			uint16_t *cl1 = imageData.pvrtc_col + max(1,pw/4)*max(1,ph/4);
-			imageData.pvrtc_d0 = new uint8_t[max(1,pw/4)*max(1,ph/4)];
+			imageData.pvrtc_d0 = arena.alloc<uint8_t>(max(1,pw/4)*max(1,ph/4));
 			uint8_t *d0 = (uint8_t *)imageData.pvrtc_d0;
-			imageData.pvrtc_d1 = new uint32_t[max(1,pw/4)*max(1,ph/4)];
+			imageData.pvrtc_d1 = arena.alloc<uint32_t>(max(1,pw/4)*max(1,ph/4));
 			uint8_t *d1 = (uint8_t *)imageData.pvrtc_d1;
 			
 			for ( int32_t d=0; d<max(1,pw/4)*max(1,ph/4); d++) {
@@ -1130,81 +1445,53 @@ static bool write_pvrtc_alpha(int32_t w, int32_t h, int32_t level, bool flipped,
 				}
 			}
 
-			{ // pvrtc d1
-				uint8_t *buffer = new uint8_t[max(1,pw/4)*max(1,ph/4)*sizeof(uint8_t)*2+LZMA_PROPS_SIZE+4096];
+			// shared by both planes, sized for the larger one
+			uint8_t *buffer = arena.alloc<uint8_t>(lzma_bound(max(1,pw/4)*max(1,ph/4)*sizeof(uint32_t)));
 
-				size_t bufferLen = LzmaSlowCompress((uint8_t*)imageData.pvrtc_d0, buffer, max(1,pw/4)*max(1,ph/4)*sizeof(uint8_t));
+			{ // pvrtc d0
+				ATFFilterLayout layout = { max(1,pw/4), max(1,ph/4), 1, 0 };
+				size_t bufferLen = LzmaSectionCompress((uint8_t*)imageData.pvrtc_d0, buffer, max(1,pw/4)*max(1,ph/4)*sizeof(uint8_t), layout, arena);
+				if ( !bufferLen ) {
+					return false;
+				}
 
-				write_uint24(bufferLen,ofile);
+				write_section_size(bufferLen,ofile);
 
 				ofile.write((const char *)buffer,bufferLen);
 				outlzmasize += bufferLen;
-				delete [] buffer;
 			}
 			
 			{ // pvrtc d1
-				uint8_t *buffer = new uint8_t[max(1,pw/4)*max(1,ph/4)*sizeof(uint32_t)*2+LZMA_PROPS_SIZE+4096];
-
-				size_t bufferLen = LzmaSlowCompress((uint8_t*)imageData.pvrtc_d1, buffer, max(1,pw/4)*max(1,ph/4)*sizeof(uint32_t));
+				ATFFilterLayout layout = { max(1,pw/4), max(1,ph/4), 4, 2 };
+				size_t bufferLen = LzmaSectionCompress((uint8_t*)imageData.pvrtc_d1, buffer, max(1,pw/4)*max(1,ph/4)*sizeof(uint32_t), layout, arena);
+				if ( !bufferLen ) {
+					return false;
+				}
 
-				write_uint24(bufferLen,ofile);
+				write_section_size(bufferLen,ofile);
 
 				ofile.write((const char *)buffer,bufferLen);
 				outlzmasize += bufferLen;
-				delete [] buffer;
 			}
 
-			jxr_container_t container = jxr_create_container();
-			jxrc_start_file(container);
-
-			if ( jxrc_begin_ifd_entry(container) != 0 ) {
-				cerr << "Could not create ATF file!\n\n";
-				return false;
-			}
-			jxrc_set_pixel_format(container, JXRC_FMT_16bppBGR555);
-			jxrc_set_image_shape(container, max(1,pw/4), max(2,ph/2));
-			jxrc_set_separate_alpha_image_plane(container, 0);
-			jxrc_set_image_band_presence(container, JXR_BP_ALL);
-			static unsigned char window_params[5] = {0,0,0,0,0};
-			jxr_image_t image = jxr_create_image(max(1,pw/4), max(2,ph/2), window_params);
-
+			jxr_image_t image = jxr.begin(JXRC_FMT_16bppBGR555, max(1,pw/4), max(2,ph/2));
 			if ( !image ) {
 				return false;
 			}
 
-			SetJPEGX555(container,image,gJxrQuality, max(1,pw/4), max(2,ph/2));
-
-			jxrc_begin_image_data(container);
-			jxr_set_block_input(image, Read555Data_PVRTC);  
-			jxr_set_user_data(image, &imageData);
+			SetJPEGX555(jxr.container(),image,gJxrQuality, max(1,pw/4), max(2,ph/2));
 
-			if ( jxr_write_image_bitstream(image,container) != 0 ) {
-				cerr << "JPEGXR encoding error!\n";
+			if ( !jxr.write(Read555Data_PVRTC, &imageData, ofile) ) {
 				return false;
 			}
-
-			jxr_destroy(image); 
-
-			jxrc_write_container_post(container);
-
-			//write_debug_image(container);
-			
-			write_uint24(container->wb.len(),ofile);
-			ofile.write((const char *)container->wb.buffer(),container->wb.len());
-			
-			jxr_destroy_container(container);
-			
-			delete [] imageData.pvrtc_col;
-			delete [] imageData.pvrtc_d0;
-			delete [] imageData.pvrtc_d1;
 		}
 	} else {
 		if ( gStoreRawCompressed ) {
-			write_uint24(0,ofile);
+			write_section_size(0,ofile);
 		} else {
-			write_uint24(0,ofile);
-			write_uint24(0,ofile);
-			write_uint24(0,ofile);
+			write_section_size(0,ofile);
+			write_section_size(0,ofile);
+			write_section_size(0,ofile);
 		}
 		for ( int32_t d=0; d<max(1,pw/4)*max(1,ph/4); d++) {
             read_uint32(ifile);
@@ -1215,8 +1502,11 @@ static bool write_pvrtc_alpha(int32_t w, int32_t h, int32_t level, bool flipped,
 }
 
 
-static bool write_pvrtc(int32_t w, int32_t h, int32_t level, bool flipped, istream &ifile, ostream &ofile)
+static bool write_pvrtc(int32_t w, int32_t h, int32_t level, bool flipped, istream &ifile, ostream &ofile, ScratchArena &arena, JxrEncoder &jxr)
 {
+	ATFTraceSpan span("write_pvrtc","level",level);
+	ATFStageTimer timer(ATF_STAGE_SPLIT);
+
 	int32_t pw = max(int32_t(PVRTC4_MIN_TEXWIDTH),w);
 	int32_t ph = max(int32_t(PVRTC4_MIN_TEXWIDTH),h);
 
@@ -1225,20 +1515,21 @@ static bool write_pvrtc(int32_t w, int32_t h, int32_t level, bool flipped, istre
         if ( gStoreRawCompressed ) {
 
 			uint32_t tsize = max(1,pw/4)*max(1,ph/4)*sizeof(uint32_t)*2;
-			write_uint24(tsize,ofile);
+			write_section_size(tsize,ofile);
 			for ( int32_t d=0; d<tsize; d++) {
 				write_uint8(read_uint8(ifile),ofile);
 			}
 
 		} else {
+			arena.reset();
 			ImageData imageData;
 			imageData.flipped = flipped;
-			imageData.pvrtc_col = new uint16_t[max(2,pw/4)*max(2,ph/4)*2];
+			imageData.pvrtc_col = arena.alloc<uint16_t>(max(1,pw/4)*max(1,ph/4)*2);
 			uint16_t *cl0 = imageData.pvrtc_col;
 			uint16_t *cl1 = imageData.pvrtc_col + max(1,pw/4)*max(1,ph/4);
-			imageData.pvrtc_d0 = new uint8_t[max(1,pw/4)*max(1,ph/4)];
+			imageData.pvrtc_d0 = arena.alloc<uint8_t>(max(1,pw/4)*max(1,ph/4));
 			uint8_t *d0 = (uint8_t *)imageData.pvrtc_d0;
-			imageData.pvrtc_d1 = new uint32_t[max(1,pw/4)*max(1,ph/4)];
+			imageData.pvrtc_d1 = arena.alloc<uint32_t>(max(1,pw/4)*max(1,ph/4));
 			uint8_t *d1 = (uint8_t *)imageData.pvrtc_d1;
 			
 			for ( int32_t d=0; d<max(1,pw/4)*max(1,ph/4); d++) {
@@ -1271,81 +1562,53 @@ static bool write_pvrtc(int32_t w, int32_t h, int32_t level, bool flipped, istre
 				}
 			}
 
-			{ // pvrtc d1
-				uint8_t *buffer = new uint8_t[max(1,pw/4)*max(1,ph/4)*sizeof(uint8_t)*2+LZMA_PROPS_SIZE+4096];
+			// shared by both planes, sized for the larger one
+			uint8_t *buffer = arena.alloc<uint8_t>(lzma_bound(max(1,pw/4)*max(1,ph/4)*sizeof(uint32_t)));
 
-				size_t bufferLen = LzmaSlowCompress((uint8_t*)imageData.pvrtc_d0, buffer, max(1,pw/4)*max(1,ph/4)*sizeof(uint8_t));
+			{ // pvrtc d0
+				ATFFilterLayout layout = { max(1,pw/4), max(1,ph/4), 1, 0 };
+				size_t bufferLen = LzmaSectionCompress((uint8_t*)imageData.pvrtc_d0, buffer, max(1,pw/4)*max(1,ph/4)*sizeof(uint8_t), layout, arena);
+				if ( !bufferLen ) {
+					return false;
+				}
 
-				write_uint24(bufferLen,ofile);
+				write_section_size(bufferLen,ofile);
 
 				ofile.write((const char *)buffer,bufferLen);
 				outlzmasize += bufferLen;
-				delete [] buffer;
 			}
 			
 			{ // pvrtc d1
-				uint8_t *buffer = new uint8_t[max(1,pw/4)*max(1,ph/4)*sizeof(uint32_t)*2+LZMA_PROPS_SIZE+4096];
-
-				size_t bufferLen = LzmaSlowCompress((uint8_t*)imageData.pvrtc_d1, buffer, max(1,pw/4)*max(1,ph/4)*sizeof(uint32_t));
+				ATFFilterLayout layout = { max(1,pw/4), max(1,ph/4), 4, 2 };
+				size_t bufferLen = LzmaSectionCompress((uint8_t*)imageData.pvrtc_d1, buffer, max(1,pw/4)*max(1,ph/4)*sizeof(uint32_t), layout, arena);
+				if ( !bufferLen ) {
+					return false;
+				}
 
-				write_uint24(bufferLen,ofile);
+				write_section_size(bufferLen,ofile);
 
 				ofile.write((const char *)buffer,bufferLen);
 				outlzmasize += bufferLen;
-				delete [] buffer;
-			}
-
-			jxr_container_t container = jxr_create_container();
-			jxrc_start_file(container);
-
-			if ( jxrc_begin_ifd_entry(container) != 0 ) {
-				cerr << "Could not create ATF file!\n\n";
-				return false;
 			}
-			jxrc_set_pixel_format(container, JXRC_FMT_16bppBGR555);
-			jxrc_set_image_shape(container, max(1,pw/4), max(2,ph/2));
-			jxrc_set_separate_alpha_image_plane(container, 0);
-			jxrc_set_image_band_presence(container, JXR_BP_ALL);
-			static unsigned char window_params[5] = {0,0,0,0,0};
-			jxr_image_t image = jxr_create_image(max(1,pw/4), max(2,ph/2), window_params);
 
+			jxr_image_t image = jxr.begin(JXRC_FMT_16bppBGR555, max(1,pw/4), max(2,ph/2));
 			if ( !image ) {
 				return false;
 			}
 
-			SetJPEGX555(container,image,gJxrQuality, max(1,pw/4), max(2,ph/2));
+			SetJPEGX555(jxr.container(),image,gJxrQuality, max(1,pw/4), max(2,ph/2));
 
-			jxrc_begin_image_data(container);
-			jxr_set_block_input(image, Read555Data_PVRTC);  
-			jxr_set_user_data(image, &imageData);
-
-			if ( jxr_write_image_bitstream(image,container) != 0 ) {
-				cerr << "JPEGXR encoding error!\n";
+			if ( !jxr.write(Read555Data_PVRTC, &imageData, ofile) ) {
 				return false;
 			}
-
-			jxr_destroy(image); 
-
-			jxrc_write_container_post(container);
-
-			//write_debug_image(container);
-			
-			write_uint24(container->wb.len(),ofile);
-			ofile.write((const char *)container->wb.buffer(),container->wb.len());
-			
-			jxr_destroy_container(container);
-			
-			delete [] imageData.pvrtc_col;
-			delete [] imageData.pvrtc_d0;
-			delete [] imageData.pvrtc_d1;
 		}
 	} else {
 		if ( gStoreRawCompressed ) {
-			write_uint24(0,ofile);
+			write_section_size(0,ofile);
 		} else {
-			write_uint24(0,ofile);
-			write_uint24(0,ofile);
-			write_uint24(0,ofile);
+			write_section_size(0,ofile);
+			write_section_size(0,ofile);
+			write_section_size(0,ofile);
 		}
 		for ( int32_t d=0; d<max(1,pw/4)*max(1,ph/4); d++) {
             read_uint32(ifile);
@@ -1355,8 +1618,11 @@ static bool write_pvrtc(int32_t w, int32_t h, int32_t level, bool flipped, istre
 	return true;
 }
 				
-static bool write_etc1(int32_t w, int32_t h, int32_t level, bool flipped, istream &ifile, ostream &ofile, bool alpha)
+static bool write_etc1(int32_t w, int32_t h, int32_t level, bool flipped, istream &ifile, ostream &ofile, bool alpha, ScratchArena &arena, JxrEncoder &jxr)
 {
+	ATFTraceSpan span("write_etc1","level",level);
+	ATFStageTimer timer(ATF_STAGE_SPLIT);
+
 	if ( ( gCompressedFormats == 0 || gCompressedFormats == 2 ) && !(level < gEmbedRangeStart || level > gEmbedRangeEnd ) ) {
 
 		if ( gStoreRawCompressed ) {
@@ -1365,20 +1631,21 @@ static bool write_etc1(int32_t w, int32_t h, int32_t level, bool flipped, istrea
             if ( alpha ) {
                 tsize = max(1,w/4)*max(1,h/4)*sizeof(uint32_t)*4;
             }
-			write_uint24(tsize,ofile);
+			write_section_size(tsize,ofile);
 			for ( int32_t d=0; d<tsize; d++) {
 				write_uint8(read_uint8(ifile),ofile);
 			}
 
 		} else {
 
+			arena.reset();
 			ImageData imageData;
 			imageData.flipped = flipped;
-			imageData.etc1_col = new uint32_t[max(2,w/4)*max(2,h/2)*(alpha?2:1)];
+			imageData.etc1_col = arena.alloc<uint32_t>(max(1,w/4)*max(1,h/4)*(alpha?2:1));
 			uint32_t *col = imageData.etc1_col;
-			imageData.etc1_d0 = new uint8_t[max(1,w/4)*max(1,h/4)*(alpha?2:1)];
+			imageData.etc1_d0 = arena.alloc<uint8_t>(max(1,w/4)*max(1,h/4)*(alpha?2:1));
 			uint8_t *d0 = (uint8_t *)imageData.etc1_d0;
-			imageData.etc1_d1 = new uint32_t[max(1,w/4)*max(1,h/4)*(alpha?2:1)];
+			imageData.etc1_d1 = arena.alloc<uint32_t>(max(1,w/4)*max(1,h/4)*(alpha?2:1));
 			uint8_t *d1 = (uint8_t *)imageData.etc1_d1;
 
 			for ( int32_t d=0; d<max(1,w/4)*max(1,h/4)*(alpha?2:1); d++) {
@@ -1399,83 +1666,53 @@ static bool write_etc1(int32_t w, int32_t h, int32_t level, bool flipped, istrea
 				}
 			}
 
-			{ // etc1 d0 data				
-				uint8_t *buffer = new uint8_t[max(1,w/4)*max(1,h/4)*sizeof(uint8_t)*2*(alpha?2:1)+LZMA_PROPS_SIZE+4096];
+			// shared by both planes, sized for the larger one
+			uint8_t *buffer = arena.alloc<uint8_t>(lzma_bound(max(1,w/4)*max(1,h/4)*sizeof(uint32_t)*(alpha?2:1)));
 
-				size_t bufferLen = LzmaSlowCompress((uint8_t*)imageData.etc1_d0, buffer, max(1,w/4)*max(1,h/4)*sizeof(uint8_t)*(alpha?2:1));
+			{ // etc1 d0 data				
+				ATFFilterLayout layout = { max(1,w/4), max(1,h/4)*(alpha?2:1), 1, 0 };
+				size_t bufferLen = LzmaSectionCompress((uint8_t*)imageData.etc1_d0, buffer, max(1,w/4)*max(1,h/4)*sizeof(uint8_t)*(alpha?2:1), layout, arena);
+				if ( !bufferLen ) {
+					return false;
+				}
 
-				write_uint24(bufferLen,ofile);
+				write_section_size(bufferLen,ofile);
 
 				ofile.write((const char *)buffer,bufferLen);
 				outlzmasize += bufferLen;
-
-				delete [] buffer;
 			}
 
 			{ // etc1 d1 data				
-				uint8_t *buffer = new uint8_t[max(1,w/4)*max(1,h/4)*sizeof(uint32_t)*2*(alpha?2:1)+LZMA_PROPS_SIZE+4096];
-				
-				size_t bufferLen = LzmaSlowCompress((uint8_t*)imageData.etc1_d1, buffer, max(1,w/4)*max(1,h/4)*sizeof(uint32_t)*(alpha?2:1));
+				ATFFilterLayout layout = { max(1,w/4), max(1,h/4)*(alpha?2:1), 4, 0 };
+				size_t bufferLen = LzmaSectionCompress((uint8_t*)imageData.etc1_d1, buffer, max(1,w/4)*max(1,h/4)*sizeof(uint32_t)*(alpha?2:1), layout, arena);
+				if ( !bufferLen ) {
+					return false;
+				}
 
-				write_uint24(bufferLen,ofile);
+				write_section_size(bufferLen,ofile);
 
 				ofile.write((const char *)buffer,bufferLen);
 				outlzmasize += bufferLen;
-
-				delete [] buffer;
-			}
-
-			jxr_container_t container = jxr_create_container();
-			jxrc_start_file(container);
-			
-			if ( jxrc_begin_ifd_entry(container) != 0 ) {
-				cerr << "Could not create ATF file!\n\n";
-				return false;
 			}
-			jxrc_set_pixel_format(container, JXRC_FMT_16bppBGR555);
-			jxrc_set_image_shape(container, max(1,w/4), max(2,h/2)*(alpha?2:1));
-			jxrc_set_separate_alpha_image_plane(container, 0);
-			jxrc_set_image_band_presence(container, JXR_BP_ALL);
-			static unsigned char window_params[5] = {0,0,0,0,0};
-			jxr_image_t image = jxr_create_image(max(1,w/4), max(2,h/2)*(alpha?2:1), window_params);
 
+			jxr_image_t image = jxr.begin(JXRC_FMT_16bppBGR555, max(1,w/4), max(2,h/2)*(alpha?2:1));
 			if ( !image ) {
 				return false;
 			}
 
-			SetJPEGX555(container,image,gJxrQuality, max(1,w/4), max(2,h/2)*(alpha?2:1));
-
-			jxrc_begin_image_data(container);
-			jxr_set_block_input(image, Read555Data_ETC1);  
-			jxr_set_user_data(image, &imageData);
+			SetJPEGX555(jxr.container(),image,gJxrQuality, max(1,w/4), max(2,h/2)*(alpha?2:1));
 
-			if ( jxr_write_image_bitstream(image,container) != 0 ) {
-				cerr << "JPEGXR encoding error!\n";
+			if ( !jxr.write(Read555Data_ETC1, &imageData, ofile) ) {
 				return false;
 			}
-
-			jxr_destroy(image); 
-
-			jxrc_write_container_post(container);
-
-			//write_debug_image(container);
-
-			write_uint24(container->wb.len(),ofile);
-			ofile.write((const char *)container->wb.buffer(),container->wb.len());
-			
-			jxr_destroy_container(container);
-
-			delete [] imageData.etc1_col;
-			delete [] imageData.etc1_d0;
-			delete [] imageData.etc1_d1;
 		}
 	} else {
 		if ( gStoreRawCompressed ) {
-			write_uint24(0,ofile);
+			write_section_size(0,ofile);
 		} else {
-			write_uint24(0,ofile);
-			write_uint24(0,ofile);
-			write_uint24(0,ofile);
+			write_section_size(0,ofile);
+			write_section_size(0,ofile);
+			write_section_size(0,ofile);
 		}
 		for ( int32_t d=0; d<max(1,w/4)*max(1,h/4)*(alpha?2:1); d++) {
             read_uint32(ifile);
@@ -1485,7 +1722,57 @@ static bool write_etc1(int32_t w, int32_t h, int32_t level, bool flipped, istrea
 	return true;
 }
 
+// Scratch taken by LzmaSectionCompress for a section of len bytes.
+static size_t filter_scratch_size(size_t len)
+{
+	if ( !gFilterLzma ) {
+		return 0;
+	}
+	return ScratchArena::bytes<uint8_t>(len) + ScratchArena::bytes<uint8_t>(lzma_bound(len));
+}
+
+// Scratch needed by the largest (top) level of a block compressed texture.
+// The dxt, pvrtc and etc1 writers each rewind the arena, so the maximum of
+// the three is enough for the whole mip chain.
+static size_t compressed_scratch_size(int32_t w, int32_t h, bool alpha)
+{
+	size_t n = max(1,w/4)*max(1,h/4);
+	size_t p = max(1,max(int32_t(PVRTC4_MIN_TEXWIDTH),w)/4)*max(1,max(int32_t(PVRTC4_MIN_TEXWIDTH),h)/4);
+	size_t e = n*(alpha?2:1);
+
+	size_t dxt = 0;
+	if ( alpha ) {
+		dxt = ScratchArena::bytes<uint8_t>(n*2) +
+			  ScratchArena::bytes<uint16_t>(n*2) +
+			  ScratchArena::bytes<uint8_t>(n*6) +
+			  ScratchArena::bytes<uint8_t>(n*4) +
+			  ScratchArena::bytes<uint8_t>(lzma_bound(n*6)) +
+			  filter_scratch_size(n*6) +
+			  filter_scratch_size(n*4);
+	} else {
+		dxt = ScratchArena::bytes<uint16_t>(n*2) +
+			  ScratchArena::bytes<uint8_t>(n*4) +
+			  ScratchArena::bytes<uint8_t>(lzma_bound(n*4)) +
+			  filter_scratch_size(n*4);
+	}
+	size_t pvrtc = ScratchArena::bytes<uint16_t>(p*2) +
+				   ScratchArena::bytes<uint8_t>(p) +
+				   ScratchArena::bytes<uint32_t>(p) +
+				   ScratchArena::bytes<uint8_t>(lzma_bound(p*4)) +
+				   filter_scratch_size(p) +
+				   filter_scratch_size(p*4);
+	size_t etc1 = ScratchArena::bytes<uint32_t>(e) +
+				  ScratchArena::bytes<uint8_t>(e) +
+				  ScratchArena::bytes<uint32_t>(e) +
+				  ScratchArena::bytes<uint8_t>(lzma_bound(e*4)) +
+				  filter_scratch_size(e) +
+				  filter_scratch_size(e*4);
+	return max(dxt,max(pvrtc,etc1));
+}
+
 static bool write_raw_jxr(istream &ifile_raw, ostream &ofile) {
+	ATFTraceSpan span("write_raw_jxr");
+
 	if ( gJxrQualityDefault ) {
 		gJxrQuality = 15;
 	}
@@ -1547,7 +1834,7 @@ static bool write_raw_jxr(istream &ifile_raw, ostream &ofile) {
 	}
 
 	int32_t w = texturew = pvr_header.dwWidth;
-	int32_t h = texturew = pvr_header.dwHeight;
+	int32_t h = textureh = pvr_header.dwHeight;
 	
 	if ( ( pvr_header.dwpfFlags & 0xFF ) == PVR_OGL_RGBA_8888 ) {
 		texturecomp = 4;
@@ -1557,11 +1844,15 @@ static bool write_raw_jxr(istream &ifile_raw, ostream &ofile) {
 	}
 
     int32_t raw_pos = ifile_raw.tellg();
+
+	ScratchArena arena;
+	arena.reserve(ScratchArena::bytes<uint8_t>(max(1,w)*max(1,h)*4));
+	JxrEncoder jxr;
 	
 	for ( int32_t i=0; i<(cubeMap?6:1); i++) {
 
 		w = texturew = pvr_header.dwWidth;
-		h = texturew = pvr_header.dwHeight;
+		h = textureh = pvr_header.dwHeight;
 
 		if ( cubeMap ) {
             if ( pvr_header.dwpfFlags & ( PVRTEX_DDSCUBEMAPORDER | PVRTEX_PVRCUBEMAPORDER ) ) {
@@ -1572,16 +1863,22 @@ static bool write_raw_jxr(istream &ifile_raw, ostream &ofile) {
 		}
 	
 		for ( int32_t c=0; (c<pvr_header.dwMipMapCount+1) && (w>0||h>0); c++ ) {
+
+			streamoff inStart = ifile_raw.tellg();
+			streamoff outStart = ofile.tellp();
 		
             if ( c < gEmbedRangeStart || c > gEmbedRangeEnd ) {
 
-			    write_uint24(0,ofile);
+			    write_section_size(0,ofile);
 				int32_t l = max(1,w)*max(1,h)*3;
 				for ( int32_t d=0; d<l; d++) {
                     read_uint8(ifile_raw);
                 }
 
             } else {
+			    ATFTraceSpan span("jxr level","level",c);
+			    ATFStageTimer timer(ATF_STAGE_SPLIT);
+
 			    ImageData imageData;
 			    imageData.flipped = ( pvr_header.dwpfFlags & PVRTEX_FLIPPED ) ? true : false;
 
@@ -1590,7 +1887,8 @@ static bool write_raw_jxr(istream &ifile_raw, ostream &ofile) {
 				    return false;
 			    }
 
-			    imageData.raw = new uint8_t [max(1,w)*max(1,h)*4];
+			    arena.reset();
+			    imageData.raw = arena.alloc<uint8_t>(max(1,w)*max(1,h)*4);
 			    uint8_t *raw = imageData.raw;
 			    if ( ( pvr_header.dwpfFlags & 0xFF ) == PVR_OGL_RGBA_8888 ) {
 				    int32_t l = max(1,w)*max(1,h)*4;
@@ -1612,62 +1910,23 @@ static bool write_raw_jxr(istream &ifile_raw, ostream &ofile) {
 				    }
 			    }
 
-			    jxr_container_t container = jxr_create_container();
-			    jxrc_start_file(container);
-
-			    if ( jxrc_begin_ifd_entry(container) != 0 ) {
-				    cerr << "Could not create ATF file!\n\n";
-				    return false;
-			    }
-
-			    if ( ( pvr_header.dwpfFlags & 0xFF ) == PVR_OGL_RGBA_8888 ) {
-				    jxrc_set_pixel_format(container, JXRC_FMT_32bppBGRA);
-			    } else {
-				    jxrc_set_pixel_format(container, JXRC_FMT_24bppBGR);
-			    }
-			
-			    jxrc_set_image_shape(container, max(1,w), max(1,h));
-			    jxrc_set_separate_alpha_image_plane(container, 0);
-			    jxrc_set_image_band_presence(container, JXR_BP_ALL);
-
-			    static unsigned char window_params[5] = {0,0,0,0,0};
-			    jxr_image_t image = jxr_create_image(max(1,w), max(1,h), window_params);
-		    
+			    bool rgba = ( pvr_header.dwpfFlags & 0xFF ) == PVR_OGL_RGBA_8888;
+			    jxr_image_t image = jxr.begin(rgba ? JXRC_FMT_32bppBGRA : JXRC_FMT_24bppBGR, max(1,w), max(1,h));
 			    if ( !image ) {
-				    cerr << "Could not create image!\n\n";
-				    return false;
-			    }
-		    
-			    SetJPEGXRaw(container,image,gJxrQuality,( pvr_header.dwpfFlags & 0xFF ) == PVR_OGL_RGBA_8888, max(1,w), max(1,h));
-
-			    jxrc_begin_image_data(container);
-			    if ( ( pvr_header.dwpfFlags & 0xFF ) == PVR_OGL_RGBA_8888 ) {
-				    jxr_set_block_input(image, Read8888Data);  
-			    } else {
-				    jxr_set_block_input(image, Read888Data);  
-			    }
-			    jxr_set_user_data(image, &imageData);
-			
-			    if ( jxr_write_image_bitstream(image,container) != 0 ) {
-				    cerr << "JPEGXR encoding error!\n";
-				    return false;
+			    	return false;
 			    }
 
-			    jxr_destroy(image); 
-
-			    jxrc_write_container_post(container);
+			    SetJPEGXRaw(jxr.container(),image,gJxrQuality,rgba, max(1,w), max(1,h));
 
-			    write_uint24(container->wb.len(),ofile);
-			    ofile.write((const char *)container->wb.buffer(),container->wb.len());
-			
-			    //write_debug_image(container);
-
-			    jxr_destroy_container(container);
-			
-			    delete [] imageData.raw;
-			    imageData.raw = 0;
+			    if ( !jxr.write(rgba ? Read8888Data : Read888Data, &imageData, ofile) ) {
+			    	return false;
+			    }
             }
             			
+			if ( gLevelWritten ) {
+				gLevelWritten(i,c,w,h,inStart,ifile_raw.tellg(),outStart,ofile.tellp());
+			}
+
 			w /= 2;
 			h /= 2;
 		}
@@ -1815,6 +2074,12 @@ static bool write_compressed_alpha_textures(istream &ifile_etc1, istream &ifile_
 	
 	write_header(w,h,(gStoreRawCompressed?ATF_FORMAT_COMPRESSEDRAWALPHA:ATF_FORMAT_COMPRESSEDALPHA)|(cubeMap?ATF_FORMAT_CUBEMAP:0),checkHeader->dwMipMapCount+1,ofile);
 	
+	ScratchArena arena;
+	if ( !gStoreRawCompressed ) {
+		arena.reserve(compressed_scratch_size(w,h,true));
+	}
+	JxrEncoder jxr;
+
 	size_t dxt5_pos = ifile_dxt5.tellg();
 	size_t etc1_pos = ifile_etc1.tellg();
 	size_t pvrtc_pos = ifile_pvrtc.tellg();
@@ -1856,7 +2121,7 @@ static bool write_compressed_alpha_textures(istream &ifile_etc1, istream &ifile_
 		}
 
 		w = texturew = checkHeader->dwWidth;
-		h = texturew = checkHeader->dwHeight;
+		h = textureh = checkHeader->dwHeight;
 	
 		for ( int32_t c=0; (c<checkHeader->dwMipMapCount+1) && (w>0||h>0); c++ ) {
 
@@ -1873,9 +2138,14 @@ static bool write_compressed_alpha_textures(istream &ifile_etc1, istream &ifile_
 				etc1_flipped = ( pvr_header_pvrtc.dwpfFlags & PVRTEX_FLIPPED ) ? true : false;
 			}
 
-			if ( !write_dxt5(w,h,c,dxt_flipped,ifile_dxt5,ofile) ) return false;
-			if ( !write_pvrtc_alpha(w,h,c,pvrtc_flipped,ifile_pvrtc,ofile) ) return false;
-			if ( !write_etc1(w,h,c,etc1_flipped,ifile_etc1,ofile,true) ) return false;
+			streamoff inStart = ifile_dxt5.tellg();
+			streamoff outStart = ofile.tellp();
+			if ( !write_dxt5(w,h,c,dxt_flipped,ifile_dxt5,ofile,arena,jxr) ) return false;
+			if ( !write_pvrtc_alpha(w,h,c,pvrtc_flipped,ifile_pvrtc,ofile,arena,jxr) ) return false;
+			if ( !write_etc1(w,h,c,etc1_flipped,ifile_etc1,ofile,true,arena,jxr) ) return false;
+			if ( gLevelWritten ) {
+				gLevelWritten(i,c,w,h,inStart,ifile_dxt5.tellg(),outStart,ofile.tellp());
+			}
 
 			w /= 2;
 			h /= 2;
@@ -2022,6 +2292,12 @@ static bool write_compressed_textures(istream &ifile_etc1, istream &ifile_pvrtc,
 	
 	write_header(w,h,(gStoreRawCompressed ? ATF_FORMAT_COMPRESSEDRAW : ATF_FORMAT_COMPRESSED )|(cubeMap?ATF_FORMAT_CUBEMAP:0),checkHeader->dwMipMapCount+1,ofile);
 	
+	ScratchArena arena;
+	if ( !gStoreRawCompressed ) {
+		arena.reserve(compressed_scratch_size(w,h,false));
+	}
+	JxrEncoder jxr;
+
 	size_t dxt1_pos = ifile_dxt1.tellg();
 	size_t etc1_pos = ifile_dxt1.tellg();
 	size_t pvrtc_pos = ifile_dxt1.tellg();
@@ -2063,7 +2339,7 @@ static bool write_compressed_textures(istream &ifile_etc1, istream &ifile_pvrtc,
 		}
 
 		w = texturew = checkHeader->dwWidth;
-		h = texturew = checkHeader->dwHeight;
+		h = textureh = checkHeader->dwHeight;
 	
 		for ( int32_t c=0; (c<checkHeader->dwMipMapCount+1) && (w>0||h>0); c++ ) {
 
@@ -2080,9 +2356,14 @@ static bool write_compressed_textures(istream &ifile_etc1, istream &ifile_pvrtc,
 				etc1_flipped = ( pvr_header_pvrtc.dwpfFlags & PVRTEX_FLIPPED ) ? true : false;
 			}
 
-			if ( !write_dxt1(w,h,c,dxt_flipped,ifile_dxt1,ofile) ) return false;
-			if ( !write_pvrtc(w,h,c,pvrtc_flipped,ifile_pvrtc,ofile) ) return false;
-			if ( !write_etc1(w,h,c,etc1_flipped,ifile_etc1,ofile,false) ) return false;
+			streamoff inStart = ifile_dxt1.tellg();
+			streamoff outStart = ofile.tellp();
+			if ( !write_dxt1(w,h,c,dxt_flipped,ifile_dxt1,ofile,arena,jxr) ) return false;
+			if ( !write_pvrtc(w,h,c,pvrtc_flipped,ifile_pvrtc,ofile,arena,jxr) ) return false;
+			if ( !write_etc1(w,h,c,etc1_flipped,ifile_etc1,ofile,false,arena,jxr) ) return false;
+			if ( gLevelWritten ) {
+				gLevelWritten(i,c,w,h,inStart,ifile_dxt1.tellg(),outStart,ofile.tellp());
+			}
 
 			w /= 2;
 			h /= 2;
@@ -2091,20 +2372,34 @@ static bool write_compressed_textures(istream &ifile_etc1, istream &ifile_pvrtc,
 	return true;
 }
 
+// Patches the size placeholder written by write_header.
+static void write_file_size(ostream &ofile)
+{
+	size_t filesize = ofile.tellp();
+	gIndex.fileLength = filesize;
+	gIndex.sectionsPerLevel = gIndex.sections.size()/(gIndex.faces*gIndex.count);
+	if ( gFilterLzma ) {
+		filesize -= 12;
+		ofile.seekp(8);
+		write_uint32(filesize,ofile);
+	} else {
+		filesize -= 6;
+		ofile.seekp(3);
+
+		ofile.put(uint8_t((filesize>>16)&0xFF));
+		ofile.put(uint8_t((filesize>> 8)&0xFF));
+		ofile.put(uint8_t((filesize>> 0)&0xFF));
+	}
+	
+	ofile.seekp(0,ios_base::end);
+}
+
 bool convert_with_alpha(istream &ifile_etc1, istream &ifile_pvrtc, istream &ifile_dxt5, ostream &ofile) {
 	if ( !write_compressed_alpha_textures(ifile_etc1,ifile_pvrtc,ifile_dxt5,ofile) ) {
 		return false;
 	}
 
-	size_t filesize = ofile.tellp();
-	filesize -= 6;
-	ofile.seekp(3);
-
-	ofile.put(uint8_t((filesize>>16)&0xFF));
-	ofile.put(uint8_t((filesize>> 8)&0xFF));
-	ofile.put(uint8_t((filesize>> 0)&0xFF));
-	
-	ofile.seekp(0,ios_base::end);
+	write_file_size(ofile);
 
     return true;
 }
@@ -2121,15 +2416,86 @@ bool convert(istream &ifile_etc1, istream &ifile_pvrtc, istream &ifile_dxt1, ist
 		}
 	}
 	
-	size_t filesize = ofile.tellp();
-	filesize -= 6;
-	ofile.seekp(3);
-
-	ofile.put(uint8_t((filesize>>16)&0xFF));
-	ofile.put(uint8_t((filesize>> 8)&0xFF));
-	ofile.put(uint8_t((filesize>> 0)&0xFF));
-	
-	ofile.seekp(0,ios_base::end);
+	write_file_size(ofile);
 
 	return true;
 }
+
+#ifdef ATF_MICROBENCH
+// Benchmark hooks, only compiled into atf-microbench's copy of this file
+// (pvr2atfcore-bench.o), dds2atf does not carry them.
+
+// the block input results go here, so the calls are not optimized away
+volatile int gBlockInputSink;
+
+// For atf-microbench: runs the JPEG-XR block input of one platform, 0 for
+// DXT1 (Read565Data_DXT1), 1 for PVRTC (Read555Data_PVRTC) or 2 for ETC1
+// (Read555Data_ETC1), over every macroblock of a w x h color plane runs
+// times and returns the seconds it took, or a negative value. colors holds
+// w*h uint16_t for DXT1 and PVRTC and uint32_t for ETC1, modes the ETC1
+// block modes.
+double time_block_input(int32_t platform, int32_t w, int32_t h, const void *colors, const uint8_t *modes, int32_t runs) {
+	static const block_fun_t inputs[3] = { Read565Data_DXT1, Read555Data_PVRTC, Read555Data_ETC1 };
+	static const jxrc_t_pixelFormat formats[3] = { JXRC_FMT_16bppBGR565, JXRC_FMT_16bppBGR555, JXRC_FMT_16bppBGR555 };
+	if ( platform < 0 || platform > 2 ) {
+		return -1;
+	}
+
+	JxrEncoder jxr;
+	jxr_image_t image = jxr.begin(formats[platform], w, h);
+	if ( !image ) {
+		return -1;
+	}
+	// only the channel count, the tiling set up by SetJPEGXRCommon is not
+	// meant to outlive an encode
+	jxr_set_INTERNAL_CLR_FMT(image, gJxrFormat, 1);
+
+	ImageData imageData = ImageData();
+	imageData.dxt1_col = (uint16_t *)colors;
+	imageData.pvrtc_col = (uint16_t *)colors;
+	imageData.etc1_col = (uint32_t *)colors;
+	imageData.etc1_d0 = (uint8_t *)modes;
+	jxr_set_user_data(image, &imageData);
+
+	vector<int> data(16*16*jxr_get_IMAGE_CHANNELS(image));
+	int32_t mw = (w+15)/16;
+	int32_t mh = (h+15)/16;
+	int sum = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for ( int32_t r=0; r<runs; r++ ) {
+		for ( int32_t my=0; my<mh; my++ ) {
+			for ( int32_t mx=0; mx<mw; mx++ ) {
+				inputs[platform](image,mx,my,data.data());
+				sum += data[mx&255];
+			}
+		}
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+	gBlockInputSink = sum;
+	return seconds;
+}
+
+// For atf-microbench: encodes a w x h DXT1 color plane the way write_dxt1
+// does, in the given internal color format, and returns the length of the
+// section or 0. Timed through jxr_set_stage_hook it shows the cost of the
+// encoder's color conversion.
+size_t encode_color_plane(int32_t w, int32_t h, const uint16_t *colors, jxr_color_fmt_t format, int32_t quality) {
+	jxr_color_fmt_t savedFormat = gJxrFormat;
+	gJxrFormat = format;
+
+	JxrEncoder jxr;
+	ostringstream out;
+	bool encoded = false;
+	jxr_image_t image = jxr.begin(JXRC_FMT_16bppBGR565, w, h);
+	if ( image ) {
+		SetJPEGX565(jxr.container(),image,quality,w,h);
+		ImageData imageData = ImageData();
+		imageData.dxt1_col = (uint16_t *)colors;
+		encoded = jxr.write(Read565Data_DXT1, &imageData, out);
+	}
+
+	gJxrFormat = savedFormat;
+	return encoded ? out.str().size() : 0;
+}
+#endif //#ifdef ATF_MICROBENCH